@@ -9,189 +9,46 @@
 #include <memory>
 #include <algorithm>
 #include <fstream>
+#include <set>
+#include <map>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <cassert>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <functional>
+#include <atomic>
+#include <csignal>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+#include <string_view>
+
+#include "pascal.h"
+#include "pascal_syntax.h"
 
 
-class ActivationRecord {
-    private:
-        std::string procedureName;
-        std::unordered_map<std::string, int> memory;
-        int scope;
-    public:
-        ActivationRecord(std::string procedureName) {
-            this->procedureName = procedureName;
-        }
-
-        void setScope(int scope) {
-            this->scope = scope;
-        }
-
-        int lookup(std::string name) {
-            int result = -1;
-            if (memory.find(name) != memory.end())
-                result = memory[name];
-            return result;
-        }
-
-        // the value might change
-        void assign(std::string name, int value) {
-            memory.insert_or_assign(name, value);
-        }
-
-        // Returns a string containing the contents of the activation record
-        const std::string toString() {
-            std::stringstream ss;
-            ss << "Activation record: Name = \"" << procedureName
-                << "\", Scope = " << scope << "\n";
-            for (auto pair : memory) {
-                ss << " { \"" << pair.first << "\" = " << pair.second << " }\n";
-            }
-            return ss.str();
-        }
-};
-
-// Main class for the call stack, which holes activation records.
-class CallStack {
-    private:
-        std::vector<std::unique_ptr<ActivationRecord>> records;
-        int top = -1;
-
-    public:
-        CallStack() {};
-
-        bool isEmpty() {
-            return top == -1;
-        }
-
-        ActivationRecord* peek() {
-            ActivationRecord* result = nullptr;
-            if (!isEmpty())
-                result = records[top].get();
-            return result;
-        }
-
-        void pop() {
-            records.erase(records.end() - 1);
-            top--;
-        }
-
-        void push(std::unique_ptr<ActivationRecord> record) {
-            top++;
-            ActivationRecord *ptr = record.get();
-            records.push_back(std::move(record));
-
-            ptr->setScope(top);
-        }
-
-        void print() {
-            std::cout << "Call stack:\n";
-            for (auto it = records.begin(); it != records.end(); ++it) {
-                std::cout << (*it)->toString() << "\n";
-            }
-        }
-
-        void printHighestRecord() {
-            std::cout << records[top]->toString() << "\n";
-        }
-};
-
-// ----------------------------------------------------------------------------
-enum class TokenType {
-    ADD,
-    SUB,
-    MUL,
-    DIV,
-    INT_DIV,
-    LPAREN,
-    RPAREN,
-    INT,
-    END_OF_FILE,
-
-    BEGIN,
-    END,
-    COMMA,
-    DOT,
-    SEMI,
-    COLON,
-    ASSIGN,
-    VARIABLE,
-    PROCEDURE,
-    PROGRAM,
-    PROGRAM_NAME,
-    VAR,
-
-    INTEGER,
-    REAL,
-};
-
-
-const std::string tokenType_tostring(TokenType aTokenType) {
-    switch (aTokenType) {
-        case TokenType::ADD: return "ADD";
-        case TokenType::SUB: return "SUB";
-        case TokenType::MUL: return "MUL";
-        case TokenType::DIV: return "DIV";
-        case TokenType::INT_DIV: return "INT_DIV";
-        case TokenType::INT: return "INT";
-        case TokenType::LPAREN: return "LPAREN";
-        case TokenType::RPAREN: return "RPAREN";
-        case TokenType::END_OF_FILE: return "EOF";
-
-        case TokenType::BEGIN: return "BEGIN";
-        case TokenType::END: return "END";
-        case TokenType::COMMA: return "COMMA";
-        case TokenType::DOT: return "DOT";
-        case TokenType::SEMI: return "SEMI";
-        case TokenType::COLON: return "COLON";
-        case TokenType::ASSIGN: return "ASSIGN";
-        case TokenType::VARIABLE: return "VARIABLE";
-        case TokenType::PROCEDURE: return "PROCEDURE";
-        case TokenType::PROGRAM: return "PROGRAM";
-        case TokenType::PROGRAM_NAME: return "PROGRAM_NAME";
-        case TokenType::VAR: return "VAR";
-        case TokenType::INTEGER: return "INTEGER";
-        case TokenType::REAL: return "REAL";
-    }
-    return "Unknown";
-}
-
-enum class ErrorCode {
-    UNEXPECTED_TOKEN,
-    UNDECLARED_ID,
-    DUPLICATE_ID,
-    DUPLICATE_PROCEDURE,
-    UNDECLARED_PROCEDURE,
-    PROCEDURE_ARGUMENT_MISMATCH,
-    NONE,
-};
-const std::string error_tostring(ErrorCode errorType) {
-    switch (errorType) {
-        case ErrorCode::UNEXPECTED_TOKEN:
-            return "Unexpected token";
-        case ErrorCode::UNDECLARED_ID:
-            return "undeclared identifier";
-        case ErrorCode::DUPLICATE_ID:
-            return "duplicate identifier";
-        case ErrorCode::DUPLICATE_PROCEDURE:
-            return "duplicate procedure";
-        case ErrorCode::UNDECLARED_PROCEDURE:
-            return "undeclared procedure";
-        case ErrorCode::PROCEDURE_ARGUMENT_MISMATCH:
-            return "procedure call has mismatched arguments";
-    }
-    return "Unknown ErrorCode";
-}
-
 // ---------------------------------------------------------------------
 
 
 class Token {
     public:
-        static std::unordered_map<std::string, TokenType> KEYWORDS;
         TokenType tokenType;
         std::string value;
         int lineno;
         int column;
         Token(TokenType aTokenType, const std::string& aValue, int lineno, int column);
+        static std::string valueOf(TokenType aTokenType, const std::string& text, int start, int end);
         void print();
         const std::string toString() {
             std::stringstream ss;
@@ -200,22 +57,22 @@ class Token {
         }
 };
 
-std::unordered_map<std::string, TokenType> Token::KEYWORDS = {
-    {"begin", TokenType::BEGIN},
-    {"end", TokenType::END},
-    {"program", TokenType::PROGRAM},
-    {"var", TokenType::VAR},
-    {"procedure", TokenType::PROCEDURE},
-    {"integer", TokenType::INTEGER},
-    {"real", TokenType::REAL},
-    {"div", TokenType::INT_DIV},
-};
 Token::Token(TokenType aTokenType, const std::string& aValue, int lineno, int column) {
     tokenType = aTokenType;
     value = aValue;
     this->lineno = lineno;
     this->column = column;
 }
+// the value of a token of the given type that spans text[start, end)
+std::string Token::valueOf(TokenType aTokenType, const std::string& text, int start, int end) {
+    if (aTokenType == TokenType::END_OF_FILE)
+        return "EOF";
+    std::string value = text.substr(start, end - start);
+    // keywords are kept in lower case
+    if (aTokenType != TokenType::VARIABLE && isalpha(value[0]))
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+    return value;
+}
 void Token::print() {
     std::cout << "Token: { TokenType: " << tokenType_tostring(tokenType) << " | Value: \"" << value << "\" }\n";   
 }
@@ -264,6 +121,11 @@ class ParserError: public Error {
             this->got = got;
             load_message();
         }
+        // an error that is not about a missing token
+        ParserError(ErrorCode code, std::shared_ptr<Token> got) : Error("", got, code) {
+            this->got = got;
+            message = "ParserError: " + error_tostring(code) + " at \'" + got->toString() + "\' token";
+        }
         void load_message() {
             std::stringstream ss;
             ss.str("");
@@ -301,6 +163,167 @@ class SemanticError: public Error {
         }
 };
 
+// Thrown by a checked integer operation (--checked) whose result does not
+// fit in an INTEGER, or that divides by zero. token is the operator.
+class ArithmeticError: public Error {
+    public:
+        ArithmeticError(ErrorCode code, std::shared_ptr<Token> token)
+        : Error("", token, code) {
+            message = "ArithmeticError: " + error_tostring(code) + " at \'" + token->toString() + "\'";
+        }
+        const char *what() const noexcept override {
+            return message.c_str();
+        }
+};
+
+// --------------------------------------------------------------
+
+// Memory charged to one Interpreter run, by the component that allocated it.
+// Lexer tokens are charged exactly through BudgetAllocator; parser nodes,
+// symbol table entries and call stack buffers charge their sizes when they
+// are created or grown. When a limit is set, the charge that would go past
+// it throws a MemoryLimitError instead. While worker threads run, the
+// budget is marked shared and charges take a lock.
+class MemoryBudget {
+    public:
+        enum class Category { LEXER, PARSER, SYMBOL_TABLE, CALL_STACK, COUNT };
+        enum class Phase { PARSE, ANALYSIS, OPTIMIZATION, EXECUTION, COUNT };
+
+        static const char *category_tostring(Category category) {
+            switch (category) {
+                case Category::LEXER: return "Lexer";
+                case Category::PARSER: return "Parser";
+                case Category::SYMBOL_TABLE: return "SymbolTable";
+                case Category::CALL_STACK: return "CallStack";
+                default: return "Unknown";
+            }
+        }
+        static const char *phase_tostring(Phase phase) {
+            switch (phase) {
+                case Phase::PARSE: return "parse";
+                case Phase::ANALYSIS: return "analysis";
+                case Phase::OPTIMIZATION: return "optimization";
+                case Phase::EXECUTION: return "execution";
+                default: return "unknown";
+            }
+        }
+    private:
+        size_t limit; // 0 means unlimited
+        size_t used = 0;
+        size_t usedBy[(int)Category::COUNT] = {};
+        size_t phasePeak[(int)Phase::COUNT] = {};
+        Phase phase = Phase::PARSE;
+        bool shared = false;
+        std::mutex mutex;
+    public:
+        MemoryBudget(size_t limit = 0) : limit(limit) {}
+
+        void charge(Category category, size_t bytes);
+
+        void release(Category category, size_t bytes) {
+            std::unique_lock<std::mutex> lock;
+            if (shared)
+                lock = std::unique_lock<std::mutex>(mutex);
+            used -= bytes;
+            usedBy[(int)category] -= bytes;
+        }
+
+        void setShared(bool shared) {
+            this->shared = shared;
+        }
+
+        void setPhase(Phase phase) {
+            this->phase = phase;
+            phasePeak[(int)phase] = std::max(phasePeak[(int)phase], used);
+        }
+
+        size_t getLimit() const { return limit; }
+        size_t getUsed() const { return used; }
+        size_t getUsed(Category category) const { return usedBy[(int)category]; }
+        size_t getPeak(Phase phase) const { return phasePeak[(int)phase]; }
+        Phase getPhase() const { return phase; }
+
+        void print() {
+            std::cout << "Memory usage: peak bytes per phase\n";
+            for (int i = 0; i < (int)Phase::COUNT; ++i) {
+                std::cout << " { \"" << phase_tostring((Phase)i) << "\" = " << phasePeak[i] << " }\n";
+            }
+            if (limit > 0)
+                std::cout << " limit = " << limit << "\n";
+        }
+};
+
+// Thrown when a MemoryBudget charge would pass its limit. The run is
+// aborted; the error keeps the numbers needed to report what happened.
+class MemoryLimitError: public Error {
+    public:
+        const MemoryBudget::Category category;
+        const MemoryBudget::Phase phase;
+        const size_t limit;
+        const size_t used;
+        const size_t requested;
+
+        MemoryLimitError(MemoryBudget::Category category, MemoryBudget::Phase phase,
+            size_t limit, size_t used, size_t requested)
+        : Error("", nullptr, ErrorCode::MEMORY_LIMIT_EXCEEDED), category(category),
+            phase(phase), limit(limit), used(used), requested(requested) {
+            std::stringstream ss;
+            ss << "MemoryLimitError: " << error_tostring(code) << " by "
+                << MemoryBudget::category_tostring(category) << " during "
+                << MemoryBudget::phase_tostring(phase) << " (limit " << limit
+                << " bytes, used " << used << ", requested " << requested << ")";
+            message = ss.str();
+        }
+        const char *what() const noexcept override {
+            return message.c_str();
+        }
+};
+
+void MemoryBudget::charge(Category category, size_t bytes) {
+    std::unique_lock<std::mutex> lock;
+    if (shared)
+        lock = std::unique_lock<std::mutex>(mutex);
+    if (limit > 0 && used + bytes > limit)
+        throw MemoryLimitError(category, phase, limit, used, bytes);
+    used += bytes;
+    usedBy[(int)category] += bytes;
+    phasePeak[(int)phase] = std::max(phasePeak[(int)phase], used);
+}
+
+// Standard allocator that charges a MemoryBudget. It shares ownership of
+// the budget, so objects that outlive their Interpreter (such as the token
+// inside a thrown error) can still release what they were charged.
+template <typename T>
+class BudgetAllocator {
+    public:
+        using value_type = T;
+        std::shared_ptr<MemoryBudget> budget;
+        MemoryBudget::Category category;
+
+        BudgetAllocator(std::shared_ptr<MemoryBudget> budget, MemoryBudget::Category category)
+        : budget(budget), category(category) {}
+        template <typename U>
+        BudgetAllocator(const BudgetAllocator<U>& other)
+        : budget(other.budget), category(other.category) {}
+
+        T *allocate(size_t n) {
+            budget->charge(category, n * sizeof(T));
+            return std::allocator<T>().allocate(n);
+        }
+        void deallocate(T *p, size_t n) {
+            budget->release(category, n * sizeof(T));
+            std::allocator<T>().deallocate(p, n);
+        }
+        template <typename U>
+        bool operator==(const BudgetAllocator<U>& other) const {
+            return budget == other.budget;
+        }
+        template <typename U>
+        bool operator!=(const BudgetAllocator<U>& other) const {
+            return budget != other.budget;
+        }
+};
+
 // --------------------------------------------------------------
 
 class Node;
@@ -319,13 +342,21 @@ class Procedure;
 class ParamDeclaration;
 class Block;
 class ProgramNode;
+class IntToReal;
+class IfStatement;
+class WhileStatement;
+class ForStatement;
+class AssignVarOpConst;
+class AssignVarOpVar;
+class IncrementVar;
+class CallWithConstArgs;
 
 // --------------------------------------------------------------
 
 // Abstract class
 class Symbol {
     public:
-        enum class Type { INTEGER, REAL, NO_TYPE };
+        using Type = ValueType;
         const std::string name;
         std::shared_ptr<Symbol> type;
     private:
@@ -337,48 +368,78 @@ class Symbol {
         virtual void print() = 0;
 };
 
-class ProcedureSymbol: public Symbol {
+class BuiltinTypeSymbol: public Symbol {
     public:
-        Block *block;
-        std::vector<std::shared_ptr<Symbol>> formalParams;
-
-        ProcedureSymbol(const std::string& name, Block *block) : Symbol(name), block(block) {}
-        
+        const Type builtinType;
+        BuiltinTypeSymbol(const std::string& name, Type builtinType) : Symbol(name), builtinType(builtinType) {};
         void print() override {
-            std::cout << "Procedure symbol: " << name;
+            std::cout << "Type symbol: " << name;
         }
 };
 
-class ProgramSymbol: public Symbol {
+class VarSymbol: public Symbol {
     public:
-        ProgramSymbol(const std::string& name) : Symbol(name) {};
+        int slot = -1;  // index into the owning frame
+        int level = 0;  // scope level of the owning frame
+        const Type valueType;
+        bool hidden = false; // compiler temporary, not shown in records
+        VarSymbol(const std::string& name, std::shared_ptr<Symbol> type)
+        : Symbol(name, type), valueType(static_cast<BuiltinTypeSymbol*>(type.get())->builtinType) {};
+        // compiler temporaries are never put in a symbol table
+        VarSymbol(const std::string& name, Type valueType)
+        : Symbol(name), valueType(valueType), hidden(true) {};
+
         void print() override {
-            std::cout << "Program symbol: " << name;
+            std::cout << "Var symbol: " << name << " | ";
+            type->print(); 
         }
 };
 
-class VarSymbol: public Symbol {
+// A symbol that owns a stack frame at run time (the program or a procedure).
+// frameVars is the frame layout: parameters first, then local variables,
+// each stored at the slot equal to its index in this vector.
+class FrameSymbol: public Symbol {
+    public:
+        std::vector<std::shared_ptr<VarSymbol>> frameVars;
+        int level = 0; // scope level of the frame's variables
+
+        FrameSymbol(const std::string& name) : Symbol(name) {}
+
+        int frameSize() const {
+            return frameVars.size();
+        }
+};
+
+class ProcedureSymbol: public FrameSymbol {
     public:
-        VarSymbol(const std::string& name, std::shared_ptr<Symbol> type) : Symbol(name, type) {};
+        Block *block;
+        std::vector<std::shared_ptr<VarSymbol>> formalParams;
+        // touches nothing outside its own frame, so a call is decided by
+        // its arguments; set by markPureProcedures
+        bool pure = false;
 
+        ProcedureSymbol(const std::string& name, Block *block) : FrameSymbol(name), block(block) {}
+        
         void print() override {
-            std::cout << "Var symbol: " << name << " | ";
-            type->print(); 
+            std::cout << "Procedure symbol: " << name;
         }
 };
 
-class BuiltinTypeSymbol: public Symbol {
+class ProgramSymbol: public FrameSymbol {
     public:
-        BuiltinTypeSymbol(const std::string& name) : Symbol(name) {};
+        ProgramSymbol(const std::string& name) : FrameSymbol(name) {};
         void print() override {
-            std::cout << "Type symbol: " << name;
+            std::cout << "Program symbol: " << name;
         }
 };
 
 
 class SymbolTable {
     private:
-        std::unordered_map<std::string, std::shared_ptr<Symbol>> map;
+        using Entry = std::pair<const std::string, std::shared_ptr<Symbol>>;
+        // the map's nodes and buckets are charged to the run's memory budget
+        std::unordered_map<std::string, std::shared_ptr<Symbol>, std::hash<std::string>,
+            std::equal_to<std::string>, BudgetAllocator<Entry>> map;
         const std::string name; // global or procedure name
         
         // symbols would only be inside this map
@@ -387,11 +448,15 @@ class SymbolTable {
         int level;
         
 
-        SymbolTable(int level, const std::string& name, const std::shared_ptr<SymbolTable> enclosingScope = nullptr) : level(level), name(name) {
+        SymbolTable(int level, const std::string& name, std::shared_ptr<MemoryBudget> budget,
+            const std::shared_ptr<SymbolTable> enclosingScope = nullptr)
+        : map(0, std::hash<std::string>(), std::equal_to<std::string>(),
+            BudgetAllocator<Entry>(budget, MemoryBudget::Category::SYMBOL_TABLE)),
+            name(name), level(level) {
             this->enclosingScope = enclosingScope;
             if (level == 0) {
-                define(std::make_unique<BuiltinTypeSymbol>("INTEGER"));
-                define(std::make_unique<BuiltinTypeSymbol>("REAL"));
+                define(std::make_unique<BuiltinTypeSymbol>("INTEGER", Symbol::Type::INTEGER));
+                define(std::make_unique<BuiltinTypeSymbol>("REAL", Symbol::Type::REAL));
             }
         };
         // for variable symbols, their type symbols will point to the type symbols in the map.
@@ -425,6 +490,412 @@ class SymbolTable {
 
 // --------------------------------------------------------------
 
+// Untagged value of a variable or expression. Which member is live is known
+// statically from the type the SemanticAnalyzer gave the variable or node,
+// so values are never tag-checked at run time.
+union Value {
+    int i;
+    double r;
+};
+
+// The final values of a run's variables. Every record is a frame's slots
+// as they were when it was popped, kept in the order the frames were
+// popped, so the program's own record comes last. Names and types are
+// read from the frame's symbol when the state is written out. Procedure
+// records are only kept when asked for, since a long run pops many.
+class ExecutionState {
+    public:
+        struct Record {
+            FrameSymbol *frame;
+            int depth;  // 0 for the program
+            int offset; // of its first slot in values
+        };
+        std::vector<Record> records;
+        std::vector<Value, BudgetAllocator<Value>> values;
+        bool keepProcedures = false;
+        // past this many values, records are dropped and overflowed is set
+        size_t maxValues = SIZE_MAX;
+        bool overflowed = false;
+
+        ExecutionState(std::shared_ptr<MemoryBudget> budget)
+        : values(BudgetAllocator<Value>(budget, MemoryBudget::Category::CALL_STACK)) {}
+
+        void capture(FrameSymbol *frame, int depth, const Value *slots) {
+            if (depth > 0 && !keepProcedures)
+                return;
+            if (values.size() + frame->frameSize() > maxValues) {
+                overflowed = true;
+                return;
+            }
+            records.push_back({frame, depth, (int)values.size()});
+            values.insert(values.end(), slots, slots + frame->frameSize());
+        }
+        // adds the records of other after these
+        void append(const ExecutionState &other) {
+            for (const Record &record : other.records)
+                records.push_back({record.frame, record.depth, record.offset + (int)values.size()});
+            values.insert(values.end(), other.values.begin(), other.values.end());
+        }
+        void clear() {
+            records.clear();
+            values.clear();
+            overflowed = false;
+        }
+        // the program's record, or nullptr if the run did not finish
+        const Record* global() const {
+            if (records.empty() || records.back().depth != 0)
+                return nullptr;
+            return &records.back();
+        }
+};
+
+// Main class for the call stack. All frames live in one contiguous buffer of
+// slots; a call bumps the frame pointer by the callee's precomputed frame
+// size, so pushing and popping frames never allocates once the buffer has
+// grown. Variable names are only looked up from the frame's symbol when a
+// record is printed.
+// Non-local variables are found through a display: for each scope level,
+// the base of the newest frame of that level. Without procedure values the
+// newest frame of a level is always the lexically enclosing one, so an
+// access at any nesting depth is two loads. A push saves the entry it
+// overwrites in its frame and the pop puts it back.
+class CallStack {
+    private:
+        struct Frame {
+            FrameSymbol *symbol;
+            int base;
+            int savedDisplay; // the display entry of its level before the push
+        };
+        // the buffers are charged to the run's memory budget as they grow
+        std::vector<Value, BudgetAllocator<Value>> slots;
+        std::vector<Frame, BudgetAllocator<Frame>> frames;
+        // -1 for levels with no frame on this stack
+        std::vector<int, BudgetAllocator<int>> display;
+        int fp = 0; // base of the top frame
+        int sp = 0; // first slot past the top frame
+        ExecutionState *state = nullptr;
+        std::ostream *out = &std::cout;
+        // the stack of the thread that handed this one a call; frames not
+        // found here are looked up in it
+        CallStack *parent = nullptr;
+        int parentDepth = 0; // its frames when the call was handed over
+        // also gets every popped record while a memoized call is recorded
+        ExecutionState *log = nullptr;
+
+        static const std::string recordToString(FrameSymbol *symbol, int scope, const Value *values) {
+            std::stringstream ss;
+            ss << "Activation record: Name = \"" << symbol->name
+                << "\", Scope = " << scope << "\n";
+            for (int i = 0; i < symbol->frameSize(); ++i) {
+                VarSymbol *var = symbol->frameVars[i].get();
+                if (var->hidden)
+                    continue;
+                ss << " { \"" << var->name << "\" = ";
+                if (var->valueType == Symbol::Type::REAL)
+                    ss << values[i].r;
+                else
+                    ss << values[i].i;
+                ss << " }\n";
+            }
+            return ss.str();
+        }
+        const std::string recordToString(int index) {
+            const Frame &frame = frames[index];
+            return recordToString(frame.symbol, parentDepth + index, slots.data() + frame.base);
+        }
+
+    public:
+        CallStack(std::shared_ptr<MemoryBudget> budget)
+        : slots(BudgetAllocator<Value>(budget, MemoryBudget::Category::CALL_STACK)),
+            frames(BudgetAllocator<Frame>(budget, MemoryBudget::Category::CALL_STACK)),
+            display(BudgetAllocator<int>(budget, MemoryBudget::Category::CALL_STACK)) {};
+
+        bool isEmpty() {
+            return frames.empty();
+        }
+
+        // Makes room for a frame of the given size above the top frame and
+        // returns its base, so arguments can be written into the callee's
+        // slots before it is pushed.
+        int reserve(int frameSize) {
+            if (slots.size() < (size_t)(sp + frameSize))
+                slots.resize(std::max(slots.size() * 2, (size_t)(sp + frameSize)));
+            return sp;
+        }
+
+        Value& slotAt(int index) {
+            return slots[index];
+        }
+
+        // slots of the frames on the stack, from the bottom one's base
+        int slotsInUse() {
+            return sp;
+        }
+
+        // Pushes a frame at the reserved base. The first numInitialized slots
+        // (the arguments) are kept, the rest are zeroed. numTemps extra slots
+        // past the frame's variables are left for the engine's own use and
+        // never show up in a record.
+        void push(FrameSymbol *symbol, int numInitialized = 0, int numTemps = 0) {
+            int size = symbol->frameSize() + numTemps;
+            int base = reserve(size);
+            // all-zero bits, so both integer and real locals start at 0
+            Value zero;
+            zero.r = 0.0;
+            std::fill(slots.begin() + base + numInitialized, slots.begin() + base + size, zero);
+            if (display.size() <= (size_t)symbol->level)
+                display.resize(symbol->level + 1, -1);
+            frames.push_back({symbol, base, display[symbol->level]});
+            display[symbol->level] = base;
+            fp = base;
+            sp = base + size;
+        }
+
+        void pop() {
+            display[frames.back().symbol->level] = frames.back().savedDisplay;
+            sp = fp;
+            frames.pop_back();
+            fp = frames.empty() ? 0 : frames.back().base;
+        }
+
+        Value& local(int slot) {
+            return slots[fp + slot];
+        }
+
+        // the top frame's slots; invalidated by the next reserve or push
+        Value* frameSlots() {
+            return slots.data() + fp;
+        }
+
+        // a slot of the enclosing frame at the given scope level
+        Value& nonLocal(int level, int slot) {
+            if ((size_t)level < display.size() && display[level] >= 0)
+                return slots[display[level] + slot];
+            if (parent != nullptr)
+                return parent->nonLocal(level, slot);
+            throw std::runtime_error("No frame for scope level " + std::to_string(level));
+        }
+
+        Value& variable(int level, int slot) {
+            if (frames.back().symbol->level == level)
+                return local(slot);
+            return nonLocal(level, slot);
+        }
+
+        int depth() {
+            return frames.size();
+        }
+
+        // the records of the parent's frames come first
+        void writeRecords(std::ostream &ss) {
+            if (parent != nullptr)
+                parent->writeRecords(ss);
+            for (int i = 0; i < (int)frames.size(); ++i) {
+                ss << recordToString(i) << "\n";
+            }
+        }
+
+        const std::string toString() {
+            std::stringstream ss;
+            ss << "Call stack:\n";
+            writeRecords(ss);
+            return ss.str();
+        }
+
+        void print() {
+            std::cout << toString();
+        }
+
+        void printHighestRecord() {
+            if (out != nullptr)
+                *out << recordToString(frames.size() - 1) << "\n";
+        }
+
+        // where printed records go from now on; nullptr prints none
+        void printTo(std::ostream *out) {
+            this->out = out;
+        }
+
+        void setParent(CallStack *parent) {
+            this->parent = parent;
+            parentDepth = parent->depth();
+        }
+
+        // drops every frame, after a run on this stack was abandoned
+        void clear() {
+            frames.clear();
+            display.clear();
+            fp = sp = 0;
+        }
+
+        // keeps the records of popped frames in state from now on
+        void recordInto(ExecutionState *state) {
+            this->state = state;
+        }
+
+        void logInto(ExecutionState *log) {
+            this->log = log;
+        }
+
+        // Prints the top frame's record, keeps it in the recorded state
+        // and pops it.
+        void popRecord() {
+            printHighestRecord();
+            int depth = parentDepth + frames.size() - 1;
+            if (state != nullptr)
+                state->capture(frames.back().symbol, depth, slots.data() + fp);
+            if (log != nullptr)
+                log->capture(frames.back().symbol, depth, slots.data() + fp);
+            pop();
+        }
+
+        // Prints and keeps a record as if a frame holding values had just
+        // been popped at the given depth.
+        void replayRecord(FrameSymbol *symbol, int depth, const Value *values) {
+            if (out != nullptr)
+                *out << recordToString(symbol, depth, values) << "\n";
+            if (state != nullptr)
+                state->capture(symbol, depth, values);
+            if (log != nullptr)
+                log->capture(symbol, depth, values);
+        }
+};
+
+// --------------------------------------------------------------
+
+// Thrown when an execution limit is hit. It carries the numbers and a dump
+// of the call stack at the point the run was stopped.
+class ExecutionLimitError: public Error {
+    public:
+        const long long limit;
+        const long long steps;
+        const int depth;
+        const std::string state;
+
+        ExecutionLimitError(ErrorCode code, long long limit, long long steps, int depth,
+            const std::string& state)
+        : Error("", nullptr, code), limit(limit), steps(steps), depth(depth), state(state) {
+            std::stringstream ss;
+            ss << "ExecutionLimitError: " << error_tostring(code) << " (limit " << limit
+                << ", " << steps << " steps, call depth " << depth << ")\n"
+                << "Partial state:\n" << state;
+            message = ss.str();
+        }
+        const char *what() const noexcept override {
+            return message.c_str();
+        }
+};
+
+// Enforces ExecutionLimits with as little work as possible on the hot path.
+// step() is called at every statement and call and only decrements a
+// counter; when it runs out, checkpoint() accounts for the finished chunk,
+// checks the step limit and the deadline, and starts the next chunk. With a
+// deadline set, chunks are at most DEADLINE_INTERVAL steps long, so the
+// clock is read once per that many statements. A time slice ends a chunk
+// the same way, so an engine that can pause checks for it for free.
+class ExecutionBudget {
+    private:
+        static constexpr long long DEADLINE_INTERVAL = 4096;
+        ExecutionLimits limits;
+        CallStack *callStack;
+        long long countdown = 0;  // steps left in the current chunk
+        long long chunk = 0;      // length of the current chunk
+        long long stepsDone = 0;  // steps of the finished chunks
+        long long sliceEnd = 0;   // steps after which to pause, or 0
+        int depth = 0;
+        std::chrono::steady_clock::time_point deadline;
+
+        void refill() {
+            chunk = LLONG_MAX / 2;
+            if (limits.maxSteps > 0)
+                chunk = std::min(chunk, limits.maxSteps - stepsDone);
+            if (limits.timeoutMs > 0)
+                chunk = std::min(chunk, DEADLINE_INTERVAL);
+            if (sliceEnd > 0)
+                chunk = std::min(chunk, std::max(sliceEnd - stepsDone, 0LL));
+            countdown = chunk;
+        }
+
+        void fail(ErrorCode code, long long limit, long long steps) {
+            throw ExecutionLimitError(code, limit, steps, depth, callStack->toString());
+        }
+
+        // true if the time slice is over
+        bool checkpoint() {
+            stepsDone += chunk;
+            if (limits.maxSteps > 0 && stepsDone >= limits.maxSteps)
+                fail(ErrorCode::STEP_LIMIT_EXCEEDED, limits.maxSteps, stepsDone);
+            if (limits.timeoutMs > 0 && std::chrono::steady_clock::now() >= deadline)
+                fail(ErrorCode::TIME_LIMIT_EXCEEDED, limits.timeoutMs, stepsDone);
+            refill();
+            --countdown; // the step that triggered the checkpoint
+            return sliceEnd > 0 && stepsDone >= sliceEnd;
+        }
+    public:
+        ExecutionBudget(const ExecutionLimits& limits, CallStack *callStack)
+        : limits(limits), callStack(callStack) {
+            deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(limits.timeoutMs);
+            refill();
+        }
+
+        // Counts a step. Returns true when the time slice is over; an
+        // engine that cannot pause ignores it.
+        bool step() {
+            if (--countdown < 0)
+                return checkpoint();
+            return false;
+        }
+
+        // Lets the run take about steps more steps before step() asks it to
+        // pause; 0 for no slice.
+        void startSlice(long long steps) {
+            stepsDone = this->steps();
+            sliceEnd = steps > 0 ? stepsDone + steps : 0;
+            refill();
+        }
+
+        void enter() {
+            ++depth;
+            if (limits.maxCallDepth > 0 && depth > limits.maxCallDepth)
+                fail(ErrorCode::CALL_DEPTH_EXCEEDED, limits.maxCallDepth, steps());
+        }
+
+        void leave() {
+            --depth;
+        }
+
+        // true if levels more nested calls fit under the depth limit
+        bool canEnter(int levels) {
+            return limits.maxCallDepth <= 0 || depth + levels <= limits.maxCallDepth;
+        }
+
+        long long steps() {
+            return stepsDone + chunk - countdown;
+        }
+
+        // Takes over the deadline and call depth of the budget of the
+        // thread that handed this one a call, which had done stepsBefore
+        // steps by then. Steps of calls running beside this one are not
+        // counted, so a step limit is not enforced across threads.
+        void continueFrom(const ExecutionBudget &other, long long stepsBefore) {
+            deadline = other.deadline;
+            depth = other.depth;
+            stepsDone = stepsBefore;
+            refill();
+        }
+
+        // Goes on counting from a run restored from a snapshot, which had
+        // done steps steps.
+        void restoreSteps(long long steps) {
+            if (limits.maxSteps > 0 && steps > limits.maxSteps)
+                fail(ErrorCode::STEP_LIMIT_EXCEEDED, limits.maxSteps, steps);
+            stepsDone = steps;
+            refill();
+        }
+};
+
+// --------------------------------------------------------------
+
 class Visitor {
     public:
         Visitor() {};
@@ -443,32 +914,80 @@ class Visitor {
         virtual void visitProcedure(Procedure *node) {};
         virtual void visitBlock(Block *node) {};
         virtual void visitProgramNode(ProgramNode *node) {};
+        virtual void visitIntToReal(IntToReal *node) {};
+        virtual void visitIfStatement(IfStatement *node) {};
+        virtual void visitWhileStatement(WhileStatement *node) {};
+        virtual void visitForStatement(ForStatement *node) {};
+        virtual void visitAssignVarOpConst(AssignVarOpConst *node) {};
+        virtual void visitAssignVarOpVar(AssignVarOpVar *node) {};
+        virtual void visitIncrementVar(IncrementVar *node) {};
+        virtual void visitCallWithConstArgs(CallWithConstArgs *node) {};
 };
 
+// applyBinaryOp (or a negation, with only left used) of an operation the
+// range analysis could not prove safe; throws an ArithmeticError at op
+inline Value applyCheckedOp(OpKind kind, Value left, Value right, const std::shared_ptr<Token> &op) {
+    Value result;
+    ErrorCode code = checkedIntOp(kind, left.i, right.i, result.i);
+    if (code != ErrorCode::NONE)
+        throw ArithmeticError(code, op);
+    return result;
+}
+
 class Node {
     public:
-        Node() {};
+        // what the node is, so a pass can switch on it instead of going
+        // through accept
+        const NodeKind nodeKind;
+        // static type of an expression, set by the SemanticAnalyzer
+        Symbol::Type type = Symbol::Type::NO_TYPE;
+        Node(NodeKind nodeKind) : nodeKind(nodeKind) {};
         virtual ~Node() {};
-        Node(Node *node) {};
         virtual void accept(Visitor *visitor) = 0;
-        virtual void print() = 0;
         // some derived classes will have child nodes
 };
 
+// Base of the concrete node classes; fills in the kind.
+template <NodeKind K>
+class NodeOfKind: public Node {
+    public:
+        static const NodeKind KIND = K;
+        NodeOfKind() : Node(K) {};
+};
+
+// static_cast to a node class, checking the kind in debug builds
+template <typename T>
+T *node_cast(Node *node) {
+    assert(node->nodeKind == T::KIND);
+    return static_cast<T*>(node);
+}
+
+// the node as a T, or nullptr if it is some other kind
+template <typename T>
+T *node_as(Node *node) {
+    return node->nodeKind == T::KIND ? static_cast<T*>(node) : nullptr;
+}
+
 
-class NumberNode: public Node {
+class NumberNode: public NodeOfKind<NodeKind::NUMBER> {
     public:
         std::shared_ptr<Token> token;
-        int value;
+        Value value;
         NumberNode(std::shared_ptr<Token> token);
         void accept(Visitor *visitor);
-        void print();
     private:
         std::string to_string(int num);
 };
 NumberNode::NumberNode(std::shared_ptr<Token> token) {
     this->token = token;
-    this->value = std::stoi(token->value);
+    if (token->tokenType == TokenType::REAL_CONST) {
+        this->value.r = std::stod(token->value);
+        this->type = Symbol::Type::REAL;
+    }
+    else {
+        this->value.i = std::stoi(token->value);
+        this->type = Symbol::Type::INTEGER;
+    }
 }
 std::string NumberNode::to_string(int num) {
     std::string res = "";
@@ -482,40 +1001,61 @@ std::string NumberNode::to_string(int num) {
 void NumberNode::accept(Visitor *visitor)  {
     visitor->visitNumberNode(this);
 }
-void NumberNode::print() {
-    std::printf("NumberNode: { Value: %d }\n", value);
-}
 
 
-class BinaryOp: public Node {
+class BinaryOp: public NodeOfKind<NodeKind::BINARY_OP> {
     public:
         std::shared_ptr<Token> op;
         std::unique_ptr<Node> left;
         std::unique_ptr<Node> right;
+        OpKind kind = OpKind::NONE;
+        // an integer operation that may overflow or divide by zero, and so
+        // is checked at run time; set by the RangeAnalyzer under --checked
+        bool check = false;
         BinaryOp(std::shared_ptr<Token> op, std::unique_ptr<Node> left, std::unique_ptr<Node> right);
+        ~BinaryOp();
         void accept(Visitor *visitor) override;
-        void print() override;
 };
 BinaryOp::BinaryOp(std::shared_ptr<Token> op, std::unique_ptr<Node> left, std::unique_ptr<Node> right) {
     this->op = op;
     this->left = std::move(left);
     this->right = std::move(right);
 }
+// A chain like 1+1+...+1 nests a BinaryOp per operator down the left
+// side, so it is freed one link at a time instead of recursively.
+BinaryOp::~BinaryOp() {
+    std::unique_ptr<Node> next = std::move(left);
+    while (next != nullptr && next->nodeKind == NodeKind::BINARY_OP) {
+        std::unique_ptr<Node> below = std::move(static_cast<BinaryOp*>(next.get())->left);
+        next = std::move(below);
+    }
+}
 void BinaryOp::accept(Visitor *visitor) {
     visitor->visitBinaryOp(this);
 }
-void BinaryOp::print() {
-    std::cout << "BinaryOp: { Type: " << tokenType_tostring(op->tokenType) << " }\n";
+
+// Pushes node and the BinaryOps down its left side onto spine, outermost
+// first, and returns the operand at the bottom. The parser builds such a
+// chain as deep as the expression is long, so passes walk it with this in
+// a loop rather than recursing once per operator.
+Node *pushLeftSpine(BinaryOp *node, std::vector<BinaryOp*> &spine) {
+    Node *operand = node;
+    while (BinaryOp *bin = node_as<BinaryOp>(operand)) {
+        spine.push_back(bin);
+        operand = bin->left.get();
+    }
+    return operand;
 }
 
 
-class UnaryOp: public Node {
+class UnaryOp: public NodeOfKind<NodeKind::UNARY_OP> {
     public:
         std::shared_ptr<Token> op;
         std::unique_ptr<Node> factor; // only child node
+        OpKind kind = OpKind::NONE;
+        bool check = false; // as in BinaryOp
         UnaryOp(std::shared_ptr<Token> op, std::unique_ptr<Node> factor);
         void accept(Visitor *visitor) override;
-        void print() override;
 };
 UnaryOp::UnaryOp(std::shared_ptr<Token> op, std::unique_ptr<Node> factor) {
     this->op = op;
@@ -524,19 +1064,32 @@ UnaryOp::UnaryOp(std::shared_ptr<Token> op, std::unique_ptr<Node> factor) {
 void UnaryOp::accept(Visitor *visitor) {
     visitor->visitUnaryOp(this);
 }
-void UnaryOp::print() {
-    std::cout << "UnaryOp: { Type: " << tokenType_tostring(op->tokenType) << " }\n";
-}
+
+
+// Implicit conversion of an INTEGER expression to REAL, inserted by the
+// SemanticAnalyzer wherever an integer is used in a real context.
+class IntToReal: public NodeOfKind<NodeKind::INT_TO_REAL> {
+    public:
+        std::unique_ptr<Node> expr;
+        IntToReal(std::unique_ptr<Node> expr) {
+            this->expr = std::move(expr);
+            this->type = Symbol::Type::REAL;
+        }
+        void accept(Visitor *visitor) override {
+            visitor->visitIntToReal(this);
+        }
+};
 
 
 // Does not store a type
-class VariableNode: public Node {
+class VariableNode: public NodeOfKind<NodeKind::VARIABLE> {
     public:
         std::shared_ptr<Token> variableToken;
         std::string name;
+        int slot = -1;  // resolved by the SemanticAnalyzer
+        int level = 0;
         VariableNode(std::shared_ptr<Token> token);
         void accept(Visitor *visitor) override;
-        void print() override;
 };
 VariableNode::VariableNode(std::shared_ptr<Token> token) {
     this->variableToken = token;
@@ -545,16 +1098,26 @@ VariableNode::VariableNode(std::shared_ptr<Token> token) {
 void VariableNode::accept(Visitor *visitor) {
     visitor->visitVariableNode(this);
 }
-void VariableNode::print() {
-    std::cout << "Variable {\"name\" = \"" << name << "\"}\n";
-}
 
-class CompoundStatement: public Node {
+// How a compound statement's statements run when calls are spread over
+// threads; filled in by the DependencyAnalyzer. A CALL statement is handed
+// to a worker once the earlier calls in its waitsFor list have finished.
+// The other statements run on the thread that owns the compound statement:
+// INLINE ones after their waitsFor calls, BARRIER ones (those with a call
+// further inside) after every earlier call.
+struct ParallelPlan {
+    enum class Kind : uint8_t { CALL, INLINE, BARRIER };
+    std::vector<Kind> kinds;
+    std::vector<std::vector<int>> waitsFor;
+    int numCalls = 0;
+};
+
+class CompoundStatement: public NodeOfKind<NodeKind::COMPOUND> {
     public:
         std::vector<std::unique_ptr<Node>> statementList;
+        std::unique_ptr<ParallelPlan> plan; // only with --threads
         CompoundStatement(std::vector<std::unique_ptr<Node>> list);
         void accept(Visitor *visitor) override;
-        void print() override;
 };
 CompoundStatement::CompoundStatement(std::vector<std::unique_ptr<Node>> list) {
     this->statementList = std::move(list);
@@ -562,12 +1125,9 @@ CompoundStatement::CompoundStatement(std::vector<std::unique_ptr<Node>> list) {
 void CompoundStatement::accept(Visitor *visitor) {
     visitor->visitCompoundStatement(this);
 }
-void CompoundStatement::print() {
-    std::cout << "Compound Statement\n";
-}
 
 
-class ProcedureCall: public Node {
+class ProcedureCall: public NodeOfKind<NodeKind::PROCEDURE_CALL> {
     public:
         std::shared_ptr<Token> procedure;
         std::vector<std::unique_ptr<Node>> args;
@@ -580,20 +1140,16 @@ class ProcedureCall: public Node {
         void accept(Visitor *visitor) override {
             visitor->visitProcedureCall(this);
         }
-        void print() override {
-            std::cout << "Procedure call { " << procedure->value << "( ... ) }\n";
-        }
 };
 
 
-class AssignStatement: public Node {
+class AssignStatement: public NodeOfKind<NodeKind::ASSIGN> {
     public:
         std::unique_ptr<Node> left;
         std::shared_ptr<Token> assignment;
         std::unique_ptr<Node> right;      
         AssignStatement(std::unique_ptr<Node> variable, std::shared_ptr<Token> assignment, std::unique_ptr<Node> expr);
         void accept(Visitor *visitor) override;
-        void print();
 };
 AssignStatement::AssignStatement(std::unique_ptr<Node> variable, std::shared_ptr<Token> assignment, std::unique_ptr<Node> expr) {
     this->left = std::move(variable);
@@ -603,43 +1159,207 @@ AssignStatement::AssignStatement(std::unique_ptr<Node> variable, std::shared_ptr
 void AssignStatement::accept(Visitor *visitor) {
     visitor->visitAssignStatement(this);
 }
-void AssignStatement::print() {
-    Node *leftRaw = left.get();
-    if (leftRaw == nullptr) return;
-    if (typeid(*left) == typeid(VariableNode)) {
-        VariableNode *node = dynamic_cast<VariableNode*>(leftRaw);
-        std::cout << "Assignment Statement { " << node->name << " = ... }\n";
-    }
-}
 
 
-class EmptyStatement: public Node {
+class EmptyStatement: public NodeOfKind<NodeKind::EMPTY> {
     public:
         EmptyStatement() {};
         void accept(Visitor *visitor) override;
-        void print() override;
 };
 void EmptyStatement::accept(Visitor *visitor) {
     visitor->visitEmptyStatement(this);
 }
-void EmptyStatement::print() {
-    std::printf("Empty Statement\n");
-}
 
 
-class TypeNode: public Node {
+// IF condition THEN statement (ELSE statement)?
+class IfStatement: public NodeOfKind<NodeKind::IF> {
+    public:
+        std::shared_ptr<Token> token;
+        std::unique_ptr<Node> condition;
+        std::unique_ptr<Node> thenBranch;
+        std::unique_ptr<Node> elseBranch; // may be null
+
+        IfStatement(std::shared_ptr<Token> token, std::unique_ptr<Node> condition,
+            std::unique_ptr<Node> thenBranch, std::unique_ptr<Node> elseBranch) {
+            this->token = token;
+            this->condition = std::move(condition);
+            this->thenBranch = std::move(thenBranch);
+            this->elseBranch = std::move(elseBranch);
+        }
+        void accept(Visitor *visitor) override {
+            visitor->visitIfStatement(this);
+        }
+};
+
+// WHILE condition DO statement
+class WhileStatement: public NodeOfKind<NodeKind::WHILE> {
+    public:
+        std::shared_ptr<Token> token;
+        std::unique_ptr<Node> condition;
+        std::unique_ptr<Node> body;
+
+        WhileStatement(std::shared_ptr<Token> token, std::unique_ptr<Node> condition,
+            std::unique_ptr<Node> body) {
+            this->token = token;
+            this->condition = std::move(condition);
+            this->body = std::move(body);
+        }
+        void accept(Visitor *visitor) override {
+            visitor->visitWhileStatement(this);
+        }
+};
+
+// FOR variable := start (TO | DOWNTO) end DO statement
+// The bounds are evaluated once, before the first iteration.
+class ForStatement: public NodeOfKind<NodeKind::FOR> {
+    public:
+        std::shared_ptr<Token> token;
+        std::unique_ptr<Node> variable;
+        std::unique_ptr<Node> start;
+        std::unique_ptr<Node> end;
+        bool downto;
+        std::unique_ptr<Node> body;
+
+        ForStatement(std::shared_ptr<Token> token, std::unique_ptr<Node> variable,
+            std::unique_ptr<Node> start, std::unique_ptr<Node> end, bool downto,
+            std::unique_ptr<Node> body) {
+            this->token = token;
+            this->variable = std::move(variable);
+            this->start = std::move(start);
+            this->end = std::move(end);
+            this->downto = downto;
+            this->body = std::move(body);
+        }
+        void accept(Visitor *visitor) override {
+            visitor->visitForStatement(this);
+        }
+};
+
+
+// Fused forms of the most common statement shapes, produced by the
+// SuperinstructionFuser after semantic analysis. Each one runs in a single
+// visit with its variables resolved to (level, slot) and its constants
+// already evaluated.
+
+// target := source op constant
+class AssignVarOpConst: public NodeOfKind<NodeKind::ASSIGN_VAR_OP_CONST> {
+    public:
+        std::unique_ptr<VariableNode> target;
+        std::unique_ptr<VariableNode> source;
+        std::shared_ptr<Token> op;
+        OpKind kind;
+        bool check = false; // as on the BinaryOp it was fused from
+        Value constant;
+        int targetLevel, targetSlot;
+        int sourceLevel, sourceSlot;
+
+        AssignVarOpConst(std::unique_ptr<VariableNode> target, std::unique_ptr<VariableNode> source,
+            std::shared_ptr<Token> op, OpKind kind, bool check, Value constant) {
+            this->target = std::move(target);
+            this->source = std::move(source);
+            this->op = op;
+            this->kind = kind;
+            this->check = check;
+            this->constant = constant;
+            targetLevel = this->target->level;
+            targetSlot = this->target->slot;
+            sourceLevel = this->source->level;
+            sourceSlot = this->source->slot;
+        }
+        void accept(Visitor *visitor) override {
+            visitor->visitAssignVarOpConst(this);
+        }
+};
+
+// target := left op right
+class AssignVarOpVar: public NodeOfKind<NodeKind::ASSIGN_VAR_OP_VAR> {
+    public:
+        std::unique_ptr<VariableNode> target;
+        std::unique_ptr<VariableNode> left;
+        std::unique_ptr<VariableNode> right;
+        std::shared_ptr<Token> op;
+        OpKind kind;
+        bool check = false;
+        int targetLevel, targetSlot;
+        int leftLevel, leftSlot;
+        int rightLevel, rightSlot;
+
+        AssignVarOpVar(std::unique_ptr<VariableNode> target, std::unique_ptr<VariableNode> left,
+            std::unique_ptr<VariableNode> right, std::shared_ptr<Token> op, OpKind kind, bool check) {
+            this->target = std::move(target);
+            this->left = std::move(left);
+            this->right = std::move(right);
+            this->op = op;
+            this->kind = kind;
+            this->check = check;
+            targetLevel = this->target->level;
+            targetSlot = this->target->slot;
+            leftLevel = this->left->level;
+            leftSlot = this->left->slot;
+            rightLevel = this->right->level;
+            rightSlot = this->right->slot;
+        }
+        void accept(Visitor *visitor) override {
+            visitor->visitAssignVarOpVar(this);
+        }
+};
+
+// target := target + delta (a subtraction is stored as a negated delta)
+class IncrementVar: public NodeOfKind<NodeKind::INCREMENT_VAR> {
+    public:
+        std::unique_ptr<VariableNode> target;
+        std::shared_ptr<Token> op;
+        OpKind kind; // INT_ADD or REAL_ADD
+        bool check = false;
+        Value delta;
+        int targetLevel, targetSlot;
+
+        IncrementVar(std::unique_ptr<VariableNode> target, std::shared_ptr<Token> op,
+            OpKind kind, bool check, Value delta) {
+            this->target = std::move(target);
+            this->op = op;
+            this->kind = kind;
+            this->check = check;
+            this->delta = delta;
+            targetLevel = this->target->level;
+            targetSlot = this->target->slot;
+        }
+        void accept(Visitor *visitor) override {
+            visitor->visitIncrementVar(this);
+        }
+};
+
+// procedure call whose arguments are all constants
+class CallWithConstArgs: public NodeOfKind<NodeKind::CALL_WITH_CONST_ARGS> {
+    public:
+        std::shared_ptr<Token> procedure;
+        std::shared_ptr<ProcedureSymbol> procSymbol;
+        std::vector<Value> args;
+
+        CallWithConstArgs(std::shared_ptr<Token> procedure,
+            std::shared_ptr<ProcedureSymbol> procSymbol, std::vector<Value> args) {
+            this->procedure = procedure;
+            this->procSymbol = procSymbol;
+            this->args = std::move(args);
+        }
+        void accept(Visitor *visitor) override {
+            visitor->visitCallWithConstArgs(this);
+        }
+};
+
+
+class TypeNode: public NodeOfKind<NodeKind::TYPE> {
     public:
         std::unique_ptr<Token> type;
         TypeNode(TokenType tokenType) {
             type = std::make_unique<Token>(tokenType, tokenType_tostring(tokenType), 0, 0);
         }
         void accept(Visitor *visitor) override {}
-        void print() override {}
 };
 
 
 // tokenType must be INTEGER or REAL
-class VarDeclaration: public Node {
+class VarDeclaration: public NodeOfKind<NodeKind::VAR_DECLARATION> {
     public:
         std::unique_ptr<Node> varNode;
         std::unique_ptr<Node> typeNode;
@@ -650,14 +1370,8 @@ class VarDeclaration: public Node {
         void accept(Visitor *visitor) override {
             visitor->visitVarDeclaration(this);
         }
-        void print() override {
-            // "a : INTEGER"
-            VariableNode *varConv = dynamic_cast<VariableNode*>(varNode.get());
-            TypeNode *typeConv = dynamic_cast<TypeNode*>(typeNode.get());
-            std::cout << "VAR -> " << varConv->name << " : " << tokenType_tostring(typeConv->type->tokenType) << "\n";
-        }
 };
-class DeclarationRoot: public Node {
+class DeclarationRoot: public NodeOfKind<NodeKind::DECLARATION_ROOT> {
     public:
         std::vector<std::unique_ptr<Node>> declarations;
         DeclarationRoot() {}
@@ -667,11 +1381,8 @@ class DeclarationRoot: public Node {
         void accept(Visitor *visitor) override {
             visitor->visitDeclarationRoot(this);
         }
-        void print() override {
-            std::cout << "Declaration Root\n";
-        }
 };
-class Block: public Node {
+class Block: public NodeOfKind<NodeKind::BLOCK> {
     public:
         std::vector<std::unique_ptr<Node>> varDeclarations; // replace decRoot;
         std::unique_ptr<Node> compoundStatement;
@@ -688,12 +1399,9 @@ class Block: public Node {
         void accept(Visitor *visitor) override {
             visitor->visitBlock(this);
         }
-        void print() override {
-            std::cout << "Block\n";
-        }
 };
 
-class ParamDeclaration: public Node {
+class ParamDeclaration: public NodeOfKind<NodeKind::PARAM_DECLARATION> {
     public:
         std::unique_ptr<Node> varNode;
         std::unique_ptr<Node> typeNode;
@@ -704,36 +1412,28 @@ class ParamDeclaration: public Node {
         void accept(Visitor *visitor) override {
             visitor->visitParamDeclaration(this);
         }
-        void print() override {
-            // "a : INTEGER"
-            std::cout << "PARAM -> ";
-            VariableNode *varConv = dynamic_cast<VariableNode*>(varNode.get());
-            TypeNode *typeConv = dynamic_cast<TypeNode*>(typeNode.get());
-            std::cout << varConv->name << " : " << tokenType_tostring(typeConv->type->tokenType) << "\n";
-        }
 };
-class Procedure: public Node {
+class Procedure: public NodeOfKind<NodeKind::PROCEDURE> {
     public:
         std::shared_ptr<Token> id;
         std::unique_ptr<Node> block;
         std::vector<std::unique_ptr<Node>> paramDeclarations;
+        std::shared_ptr<ProcedureSymbol> procSymbol;
 
         Procedure(std::shared_ptr<Token> id, std::unique_ptr<Node> block, std::vector<std::unique_ptr<Node>> params) {
             this->id = id;
             this->block = std::move(block);
             this->paramDeclarations = std::move(params);
         }
-        void print() override {
-            std::cout << "Procedure \"" << id->value << "\"\n";
-        }
         void accept(Visitor *visitor) override {
             visitor->visitProcedure(this);
         }
 };
-class ProgramNode: public Node {
+class ProgramNode: public NodeOfKind<NodeKind::PROGRAM> {
     public:
         std::shared_ptr<Token> programName;
         std::unique_ptr<Node> block;
+        std::shared_ptr<ProgramSymbol> programSymbol;
 
         ProgramNode(std::shared_ptr<Token> programName, 
         std::unique_ptr<Node> block) {
@@ -743,11 +1443,465 @@ class ProgramNode: public Node {
         void accept(Visitor *visitor) override {
             visitor->visitProgramNode(this);
         }
-        void print() override {
-            std::cout << "Program \"" << programName->value << ".pas\" \n";
+};
+
+// --------------------------------------------------------------
+
+// dispatch() is inlined into every call site, so each site gets its own
+// copy of the switch and its own branch history, like the VM's threaded
+// dispatch; one shared switch predicts worse than the virtual calls it
+// replaces.
+#if defined(__GNUC__)
+#define DISPATCH_INLINE __attribute__((always_inline)) inline
+#else
+#define DISPATCH_INLINE inline
+#endif
+
+// Base of the passes that recurse through dispatch() instead of accept().
+// dispatch() switches on the node kind and calls Derived's visit method
+// directly, so with a final Derived the visit is resolved at compile time;
+// accept() costs two virtual calls per node. It is still a Visitor, so
+// node->accept(pass) works as the entry point.
+template <typename Derived>
+class StaticVisitor: public Visitor {
+    public:
+        DISPATCH_INLINE void dispatch(Node *node) {
+            Derived *self = static_cast<Derived*>(this);
+            switch (node->nodeKind) {
+                case NodeKind::NUMBER: self->visitNumberNode(static_cast<NumberNode*>(node)); break;
+                case NodeKind::BINARY_OP: self->visitBinaryOp(static_cast<BinaryOp*>(node)); break;
+                case NodeKind::UNARY_OP: self->visitUnaryOp(static_cast<UnaryOp*>(node)); break;
+                case NodeKind::INT_TO_REAL: self->visitIntToReal(static_cast<IntToReal*>(node)); break;
+                case NodeKind::VARIABLE: self->visitVariableNode(static_cast<VariableNode*>(node)); break;
+                case NodeKind::COMPOUND: self->visitCompoundStatement(static_cast<CompoundStatement*>(node)); break;
+                case NodeKind::PROCEDURE_CALL: self->visitProcedureCall(static_cast<ProcedureCall*>(node)); break;
+                case NodeKind::ASSIGN: self->visitAssignStatement(static_cast<AssignStatement*>(node)); break;
+                case NodeKind::EMPTY: self->visitEmptyStatement(static_cast<EmptyStatement*>(node)); break;
+                case NodeKind::IF: self->visitIfStatement(static_cast<IfStatement*>(node)); break;
+                case NodeKind::WHILE: self->visitWhileStatement(static_cast<WhileStatement*>(node)); break;
+                case NodeKind::FOR: self->visitForStatement(static_cast<ForStatement*>(node)); break;
+                case NodeKind::ASSIGN_VAR_OP_CONST: self->visitAssignVarOpConst(static_cast<AssignVarOpConst*>(node)); break;
+                case NodeKind::ASSIGN_VAR_OP_VAR: self->visitAssignVarOpVar(static_cast<AssignVarOpVar*>(node)); break;
+                case NodeKind::INCREMENT_VAR: self->visitIncrementVar(static_cast<IncrementVar*>(node)); break;
+                case NodeKind::CALL_WITH_CONST_ARGS: self->visitCallWithConstArgs(static_cast<CallWithConstArgs*>(node)); break;
+                case NodeKind::VAR_DECLARATION: self->visitVarDeclaration(static_cast<VarDeclaration*>(node)); break;
+                case NodeKind::DECLARATION_ROOT: self->visitDeclarationRoot(static_cast<DeclarationRoot*>(node)); break;
+                case NodeKind::PARAM_DECLARATION: self->visitParamDeclaration(static_cast<ParamDeclaration*>(node)); break;
+                case NodeKind::BLOCK: self->visitBlock(static_cast<Block*>(node)); break;
+                case NodeKind::PROCEDURE: self->visitProcedure(static_cast<Procedure*>(node)); break;
+                case NodeKind::PROGRAM: self->visitProgramNode(static_cast<ProgramNode*>(node)); break;
+                case NodeKind::TYPE: break;
+            }
+        }
+};
+
+
+// --------------------------------------------------------------
+
+class FlatVisitor;
+
+// The tree laid out in one array of nodes, in preorder, with each field in
+// its own column. A node's subtree is the range [node, ends[node]). Child
+// references are 32-bit indices; variable-length child lists are ranges of
+// the lists array. What a, b, c and payload hold depends on the kind:
+//
+//   NUMBER               payload = the constant
+//   BINARY_OP            a = left, b = right
+//   UNARY_OP             a = operand
+//   INT_TO_REAL          a = operand
+//   VARIABLE             a = slot, b = level
+//   COMPOUND             lists[a .. a+b) = statements
+//   PROCEDURE_CALL       lists[a .. a+b) = arguments, c = frame
+//   ASSIGN               a = variable, b = expression
+//   IF                   a = condition, b = then, c = else or -1
+//   WHILE                a = condition, b = body
+//   FOR                  lists[a .. a+4) = variable, start, end, body; c = downto
+//   ASSIGN_VAR_OP_CONST  a = target, b = source, payload = constant
+//   ASSIGN_VAR_OP_VAR    a = target, b = left, c = right
+//   INCREMENT_VAR        a = target, payload = delta
+//   CALL_WITH_CONST_ARGS values[a .. a+b) = arguments, c = frame
+//   VAR_DECLARATION      a = variable, payload.i = its TokenType
+//   DECLARATION_ROOT     lists[a .. a+b) = declarations
+//   PARAM_DECLARATION    a = variable, payload.i = its TokenType
+//   BLOCK                lists[a ..) = b procedures, c declarations, then
+//                        the compound statement
+//   PROCEDURE            a = block, lists[b .. b+c) = parameters,
+//                        payload.i = frame
+//   PROGRAM              a = block, payload.i = frame
+//
+// Frames index the frames table and are -1 before semantic analysis.
+class FlatAst {
+    private:
+        template <typename T>
+        using Column = std::vector<T, BudgetAllocator<T>>;
+        std::shared_ptr<MemoryBudget> budget;
+    public:
+        Column<NodeKind> kinds;
+        Column<Symbol::Type> types;
+        Column<OpKind> ops;
+        Column<int32_t> tokens; // into tokenTable, or -1
+        Column<int32_t> a, b, c;
+        Column<Value> payloads;
+        Column<int32_t> ends;
+
+        Column<int32_t> lists;
+        Column<Value> values;
+        std::vector<std::shared_ptr<Token>> tokenTable;
+        std::vector<std::shared_ptr<FrameSymbol>> frames;
+
+        FlatAst(std::shared_ptr<MemoryBudget> budget);
+        int size() const {
+            return kinds.size();
+        }
+        const std::shared_ptr<Token>& token(int node) const {
+            return tokenTable[tokens[node]];
+        }
+        // appends a node with no children and returns its index
+        int add(NodeKind kind, Symbol::Type type = Symbol::Type::NO_TYPE);
+        int addToken(std::shared_ptr<Token> token);
+        int addFrame(std::shared_ptr<FrameSymbol> frame);
+        void accept(int node, FlatVisitor *visitor) const;
+        // pushLeftSpine for a flattened BINARY_OP
+        int pushLeftSpine(int node, std::vector<int> &spine) const {
+            while (kinds[node] == NodeKind::BINARY_OP) {
+                spine.push_back(node);
+                node = a[node];
+            }
+            return node;
         }
 };
+FlatAst::FlatAst(std::shared_ptr<MemoryBudget> budget)
+: budget(budget),
+    kinds(BudgetAllocator<NodeKind>(budget, MemoryBudget::Category::PARSER)),
+    types(BudgetAllocator<Symbol::Type>(budget, MemoryBudget::Category::PARSER)),
+    ops(BudgetAllocator<OpKind>(budget, MemoryBudget::Category::PARSER)),
+    tokens(BudgetAllocator<int32_t>(budget, MemoryBudget::Category::PARSER)),
+    a(BudgetAllocator<int32_t>(budget, MemoryBudget::Category::PARSER)),
+    b(BudgetAllocator<int32_t>(budget, MemoryBudget::Category::PARSER)),
+    c(BudgetAllocator<int32_t>(budget, MemoryBudget::Category::PARSER)),
+    payloads(BudgetAllocator<Value>(budget, MemoryBudget::Category::PARSER)),
+    ends(BudgetAllocator<int32_t>(budget, MemoryBudget::Category::PARSER)),
+    lists(BudgetAllocator<int32_t>(budget, MemoryBudget::Category::PARSER)),
+    values(BudgetAllocator<Value>(budget, MemoryBudget::Category::PARSER)) {}
+int FlatAst::add(NodeKind kind, Symbol::Type type) {
+    Value zero;
+    zero.r = 0;
+    kinds.push_back(kind);
+    types.push_back(type);
+    ops.push_back(OpKind::NONE);
+    tokens.push_back(-1);
+    a.push_back(-1);
+    b.push_back(-1);
+    c.push_back(-1);
+    payloads.push_back(zero);
+    ends.push_back(kinds.size());
+    return kinds.size() - 1;
+}
+int FlatAst::addToken(std::shared_ptr<Token> token) {
+    tokenTable.push_back(std::move(token));
+    return tokenTable.size() - 1;
+}
+int FlatAst::addFrame(std::shared_ptr<FrameSymbol> frame) {
+    if (frame == nullptr)
+        return -1;
+    frames.push_back(std::move(frame));
+    return frames.size() - 1;
+}
+
+// A pass over a FlatAst. Like Visitor, a method visits the node's children
+// itself, through FlatAst::accept.
+class FlatVisitor {
+    public:
+        FlatVisitor() {};
+        virtual ~FlatVisitor() {};
+        virtual void visitNumberNode(const FlatAst &ast, int node) {};
+        virtual void visitBinaryOp(const FlatAst &ast, int node) {};
+        virtual void visitUnaryOp(const FlatAst &ast, int node) {};
+        virtual void visitIntToReal(const FlatAst &ast, int node) {};
+        virtual void visitVariableNode(const FlatAst &ast, int node) {};
+        virtual void visitCompoundStatement(const FlatAst &ast, int node) {};
+        virtual void visitProcedureCall(const FlatAst &ast, int node) {};
+        virtual void visitAssignStatement(const FlatAst &ast, int node) {};
+        virtual void visitEmptyStatement(const FlatAst &ast, int node) {};
+        virtual void visitIfStatement(const FlatAst &ast, int node) {};
+        virtual void visitWhileStatement(const FlatAst &ast, int node) {};
+        virtual void visitForStatement(const FlatAst &ast, int node) {};
+        virtual void visitAssignVarOpConst(const FlatAst &ast, int node) {};
+        virtual void visitAssignVarOpVar(const FlatAst &ast, int node) {};
+        virtual void visitIncrementVar(const FlatAst &ast, int node) {};
+        virtual void visitCallWithConstArgs(const FlatAst &ast, int node) {};
+        virtual void visitVarDeclaration(const FlatAst &ast, int node) {};
+        virtual void visitDeclarationRoot(const FlatAst &ast, int node) {};
+        virtual void visitParamDeclaration(const FlatAst &ast, int node) {};
+        virtual void visitBlock(const FlatAst &ast, int node) {};
+        virtual void visitProcedure(const FlatAst &ast, int node) {};
+        virtual void visitProgramNode(const FlatAst &ast, int node) {};
+};
+void FlatAst::accept(int node, FlatVisitor *visitor) const {
+    switch (kinds[node]) {
+        case NodeKind::NUMBER: visitor->visitNumberNode(*this, node); break;
+        case NodeKind::BINARY_OP: visitor->visitBinaryOp(*this, node); break;
+        case NodeKind::UNARY_OP: visitor->visitUnaryOp(*this, node); break;
+        case NodeKind::INT_TO_REAL: visitor->visitIntToReal(*this, node); break;
+        case NodeKind::VARIABLE: visitor->visitVariableNode(*this, node); break;
+        case NodeKind::COMPOUND: visitor->visitCompoundStatement(*this, node); break;
+        case NodeKind::PROCEDURE_CALL: visitor->visitProcedureCall(*this, node); break;
+        case NodeKind::ASSIGN: visitor->visitAssignStatement(*this, node); break;
+        case NodeKind::EMPTY: visitor->visitEmptyStatement(*this, node); break;
+        case NodeKind::IF: visitor->visitIfStatement(*this, node); break;
+        case NodeKind::WHILE: visitor->visitWhileStatement(*this, node); break;
+        case NodeKind::FOR: visitor->visitForStatement(*this, node); break;
+        case NodeKind::ASSIGN_VAR_OP_CONST: visitor->visitAssignVarOpConst(*this, node); break;
+        case NodeKind::ASSIGN_VAR_OP_VAR: visitor->visitAssignVarOpVar(*this, node); break;
+        case NodeKind::INCREMENT_VAR: visitor->visitIncrementVar(*this, node); break;
+        case NodeKind::CALL_WITH_CONST_ARGS: visitor->visitCallWithConstArgs(*this, node); break;
+        case NodeKind::VAR_DECLARATION: visitor->visitVarDeclaration(*this, node); break;
+        case NodeKind::DECLARATION_ROOT: visitor->visitDeclarationRoot(*this, node); break;
+        case NodeKind::PARAM_DECLARATION: visitor->visitParamDeclaration(*this, node); break;
+        case NodeKind::BLOCK: visitor->visitBlock(*this, node); break;
+        case NodeKind::PROCEDURE: visitor->visitProcedure(*this, node); break;
+        case NodeKind::PROGRAM: visitor->visitProgramNode(*this, node); break;
+        case NodeKind::TYPE: break;
+    }
+}
 
+// Lays a pointer tree out as a FlatAst. Every node is added before its
+// children, and a child list is copied into lists once all of its members
+// have been added, so that it stays contiguous. Lists still being filled
+// wait on the pending stack.
+class FlatAstBuilder: public Visitor {
+    private:
+        FlatAst &ast;
+        int last = -1; // the node added for the subtree visited last
+        std::vector<int32_t> pending;
+        std::vector<BinaryOp*> spine;
+        int flatten(Node *node) {
+            node->accept(this);
+            return last;
+        }
+        template <typename T>
+        void pendList(std::vector<std::unique_ptr<T>> &nodes) {
+            for (auto &node : nodes)
+                pending.push_back(flatten(node.get()));
+        }
+        // moves the members pending since mark to lists and returns their offset
+        int closeList(size_t mark) {
+            int offset = ast.lists.size();
+            ast.lists.insert(ast.lists.end(), pending.begin() + mark, pending.end());
+            pending.resize(mark);
+            return offset;
+        }
+        template <typename T>
+        int flattenList(std::vector<std::unique_ptr<T>> &nodes) {
+            size_t mark = pending.size();
+            pendList(nodes);
+            return closeList(mark);
+        }
+        int begin(Node *node, NodeKind kind) {
+            last = ast.add(kind, node->type);
+            return last;
+        }
+        void end(int index) {
+            ast.ends[index] = ast.size();
+            last = index;
+        }
+        int declaredType(Node *typeNode) {
+            return (int)static_cast<TypeNode*>(typeNode)->type->tokenType;
+        }
+    public:
+        FlatAstBuilder(FlatAst &ast) : ast(ast) {}
+        // returns the index of node's own entry
+        int build(Node *node) {
+            return flatten(node);
+        }
+        void visitNumberNode(NumberNode *node) override {
+            int index = begin(node, NodeKind::NUMBER);
+            ast.tokens[index] = ast.addToken(node->token);
+            ast.payloads[index] = node->value;
+            end(index);
+        }
+        // A left chain is added top down, as preorder wants, so its links
+        // get consecutive indices; each is closed after its right side on
+        // the way back up.
+        void visitBinaryOp(BinaryOp *node) override {
+            size_t mark = spine.size();
+            Node *operand = pushLeftSpine(node, spine);
+            int first = ast.size();
+            for (size_t i = mark; i < spine.size(); ++i) {
+                int index = begin(spine[i], NodeKind::BINARY_OP);
+                ast.tokens[index] = ast.addToken(spine[i]->op);
+                ast.ops[index] = spine[i]->kind;
+            }
+            int left = flatten(operand);
+            while (spine.size() > mark) {
+                int index = first + (spine.size() - mark - 1);
+                ast.a[index] = left;
+                ast.b[index] = flatten(spine.back()->right.get());
+                spine.pop_back();
+                end(index);
+                left = index;
+            }
+        }
+        void visitUnaryOp(UnaryOp *node) override {
+            int index = begin(node, NodeKind::UNARY_OP);
+            ast.tokens[index] = ast.addToken(node->op);
+            ast.ops[index] = node->kind;
+            ast.a[index] = flatten(node->factor.get());
+            end(index);
+        }
+        void visitIntToReal(IntToReal *node) override {
+            int index = begin(node, NodeKind::INT_TO_REAL);
+            ast.a[index] = flatten(node->expr.get());
+            end(index);
+        }
+        void visitVariableNode(VariableNode *node) override {
+            int index = begin(node, NodeKind::VARIABLE);
+            ast.tokens[index] = ast.addToken(node->variableToken);
+            ast.a[index] = node->slot;
+            ast.b[index] = node->level;
+            end(index);
+        }
+        void visitCompoundStatement(CompoundStatement *node) override {
+            int index = begin(node, NodeKind::COMPOUND);
+            ast.a[index] = flattenList(node->statementList);
+            ast.b[index] = node->statementList.size();
+            end(index);
+        }
+        void visitProcedureCall(ProcedureCall *node) override {
+            int index = begin(node, NodeKind::PROCEDURE_CALL);
+            ast.tokens[index] = ast.addToken(node->procedure);
+            ast.a[index] = flattenList(node->args);
+            ast.b[index] = node->args.size();
+            ast.c[index] = ast.addFrame(node->procSymbol);
+            end(index);
+        }
+        void visitAssignStatement(AssignStatement *node) override {
+            int index = begin(node, NodeKind::ASSIGN);
+            ast.tokens[index] = ast.addToken(node->assignment);
+            int variable = flatten(node->left.get());
+            ast.a[index] = variable;
+            ast.b[index] = flatten(node->right.get());
+            end(index);
+        }
+        void visitEmptyStatement(EmptyStatement *node) override {
+            end(begin(node, NodeKind::EMPTY));
+        }
+        void visitIfStatement(IfStatement *node) override {
+            int index = begin(node, NodeKind::IF);
+            ast.tokens[index] = ast.addToken(node->token);
+            int condition = flatten(node->condition.get());
+            ast.a[index] = condition;
+            int thenBranch = flatten(node->thenBranch.get());
+            ast.b[index] = thenBranch;
+            if (node->elseBranch != nullptr)
+                ast.c[index] = flatten(node->elseBranch.get());
+            end(index);
+        }
+        void visitWhileStatement(WhileStatement *node) override {
+            int index = begin(node, NodeKind::WHILE);
+            ast.tokens[index] = ast.addToken(node->token);
+            int condition = flatten(node->condition.get());
+            ast.a[index] = condition;
+            ast.b[index] = flatten(node->body.get());
+            end(index);
+        }
+        void visitForStatement(ForStatement *node) override {
+            int index = begin(node, NodeKind::FOR);
+            ast.tokens[index] = ast.addToken(node->token);
+            size_t mark = pending.size();
+            pending.push_back(flatten(node->variable.get()));
+            pending.push_back(flatten(node->start.get()));
+            pending.push_back(flatten(node->end.get()));
+            pending.push_back(flatten(node->body.get()));
+            ast.a[index] = closeList(mark);
+            ast.c[index] = node->downto;
+            end(index);
+        }
+        void visitAssignVarOpConst(AssignVarOpConst *node) override {
+            int index = begin(node, NodeKind::ASSIGN_VAR_OP_CONST);
+            ast.tokens[index] = ast.addToken(node->op);
+            ast.ops[index] = node->kind;
+            ast.payloads[index] = node->constant;
+            int target = flatten(node->target.get());
+            ast.a[index] = target;
+            ast.b[index] = flatten(node->source.get());
+            end(index);
+        }
+        void visitAssignVarOpVar(AssignVarOpVar *node) override {
+            int index = begin(node, NodeKind::ASSIGN_VAR_OP_VAR);
+            ast.tokens[index] = ast.addToken(node->op);
+            ast.ops[index] = node->kind;
+            int target = flatten(node->target.get());
+            ast.a[index] = target;
+            int left = flatten(node->left.get());
+            ast.b[index] = left;
+            ast.c[index] = flatten(node->right.get());
+            end(index);
+        }
+        void visitIncrementVar(IncrementVar *node) override {
+            int index = begin(node, NodeKind::INCREMENT_VAR);
+            ast.tokens[index] = ast.addToken(node->op);
+            ast.ops[index] = node->kind;
+            ast.payloads[index] = node->delta;
+            ast.a[index] = flatten(node->target.get());
+            end(index);
+        }
+        void visitCallWithConstArgs(CallWithConstArgs *node) override {
+            int index = begin(node, NodeKind::CALL_WITH_CONST_ARGS);
+            ast.tokens[index] = ast.addToken(node->procedure);
+            ast.a[index] = ast.values.size();
+            ast.b[index] = node->args.size();
+            ast.values.insert(ast.values.end(), node->args.begin(), node->args.end());
+            ast.c[index] = ast.addFrame(node->procSymbol);
+            end(index);
+        }
+        void visitVarDeclaration(VarDeclaration *node) override {
+            int index = begin(node, NodeKind::VAR_DECLARATION);
+            ast.payloads[index].i = declaredType(node->typeNode.get());
+            ast.a[index] = flatten(node->varNode.get());
+            end(index);
+        }
+        void visitDeclarationRoot(DeclarationRoot *node) override {
+            int index = begin(node, NodeKind::DECLARATION_ROOT);
+            ast.a[index] = flattenList(node->declarations);
+            ast.b[index] = node->declarations.size();
+            end(index);
+        }
+        void visitParamDeclaration(ParamDeclaration *node) override {
+            int index = begin(node, NodeKind::PARAM_DECLARATION);
+            ast.payloads[index].i = declaredType(node->typeNode.get());
+            ast.a[index] = flatten(node->varNode.get());
+            end(index);
+        }
+        void visitBlock(Block *node) override {
+            int index = begin(node, NodeKind::BLOCK);
+            size_t mark = pending.size();
+            pendList(node->procedures);
+            pendList(node->varDeclarations);
+            pending.push_back(flatten(node->compoundStatement.get()));
+            ast.a[index] = closeList(mark);
+            ast.b[index] = node->procedures.size();
+            ast.c[index] = node->varDeclarations.size();
+            end(index);
+        }
+        void visitProcedure(Procedure *node) override {
+            int index = begin(node, NodeKind::PROCEDURE);
+            ast.tokens[index] = ast.addToken(node->id);
+            ast.payloads[index].i = ast.addFrame(node->procSymbol);
+            int block = flatten(node->block.get());
+            ast.a[index] = block;
+            ast.b[index] = flattenList(node->paramDeclarations);
+            ast.c[index] = node->paramDeclarations.size();
+            end(index);
+        }
+        void visitProgramNode(ProgramNode *node) override {
+            int index = begin(node, NodeKind::PROGRAM);
+            ast.tokens[index] = ast.addToken(node->programName);
+            ast.payloads[index].i = ast.addFrame(node->programSymbol);
+            ast.a[index] = flatten(node->block.get());
+            end(index);
+        }
+};
 
 // --------------------------------------------------------------
 
@@ -757,24 +1911,51 @@ class Lexer {
         int pos;
         int lineno = 1;
         int column = 0;
+        char currentChar;
         void error();
         char peek();
         void advance();
         void skip_comment();
         void skip_whitespace();
-        std::string integer();
-        std::string identifier();
+        void skip_digits();
+        TokenType number();
+        TokenType identifier();
+        std::shared_ptr<MemoryBudget> budget;
     public:
-        char currentChar;
-        Lexer(const std::string& aText);
-        std::shared_ptr<Token> get_next_token();
+        // where the last token scanned starts
+        int tokenStart = 0;
+        int tokenLine = 1;
+        int tokenColumn = 0;
+        Lexer(const std::string& aText, std::shared_ptr<MemoryBudget> budget);
+        Lexer(const std::string& aText, std::shared_ptr<MemoryBudget> budget, int lineno, int column);
+        ~Lexer();
+        TokenType scan();
+        int position() {
+            return pos;
+        }
     
 };
-Lexer::Lexer(const std::string& aText) {
+Lexer::Lexer(const std::string& aText, std::shared_ptr<MemoryBudget> budget) {
+    this->budget = budget;
+    budget->charge(MemoryBudget::Category::LEXER, aText.size());
     text = aText;
     pos = 0;
     currentChar = text[pos];
 }
+// Lexes a piece of a larger source that starts right after the character at
+// the given line and column, so tokens get their positions in the whole text.
+Lexer::Lexer(const std::string& aText, std::shared_ptr<MemoryBudget> budget, int lineno, int column) {
+    this->budget = budget;
+    budget->charge(MemoryBudget::Category::LEXER, aText.size());
+    text = aText;
+    this->lineno = lineno;
+    this->column = column;
+    pos = -1;
+    advance();
+}
+Lexer::~Lexer() {
+    budget->release(MemoryBudget::Category::LEXER, text.size());
+}
 void Lexer::error() {
     std::stringstream ss;
     ss.str("");
@@ -816,27 +1997,32 @@ void Lexer::skip_whitespace() {
         advance();
     }
 }
-std::string Lexer::integer() {
-    std::string result = "";
+void Lexer::skip_digits() {
     while(currentChar - '0' >= 0 && currentChar - '0' <= 9) {
-        // result.append(currentChar);
-        result += currentChar;
         advance();
     }
-    return result;
 }
-std::string Lexer::identifier() {
-    std::string result = "";
-    while (currentChar != '\0' && isalnum(currentChar)) {
-        result += currentChar;
+// INTEGER constant, or REAL constant when a fraction follows
+TokenType Lexer::number() {
+    skip_digits();
+    if (currentChar == '.' && isdigit(peek())) {
         advance();
+        skip_digits();
+        return TokenType::REAL_CONST;
     }
-    return result;
+    return TokenType::INT;
 }
-std::shared_ptr<Token> Lexer::get_next_token() {
-    if (currentChar == '\0') {
-        return std::make_shared<Token>(TokenType::END_OF_FILE, "EOF", lineno, column);
+TokenType Lexer::identifier() {
+    int start = pos;
+    while (currentChar != '\0' && isalnum(currentChar)) {
+        advance();
     }
+    return keywordType(text.data() + start, pos - start);
+}
+// Moves past the next token and returns its type. The token spans
+// [tokenStart, position()) and starts at tokenLine and tokenColumn; no
+// Token is made for it.
+TokenType Lexer::scan() {
     while (currentChar == ' ' || currentChar == '\n' || currentChar == '{') {
         if (currentChar == ' ' || currentChar == '\n') {
             skip_whitespace();
@@ -845,70 +2031,178 @@ std::shared_ptr<Token> Lexer::get_next_token() {
             skip_comment();
         }
     }
-    int tokenLine = lineno;
-    int tokenColumn = column;
+    tokenStart = pos;
+    tokenLine = lineno;
+    tokenColumn = column;
+    // also after trailing whitespace or an unterminated comment
+    if (currentChar == '\0') {
+        return TokenType::END_OF_FILE;
+    }
     if (currentChar - '0' >= 0 && currentChar - '0' <= 9) {
-        return std::make_shared<Token>(TokenType::INT, integer(), tokenLine, tokenColumn);
+        return number();
     }
     else if (isalnum(currentChar)) {
-        std::string id = identifier();
-        std::string lexeme = id;
-        std::transform(lexeme.begin(), lexeme.end(), lexeme.begin(), ::tolower);
-        auto pair = Token::KEYWORDS.find(lexeme);
-        if (pair != Token::KEYWORDS.end()) {
-            return std::make_shared<Token>(pair->second, pair->first, tokenLine, tokenColumn);
-        }
-        return std::make_shared<Token>(TokenType::VARIABLE, id, tokenLine, tokenColumn);
-    }
-    switch (currentChar) { 
-        case '+': 
-            advance();
-            return std::make_shared<Token>(TokenType::ADD, "+", tokenLine, tokenColumn);
-        case '-':
-            advance();
-            return std::make_shared<Token>(TokenType::SUB, "-", tokenLine, tokenColumn);
-        case '*':
-            advance();
-            return std::make_shared<Token>(TokenType::MUL, "*", tokenLine, tokenColumn);
-        case '/':
-            advance();
-            return std::make_shared<Token>(TokenType::DIV, "/", tokenLine, tokenColumn);
-        case '(':
-            advance();
-            return std::make_shared<Token>(TokenType::LPAREN, "(", tokenLine, tokenColumn);
-        case ')':
-            advance();
-            return std::make_shared<Token>(TokenType::RPAREN, ")", tokenLine, tokenColumn);
-        case ':':
-            if (peek() == '=') {
-                advance();
-                advance();
-                return std::make_shared<Token>(TokenType::ASSIGN, ":=", tokenLine, tokenColumn);  
-            } 
-            advance();
-            return std::make_shared<Token>(TokenType::COLON, ":", tokenLine, tokenColumn);
-        case ',':
-            advance();
-            return std::make_shared<Token>(TokenType::COMMA, ",", tokenLine, tokenColumn);
-        case '.':
-            advance();
-            return std::make_shared<Token>(TokenType::DOT, ".", tokenLine, tokenColumn);
-        case ';':
-            advance();
-            return std::make_shared<Token>(TokenType::SEMI, ";", tokenLine, tokenColumn);
-    }
-
-    // std::string errormsg = "Invalid token ";
+        return identifier();
+    }
+    int length = 0;
+    TokenType type = symbolToken(currentChar, peek(), length);
+    for (int i = 0; i < length; ++i) {
+        advance();
+    }
+    if (length > 0) {
+        return type;
+    }
     error();
-    return nullptr;
+    return TokenType::END_OF_FILE;
 }
 
 // -------------------------------------------------------------------------
 
+// The tokens of a source, lexed in one pass before it is parsed. Each
+// property has its own array, so lookahead and searches by offset only walk
+// the data they compare. A Token object is only made for a token the parser
+// asks for, from the text the buffer was lexed from, which has to outlive
+// it.
+class TokenBuffer {
+    private:
+        template <typename T>
+        using Column = std::vector<T, BudgetAllocator<T>>;
+        template <typename T>
+        static void splice(Column<T>& column, int first, int last, const Column<T>& fresh);
+        std::shared_ptr<MemoryBudget> budget;
+        const std::string *text = nullptr;
+        mutable Column<std::shared_ptr<Token>> made; // null until asked for
+    public:
+        Column<TokenType> types;
+        Column<int> starts; // offsets in the text
+        Column<int> lengths;
+        Column<int> lines;
+        Column<int> columns;
+        // a lexer error right after the last token; the parser raises it
+        // when it gets there
+        std::string lexerError;
+
+        TokenBuffer(const std::string& text, std::shared_ptr<MemoryBudget> budget);
+        int size() const {
+            return types.size();
+        }
+        int end(int i) const {
+            return starts[i] + lengths[i];
+        }
+        // the Token that the tree keeps for token i
+        const std::shared_ptr<Token>& token(int i) const;
+        // token i if a Token was made for it, otherwise null
+        Token *madeToken(int i) const {
+            return made[i].get();
+        }
+        void push(TokenType type, int start, int end, int line, int column);
+        void lex();
+        void replace(int first, int last, const TokenBuffer& fresh);
+};
+TokenBuffer::TokenBuffer(const std::string& text, std::shared_ptr<MemoryBudget> budget)
+: budget(budget), text(&text),
+    made(BudgetAllocator<std::shared_ptr<Token>>(budget, MemoryBudget::Category::LEXER)),
+    types(BudgetAllocator<TokenType>(budget, MemoryBudget::Category::LEXER)),
+    starts(BudgetAllocator<int>(budget, MemoryBudget::Category::LEXER)),
+    lengths(BudgetAllocator<int>(budget, MemoryBudget::Category::LEXER)),
+    lines(BudgetAllocator<int>(budget, MemoryBudget::Category::LEXER)),
+    columns(BudgetAllocator<int>(budget, MemoryBudget::Category::LEXER)) {}
+// tokens are charged to the run's memory budget for as long as they live
+const std::shared_ptr<Token>& TokenBuffer::token(int i) const {
+    if (made[i] == nullptr) {
+        made[i] = std::allocate_shared<Token>(
+            BudgetAllocator<Token>(budget, MemoryBudget::Category::LEXER),
+            types[i], Token::valueOf(types[i], *text, starts[i], end(i)), lines[i], columns[i]);
+    }
+    return made[i];
+}
+void TokenBuffer::push(TokenType type, int start, int end, int line, int column) {
+    types.push_back(type);
+    starts.push_back(start);
+    lengths.push_back(end - start);
+    lines.push_back(line);
+    columns.push_back(column);
+    made.push_back(nullptr);
+}
+void TokenBuffer::lex() {
+    Lexer lexer(*text, budget);
+    // sources run at about four characters a token
+    int expected = text->size() / 4 + 1;
+    types.reserve(expected);
+    starts.reserve(expected);
+    lengths.reserve(expected);
+    lines.reserve(expected);
+    columns.reserve(expected);
+    made.reserve(expected);
+    try {
+        while (true) {
+            TokenType type = lexer.scan();
+            push(type, lexer.tokenStart, lexer.position(), lexer.tokenLine, lexer.tokenColumn);
+            if (type == TokenType::END_OF_FILE)
+                break;
+        }
+    } catch (const LexerError& e) {
+        lexerError = e.what();
+    }
+}
+template <typename T>
+void TokenBuffer::splice(Column<T>& column, int first, int last, const Column<T>& fresh) {
+    // overwrite what can be overwritten so that the tail only moves when
+    // the number of tokens changed
+    size_t replaced = std::min<size_t>(fresh.size(), last - first);
+    std::copy(fresh.begin(), fresh.begin() + replaced, column.begin() + first);
+    if (replaced < fresh.size())
+        column.insert(column.begin() + last, fresh.begin() + replaced, fresh.end());
+    else
+        column.erase(column.begin() + first + replaced, column.begin() + last);
+}
+// puts the tokens of fresh in place of those in [first, last)
+void TokenBuffer::replace(int first, int last, const TokenBuffer& fresh) {
+    splice(types, first, last, fresh.types);
+    splice(starts, first, last, fresh.starts);
+    splice(lengths, first, last, fresh.lengths);
+    splice(lines, first, last, fresh.lines);
+    splice(columns, first, last, fresh.columns);
+    splice(made, first, last, fresh.made);
+}
+
+// Lets an incremental re-parse take top-level procedures over from the
+// previous tree. reuse() is asked first at each top-level PROCEDURE token
+// and returns null (leaving count alone) when the procedure has to be
+// parsed; parsed() then sees every freshly parsed one and returns the node
+// to keep.
+class ReusableProcedures {
+    public:
+        virtual ~ReusableProcedures() {};
+        virtual std::unique_ptr<Node> reuse(int first, int &count) = 0;
+        virtual std::unique_ptr<Node> parsed(std::unique_ptr<Node> procedure, int first, int count) = 0;
+};
+
 class Parser {
     private:
-        std::unique_ptr<Lexer> lexer;
-        std::shared_ptr<Token> currentToken;
+        // the buffer lexed from the source, unless one was handed in
+        std::unique_ptr<TokenBuffer> lexed;
+        const TokenBuffer *tokens;
+        int tokenIndex = 0;
+        ReusableProcedures *reusable = nullptr;
+        int procedureDepth = 0;
+        int nesting = 0;
+        // enters one more level of nesting, failing past MAX_NESTING
+        void nest() {
+            if (++nesting > MAX_NESTING)
+                throw ParserError(ErrorCode::NESTING_TOO_DEEP, currentToken());
+        }
+        const std::shared_ptr<Token>& currentToken() {
+            return tokens->token(tokenIndex);
+        }
+        void advance();
+        // the type of the token k places after the current one
+        TokenType lookahead(int k = 0) {
+            int index = tokenIndex + k;
+            if (index >= tokens->size())
+                return TokenType::END_OF_FILE;
+            return tokens->types[index];
+        }
         void error(TokenType expected, std::shared_ptr<Token> got);
         void eat(TokenType aTokenType);
         std::unique_ptr<Node> program(); 
@@ -922,31 +2216,67 @@ class Parser {
         std::vector<std::unique_ptr<Node>> varList();
         std::unique_ptr<Node> compoundStatement();
         std::vector<std::unique_ptr<Node>> statementList(std::vector<std::unique_ptr<Node>> &list);
+        std::unique_ptr<Node> statement();
+        std::unique_ptr<Node> ifStatement();
+        std::unique_ptr<Node> whileStatement();
+        std::unique_ptr<Node> forStatement();
         std::unique_ptr<Node> assignStatement();
         std::unique_ptr<Node> procedureCall();
         std::vector<std::unique_ptr<Node>> argList(std::vector<std::unique_ptr<Node>> &list);
         std::unique_ptr<Node> emptyStatement();
         std::unique_ptr<Node> factor();
         std::unique_ptr<Node> term();
+        std::unique_ptr<Node> simpleExpr();
         std::unique_ptr<Node> expr();
+        std::shared_ptr<MemoryBudget> budget;
+        // AST nodes are charged to the memory budget when they are created
+        template <typename T, typename... Args>
+        std::unique_ptr<T> makeNode(Args&&... args) {
+            budget->charge(MemoryBudget::Category::PARSER, sizeof(T));
+            return std::make_unique<T>(std::forward<Args>(args)...);
+        }
     public:
-        Parser(const std::string& aText);
+        // The deepest nesting of procedures, statements, parentheses and
+        // unary operators accepted. Parsing and the passes over the tree
+        // recurse once per level, so this bounds their native stack. The
+        // left side of a chain like 1+1+...+1 does not count: every pass
+        // walks it in a loop.
+        static const int MAX_NESTING = 1000;
+        Parser(const std::string& aText, std::shared_ptr<MemoryBudget> budget);
+        Parser(const TokenBuffer& tokens, std::shared_ptr<MemoryBudget> budget,
+            ReusableProcedures *reusable = nullptr);
         ~Parser();
         void print_tokens();
         std::unique_ptr<Node> parse();
 };
-Parser::Parser(const std::string& aText) {
-    lexer = std::make_unique<Lexer>(aText);
-    currentToken = lexer->get_next_token();
+Parser::Parser(const std::string& aText, std::shared_ptr<MemoryBudget> budget) {
+    this->budget = budget;
+    lexed = std::make_unique<TokenBuffer>(aText, budget);
+    lexed->lex();
+    if (lexed->size() == 0)
+        throw LexerError(lexed->lexerError);
+    tokens = lexed.get();
+}
+Parser::Parser(const TokenBuffer& tokens, std::shared_ptr<MemoryBudget> budget,
+    ReusableProcedures *reusable) {
+    this->budget = budget;
+    this->tokens = &tokens;
+    this->reusable = reusable;
 }
 Parser::~Parser() {}
+void Parser::advance() {
+    if (tokenIndex + 1 < tokens->size())
+        ++tokenIndex;
+    else if (!tokens->lexerError.empty())
+        throw LexerError(tokens->lexerError);
+}
 void Parser::print_tokens() {
-    while(currentToken != nullptr) {
-        currentToken->print();
-        if (currentToken->tokenType == TokenType::END_OF_FILE) {
+    while(true) {
+        currentToken()->print();
+        if (lookahead() == TokenType::END_OF_FILE) {
             break;
         }
-        currentToken = std::shared_ptr<Token>(lexer->get_next_token());
+        advance();
     }
 }
 // only called by eat()
@@ -954,11 +2284,11 @@ void Parser::error(TokenType expected, std::shared_ptr<Token> got) {
     throw ParserError(expected, got);
 }
 void Parser::eat(TokenType aTokenType) {
-    if (currentToken->tokenType != aTokenType) {
-        std::string errormsg = "expected token \'" +tokenType_tostring(aTokenType)+ "\', got \'" +tokenType_tostring(currentToken->tokenType)+ "\' token";
-        error(aTokenType, currentToken);
+    if (lookahead() != aTokenType) {
+        std::string errormsg = "expected token \'" +tokenType_tostring(aTokenType)+ "\', got \'" +tokenType_tostring(lookahead())+ "\' token";
+        error(aTokenType, currentToken());
     }
-    currentToken = lexer->get_next_token();
+    advance();
 }
 std::unique_ptr<Node> Parser::program() {
     eat(TokenType::PROGRAM);
@@ -966,61 +2296,59 @@ std::unique_ptr<Node> Parser::program() {
     eat(TokenType::SEMI);
     std::unique_ptr<Node> blockNode = block();
     eat(TokenType::DOT);
-    std::unique_ptr<Node> root = std::make_unique<ProgramNode>(name, std::move(blockNode));
+    std::unique_ptr<Node> root = makeNode<ProgramNode>(name, std::move(blockNode));
     return root;
 }
 std::shared_ptr<Token> Parser::program_name() {
-    std::shared_ptr<Token> name = currentToken;
+    std::shared_ptr<Token> name = currentToken();
     eat(TokenType::VARIABLE);
     return name;
 }
 // PROCEDURE VARIABLE (LPAREN PARAM_LIST RPAREN)? SEMI BLOCK SEMI;
 std::unique_ptr<Node> Parser::procedure() {
     eat(TokenType::PROCEDURE);
-    std::shared_ptr<Token> name = currentToken;
+    std::shared_ptr<Token> name = currentToken();
     eat(TokenType::VARIABLE);
 
     std::vector<std::unique_ptr<Node>> paramDeclarations;
 
-    if (currentToken->tokenType == TokenType::LPAREN) {
+    if (lookahead() == TokenType::LPAREN) {
         eat(TokenType::LPAREN);
         paramDeclarations = paramList();
         eat(TokenType::RPAREN);
     }
 
     eat(TokenType::SEMI);
+    ++procedureDepth;
+    nest();
     std::unique_ptr<Node> blockNode = block();
+    --nesting;
+    --procedureDepth;
     eat(TokenType::SEMI);
-    return std::make_unique<Procedure>(
+    return makeNode<Procedure>(
         name, std::move(blockNode), std::move(paramDeclarations));
 }
 // paramDecLine (SEMI paramDecLine)*
 // parse through all param arguments between LPAREN and RPAREN
 std::vector<std::unique_ptr<Node>> Parser::paramList() {
     std::vector<std::unique_ptr<Node>> list;
-    
-    std::vector<std::unique_ptr<Node>> lineDecList = paramDecLine();
-    list.insert(list.end(), 
-        std::make_move_iterator(lineDecList.begin()), 
-        std::make_move_iterator(lineDecList.end()));
-
-    if (currentToken->tokenType == TokenType::SEMI) {
-        eat(TokenType::SEMI);
-        std::vector<std::unique_ptr<Node>> nextList = paramList();
+    while (true) {
+        std::vector<std::unique_ptr<Node>> lineDecList = paramDecLine();
         list.insert(list.end(),
-            std::make_move_iterator(nextList.begin()),
-            std::make_move_iterator(nextList.end())
-        );
+            std::make_move_iterator(lineDecList.begin()),
+            std::make_move_iterator(lineDecList.end()));
+        if (lookahead() != TokenType::SEMI)
+            return list;
+        eat(TokenType::SEMI);
     }
-    return list;
 }
 // variable (COMMA variable)* COLON type
 std::vector<std::unique_ptr<Node>> Parser::paramDecLine() {
     std::vector<std::unique_ptr<Node>> varsUsing = varList();
     eat(TokenType::COLON);
 
-    TokenType decType = currentToken->tokenType;
-    switch (currentToken->tokenType) {
+    TokenType decType = lookahead();
+    switch (lookahead()) {
         case TokenType::REAL:
             eat(TokenType::REAL);
             break;
@@ -1030,26 +2358,40 @@ std::vector<std::unique_ptr<Node>> Parser::paramDecLine() {
     std::vector<std::unique_ptr<Node>> decList;
     for (auto &var : varsUsing) {
         std::unique_ptr<Node> paramDec = 
-            std::make_unique<ParamDeclaration>(std::move(var), decType);
+            makeNode<ParamDeclaration>(std::move(var), decType);
         decList.push_back(std::move(paramDec));
     }
     return decList;
 }
 std::unique_ptr<Node> Parser::block() {
     std::vector<std::unique_ptr<Node>> declarations;
-    if (currentToken->tokenType == TokenType::VAR) {
+    if (lookahead() == TokenType::VAR) {
         eat(TokenType::VAR);
         declarations = declarationList();
     }
     std::vector<std::unique_ptr<Node>> procedures = procedureList();
     std::unique_ptr<Node> statementRoot = compoundStatement();
 
-    return std::make_unique<Block>(std::move(statementRoot), 
+    return makeNode<Block>(std::move(statementRoot), 
         std::move(procedures), std::move(declarations));
 }
 std::vector<std::unique_ptr<Node>> Parser::procedureList() {
     std::vector<std::unique_ptr<Node>> list;
-    while(currentToken->tokenType == TokenType::PROCEDURE) {
+    while(lookahead() == TokenType::PROCEDURE) {
+        if (reusable != nullptr && procedureDepth == 0) {
+            int first = tokenIndex;
+            int count = 0;
+            std::unique_ptr<Node> proc = reusable->reuse(first, count);
+            if (proc != nullptr) {
+                tokenIndex += count;
+            }
+            else {
+                proc = procedure();
+                proc = reusable->parsed(std::move(proc), first, tokenIndex - first);
+            }
+            list.push_back(std::move(proc));
+            continue;
+        }
         std::unique_ptr<Node> proc = procedure();
         list.push_back(std::move(proc));
     }
@@ -1058,11 +2400,11 @@ std::vector<std::unique_ptr<Node>> Parser::procedureList() {
 std::vector<std::unique_ptr<Node>> Parser::declarationList() {
     std::vector<std::unique_ptr<Node>> list;
 
-    while(currentToken->tokenType == TokenType::VARIABLE) {
+    while(lookahead() == TokenType::VARIABLE) {
         std::vector<std::unique_ptr<Node>> varListResult = varList();
         eat(TokenType::COLON);
-        std::shared_ptr<Token> typeToken = currentToken;
-        if (currentToken->tokenType == TokenType::INTEGER) {
+        std::shared_ptr<Token> typeToken = currentToken();
+        if (lookahead() == TokenType::INTEGER) {
             eat(TokenType::INTEGER);
         }
         else {
@@ -1071,7 +2413,7 @@ std::vector<std::unique_ptr<Node>> Parser::declarationList() {
         eat(TokenType::SEMI);
 
         for (auto &varNode : varListResult) {
-            std::unique_ptr<VarDeclaration> varDecNode = std::make_unique<VarDeclaration>(std::move(varNode), typeToken->tokenType);
+            std::unique_ptr<VarDeclaration> varDecNode = makeNode<VarDeclaration>(std::move(varNode), typeToken->tokenType);
             list.push_back(std::move(varDecNode));
         }
     }
@@ -1081,134 +2423,213 @@ std::vector<std::unique_ptr<Node>> Parser::declarationList() {
 // list of variable nodes
 std::vector<std::unique_ptr<Node>> Parser::varList() {
     std::vector<std::unique_ptr<Node>> list;
-    list.push_back(std::make_unique<VariableNode>(currentToken));
+    list.push_back(makeNode<VariableNode>(currentToken()));
     eat(TokenType::VARIABLE);
     
-    while(currentToken->tokenType == TokenType::COMMA) {
+    while(lookahead() == TokenType::COMMA) {
         eat(TokenType::COMMA);
-        list.push_back(std::make_unique<VariableNode>(currentToken));
+        list.push_back(makeNode<VariableNode>(currentToken()));
         eat(TokenType::VARIABLE);
     }
     return list;
 }
 std::unique_ptr<Node> Parser::compoundStatement() {
+    nest();
     eat(TokenType::BEGIN);
     std::vector<std::unique_ptr<Node>> list;
     list = std::move(statementList(list));
     eat(TokenType::END);
+    --nesting;
 
-    return std::make_unique<CompoundStatement>(std::move(list));
+    return makeNode<CompoundStatement>(std::move(list));
 }
 std::vector<std::unique_ptr<Node>> Parser::statementList(std::vector<std::unique_ptr<Node>> &list) {
-    if (currentToken->tokenType == TokenType::END_OF_FILE) {
-        return std::move(list);
-    }
-    if (currentToken->tokenType == TokenType::END) {
-        std::unique_ptr<Node>statement = std::unique_ptr<Node>(emptyStatement());
-        list.push_back(std::move(statement));
-        return std::move(list);
-    }
-    else if (currentToken->tokenType == TokenType::BEGIN) {
-        list.push_back(std::unique_ptr<Node>(compoundStatement()));
-        eat(TokenType::SEMI);
-        return statementList(list);
-    }
+    while (true) {
+        if (lookahead() == TokenType::END_OF_FILE) {
+            return std::move(list);
+        }
+        if (lookahead() == TokenType::END) {
+            std::unique_ptr<Node>statement = std::unique_ptr<Node>(emptyStatement());
+            list.push_back(std::move(statement));
+            return std::move(list);
+        }
+        else if (lookahead() == TokenType::BEGIN) {
+            list.push_back(std::unique_ptr<Node>(compoundStatement()));
+            eat(TokenType::SEMI);
+            continue;
+        }
 
-    // normal circumstance
-    std::unique_ptr<Node> statement;
-    if (currentToken->tokenType == TokenType::VARIABLE && lexer->currentChar == '(') {
-        statement = procedureCall();
-    } else {
-        statement = assignStatement();
+        // normal circumstance
+        list.push_back(statement());
+        if (lookahead() == TokenType::SEMI) {
+            eat(TokenType::SEMI);
+        }
     }
-    list.push_back(std::move(statement));
-    if (currentToken->tokenType == TokenType::SEMI) {
-        eat(TokenType::SEMI);
+}
+// a single statement, as used in the body of IF, WHILE and FOR
+std::unique_ptr<Node> Parser::statement() {
+    switch (lookahead()) {
+        case TokenType::BEGIN:
+            return compoundStatement();
+        case TokenType::IF:
+            return ifStatement();
+        case TokenType::WHILE:
+            return whileStatement();
+        case TokenType::FOR:
+            return forStatement();
+        case TokenType::SEMI:
+        case TokenType::END:
+            return emptyStatement();
+        // only an IF can be followed by ELSE, and it checks for one itself
+        case TokenType::ELSE:
+            throw ParserError(ErrorCode::UNEXPECTED_TOKEN, currentToken());
+        default:
+            if (lookahead(1) == TokenType::LPAREN)
+                return procedureCall();
+            return assignStatement();
     }
-    return statementList(list);
+}
+// IF expr THEN statement (ELSE statement)?
+std::unique_ptr<Node> Parser::ifStatement() {
+    std::shared_ptr<Token> token = currentToken();
+    nest();
+    eat(TokenType::IF);
+    std::unique_ptr<Node> condition = expr();
+    eat(TokenType::THEN);
+    // IF c THEN ELSE s leaves the THEN branch empty
+    std::unique_ptr<Node> thenBranch = lookahead() == TokenType::ELSE ? emptyStatement() : statement();
+    std::unique_ptr<Node> elseBranch;
+    if (lookahead() == TokenType::ELSE) {
+        eat(TokenType::ELSE);
+        elseBranch = statement();
+    }
+    --nesting;
+    return makeNode<IfStatement>(token, std::move(condition),
+        std::move(thenBranch), std::move(elseBranch));
+}
+// WHILE expr DO statement
+std::unique_ptr<Node> Parser::whileStatement() {
+    std::shared_ptr<Token> token = currentToken();
+    nest();
+    eat(TokenType::WHILE);
+    std::unique_ptr<Node> condition = expr();
+    eat(TokenType::DO);
+    std::unique_ptr<Node> body = statement();
+    --nesting;
+    return makeNode<WhileStatement>(token, std::move(condition), std::move(body));
+}
+// FOR variable ASSIGN expr (TO | DOWNTO) expr DO statement
+std::unique_ptr<Node> Parser::forStatement() {
+    std::shared_ptr<Token> token = currentToken();
+    eat(TokenType::FOR);
+    std::unique_ptr<Node> variable = makeNode<VariableNode>(currentToken());
+    eat(TokenType::VARIABLE);
+    eat(TokenType::ASSIGN);
+    std::unique_ptr<Node> start = expr();
+    bool downto = lookahead() == TokenType::DOWNTO;
+    if (downto)
+        eat(TokenType::DOWNTO);
+    else
+        eat(TokenType::TO);
+    std::unique_ptr<Node> end = expr();
+    eat(TokenType::DO);
+    nest();
+    std::unique_ptr<Node> body = statement();
+    --nesting;
+    return makeNode<ForStatement>(token, std::move(variable),
+        std::move(start), std::move(end), downto, std::move(body));
 }
 std::unique_ptr<Node> Parser::assignStatement() {
-    std::shared_ptr<Token> variable = currentToken;
+    std::shared_ptr<Token> variable = currentToken();
     eat(TokenType::VARIABLE);
-    std::unique_ptr<Node> variableNode = std::make_unique<VariableNode>(variable);
+    std::unique_ptr<Node> variableNode = makeNode<VariableNode>(variable);
 
-    std::shared_ptr<Token> assign = currentToken;
+    std::shared_ptr<Token> assign = currentToken();
     eat(TokenType::ASSIGN);
 
     std::unique_ptr<Node> right = expr();
-    std::unique_ptr<Node> newNode = std::make_unique<AssignStatement>(std::move(variableNode), assign, std::move(right));
+    std::unique_ptr<Node> newNode = makeNode<AssignStatement>(std::move(variableNode), assign, std::move(right));
     return newNode;
 }
 
 // name LPAREN expr (COMMA expr)* RPAREN
 std::unique_ptr<Node> Parser::procedureCall() {
-    std::shared_ptr<Token> proc = currentToken;
+    std::shared_ptr<Token> proc = currentToken();
     eat(TokenType::VARIABLE);
     eat(TokenType::LPAREN);
 
     std::vector<std::unique_ptr<Node>> args;
-    if (currentToken->tokenType != TokenType::RPAREN)
+    if (lookahead() != TokenType::RPAREN)
         args = argList(args);
 
     eat(TokenType::RPAREN);
 
-    std::unique_ptr<Node> node = std::make_unique<ProcedureCall>(proc, std::move(args));
+    std::unique_ptr<Node> node = makeNode<ProcedureCall>(proc, std::move(args));
 
     return node;
 }
 
 // expr (, expr)*
 std::vector<std::unique_ptr<Node>> Parser::argList(std::vector<std::unique_ptr<Node>> &list) {
-    std::unique_ptr<Node> express = expr();
-
-    list.push_back(std::move(express));
-
-    if (currentToken->tokenType == TokenType::COMMA) {
+    list.push_back(expr());
+    while (lookahead() == TokenType::COMMA) {
         eat(TokenType::COMMA);
-        list = argList(list);
+        list.push_back(expr());
     }
     return std::move(list);
 }
 std::unique_ptr<Node> Parser::emptyStatement() {
-    return std::make_unique<EmptyStatement>();
+    return makeNode<EmptyStatement>();
 }
 std::unique_ptr<Node> Parser::factor() {
-    std::shared_ptr<Token> current = currentToken;
+    std::shared_ptr<Token> current = currentToken();
     // regular number node
     if (current->tokenType == TokenType::INT) {
         eat(TokenType::INT);
-        return std::make_unique<NumberNode>(current); // passing raw pointer into NumberNode constructor, creating a new shared_ptr
+        return makeNode<NumberNode>(current); // passing raw pointer into NumberNode constructor, creating a new shared_ptr
+    }
+    if (current->tokenType == TokenType::REAL_CONST) {
+        eat(TokenType::REAL_CONST);
+        return makeNode<NumberNode>(current);
     }
     // case of a variable
     if (current->tokenType == TokenType::VARIABLE) {
         eat(TokenType::VARIABLE);
-        return std::make_unique<VariableNode>(current);
+        return makeNode<VariableNode>(current);
     }
     // check for unary operator
-    if (current->tokenType == TokenType::ADD || current->tokenType == TokenType::SUB) {
+    if (current->tokenType == TokenType::ADD || current->tokenType == TokenType::SUB
+        || current->tokenType == TokenType::NOT) {
         switch (current->tokenType) {
             case TokenType::ADD: eat(TokenType::ADD); break;
             case TokenType::SUB: eat(TokenType::SUB); break;
+            default: eat(TokenType::NOT); break;
         }
+        nest();
         std::unique_ptr<Node> factorNode = factor();
-        std::unique_ptr<Node> unaryOp = std::make_unique<UnaryOp>(current, std::move(factorNode));
+        --nesting;
+        std::unique_ptr<Node> unaryOp = makeNode<UnaryOp>(current, std::move(factorNode));
         return unaryOp;
     }
     // check for an expression
     if (current->tokenType == TokenType::LPAREN) {
+        nest();
         eat(TokenType::LPAREN);
         std::unique_ptr<Node> exprRoot = expr();
         eat(TokenType::RPAREN);
+        --nesting;
         return exprRoot;
     }
-    return nullptr;
+    // e.g. a missing operand, as in 'a := 1 - ;'
+    throw ParserError(ErrorCode::UNEXPECTED_TOKEN, current);
 }
 std::unique_ptr<Node> Parser::term() {
     std::unique_ptr<Node> root = factor();
-    while(currentToken->tokenType == TokenType::MUL ||
-    currentToken->tokenType == TokenType::DIV ||
-    currentToken->tokenType == TokenType::INT_DIV) {
-        std::shared_ptr<Token> op = currentToken;
+    while(lookahead() == TokenType::MUL ||
+    lookahead() == TokenType::DIV ||
+    lookahead() == TokenType::INT_DIV ||
+    lookahead() == TokenType::AND) {
+        std::shared_ptr<Token> op = currentToken();
         switch (op->tokenType) {
             case TokenType::MUL:
                 eat(TokenType::MUL);
@@ -1216,54 +2637,218 @@ std::unique_ptr<Node> Parser::term() {
             case TokenType::DIV:
                 eat(TokenType::DIV);
                 break;
+            case TokenType::AND:
+                eat(TokenType::AND);
+                break;
             default:
                 eat(TokenType::INT_DIV);
                 break;
         }
         std::unique_ptr<Node> right = factor();
-        std::unique_ptr<Node> opNode = std::make_unique<BinaryOp>(op, std::move(root), std::move(right));
+        std::unique_ptr<Node> opNode = makeNode<BinaryOp>(op, std::move(root), std::move(right));
         root = std::move(opNode);
     }
     return root;
 }
-std::unique_ptr<Node> Parser::expr() {
+std::unique_ptr<Node> Parser::simpleExpr() {
     std::unique_ptr<Node> root = term();
-    while(currentToken->tokenType == TokenType::ADD ||
-    currentToken->tokenType == TokenType::SUB) {
-        std::shared_ptr<Token> op = currentToken;
+    while(lookahead() == TokenType::ADD ||
+    lookahead() == TokenType::SUB ||
+    lookahead() == TokenType::OR) {
+        std::shared_ptr<Token> op = currentToken();
         switch(op->tokenType) {
             case TokenType::ADD:
                 eat(TokenType::ADD);
                 break;
+            case TokenType::OR:
+                eat(TokenType::OR);
+                break;
             default:
                 eat(TokenType::SUB);
                 break;
         }
         std::unique_ptr<Node> right = term();
-        std::unique_ptr<Node> opNode = std::make_unique<BinaryOp>(op, std::move(root), std::move(right));
+        std::unique_ptr<Node> opNode = makeNode<BinaryOp>(op, std::move(root), std::move(right));
         root = std::move(opNode);
     }
     return root;
 } 
-std::unique_ptr<Node> Parser::parse() {
-    return program();
+// simpleExpr (relational operator simpleExpr)?
+std::unique_ptr<Node> Parser::expr() {
+    std::unique_ptr<Node> root = simpleExpr();
+    switch (lookahead()) {
+        case TokenType::EQ:
+        case TokenType::NEQ:
+        case TokenType::LT:
+        case TokenType::LE:
+        case TokenType::GT:
+        case TokenType::GE: {
+            std::shared_ptr<Token> op = currentToken();
+            eat(op->tokenType);
+            std::unique_ptr<Node> right = simpleExpr();
+            root = makeNode<BinaryOp>(op, std::move(root), std::move(right));
+            break;
+        }
+        default:
+            break;
+    }
+    return root;
+}
+std::unique_ptr<Node> Parser::parse() {
+    std::unique_ptr<Node> root = program();
+    // the tree keeps the tokens it refers to alive on its own
+    if (lexed != nullptr) {
+        tokens = nullptr;
+        lexed.reset();
+    }
+    return root;
 }
 
 // ------------------------------------------------------------------------
 
-class SemanticAnalyzer: public Visitor {
+// Collects what is printed to std::cout while it is alive. The text is
+// passed on to the previous stream when it ends, so nothing is lost if an
+// error unwinds through it.
+class OutputCapture {
+    private:
+        std::stringstream buffer;
+        std::streambuf *previous;
+    public:
+        OutputCapture() {
+            previous = std::cout.rdbuf(buffer.rdbuf());
+        }
+        ~OutputCapture() {
+            std::cout.rdbuf(previous);
+            std::cout << buffer.str();
+        }
+        std::string text() {
+            return buffer.str();
+        }
+};
+
+// Throws away what is printed to std::cout while it is alive.
+class OutputSilencer {
+    private:
+        class NullBuffer: public std::streambuf {
+            protected:
+                int overflow(int c) override {
+                    return c;
+                }
+                std::streamsize xsputn(const char *data, std::streamsize count) override {
+                    return count;
+                }
+        };
+        NullBuffer null;
+        std::streambuf *previous;
+    public:
+        OutputSilencer() {
+            previous = std::cout.rdbuf(&null);
+        }
+        ~OutputSilencer() {
+            std::cout.rdbuf(previous);
+        }
+};
+
+// What printing, analysing and optimizing one top-level procedure produced.
+// An IncrementalSession keeps it with the procedure's subtree, so an
+// unchanged procedure is replayed instead of processed again.
+struct ProcedureRecord {
+    bool analysed = false;
+    std::string printed;
+    std::string analysis;
+    // the procedure symbols it defined, nested ones included, in order
+    std::vector<std::shared_ptr<ProcedureSymbol>> symbols;
+    int numHoisted = 0;
+    int numAssignVarOpConst = 0;
+    int numAssignVarOpVar = 0;
+    int numIncrementVar = 0;
+    int numCallWithConstArgs = 0;
+};
+
+struct AnalysisCache {
+    // the top-level procedures of the tree being analysed
+    std::unordered_map<Procedure*, ProcedureRecord*> records;
+    // Procedure symbols of the previous analysis by name. A procedure that
+    // is analysed again keeps its symbol, so calls to it from reused
+    // procedures stay valid.
+    std::unordered_map<std::string, std::shared_ptr<ProcedureSymbol>> symbols;
+};
+
+class SemanticAnalyzer final: public StaticVisitor<SemanticAnalyzer> {
     private:
         std::shared_ptr<SymbolTable> symTable;
         std::shared_ptr<SymbolTable> currentScope;
         std::shared_ptr<SymbolTable> builtinsScope;
+        std::shared_ptr<FrameSymbol> currentFrame;
+        std::shared_ptr<MemoryBudget> budget;
+        AnalysisCache *cache = nullptr;
+        bool printScopes = true;
+        std::vector<std::shared_ptr<ProcedureSymbol>> definedProcedures;
+        std::vector<BinaryOp*> spine;
+
+        // symbols are charged to the run's memory budget
+        template <typename T, typename... Args>
+        std::shared_ptr<T> makeSymbol(Args&&... args) {
+            return std::allocate_shared<T>(
+                BudgetAllocator<T>(budget, MemoryBudget::Category::SYMBOL_TABLE),
+                std::forward<Args>(args)...);
+        }
+
+        // gives the variable a slot in the frame that is currently declared
+        void allocateSlot(std::shared_ptr<VarSymbol> varSymbol) {
+            varSymbol->slot = currentFrame->frameSize();
+            varSymbol->level = currentScope->level;
+            currentFrame->frameVars.push_back(varSymbol);
+        }
+
+        // a procedure that is analysed again keeps the symbol it had before
+        std::shared_ptr<ProcedureSymbol> procedureSymbol(const std::string& name, Block *block) {
+            if (cache != nullptr) {
+                auto it = cache->symbols.find(name);
+                if (it != cache->symbols.end()) {
+                    std::shared_ptr<ProcedureSymbol> procSym = it->second;
+                    procSym->block = block;
+                    procSym->frameVars.clear();
+                    procSym->formalParams.clear();
+                    return procSym;
+                }
+            }
+            return makeSymbol<ProcedureSymbol>(name, block);
+        }
+
+        // wraps an INTEGER expression in an implicit conversion to REAL
+        void coerceToReal(std::unique_ptr<Node> &expr) {
+            if (expr->type == Symbol::Type::INTEGER)
+                expr = std::make_unique<IntToReal>(std::move(expr));
+        }
+
+        // an INTEGER value may be stored into a REAL, but not the reverse
+        void checkAssignable(Symbol::Type target, std::unique_ptr<Node> &expr,
+            std::shared_ptr<Token> token) {
+            if (target == Symbol::Type::REAL && expr->type == Symbol::Type::INTEGER)
+                coerceToReal(expr);
+            else if (expr->type != target)
+                throw SemanticError(token, ErrorCode::TYPE_MISMATCH);
+        }
 
     public:
-        SemanticAnalyzer() {
-            builtinsScope = std::make_shared<SymbolTable>(0, "builtins");
-            symTable = std::make_shared<SymbolTable>(1, "global", builtinsScope);
+        SemanticAnalyzer(std::shared_ptr<MemoryBudget> budget) : budget(budget) {
+            builtinsScope = std::make_shared<SymbolTable>(0, "builtins", budget);
+            symTable = std::make_shared<SymbolTable>(1, "global", budget, builtinsScope);
             currentScope = symTable;
         };
 
+        // top-level procedures with an analysed record are replayed from it,
+        // the others fill in their record
+        void useCache(AnalysisCache *cache) {
+            this->cache = cache;
+        }
+
+        // leaves out the scope tables that are printed as each scope closes
+        void quiet() {
+            printScopes = false;
+        }
+
         // Should only be called by interpreter
         // Should be called when this visitor end of life
         std::shared_ptr<SymbolTable> transferSymTable() {
@@ -1276,47 +2861,160 @@ class SemanticAnalyzer: public Visitor {
 
         void visitVariableNode(VariableNode *node) override {
             std::string name = node->name;
-            SymbolTable *curr = currentScope.get();
-            if (currentScope->lookup(name) == nullptr) {
+            std::shared_ptr<VarSymbol> varSymbol =
+                std::dynamic_pointer_cast<VarSymbol>(currentScope->lookup(name));
+            if (varSymbol == nullptr) {
                 throw SemanticError(node->variableToken, ErrorCode::UNDECLARED_ID);
             }
+            node->slot = varSymbol->slot;
+            node->level = varSymbol->level;
+            node->type = varSymbol->valueType;
         }
 
         void visitUnaryOp(UnaryOp *node) override {
-            node->factor->accept(this);
+            dispatch(node->factor.get());
+            node->type = node->factor->type;
+            bool boolean = node->type == Symbol::Type::BOOLEAN;
+            if (boolean != (node->op->tokenType == TokenType::NOT))
+                throw SemanticError(node->op, ErrorCode::TYPE_MISMATCH);
+
+            if (boolean)
+                node->kind = OpKind::BOOL_NOT;
+            else if (node->op->tokenType == TokenType::ADD)
+                node->kind = OpKind::IDENTITY;
+            else if (node->type == Symbol::Type::REAL)
+                node->kind = OpKind::REAL_NEG;
+            else
+                node->kind = OpKind::INT_NEG;
         }
 
         void visitBinaryOp(BinaryOp *node) override {
-            node->left->accept(this);
-            node->right->accept(this);
+            size_t mark = spine.size();
+            dispatch(pushLeftSpine(node, spine));
+            while (spine.size() > mark) {
+                BinaryOp *link = spine.back();
+                spine.pop_back();
+                dispatch(link->right.get());
+                checkBinaryOp(link);
+            }
+        }
+        // '/' always yields a REAL, 'div' only takes INTEGERs and the other
+        // operators are REAL as soon as one operand is. Relational operators
+        // compare two numbers and 'and' / 'or' combine two BOOLEANs.
+        void checkBinaryOp(BinaryOp *node) {
+            TokenType op = node->op->tokenType;
+            bool leftBool = node->left->type == Symbol::Type::BOOLEAN;
+            bool rightBool = node->right->type == Symbol::Type::BOOLEAN;
+            if (op == TokenType::AND || op == TokenType::OR) {
+                if (!leftBool || !rightBool)
+                    throw SemanticError(node->op, ErrorCode::TYPE_MISMATCH);
+                node->type = Symbol::Type::BOOLEAN;
+                node->kind = op == TokenType::AND ? OpKind::BOOL_AND : OpKind::BOOL_OR;
+                return;
+            }
+            if (leftBool || rightBool)
+                throw SemanticError(node->op, ErrorCode::TYPE_MISMATCH);
+
+            bool real = node->left->type == Symbol::Type::REAL
+                || node->right->type == Symbol::Type::REAL
+                || op == TokenType::DIV;
+            if (real && op == TokenType::INT_DIV)
+                throw SemanticError(node->op, ErrorCode::TYPE_MISMATCH);
+
+            if (real) {
+                coerceToReal(node->left);
+                coerceToReal(node->right);
+                node->type = Symbol::Type::REAL;
+            }
+            else {
+                node->type = Symbol::Type::INTEGER;
+            }
+            switch (op) {
+                case TokenType::ADD: node->kind = real ? OpKind::REAL_ADD : OpKind::INT_ADD; break;
+                case TokenType::SUB: node->kind = real ? OpKind::REAL_SUB : OpKind::INT_SUB; break;
+                case TokenType::MUL: node->kind = real ? OpKind::REAL_MUL : OpKind::INT_MUL; break;
+                case TokenType::DIV: node->kind = OpKind::REAL_DIV; break;
+                case TokenType::INT_DIV: node->kind = OpKind::INT_DIV; break;
+                case TokenType::EQ: node->kind = real ? OpKind::REAL_EQ : OpKind::INT_EQ; break;
+                case TokenType::NEQ: node->kind = real ? OpKind::REAL_NEQ : OpKind::INT_NEQ; break;
+                case TokenType::LT: node->kind = real ? OpKind::REAL_LT : OpKind::INT_LT; break;
+                case TokenType::LE: node->kind = real ? OpKind::REAL_LE : OpKind::INT_LE; break;
+                case TokenType::GT: node->kind = real ? OpKind::REAL_GT : OpKind::INT_GT; break;
+                default: node->kind = real ? OpKind::REAL_GE : OpKind::INT_GE; break;
+            }
+            switch (op) {
+                case TokenType::EQ:
+                case TokenType::NEQ:
+                case TokenType::LT:
+                case TokenType::LE:
+                case TokenType::GT:
+                case TokenType::GE:
+                    node->type = Symbol::Type::BOOLEAN;
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        void checkCondition(std::unique_ptr<Node> &condition, std::shared_ptr<Token> token) {
+            dispatch(condition.get());
+            if (condition->type != Symbol::Type::BOOLEAN)
+                throw SemanticError(token, ErrorCode::TYPE_MISMATCH);
+        }
+
+        void visitIfStatement(IfStatement *node) override {
+            checkCondition(node->condition, node->token);
+            dispatch(node->thenBranch.get());
+            if (node->elseBranch != nullptr)
+                dispatch(node->elseBranch.get());
+        }
+
+        void visitWhileStatement(WhileStatement *node) override {
+            checkCondition(node->condition, node->token);
+            dispatch(node->body.get());
+        }
+
+        void visitForStatement(ForStatement *node) override {
+            dispatch(node->variable.get());
+            if (node->variable->type != Symbol::Type::INTEGER)
+                throw SemanticError(node->token, ErrorCode::TYPE_MISMATCH);
+            dispatch(node->start.get());
+            checkAssignable(Symbol::Type::INTEGER, node->start, node->token);
+            dispatch(node->end.get());
+            checkAssignable(Symbol::Type::INTEGER, node->end, node->token);
+            dispatch(node->body.get());
         }
 
         void visitAssignStatement(AssignStatement *node) override {
-            node->right->accept(this);
-            node->left->accept(this);
+            dispatch(node->right.get());
+            dispatch(node->left.get());
+            checkAssignable(node->left->type, node->right, node->assignment);
         }
 
         void visitCompoundStatement(CompoundStatement *node) override {
             for (auto &child : node->statementList) {
-                child->accept(this);
+                dispatch(child.get());
             }
         }
 
         void visitVarDeclaration(VarDeclaration *node) override {
-            VariableNode *varNode = dynamic_cast<VariableNode*>(node->varNode.get());
+            VariableNode *varNode = node_cast<VariableNode>(node->varNode.get());
             std::shared_ptr<Token> varToken = varNode->variableToken;
             const std::string varName = varNode->name;
             if (currentScope->lookup(varNode->name, true)) {
                 throw SemanticError(varToken, ErrorCode::DUPLICATE_ID);
             }
 
-            TypeNode *typeNode = dynamic_cast<TypeNode*>(node->typeNode.get());
+            TypeNode *typeNode = node_cast<TypeNode>(node->typeNode.get());
             const std::string typeName = tokenType_tostring(typeNode->type->tokenType);
 
 
             std::shared_ptr<Symbol> typeSym = currentScope->lookup(typeName);
-            std::shared_ptr<VarSymbol> varSymbol = std::make_shared<VarSymbol>(varNode->name, typeSym);
+            std::shared_ptr<VarSymbol> varSymbol = makeSymbol<VarSymbol>(varNode->name, typeSym);
             currentScope->define(varSymbol);
+            allocateSlot(varSymbol);
+            varNode->slot = varSymbol->slot;
+            varNode->level = varSymbol->level;
         }
 
         // void visitDeclarationRoot(DeclarationRoot *node) override {
@@ -1337,6 +3035,35 @@ class SemanticAnalyzer: public Visitor {
          4. create var symbols for parameters
          */
         void visitProcedure(Procedure *node) {
+            ProcedureRecord *record = nullptr;
+            if (cache != nullptr && currentScope == symTable) {
+                auto it = cache->records.find(node);
+                if (it != cache->records.end())
+                    record = it->second;
+            }
+            if (record == nullptr) {
+                analyseProcedure(node);
+            }
+            else if (record->analysed) {
+                for (auto &procSym : record->symbols) {
+                    symTable->define(procSym);
+                    definedProcedures.push_back(procSym);
+                }
+                std::cout << record->analysis;
+            }
+            else {
+                size_t first = definedProcedures.size();
+                {
+                    OutputCapture capture;
+                    analyseProcedure(node);
+                    record->analysis = capture.text();
+                }
+                record->symbols.assign(definedProcedures.begin() + first, definedProcedures.end());
+                record->analysed = true;
+            }
+        }
+
+        void analyseProcedure(Procedure *node) {
             // check if not already declared
             const std::string procedureName = node->id->value;
             std::shared_ptr<Token> procedureToken = node->id;
@@ -1345,23 +3072,26 @@ class SemanticAnalyzer: public Visitor {
             } else {
                 // add new symbol to symbol table
                 // scope is 1 less than children
-                Block *block = dynamic_cast<Block*>(node->block.get());
-                std::shared_ptr<ProcedureSymbol> procSym = std::make_shared<ProcedureSymbol>(
-                    procedureName, block
-                );
+                Block *block = node_cast<Block>(node->block.get());
+                std::shared_ptr<ProcedureSymbol> procSym = procedureSymbol(procedureName, block);
                 symTable->define(procSym);
+                definedProcedures.push_back(procSym);
+                node->procSymbol = procSym;
 
                 // increment the scope and change current scope
-                currentScope = std::make_shared<SymbolTable>(currentScope->level + 1, procedureName, currentScope);
+                currentScope = std::make_shared<SymbolTable>(currentScope->level + 1, procedureName, budget, currentScope);
+                std::shared_ptr<FrameSymbol> enclosingFrame = currentFrame;
+                currentFrame = procSym;
+                procSym->level = currentScope->level;
 
                 for (auto &param : node->paramDeclarations) {
-                    param->accept(this);
+                    dispatch(param.get());
 
-                    ParamDeclaration* paramDec = dynamic_cast<ParamDeclaration*>(param.get());
+                    ParamDeclaration* paramDec = node_cast<ParamDeclaration>(param.get());
 
 
                     // check if param declared already in (a, b, c) param list
-                    VariableNode* varNode = dynamic_cast<VariableNode*>(paramDec->varNode.get());
+                    VariableNode* varNode = node_cast<VariableNode>(paramDec->varNode.get());
                     std::shared_ptr<Token> varToken = varNode->variableToken;
 
                     const std::string name = varNode->name;
@@ -1370,19 +3100,24 @@ class SemanticAnalyzer: public Visitor {
                     }
 
                     // get type node and type string and symbol
-                    TypeNode* typeNode = dynamic_cast<TypeNode*>(paramDec->typeNode.get());
+                    TypeNode* typeNode = node_cast<TypeNode>(paramDec->typeNode.get());
                     const std::string typeName = tokenType_tostring(typeNode->type->tokenType);
 
                     // create new param symbol and add to things
-                    std::shared_ptr<Symbol> paramSym = std::make_shared<VarSymbol>(name, symTable->lookup(typeName));
+                    std::shared_ptr<VarSymbol> paramSym = makeSymbol<VarSymbol>(name, symTable->lookup(typeName));
                     currentScope->define(paramSym);
+                    allocateSlot(paramSym);
+                    varNode->slot = paramSym->slot;
+                    varNode->level = paramSym->level;
                     procSym->formalParams.push_back(paramSym);
                 }
-                node->block->accept(this);
-                currentScope->print();
+                dispatch(node->block.get());
+                if (printScopes)
+                    currentScope->print();
 
                 // decrement the scope
                 currentScope = currentScope->enclosingScope;
+                currentFrame = enclosingFrame;
             }
         }
 
@@ -1405,194 +3140,1284 @@ class SemanticAnalyzer: public Visitor {
                 throw SemanticError(node->procedure, 
                     ErrorCode::PROCEDURE_ARGUMENT_MISMATCH);
             
-            for (auto &arg : node->args) {
-                arg->accept(this);
+            for (int i = 0; i < node->args.size(); i++) {
+                dispatch(node->args[i].get());
+                checkAssignable(procSymCasted->formalParams[i]->valueType,
+                    node->args[i], node->procedure);
             }
         }
 
         void visitBlock(Block *node) override {
             for (auto &varDeclaration : node->varDeclarations) {
-                varDeclaration->accept(this);
+                dispatch(varDeclaration.get());
             }
             for (auto &procedure : node->procedures) {
-                procedure->accept(this);
+                dispatch(procedure.get());
             }
-            node->compoundStatement->accept(this);
+            dispatch(node->compoundStatement.get());
         }
 
         void visitProgramNode(ProgramNode *node) override {
             const std::string name = node->programName->value;
-            std::shared_ptr<ProgramSymbol> sym = std::make_shared<ProgramSymbol>(name);
+            std::shared_ptr<ProgramSymbol> sym = makeSymbol<ProgramSymbol>(name);
             builtinsScope->define(sym);
-            node->block->accept(this);
-            currentScope->print();
+            sym->level = symTable->level;
+            node->programSymbol = sym;
+            currentFrame = sym;
+            dispatch(node->block.get());
+            if (printScopes)
+                currentScope->print();
         }
 };
 
 // ------------------------------------------------------------------------
 
-class EvalVisitor: public Visitor {
+// Hook policies for the EvalVisitor. The evaluator calls its policy at
+// every statement, call, return and variable write; the calls are resolved
+// at compile time, so with NoHooks they compile to nothing.
+struct NoHooks {
+    void onStatement(Node *statement) {}
+    void onCall(FrameSymbol *frame) {}
+    void onReturn(FrameSymbol *frame) {}
+    void onAssign(VariableNode *target, const Value &value) {}
+    // the run is stopping with an error; report() still follows
+    void onError() {}
+    void report(std::ostream &out) {}
+};
+
+// the token a statement starts at, for reports; null for ones without
+Token *statementToken(Node *statement) {
+    switch (statement->nodeKind) {
+        case NodeKind::ASSIGN: return node_cast<AssignStatement>(statement)->assignment.get();
+        case NodeKind::IF: return node_cast<IfStatement>(statement)->token.get();
+        case NodeKind::WHILE: return node_cast<WhileStatement>(statement)->token.get();
+        case NodeKind::FOR: return node_cast<ForStatement>(statement)->token.get();
+        case NodeKind::PROCEDURE_CALL: return node_cast<ProcedureCall>(statement)->procedure.get();
+        case NodeKind::CALL_WITH_CONST_ARGS: return node_cast<CallWithConstArgs>(statement)->procedure.get();
+        case NodeKind::ASSIGN_VAR_OP_CONST: return node_cast<AssignVarOpConst>(statement)->op.get();
+        case NodeKind::ASSIGN_VAR_OP_VAR: return node_cast<AssignVarOpVar>(statement)->op.get();
+        case NodeKind::INCREMENT_VAR: return node_cast<IncrementVar>(statement)->op.get();
+        default: return nullptr;
+    }
+}
+
+// the line a statement starts on, for reports
+int statementLine(Node *statement) {
+    Token *token = statementToken(statement);
+    return token != nullptr ? token->lineno : 0;
+}
+
+// Writes every call, return and variable write to stderr, indented by
+// call depth.
+class TraceHooks: public NoHooks {
+    private:
+        int depth = 0;
+        void indent() {
+            std::cerr << "[trace] ";
+            for (int i = 0; i < depth; ++i)
+                std::cerr << "  ";
+        }
+    public:
+        void onCall(FrameSymbol *frame) {
+            indent();
+            std::cerr << "call " << frame->name << "\n";
+            ++depth;
+        }
+        void onReturn(FrameSymbol *frame) {
+            --depth;
+            indent();
+            std::cerr << "return " << frame->name << "\n";
+        }
+        void onAssign(VariableNode *target, const Value &value) {
+            indent();
+            std::cerr << target->name << " := ";
+            if (target->type == Symbol::Type::REAL)
+                std::cerr << value.r << "\n";
+            else
+                std::cerr << value.i << "\n";
+        }
+};
+
+// Counts the calls and statements of each procedure and times its calls,
+// callees included.
+class ProfileHooks: public NoHooks {
+    private:
+        struct Entry {
+            FrameSymbol *frame;
+            long long calls = 0;
+            long long statements = 0;
+            std::chrono::steady_clock::duration time{};
+        };
+        std::vector<Entry> entries; // in order of first call
+        std::unordered_map<FrameSymbol*, int> index;
+        // the active calls, innermost last
+        std::vector<std::pair<int, std::chrono::steady_clock::time_point>> active;
+    public:
+        void onStatement(Node *statement) {
+            if (!active.empty())
+                ++entries[active.back().first].statements;
+        }
+        void onCall(FrameSymbol *frame) {
+            auto it = index.find(frame);
+            if (it == index.end()) {
+                it = index.emplace(frame, entries.size()).first;
+                entries.push_back(Entry{frame});
+            }
+            ++entries[it->second].calls;
+            active.push_back({it->second, std::chrono::steady_clock::now()});
+        }
+        void onReturn(FrameSymbol *frame) {
+            auto call = active.back();
+            active.pop_back();
+            entries[call.first].time += std::chrono::steady_clock::now() - call.second;
+        }
+        void report(std::ostream &out) {
+            out << "Profile:\n";
+            for (Entry &entry : entries) {
+                double ms = std::chrono::duration<double, std::milli>(entry.time).count();
+                out << "  " << entry.frame->name << ": " << entry.calls << " call(s), "
+                    << entry.statements << " statement(s), " << ms << " ms\n";
+            }
+        }
+};
+
+// Counts how often each statement runs and reports it by source line.
+class CoverageHooks: public NoHooks {
+    private:
+        std::unordered_map<Node*, long long> hits;
+    public:
+        void onStatement(Node *statement) {
+            ++hits[statement];
+        }
+        void report(std::ostream &out) {
+            std::map<int, long long> lines;
+            for (auto &hit : hits)
+                lines[statementLine(hit.first)] += hit.second;
+            out << "Coverage: " << hits.size() << " statement(s) on "
+                << lines.size() << " line(s) executed\n";
+            for (auto &line : lines)
+                out << "  line " << line.first << ": " << line.second << "\n";
+        }
+};
+
+// One fixed-size record of a TraceRing. Positions are the line and column
+// of a token, which --read-trace looks up in the program's source again.
+struct TraceEvent {
+    enum Kind : uint8_t { STATEMENT, CALL, RETURN, ASSIGN };
+    uint8_t kind;
+    uint8_t type;    // the Symbol::Type of an assigned value
+    uint16_t level;  // of an assigned variable
+    uint32_t slot;   // of an assigned variable; the call depth of a CALL or RETURN
+    uint32_t line;
+    uint32_t column;
+    uint64_t value;  // the bits of an assigned value
+};
+
+// The last events of one thread's run, overwritten oldest first. Only the
+// owning thread writes, so recording an event is a store into the array
+// and a release store of the count, with no lock or read-modify-write.
+// Rings are registered once and never freed, so a signal handler can dump
+// every ring at any time without allocating. A ring that is being written
+// while it is dumped may show its newest events torn.
+//
+// Dump, little-endian: "PASTRACE", u8 version, u32 ring count, and per
+// ring u64 events recorded, u32 events kept, then the kept events oldest
+// first, each u8 kind, u8 type, u16 level, u32 slot, u32 line, u32 column
+// and u64 value.
+class TraceRing {
+    public:
+        static constexpr int MAX_RINGS = 64;
+        static constexpr size_t EVENT_SIZE = 24;
+    private:
+        static std::atomic<TraceRing*> rings[MAX_RINGS];
+        static std::atomic<int> numRings;
+        static size_t capacity;
+        static char dumpPath[4096];
+
+        std::unique_ptr<TraceEvent[]> events;
+        size_t mask;
+        std::atomic<uint64_t> recorded{0};
+
+        explicit TraceRing(size_t capacity) : events(new TraceEvent[capacity]), mask(capacity - 1) {}
+
+        static void encode(const TraceEvent &event, unsigned char *out) {
+            auto put = [&](uint64_t value, int bytes) {
+                for (int i = 0; i < bytes; ++i)
+                    *out++ = (unsigned char)(value >> (8 * i));
+            };
+            put(event.kind, 1);
+            put(event.type, 1);
+            put(event.level, 2);
+            put(event.slot, 4);
+            put(event.line, 4);
+            put(event.column, 4);
+            put(event.value, 8);
+        }
+        static void handleSignal(int signal) {
+            dump();
+            if (signal != SIGUSR1) {
+                std::signal(signal, SIG_DFL);
+                std::raise(signal);
+            }
+        }
+    public:
+        static constexpr char MAGIC[8] = {'P', 'A', 'S', 'T', 'R', 'A', 'C', 'E'};
+        static constexpr uint8_t VERSION = 1;
+
+        // Where dump() writes and how many events each ring keeps, rounded
+        // up to a power of two. Set before the first ring is made.
+        static void configure(const std::string &path, size_t events) {
+            std::snprintf(dumpPath, sizeof(dumpPath), "%s", path.c_str());
+            capacity = 1;
+            while (capacity < std::max(events, (size_t)1))
+                capacity <<= 1;
+        }
+        static const char *path() {
+            return dumpPath;
+        }
+
+        // the calling thread's ring, made on first use; null once
+        // MAX_RINGS threads have one
+        static TraceRing *forThisThread() {
+            thread_local TraceRing *ring = nullptr;
+            thread_local bool made = false;
+            if (!made) {
+                made = true;
+                int index = numRings.fetch_add(1);
+                if (index < MAX_RINGS) {
+                    ring = new TraceRing(capacity);
+                    rings[index].store(ring, std::memory_order_release);
+                }
+            }
+            return ring;
+        }
+
+        void record(const TraceEvent &event) {
+            uint64_t count = recorded.load(std::memory_order_relaxed);
+            events[count & mask] = event;
+            recorded.store(count + 1, std::memory_order_release);
+        }
+        uint64_t size() const {
+            return recorded.load(std::memory_order_relaxed);
+        }
+
+        // Writes every ring to the dump path with open() and write() only,
+        // so it is safe in a signal handler. Returns false if the file
+        // could not be written.
+        static bool dump() {
+#if defined(__unix__) || defined(__APPLE__)
+            int fd = open(dumpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+                return false;
+            unsigned char buffer[4096];
+            size_t used = 0;
+            bool ok = true;
+            auto flush = [&]() {
+                size_t done = 0;
+                while (ok && done < used) {
+                    ssize_t n = write(fd, buffer + done, used - done);
+                    if (n < 0)
+                        ok = false;
+                    else
+                        done += n;
+                }
+                used = 0;
+            };
+            auto put = [&](uint64_t value, int bytes) {
+                if (used + bytes > sizeof(buffer))
+                    flush();
+                for (int i = 0; i < bytes; ++i)
+                    buffer[used++] = (unsigned char)(value >> (8 * i));
+            };
+            for (char c : MAGIC)
+                put((unsigned char)c, 1);
+            put(VERSION, 1);
+            int count = std::min(numRings.load(), MAX_RINGS);
+            const TraceRing *found[MAX_RINGS];
+            int numFound = 0;
+            for (int i = 0; i < count; ++i) {
+                const TraceRing *ring = rings[i].load(std::memory_order_acquire);
+                if (ring != nullptr)
+                    found[numFound++] = ring;
+            }
+            put(numFound, 4);
+            for (int i = 0; i < numFound; ++i) {
+                const TraceRing *ring = found[i];
+                uint64_t recorded = ring->recorded.load(std::memory_order_acquire);
+                uint64_t kept = std::min<uint64_t>(recorded, ring->mask + 1);
+                put(recorded, 8);
+                put(kept, 4);
+                for (uint64_t k = recorded - kept; k < recorded; ++k) {
+                    if (used + EVENT_SIZE > sizeof(buffer))
+                        flush();
+                    encode(ring->events[k & ring->mask], buffer + used);
+                    used += EVENT_SIZE;
+                }
+            }
+            flush();
+            return close(fd) == 0 && ok;
+#else
+            return false;
+#endif
+        }
+
+        // dumps the rings on SIGINT and SIGTERM before the default action,
+        // and on SIGUSR1 without stopping
+        static void dumpOnSignals() {
+            std::signal(SIGINT, handleSignal);
+            std::signal(SIGTERM, handleSignal);
+#ifdef SIGUSR1
+            std::signal(SIGUSR1, handleSignal);
+#endif
+        }
+};
+std::atomic<TraceRing*> TraceRing::rings[TraceRing::MAX_RINGS];
+std::atomic<int> TraceRing::numRings{0};
+size_t TraceRing::capacity = 1 << 16;
+char TraceRing::dumpPath[4096] = "pascal.trace";
+constexpr char TraceRing::MAGIC[8];
+
+// Records every statement, call, return and variable write in the calling
+// thread's TraceRing and dumps the rings if the run stops with an error.
+// A call is placed at the statement that made it.
+class RingTraceHooks: public NoHooks {
+    private:
+        TraceRing *ring = TraceRing::forThisThread();
+        uint32_t line = 0;
+        uint32_t column = 0;
+        // where the active calls were made, innermost last
+        std::vector<std::pair<uint32_t, uint32_t>> callSites;
+        bool dumped = false;
+
+        void record(uint8_t kind, uint32_t slot) {
+            if (ring != nullptr)
+                ring->record({kind, 0, 0, slot, line, column, 0});
+        }
+    public:
+        void onStatement(Node *statement) {
+            Token *token = statementToken(statement);
+            line = token != nullptr ? token->lineno : 0;
+            column = token != nullptr ? token->column : 0;
+            record(TraceEvent::STATEMENT, 0);
+        }
+        void onCall(FrameSymbol *frame) {
+            callSites.push_back({line, column});
+            record(TraceEvent::CALL, callSites.size() - 1);
+        }
+        void onReturn(FrameSymbol *frame) {
+            line = callSites.back().first;
+            column = callSites.back().second;
+            callSites.pop_back();
+            record(TraceEvent::RETURN, callSites.size());
+        }
+        void onAssign(VariableNode *target, const Value &value) {
+            if (ring == nullptr)
+                return;
+            uint64_t bits = 0;
+            std::memcpy(&bits, &value, sizeof(value));
+            const Token *token = target->variableToken.get();
+            ring->record({TraceEvent::ASSIGN, (uint8_t)target->type, (uint16_t)target->level,
+                (uint32_t)target->slot, (uint32_t)token->lineno, (uint32_t)token->column, bits});
+        }
+        void onError() {
+            dumped = TraceRing::dump();
+        }
+        void report(std::ostream &out) {
+            out << "Trace: " << (ring != nullptr ? ring->size() : 0) << " event(s) recorded";
+            if (dumped)
+                out << ", written to " << TraceRing::path();
+            out << "\n";
+        }
+};
+
+// A fixed set of threads, each with its own deque of tasks. Tasks are
+// handed out round robin. A worker runs the newest task of its own deque
+// and, once that is empty, steals the oldest task of another worker's, so
+// a few long calls on one worker do not hold up the ones queued behind
+// them. The thread that submits the tasks can help() with them while it
+// waits.
+class WorkStealingPool {
+    public:
+        using Task = std::function<void(int worker)>;
+    private:
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+        std::vector<std::unique_ptr<Queue>> queues;
+        std::vector<std::thread> threads;
+        std::mutex sleepMutex;
+        std::condition_variable wake;
+        std::atomic<int> queued{0};
+        bool stopping = false;
+        int next = 0;
+
+        bool popOwn(int worker, Task &task) {
+            Queue &queue = *queues[worker];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty())
+                return false;
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            --queued;
+            return true;
+        }
+        // takes the oldest task of any queue, starting after first
+        bool steal(int first, Task &task) {
+            int n = queues.size();
+            for (int i = 0; i < n; ++i) {
+                Queue &queue = *queues[(first + i) % n];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.tasks.empty())
+                    continue;
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+                --queued;
+                return true;
+            }
+            return false;
+        }
+        void loop(int worker) {
+            Task task;
+            for (;;) {
+                if (popOwn(worker, task) || steal(worker + 1, task)) {
+                    task(worker);
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(sleepMutex);
+                wake.wait(lock, [&]() { return stopping || queued > 0; });
+                if (stopping && queued == 0)
+                    return;
+            }
+        }
+    public:
+        WorkStealingPool(int numThreads) {
+            for (int i = 0; i < numThreads; ++i)
+                queues.push_back(std::make_unique<Queue>());
+            for (int i = 0; i < numThreads; ++i)
+                threads.emplace_back(&WorkStealingPool::loop, this, i);
+        }
+        ~WorkStealingPool() {
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (std::thread &thread : threads)
+                thread.join();
+        }
+
+        int size() const {
+            return threads.size();
+        }
+
+        void submit(Task task) {
+            Queue &queue = *queues[next++ % queues.size()];
+            {
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                queue.tasks.push_back(std::move(task));
+            }
+            ++queued;
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+            }
+            wake.notify_one();
+        }
+
+        // Runs one queued task on the calling thread, which passes the
+        // worker index its task should see. False if nothing was queued.
+        bool help(int worker) {
+            Task task;
+            if (!steal(0, task))
+                return false;
+            task(worker);
+            return true;
+        }
+};
+
+// A call statement handed to a worker, with its arguments evaluated by
+// the thread that issued it. What the call prints and the records it pops
+// are kept here until every statement before it has been printed.
+struct ParallelCall {
+    ProcedureSymbol *procSymbol;
+    std::vector<Value> args;
+    std::ostringstream output;
+    std::unique_ptr<ExecutionState> records;
+    long long stepsBefore; // done by the issuing thread
+    std::exception_ptr error;
+    bool done = false; // guarded by the issuing thread's mutex
+};
+
+// Results of calls to pure procedures, keyed by the procedure and the bits
+// of its arguments. A result is the records the call popped, with depths
+// relative to the call, so a hit can print them again at any depth. At
+// most maxEntries results are kept, the least recently used going first;
+// a call that pops more than MAX_ENTRY_VALUES slots worth of records is
+// not kept at all.
+class MemoCache {
+    public:
+        static constexpr size_t MAX_ENTRY_VALUES = 1 << 16;
+        struct Result {
+            std::vector<ExecutionState::Record> records;
+            std::vector<Value, BudgetAllocator<Value>> values;
+            int maxDepth = 0; // of the deepest record
+        };
+    private:
+        struct Key {
+            ProcedureSymbol *procedure;
+            std::vector<uint64_t> args;
+            bool operator==(const Key &other) const {
+                return procedure == other.procedure && args == other.args;
+            }
+        };
+        struct KeyHash {
+            size_t operator()(const Key &key) const {
+                size_t seed = std::hash<ProcedureSymbol*>()(key.procedure);
+                for (uint64_t arg : key.args)
+                    seed ^= std::hash<uint64_t>()(arg) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+                return seed;
+            }
+        };
+        using Entry = std::pair<Key, Result>;
+        std::shared_ptr<MemoryBudget> budget;
+        size_t maxEntries;
+        std::list<Entry> entries; // most recently used first
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+
+        static Key key(ProcedureSymbol *procedure, const Value *args, int numArgs) {
+            Key key{procedure, std::vector<uint64_t>(numArgs)};
+            for (int i = 0; i < numArgs; ++i)
+                std::memcpy(&key.args[i], &args[i], sizeof(Value));
+            return key;
+        }
+    public:
+        long long hits = 0, misses = 0, evictions = 0, tooLarge = 0;
+        int numPure = 0;
+
+        MemoCache(std::shared_ptr<MemoryBudget> budget, size_t maxEntries)
+        : budget(budget), maxEntries(maxEntries) {}
+
+        const Result* find(ProcedureSymbol *procedure, const Value *args, int numArgs) {
+            auto found = index.find(key(procedure, args, numArgs));
+            if (found == index.end())
+                return nullptr;
+            entries.splice(entries.begin(), entries, found->second);
+            return &found->second->second;
+        }
+        // keeps the records logged from first on for a call at depth
+        void insert(ProcedureSymbol *procedure, const Value *args, int numArgs,
+            const ExecutionState &log, size_t first, int depth) {
+            if (log.overflowed || log.values.size() - log.records[first].offset > MAX_ENTRY_VALUES) {
+                ++tooLarge;
+                return;
+            }
+            Result result{{}, std::vector<Value, BudgetAllocator<Value>>(
+                BudgetAllocator<Value>(budget, MemoryBudget::Category::CALL_STACK)), 0};
+            int base = log.records[first].offset;
+            for (size_t i = first; i < log.records.size(); ++i) {
+                const ExecutionState::Record &record = log.records[i];
+                result.records.push_back({record.frame, record.depth - depth, record.offset - base});
+                result.maxDepth = std::max(result.maxDepth, record.depth - depth);
+            }
+            result.values.assign(log.values.begin() + base, log.values.end());
+            Key newKey = key(procedure, args, numArgs);
+            if (index.count(newKey))
+                return;
+            entries.emplace_front(newKey, std::move(result));
+            index[newKey] = entries.begin();
+            while (entries.size() > maxEntries) {
+                index.erase(entries.back().first);
+                entries.pop_back();
+                ++evictions;
+            }
+        }
+        void report(std::ostream &out) {
+            long long calls = hits + misses;
+            out << "Memo: " << numPure << " pure procedure(s), " << hits << " hit(s), "
+                << misses << " miss(es)";
+            if (calls > 0)
+                out << " (" << (100.0 * hits / calls) << "% hits)";
+            out << ", " << entries.size() << " entries, " << evictions << " evicted, "
+                << tooLarge << " too large to keep\n";
+        }
+};
+
+template <typename Hooks = NoHooks>
+class EvalVisitor final: public StaticVisitor<EvalVisitor<Hooks>> {
     private:
-        std::unordered_map<Node*, int> nodeValues;
-        std::unordered_map<std::string, int> varValues;
-        std::unique_ptr<CallStack> callStack = std::make_unique<CallStack>();
+        std::unordered_map<Node*, Value> nodeValues;
+        std::vector<BinaryOp*> spine;
+        std::unique_ptr<CallStack> callStack;
+        ExecutionBudget limits;
+        std::shared_ptr<MemoryBudget> budget;
+        ExecutionState *state;
+        // with --threads: the pool, and an evaluator for each of its
+        // workers plus one for this thread to help with
+        WorkStealingPool *pool = nullptr;
+        std::vector<std::unique_ptr<EvalVisitor>> helpers;
+        std::mutex callsMutex;
+        std::condition_variable callDone;
+        // with --memo: the cache, and the records popped since the
+        // outermost call being recorded for it started
+        MemoCache *memo = nullptr;
+        ExecutionState memoLog;
+        int numRecording = 0;
+        // the program's variables before it starts, or nullptr for zeros
+        const Value *initialGlobals = nullptr;
+
+        void runParallel(CompoundStatement *node);
+        void runCall(ParallelCall &call, const EvalVisitor &caller);
 
         void error(const std::string& msg) {
             std::string errormsg = "EvalVisitor error: ";
             throw std::runtime_error(errormsg +msg+ "\n");
         }
     public:
-        EvalVisitor() {};
-        std::unordered_map<std::string, int> getVarValues() {
-            return varValues;
+        Hooks hooks;
+        EvalVisitor(std::shared_ptr<MemoryBudget> budget,
+            const ExecutionLimits& executionLimits = ExecutionLimits(), ExecutionState *state = nullptr)
+        : callStack(std::make_unique<CallStack>(budget)), limits(executionLimits, callStack.get()),
+            budget(budget), state(state), memoLog(budget) {
+            callStack->recordInto(state);
+            memoLog.keepProcedures = true;
+            memoLog.maxValues = MemoCache::MAX_ENTRY_VALUES;
+        };
+        // Starts the program's frame from values instead of zeros.
+        void presetGlobals(const Value *values) {
+            initialGlobals = values;
+        }
+        // where popped records are printed; nullptr prints none
+        void printTo(std::ostream *out) {
+            callStack->printTo(out);
+        }
+        // Sends the calls of pure procedures through memo.
+        void useMemo(MemoCache *memo) {
+            this->memo = memo;
+        }
+        // Lets compound statements with a ParallelPlan hand their calls to
+        // the pool's threads.
+        void useThreads(WorkStealingPool *pool, const ExecutionLimits& executionLimits) {
+            this->pool = pool;
+            for (int i = 0; i <= pool->size(); ++i)
+                helpers.push_back(std::make_unique<EvalVisitor>(budget, executionLimits));
         }
         void visitNumberNode(NumberNode *node) override {
             nodeValues[node] = node->value;
         }
+        // a left chain is folded bottom up into one running value
         void visitBinaryOp(BinaryOp *node) override {
-            node->left->accept(this);
-            node->right->accept(this);
-            try {
-                int leftVal = nodeValues[node->left.get()];
-                int rightVal = nodeValues[node->right.get()];
-                int result = 0;
-                switch (node->op->tokenType) {
-                    case TokenType::ADD: result = leftVal + rightVal; break;
-                    case TokenType::SUB: result = leftVal - rightVal; break;
-                    case TokenType::MUL: result = leftVal * rightVal; break;
-                    case TokenType::DIV: result = leftVal / rightVal; break;
-                    case TokenType::INT_DIV: result = leftVal / rightVal; break;
-                    default: error("Unknown binary op value");
+            size_t mark = spine.size();
+            Node *operand = pushLeftSpine(node, spine);
+            this->dispatch(operand);
+            Value result = nodeValues[operand];
+            while (spine.size() > mark) {
+                BinaryOp *link = spine.back();
+                spine.pop_back();
+                // 'and' / 'or' only evaluate the right side when they need to
+                if (link->kind == OpKind::BOOL_AND || link->kind == OpKind::BOOL_OR) {
+                    if (result.i == (link->kind == OpKind::BOOL_AND)) {
+                        this->dispatch(link->right.get());
+                        result = nodeValues[link->right.get()];
+                    }
+                    continue;
+                }
+                this->dispatch(link->right.get());
+                if (link->check) {
+                    result = applyCheckedOp(link->kind, result, nodeValues[link->right.get()], link->op);
+                    continue;
+                }
+                try {
+                    result = applyBinaryOp(link->kind, result, nodeValues[link->right.get()]);
+                }
+                catch (std::runtime_error& e) {
+                    std::string errormsg = "Invalid node left and right values ";
+                    error(errormsg + e.what());
                 }
-                nodeValues[node] = result;
-            }
-            catch (std::runtime_error& e) {
-                std::string errormsg = "Invalid node left and right values ";
-                error(errormsg + e.what());
             }
+            nodeValues[node] = result;
         }
         void visitUnaryOp(UnaryOp *node) override {
-            node->factor->accept(this);
-            int factorVal = nodeValues[node->factor.get()];
-            switch (node->op->tokenType) {
-                case TokenType::SUB: nodeValues[node] = -factorVal; break;
-                case TokenType::ADD: nodeValues[node] = factorVal; break;
+            this->dispatch(node->factor.get());
+            Value factorVal = nodeValues[node->factor.get()];
+            Value result = factorVal;
+            if (node->check) {
+                nodeValues[node] = applyCheckedOp(node->kind, factorVal, factorVal, node->op);
+                return;
+            }
+            switch (node->kind) {
+                case OpKind::INT_NEG: result.i = -factorVal.i; break;
+                case OpKind::REAL_NEG: result.r = -factorVal.r; break;
+                case OpKind::BOOL_NOT: result.i = !factorVal.i; break;
+                case OpKind::IDENTITY: break;
                 default: error("Invalid unary operator token");
             }
+            nodeValues[node] = result;
+        }
+        void visitIntToReal(IntToReal *node) override {
+            this->dispatch(node->expr.get());
+            Value result;
+            result.r = nodeValues[node->expr.get()].i;
+            nodeValues[node] = result;
         }
         // only for right-hand side evaluation (math expressions)
         void visitVariableNode(VariableNode *node) override {
-            ActivationRecord *record = callStack->peek();
-            nodeValues[node] = record->lookup(node->name);
+            nodeValues[node] = callStack->variable(node->level, node->slot);
         }
         void visitAssignStatement(AssignStatement *node) {
-            VariableNode *leftNode = dynamic_cast<VariableNode*>(node->left.get());
-            std::string varName = leftNode->name;
-            node->right->accept(this);
-            int rightValue = nodeValues[node->right.get()];
-            ActivationRecord *record = callStack->peek();
+            limits.step();
+            hooks.onStatement(node);
+            VariableNode *leftNode = node_cast<VariableNode>(node->left.get());
+            this->dispatch(node->right.get());
+            Value rightValue = nodeValues[node->right.get()];
             // assert that it cannot be empty
-            record->assign(varName, rightValue);
+            Value &target = callStack->variable(leftNode->level, leftNode->slot);
+            target = rightValue;
+            hooks.onAssign(leftNode, target);
         }
         void visitCompoundStatement(CompoundStatement *node) {
+            if (node->plan != nullptr && pool != nullptr) {
+                runParallel(node);
+                return;
+            }
             for (auto &child : node->statementList) {
-                child->accept(this);
+                this->dispatch(child.get());
             }
         }
-        void visitVarDeclaration(VarDeclaration *node) {
-            VariableNode *varNode = dynamic_cast<VariableNode*>(node->varNode.get());
-            ActivationRecord *record = callStack->peek();
-            record->assign(varNode->name, 0);
+        void visitIfStatement(IfStatement *node) override {
+            limits.step();
+            hooks.onStatement(node);
+            this->dispatch(node->condition.get());
+            if (nodeValues[node->condition.get()].i)
+                this->dispatch(node->thenBranch.get());
+            else if (node->elseBranch != nullptr)
+                this->dispatch(node->elseBranch.get());
+        }
+        void visitWhileStatement(WhileStatement *node) override {
+            while (true) {
+                limits.step();
+                hooks.onStatement(node);
+                this->dispatch(node->condition.get());
+                if (!nodeValues[node->condition.get()].i)
+                    break;
+                this->dispatch(node->body.get());
+            }
+        }
+        // the bounds are evaluated once; the loop variable is written
+        // through the call stack each time because the body may grow it
+        void visitForStatement(ForStatement *node) override {
+            VariableNode *var = static_cast<VariableNode*>(node->variable.get());
+            this->dispatch(node->start.get());
+            this->dispatch(node->end.get());
+            long long first = nodeValues[node->start.get()].i;
+            long long last = nodeValues[node->end.get()].i;
+            long long step = node->downto ? -1 : 1;
+            for (long long i = first; node->downto ? i >= last : i <= last; i += step) {
+                limits.step();
+                hooks.onStatement(node);
+                Value &counter = callStack->variable(var->level, var->slot);
+                counter.i = i;
+                hooks.onAssign(var, counter);
+                this->dispatch(node->body.get());
+            }
         }
         void visitDeclarationRoot(DeclarationRoot *node) {
             for (auto &child : node->declarations) {
-                child->accept(this);
+                this->dispatch(child.get());
             }
         }
         void visitProcedureCall(ProcedureCall *node) {
-            // add the stack
-            std::string procName = node->procedure->value;
-
-            std::unique_ptr<ActivationRecord> newRecord =
-                std::make_unique<ActivationRecord>(procName);
-            ActivationRecord *prevRecord = callStack->peek();
-            
             // needs to get the procedure symbol
-            std::shared_ptr<ProcedureSymbol> procSymbol = 
-            std::static_pointer_cast<ProcedureSymbol>(node->procSymbol);
+            ProcedureSymbol *procSymbol = node->procSymbol.get();
             // this is found in symbol table lookup "name"
-            
-            // add arguments to the activation memory map
-            // key = name of param, value is integer value from result
+            hooks.onStatement(node);
+
+            // evaluate the arguments straight into the callee's parameter
+            // slots, which come first in its frame
+            int base = callStack->reserve(procSymbol->frameSize());
             for (int i = 0; i < node->args.size(); i++) {
                 auto &argRoot = node->args[i];
-                argRoot->accept(this);
-
-                // get name and value
-                int calculateResult = nodeValues[argRoot.get()];
-                std::string paramName = procSymbol->formalParams[i]->name;
-                newRecord->assign(paramName, calculateResult);
+                this->dispatch(argRoot.get());
+                callStack->slotAt(base + i) = nodeValues[argRoot.get()];
+            }
+            invoke(procSymbol, node->args.size());
+        }
+        // runs a procedure whose arguments are already in its reserved frame
+        void invoke(ProcedureSymbol *procSymbol, int numArgs) {
+            if (memo != nullptr && procSymbol->pure) {
+                invokeMemoized(procSymbol, numArgs);
+                return;
             }
-            callStack->push(std::move(newRecord));
-            procSymbol->block->accept(this);
+            limits.step();
+            limits.enter();
+            callStack->push(procSymbol, numArgs);
+            hooks.onCall(procSymbol);
+            visitBlock(procSymbol->block);
 
             // pop the stack
-            callStack->printHighestRecord();
-            callStack->pop();
+            callStack->popRecord();
+            hooks.onReturn(procSymbol);
+            limits.leave();
         }
-        void visitBlock(Block *node) {
-            for (auto &varDeclaration : node->varDeclarations) {
-                varDeclaration->accept(this);
+        void visitAssignVarOpConst(AssignVarOpConst *node) override {
+            limits.step();
+            hooks.onStatement(node);
+            Value source = callStack->variable(node->sourceLevel, node->sourceSlot);
+            Value &target = callStack->variable(node->targetLevel, node->targetSlot);
+            target = node->check ? applyCheckedOp(node->kind, source, node->constant, node->op)
+                : applyBinaryOp(node->kind, source, node->constant);
+            hooks.onAssign(node->target.get(), target);
+        }
+        void visitAssignVarOpVar(AssignVarOpVar *node) override {
+            limits.step();
+            hooks.onStatement(node);
+            Value left = callStack->variable(node->leftLevel, node->leftSlot);
+            Value right = callStack->variable(node->rightLevel, node->rightSlot);
+            Value &target = callStack->variable(node->targetLevel, node->targetSlot);
+            target = node->check ? applyCheckedOp(node->kind, left, right, node->op)
+                : applyBinaryOp(node->kind, left, right);
+            hooks.onAssign(node->target.get(), target);
+        }
+        void visitIncrementVar(IncrementVar *node) override {
+            limits.step();
+            hooks.onStatement(node);
+            Value &target = callStack->variable(node->targetLevel, node->targetSlot);
+            if (node->check)
+                target = applyCheckedOp(node->kind, target, node->delta, node->op);
+            else if (node->kind == OpKind::INT_ADD)
+                target.i += node->delta.i;
+            else
+                target.r += node->delta.r;
+            hooks.onAssign(node->target.get(), target);
+        }
+        void visitCallWithConstArgs(CallWithConstArgs *node) override {
+            ProcedureSymbol *procSymbol = node->procSymbol.get();
+            hooks.onStatement(node);
+            int base = callStack->reserve(procSymbol->frameSize());
+            for (int i = 0; i < node->args.size(); i++) {
+                callStack->slotAt(base + i) = node->args[i];
             }
-            node->compoundStatement->accept(this);
+            invoke(procSymbol, node->args.size());
+        }
+        // A hit prints the cached records instead of running the body,
+        // unless replaying them at this depth would pass the depth limit;
+        // then the call runs and fails as it would have. A miss runs the
+        // call with the popped records logged and caches them.
+        void invokeMemoized(ProcedureSymbol *procSymbol, int numArgs) {
+            int base = callStack->reserve(procSymbol->frameSize());
+            int depth = callStack->depth();
+            const MemoCache::Result *result = memo->find(procSymbol, &callStack->slotAt(base), numArgs);
+            if (result != nullptr && limits.canEnter(result->maxDepth + 1)) {
+                ++memo->hits;
+                limits.step();
+                for (const ExecutionState::Record &record : result->records)
+                    callStack->replayRecord(record.frame, depth + record.depth, &result->values[record.offset]);
+                return;
+            }
+            ++memo->misses;
+            // the body may assign to its parameters
+            std::vector<Value> args(&callStack->slotAt(base), &callStack->slotAt(base) + numArgs);
+            size_t first = memoLog.records.size();
+            if (numRecording++ == 0)
+                callStack->logInto(&memoLog);
+            try {
+                limits.step();
+                limits.enter();
+                callStack->push(procSymbol, numArgs);
+                visitBlock(procSymbol->block);
+                callStack->popRecord();
+                limits.leave();
+            } catch (...) {
+                if (--numRecording == 0) {
+                    callStack->logInto(nullptr);
+                    memoLog.clear();
+                }
+                throw;
+            }
+            if (!memoLog.overflowed)
+                memo->insert(procSymbol, args.data(), numArgs, memoLog, first, depth);
+            else
+                ++memo->tooLarge;
+            if (--numRecording == 0) {
+                callStack->logInto(nullptr);
+                memoLog.clear();
+            }
+        }
+        // local variables are zeroed when the frame is pushed
+        void visitBlock(Block *node) {
+            this->dispatch(node->compoundStatement.get());
         }
         void visitProgramNode(ProgramNode *node) {
-            callStack->push(std::make_unique<ActivationRecord>(
-                node->programName->value
-            ));
-            node->block->accept(this);
-            callStack->printHighestRecord();
-            callStack->pop();
+            ProgramSymbol *symbol = node->programSymbol.get();
+            int numInitialized = 0;
+            if (initialGlobals != nullptr) {
+                int base = callStack->reserve(symbol->frameSize());
+                std::copy(initialGlobals, initialGlobals + symbol->frameSize(), &callStack->slotAt(base));
+                numInitialized = symbol->frameSize();
+            }
+            callStack->push(symbol, numInitialized);
+            hooks.onCall(node->programSymbol.get());
+            this->dispatch(node->block.get());
+            callStack->popRecord();
+            hooks.onReturn(node->programSymbol.get());
         }
 };
 
-// ------------------------------------------------------------------------
-
-class PrintVisitor: public Visitor {
-    private:
-        int level;
-        void print_with_tabs(int numTabs, const std::string& msg) {
-            for (int i = 0; i < numTabs; ++i) {
-                std::printf("  ");
+// Runs a compound statement by its ParallelPlan. Calls go to the pool in
+// statement order as soon as the calls they conflict with have finished;
+// everything else runs here. Output is printed, and records are kept, in
+// statement order, so a run prints what it would have printed serially.
+// The first error in statement order is rethrown once every call that was
+// started has finished.
+template <typename Hooks>
+void EvalVisitor<Hooks>::runParallel(CompoundStatement *node) {
+    ParallelPlan &plan = *node->plan;
+    int n = node->statementList.size();
+    std::vector<std::unique_ptr<ParallelCall>> calls(n);
+    int printed = 0;
+    int helper = pool->size();
+
+    auto finished = [&](int i) {
+        return calls[i] == nullptr || calls[i]->done;
+    };
+    // helps with queued calls until every listed one has finished
+    auto waitFor = [&](const std::vector<int> &statements) {
+        auto ready = [&]() {
+            for (int i : statements) {
+                if (!finished(i))
+                    return false;
             }
-            std::cout << msg;
-        };
-    public:
-        PrintVisitor() {
-            level = 0;
+            return true;
         };
-        void visitNumberNode(NumberNode *node) override {
-            print_with_tabs(level, "");
-            node->print();
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> lock(callsMutex);
+                if (ready())
+                    return;
+            }
+            if (!pool->help(helper)) {
+                std::unique_lock<std::mutex> lock(callsMutex);
+                callDone.wait(lock, ready);
+                return;
+            }
         }
-        void visitBinaryOp(BinaryOp *node) override {
-            ++level;
-            node->left->accept(this);
-            node->right->accept(this);
-            --level;
-            print_with_tabs(level, "");
-            node->print();
+    };
+    auto waitForAll = [&]() {
+        std::vector<int> started;
+        for (int i = 0; i < n; ++i) {
+            if (calls[i] != nullptr)
+                started.push_back(i);
         }
-        void visitUnaryOp(UnaryOp *node) override {
-            ++level;
-            node->factor->accept(this);
-            --level;
-            print_with_tabs(level, "");
-            node->print();
+        waitFor(started);
+    };
+    // prints the finished calls up to end, stopping at the first that has
+    // not finished
+    auto print = [&](int end) {
+        for (; printed < end; ++printed) {
+            ParallelCall *call = calls[printed].get();
+            if (call == nullptr)
+                continue;
+            {
+                std::lock_guard<std::mutex> lock(callsMutex);
+                if (!call->done)
+                    return;
+            }
+            if (call->error) {
+                waitForAll();
+                std::rethrow_exception(call->error);
+            }
+            std::cout << call->output.str();
+            if (call->records != nullptr)
+                state->append(*call->records);
+            calls[printed].reset();
+        }
+    };
+
+    int i = 0;
+    try {
+        for (; i < n; ++i) {
+            Node *statement = node->statementList[i].get();
+            switch (plan.kinds[i]) {
+                case ParallelPlan::Kind::INLINE:
+                    waitFor(plan.waitsFor[i]);
+                    this->dispatch(statement);
+                    break;
+                case ParallelPlan::Kind::BARRIER:
+                    waitForAll();
+                    print(i);
+                    this->dispatch(statement);
+                    break;
+                case ParallelPlan::Kind::CALL: {
+                    waitFor(plan.waitsFor[i]);
+                    print(i);
+                    auto call = std::make_unique<ParallelCall>();
+                    hooks.onStatement(statement);
+                    if (statement->nodeKind == NodeKind::PROCEDURE_CALL) {
+                        ProcedureCall *procedureCall = node_cast<ProcedureCall>(statement);
+                        call->procSymbol = procedureCall->procSymbol.get();
+                        for (auto &arg : procedureCall->args) {
+                            this->dispatch(arg.get());
+                            call->args.push_back(nodeValues[arg.get()]);
+                        }
+                    }
+                    else {
+                        CallWithConstArgs *constCall = node_cast<CallWithConstArgs>(statement);
+                        call->procSymbol = constCall->procSymbol.get();
+                        call->args = constCall->args;
+                    }
+                    if (state != nullptr && state->keepProcedures) {
+                        call->records = std::make_unique<ExecutionState>(budget);
+                        call->records->keepProcedures = true;
+                    }
+                    call->stepsBefore = limits.steps();
+                    ParallelCall *task = call.get();
+                    calls[i] = std::move(call);
+                    pool->submit([this, task](int worker) {
+                        helpers[worker]->runCall(*task, *this);
+                        // notified under the lock, so this evaluator
+                        // cannot be gone before the worker lets go of it
+                        std::lock_guard<std::mutex> lock(callsMutex);
+                        task->done = true;
+                        callDone.notify_all();
+                    });
+                    break;
+                }
+            }
+        }
+        waitForAll();
+        print(n);
+    }
+    catch (...) {
+        // the calls before the failed statement still print first
+        waitForAll();
+        print(i);
+        throw;
+    }
+}
+
+// Runs a call handed over by caller on this evaluator's stack, whose
+// parent is the caller's.
+template <typename Hooks>
+void EvalVisitor<Hooks>::runCall(ParallelCall &call, const EvalVisitor &caller) {
+    callStack->setParent(caller.callStack.get());
+    callStack->printTo(&call.output);
+    callStack->recordInto(call.records.get());
+    limits.continueFrom(caller.limits, call.stepsBefore);
+    try {
+        int base = callStack->reserve(call.procSymbol->frameSize());
+        for (size_t i = 0; i < call.args.size(); ++i)
+            callStack->slotAt(base + i) = call.args[i];
+        invoke(call.procSymbol, call.args.size());
+    }
+    catch (...) {
+        call.error = std::current_exception();
+        callStack->clear();
+    }
+}
+
+// ------------------------------------------------------------------------
+
+// Collects output in a fixed buffer and hands it to the stream in large
+// writes. Nothing is allocated per call.
+class BufferedWriter {
+    private:
+        static constexpr size_t CAPACITY = 1 << 16;
+        std::ostream &out;
+        std::unique_ptr<char[]> buffer;
+        size_t used = 0;
+    public:
+        BufferedWriter(std::ostream &out) : out(out), buffer(new char[CAPACITY]) {}
+        ~BufferedWriter() {
+            flush();
+        }
+        void flush() {
+            if (used > 0)
+                out.write(buffer.get(), used);
+            used = 0;
+        }
+        void write(const char *data, size_t size) {
+            if (size > CAPACITY - used) {
+                flush();
+                if (size > CAPACITY) {
+                    out.write(data, size);
+                    return;
+                }
+            }
+            std::memcpy(buffer.get() + used, data, size);
+            used += size;
+        }
+        void write(const std::string &text) {
+            write(text.data(), text.size());
+        }
+        void write(const char *text) {
+            write(text, std::strlen(text));
+        }
+        void put(char c) {
+            if (used == CAPACITY)
+                flush();
+            buffer[used++] = c;
+        }
+        void fill(char c, size_t count) {
+            while (count > 0) {
+                if (used == CAPACITY)
+                    flush();
+                size_t chunk = std::min(count, CAPACITY - used);
+                std::memset(buffer.get() + used, c, chunk);
+                used += chunk;
+                count -= chunk;
+            }
+        }
+        void writeInt(long long value) {
+            char digits[24];
+            int n = 0;
+            unsigned long long magnitude = value < 0 ? 0ULL - value : value;
+            do {
+                digits[n++] = '0' + magnitude % 10;
+                magnitude /= 10;
+            } while (magnitude > 0);
+            if (value < 0)
+                put('-');
+            while (n > 0)
+                put(digits[--n]);
+        }
+        // %g with the given number of significant digits, the format
+        // std::cout uses by default for 6
+        void writeReal(double value, int precision = 6) {
+            char text[32];
+            int n = std::snprintf(text, sizeof(text), "%.*g", precision, value);
+            write(text, n);
+        }
+
+        // little-endian binary fields
+        void writeU8(uint8_t value) {
+            put((char)value);
+        }
+        void writeU32(uint32_t value) {
+            for (int i = 0; i < 4; ++i)
+                put((char)(value >> (8 * i)));
+        }
+        void writeI32(int32_t value) {
+            writeU32((uint32_t)value);
+        }
+        void writeU64(uint64_t value) {
+            for (int i = 0; i < 8; ++i)
+                put((char)(value >> (8 * i)));
+        }
+};
+
+// The lines of a printed tree, shared by the printers of the pointer tree
+// and of a FlatAst; they only differ in how they reach a node's children.
+class TreePrinter {
+    protected:
+        int level;
+        BufferedWriter &out;
+        // Past MAX_TABS the indentation stops growing and the line starts
+        // with its level instead, so a deep tree prints in linear space.
+        static const int MAX_TABS = 64;
+        void print_with_tabs(int numTabs, const char *msg) {
+            if (numTabs > MAX_TABS) {
+                out.fill(' ', 2 * MAX_TABS);
+                out.put('[');
+                out.writeInt(numTabs);
+                out.write("] ");
+            }
+            else {
+                out.fill(' ', 2 * numTabs);
+            }
+            out.write(msg);
+        };
+        void printNumber(Symbol::Type type, Value value) {
+            print_with_tabs(level, "NumberNode: { Value: ");
+            if (type == Symbol::Type::REAL)
+                out.writeReal(value.r);
+            else
+                out.writeInt(value.i);
+            out.write(" }\n");
+        }
+        // e.g. BinaryOp: { Type: ADD }
+        void printOperator(int numTabs, const char *what, const std::shared_ptr<Token>& op) {
+            print_with_tabs(numTabs, what);
+            out.write(": { Type: ");
+            out.write(tokenType_tostring(op->tokenType));
+            out.write(" }\n");
+        }
+        void printVariable(const std::string& name) {
+            print_with_tabs(level, "Variable {\"name\" = \"");
+            out.write(name);
+            out.write("\"}\n");
+        }
+        void printAssignment(const std::string& name) {
+            print_with_tabs(level, "Assignment Statement { ");
+            out.write(name);
+            out.write(" = ... }\n");
+        }
+        void printCall(const std::string& name) {
+            print_with_tabs(level, "Procedure call { ");
+            out.write(name);
+            out.write("( ... ) }\n");
+        }
+        void printFor(const std::string& name, bool downto) {
+            print_with_tabs(level, "For Statement { ");
+            out.write(name);
+            out.write(downto ? " downto }\n" : " to }\n");
+        }
+        // VAR -> name : type or PARAM -> name : type
+        void printDeclaration(const char *what, const std::string& name, TokenType type) {
+            print_with_tabs(level, what);
+            out.write(name);
+            out.write(" : ");
+            out.write(tokenType_tostring(type));
+            out.put('\n');
+        }
+        void printProcedure(const std::string& name) {
+            print_with_tabs(level, "Procedure \"");
+            out.write(name);
+            out.write("\"\n");
+        }
+        void printProgram(const std::string& name) {
+            print_with_tabs(level, "Program \"");
+            out.write(name);
+            out.write(".pas\" \n\n");
+        }
+    public:
+        // level is the indentation of the node the printing starts at
+        TreePrinter(BufferedWriter &out, int level) : level(level), out(out) {};
+};
+
+// Prints the tree in postorder, straight from the nodes.
+class PrintVisitor: public Visitor, private TreePrinter {
+    private:
+        std::vector<BinaryOp*> spine;
+        const std::string& name(Node *variable) {
+            return static_cast<VariableNode*>(variable)->variableToken->value;
+        }
+    public:
+        PrintVisitor(BufferedWriter &out, int level = 0) : TreePrinter(out, level) {};
+        void visitNumberNode(NumberNode *node) override {
+            printNumber(node->type, node->value);
+        }
+        // the operand at the bottom of a left chain is one level below
+        // the lowest link, and every link below the one it closes
+        void visitBinaryOp(BinaryOp *node) override {
+            size_t mark = spine.size();
+            Node *operand = pushLeftSpine(node, spine);
+            level += spine.size() - mark;
+            operand->accept(this);
+            while (spine.size() > mark) {
+                BinaryOp *link = spine.back();
+                spine.pop_back();
+                link->right->accept(this);
+                --level;
+                printOperator(level, "BinaryOp", link->op);
+            }
+        }
+        void visitUnaryOp(UnaryOp *node) override {
+            ++level;
+            node->factor->accept(this);
+            --level;
+            printOperator(level, "UnaryOp", node->op);
         }
         void visitVariableNode(VariableNode *node) override {
-            print_with_tabs(level, "");
-            node->print();
+            printVariable(node->variableToken->value);
         };
         void visitCompoundStatement(CompoundStatement *node) override {
             for (auto &statement : node->statementList) {
@@ -1600,8 +4425,7 @@ class PrintVisitor: public Visitor {
                 statement->accept(this);
                 --level;
             }
-            print_with_tabs(level, "");
-            node->print();
+            print_with_tabs(level, "Compound Statement\n");
         }
         void visitAssignStatement(AssignStatement *node) override {
             ++level;
@@ -1614,38 +4438,61 @@ class PrintVisitor: public Visitor {
             node->right->accept(this);
             --level;
 
-            print_with_tabs(level,"");
-            node->print();
+            printAssignment(name(node->left.get()));
         }
-        void visitProcedureCall(ProcedureCall *node) {
+        void visitProcedureCall(ProcedureCall *node) override {
             ++level;
-            if (node->args.size() > 0) {
-                for (auto &arg : node->args) {
-                    arg->accept(this);
-                }
+            for (auto &arg : node->args) {
+                arg->accept(this);
+            }
+            --level;
+            printCall(node->procedure->value);
+        }
+        void visitEmptyStatement(EmptyStatement *node) override {
+            print_with_tabs(level, "Empty Statement\n");
+        }
+        void visitIfStatement(IfStatement *node) override {
+            ++level;
+            node->condition->accept(this);
+            print_with_tabs(level, "then\n");
+            node->thenBranch->accept(this);
+            if (node->elseBranch != nullptr) {
+                print_with_tabs(level, "else\n");
+                node->elseBranch->accept(this);
             }
             --level;
-            print_with_tabs(level, "");
-            node->print();
+            print_with_tabs(level, "If Statement\n");
         }
-        void visitEmptyStatement(EmptyStatement *node) {
-            print_with_tabs(level, "");
-            node->print();
+        void visitWhileStatement(WhileStatement *node) override {
+            ++level;
+            node->condition->accept(this);
+            print_with_tabs(level, "do\n");
+            node->body->accept(this);
+            --level;
+            print_with_tabs(level, "While Statement\n");
         }
-        void visitVarDeclaration(VarDeclaration *node) {
-            print_with_tabs(level, "");
-            node->print();
+        void visitForStatement(ForStatement *node) override {
+            ++level;
+            node->start->accept(this);
+            node->end->accept(this);
+            print_with_tabs(level, "do\n");
+            node->body->accept(this);
+            --level;
+            printFor(name(node->variable.get()), node->downto);
         }
-        void visitDeclarationRoot(DeclarationRoot *node) {
+        void visitVarDeclaration(VarDeclaration *node) override {
+            printDeclaration("VAR -> ", name(node->varNode.get()),
+                static_cast<TypeNode*>(node->typeNode.get())->type->tokenType);
+        }
+        void visitDeclarationRoot(DeclarationRoot *node) override {
             for (auto &dec : node->declarations) {
                 ++level;
                 dec->accept(this);
                 --level;
             }
-            print_with_tabs(level, "");
-            node->print();
+            print_with_tabs(level, "Declaration Root\n");
         }
-        void visitBlock(Block *node) {
+        void visitBlock(Block *node) override {
             ++level;
             for (auto &procedure : node->procedures) {
                 procedure->accept(this);
@@ -1655,81 +4502,3707 @@ class PrintVisitor: public Visitor {
             }
             node->compoundStatement->accept(this);
             --level;
-            print_with_tabs(level, "");
-            node->print();
+            print_with_tabs(level, "Block\n");
         }
-        void visitParamDeclaration(ParamDeclaration *node) {
-            print_with_tabs(level, "");
-            node->print();
+        void visitParamDeclaration(ParamDeclaration *node) override {
+            printDeclaration("PARAM -> ", name(node->varNode.get()),
+                static_cast<TypeNode*>(node->typeNode.get())->type->tokenType);
+        }
+        void visitProcedure(Procedure *node) override {
+            ++level;
+            node->block->accept(this);
+            for (auto &dec : node->paramDeclarations) {
+                dec->accept(this);
+            }
+            --level;
+            printProcedure(node->id->value);
+        }
+        void visitProgramNode(ProgramNode *node) override {
+            ++level;
+            node->block->accept(this);
+            --level;
+            printProgram(node->programName->value);
+        }
+};
+
+// Prints a FlatAst the same way, e.g. one read back from a binary dump.
+class FlatPrintVisitor: public FlatVisitor, private TreePrinter {
+    private:
+        std::vector<int> spine;
+        const std::string& name(const FlatAst &ast, int variable) {
+            return ast.token(variable)->value;
+        }
+    public:
+        FlatPrintVisitor(BufferedWriter &out, int level = 0) : TreePrinter(out, level) {};
+        void visitNumberNode(const FlatAst &ast, int node) override {
+            printNumber(ast.types[node], ast.payloads[node]);
+        }
+        // the operand at the bottom of a left chain is one level below
+        // the lowest link, and every link below the one it closes
+        void visitBinaryOp(const FlatAst &ast, int node) override {
+            size_t mark = spine.size();
+            int operand = ast.pushLeftSpine(node, spine);
+            level += spine.size() - mark;
+            ast.accept(operand, this);
+            while (spine.size() > mark) {
+                int link = spine.back();
+                spine.pop_back();
+                ast.accept(ast.b[link], this);
+                --level;
+                printOperator(level, "BinaryOp", ast.token(link));
+            }
+        }
+        void visitUnaryOp(const FlatAst &ast, int node) override {
+            ++level;
+            ast.accept(ast.a[node], this);
+            --level;
+            printOperator(level, "UnaryOp", ast.token(node));
+        }
+        void visitVariableNode(const FlatAst &ast, int node) override {
+            printVariable(name(ast, node));
+        };
+        void visitCompoundStatement(const FlatAst &ast, int node) override {
+            for (int i = 0; i < ast.b[node]; ++i) {
+                ++level;
+                ast.accept(ast.lists[ast.a[node] + i], this);
+                --level;
+            }
+            print_with_tabs(level, "Compound Statement\n");
+        }
+        void visitAssignStatement(const FlatAst &ast, int node) override {
+            ++level;
+            ast.accept(ast.a[node], this);
+            --level;
+
+            print_with_tabs(level+1, ":=\n");
+
+            ++level;
+            ast.accept(ast.b[node], this);
+            --level;
+
+            printAssignment(name(ast, ast.a[node]));
+        }
+        void visitProcedureCall(const FlatAst &ast, int node) override {
+            ++level;
+            for (int i = 0; i < ast.b[node]; ++i) {
+                ast.accept(ast.lists[ast.a[node] + i], this);
+            }
+            --level;
+            printCall(ast.token(node)->value);
+        }
+        void visitEmptyStatement(const FlatAst &ast, int node) override {
+            print_with_tabs(level, "Empty Statement\n");
+        }
+        void visitIfStatement(const FlatAst &ast, int node) override {
+            ++level;
+            ast.accept(ast.a[node], this);
+            print_with_tabs(level, "then\n");
+            ast.accept(ast.b[node], this);
+            if (ast.c[node] != -1) {
+                print_with_tabs(level, "else\n");
+                ast.accept(ast.c[node], this);
+            }
+            --level;
+            print_with_tabs(level, "If Statement\n");
+        }
+        void visitWhileStatement(const FlatAst &ast, int node) override {
+            ++level;
+            ast.accept(ast.a[node], this);
+            print_with_tabs(level, "do\n");
+            ast.accept(ast.b[node], this);
+            --level;
+            print_with_tabs(level, "While Statement\n");
+        }
+        void visitForStatement(const FlatAst &ast, int node) override {
+            const int32_t *parts = &ast.lists[ast.a[node]]; // variable, start, end, body
+            ++level;
+            ast.accept(parts[1], this);
+            ast.accept(parts[2], this);
+            print_with_tabs(level, "do\n");
+            ast.accept(parts[3], this);
+            --level;
+            printFor(name(ast, parts[0]), ast.c[node]);
+        }
+        void visitVarDeclaration(const FlatAst &ast, int node) override {
+            printDeclaration("VAR -> ", name(ast, ast.a[node]), (TokenType)ast.payloads[node].i);
+        }
+        void visitDeclarationRoot(const FlatAst &ast, int node) override {
+            for (int i = 0; i < ast.b[node]; ++i) {
+                ++level;
+                ast.accept(ast.lists[ast.a[node] + i], this);
+                --level;
+            }
+            print_with_tabs(level, "Declaration Root\n");
+        }
+        void visitBlock(const FlatAst &ast, int node) override {
+            // procedures, then declarations, then the compound statement
+            int count = ast.b[node] + ast.c[node] + 1;
+            ++level;
+            for (int i = 0; i < count; ++i) {
+                ast.accept(ast.lists[ast.a[node] + i], this);
+            }
+            --level;
+            print_with_tabs(level, "Block\n");
+        }
+        void visitParamDeclaration(const FlatAst &ast, int node) override {
+            printDeclaration("PARAM -> ", name(ast, ast.a[node]), (TokenType)ast.payloads[node].i);
+        }
+        void visitProcedure(const FlatAst &ast, int node) override {
+            ++level;
+            ast.accept(ast.a[node], this);
+            for (int i = 0; i < ast.c[node]; ++i) {
+                ast.accept(ast.lists[ast.b[node] + i], this);
+            }
+            --level;
+            printProcedure(ast.token(node)->value);
+        }
+        void visitProgramNode(const FlatAst &ast, int node) override {
+            ++level;
+            ast.accept(ast.a[node], this);
+            --level;
+            printProgram(ast.token(node)->value);
+        }
+};
+
+// Prints the tree under node in postorder, level being its indentation.
+void printTree(Node *node, int level = 0) {
+    BufferedWriter out(std::cout);
+    PrintVisitor printVisitor(out, level);
+    node->accept(&printVisitor);
+}
+
+
+// -----------------------------------------------------------------------------
+
+// Machine-readable AST dumps. Both formats are written from the FlatAst
+// through a BufferedWriter.
+
+const char *nodeKind_tostring(NodeKind kind) {
+    switch (kind) {
+        case NodeKind::NUMBER: return "Number";
+        case NodeKind::BINARY_OP: return "BinaryOp";
+        case NodeKind::UNARY_OP: return "UnaryOp";
+        case NodeKind::INT_TO_REAL: return "IntToReal";
+        case NodeKind::VARIABLE: return "Variable";
+        case NodeKind::COMPOUND: return "Compound";
+        case NodeKind::PROCEDURE_CALL: return "ProcedureCall";
+        case NodeKind::ASSIGN: return "Assign";
+        case NodeKind::EMPTY: return "Empty";
+        case NodeKind::IF: return "If";
+        case NodeKind::WHILE: return "While";
+        case NodeKind::FOR: return "For";
+        case NodeKind::ASSIGN_VAR_OP_CONST: return "AssignVarOpConst";
+        case NodeKind::ASSIGN_VAR_OP_VAR: return "AssignVarOpVar";
+        case NodeKind::INCREMENT_VAR: return "IncrementVar";
+        case NodeKind::CALL_WITH_CONST_ARGS: return "CallWithConstArgs";
+        case NodeKind::VAR_DECLARATION: return "VarDeclaration";
+        case NodeKind::DECLARATION_ROOT: return "DeclarationRoot";
+        case NodeKind::PARAM_DECLARATION: return "ParamDeclaration";
+        case NodeKind::BLOCK: return "Block";
+        case NodeKind::PROCEDURE: return "Procedure";
+        case NodeKind::PROGRAM: return "Program";
+        case NodeKind::TYPE: return "Type";
+    }
+    return "Unknown";
+}
+
+const char *valueType_tostring(Symbol::Type type) {
+    switch (type) {
+        case Symbol::Type::INTEGER: return "INTEGER";
+        case Symbol::Type::REAL: return "REAL";
+        case Symbol::Type::BOOLEAN: return "BOOLEAN";
+        case Symbol::Type::NO_TYPE: return "NO_TYPE";
+    }
+    return "Unknown";
+}
+
+void writeJsonString(BufferedWriter &out, const std::string &text) {
+    out.put('"');
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out.put('\\');
+            out.put(c);
+        }
+        else if ((unsigned char)c < 0x20) {
+            static const char hex[] = "0123456789abcdef";
+            out.write("\\u00");
+            out.put(hex[(c >> 4) & 0xf]);
+            out.put(hex[c & 0xf]);
+        }
+        else {
+            out.put(c);
+        }
+    }
+    out.put('"');
+}
+
+// Writes the tree as one compact JSON object per node:
+//   {"kind":"BinaryOp","line":3,"op":"ADD","left":{...},"right":{...}}
+// Every node has "kind"; "type" is only there once analysis has set it.
+class JsonAstWriter: public FlatVisitor {
+    private:
+        BufferedWriter &out;
+        std::vector<int> spine;
+
+        void string(const std::string &text) {
+            writeJsonString(out, text);
+        }
+        void key(const char *name) {
+            out.put(',');
+            out.put('"');
+            out.write(name);
+            out.write("\":");
+        }
+        void begin(const FlatAst &ast, int node) {
+            out.write("{\"kind\":\"");
+            out.write(nodeKind_tostring(ast.kinds[node]));
+            out.put('"');
+            if (ast.types[node] != Symbol::Type::NO_TYPE) {
+                key("type");
+                out.put('"');
+                out.write(valueType_tostring(ast.types[node]));
+                out.put('"');
+            }
+            if (ast.tokens[node] != -1) {
+                key("line");
+                out.writeInt(ast.token(node)->lineno);
+            }
+        }
+        void child(const FlatAst &ast, const char *name, int node) {
+            key(name);
+            ast.accept(node, this);
+        }
+        void list(const FlatAst &ast, const char *name, int offset, int count) {
+            key(name);
+            out.put('[');
+            for (int i = 0; i < count; ++i) {
+                if (i > 0)
+                    out.put(',');
+                ast.accept(ast.lists[offset + i], this);
+            }
+            out.put(']');
+        }
+        void value(Symbol::Type type, Value value) {
+            if (type == Symbol::Type::REAL)
+                out.writeReal(value.r, 17);
+            else
+                out.writeInt(value.i);
+        }
+        void op(const FlatAst &ast, int node) {
+            key("op");
+            out.put('"');
+            out.write(tokenType_tostring(ast.token(node)->tokenType));
+            out.put('"');
+        }
+        void name(const FlatAst &ast, int node) {
+            key("name");
+            string(ast.token(node)->value);
+        }
+    public:
+        JsonAstWriter(BufferedWriter &out) : out(out) {}
+        void visitNumberNode(const FlatAst &ast, int node) override {
+            begin(ast, node);
+            key("value");
+            value(ast.types[node], ast.payloads[node]);
+            out.put('}');
+        }
+        // a left chain opens its links top down and closes them bottom up
+        void visitBinaryOp(const FlatAst &ast, int node) override {
+            size_t mark = spine.size();
+            int operand = ast.pushLeftSpine(node, spine);
+            for (size_t i = mark; i < spine.size(); ++i) {
+                begin(ast, spine[i]);
+                op(ast, spine[i]);
+                key("left");
+            }
+            ast.accept(operand, this);
+            while (spine.size() > mark) {
+                child(ast, "right", ast.b[spine.back()]);
+                spine.pop_back();
+                out.put('}');
+            }
+        }
+        void visitUnaryOp(const FlatAst &ast, int node) override {
+            begin(ast, node);
+            op(ast, node);
+            child(ast, "operand", ast.a[node]);
+            out.put('}');
+        }
+        void visitIntToReal(const FlatAst &ast, int node) override {
+            begin(ast, node);
+            child(ast, "operand", ast.a[node]);
+            out.put('}');
+        }
+        void visitVariableNode(const FlatAst &ast, int node) override {
+            begin(ast, node);
+            name(ast, node);
+            out.put('}');
+        }
+        void visitCompoundStatement(const FlatAst &ast, int node) override {
+            begin(ast, node);
+            list(ast, "statements", ast.a[node], ast.b[node]);
+            out.put('}');
+        }
+        void visitProcedureCall(const FlatAst &ast, int node) override {
+            begin(ast, node);
+            name(ast, node);
+            list(ast, "args", ast.a[node], ast.b[node]);
+            out.put('}');
+        }
+        void visitAssignStatement(const FlatAst &ast, int node) override {
+            begin(ast, node);
+            child(ast, "target", ast.a[node]);
+            child(ast, "value", ast.b[node]);
+            out.put('}');
+        }
+        void visitEmptyStatement(const FlatAst &ast, int node) override {
+            begin(ast, node);
+            out.put('}');
+        }
+        void visitIfStatement(const FlatAst &ast, int node) override {
+            begin(ast, node);
+            child(ast, "condition", ast.a[node]);
+            child(ast, "then", ast.b[node]);
+            if (ast.c[node] != -1)
+                child(ast, "else", ast.c[node]);
+            out.put('}');
+        }
+        void visitWhileStatement(const FlatAst &ast, int node) override {
+            begin(ast, node);
+            child(ast, "condition", ast.a[node]);
+            child(ast, "body", ast.b[node]);
+            out.put('}');
+        }
+        void visitForStatement(const FlatAst &ast, int node) override {
+            const int32_t *parts = &ast.lists[ast.a[node]];
+            begin(ast, node);
+            child(ast, "variable", parts[0]);
+            child(ast, "start", parts[1]);
+            child(ast, "end", parts[2]);
+            key("downto");
+            out.write(ast.c[node] ? "true" : "false");
+            child(ast, "body", parts[3]);
+            out.put('}');
+        }
+        void visitAssignVarOpConst(const FlatAst &ast, int node) override {
+            begin(ast, node);
+            op(ast, node);
+            child(ast, "target", ast.a[node]);
+            child(ast, "source", ast.b[node]);
+            key("constant");
+            value(ast.types[ast.b[node]], ast.payloads[node]);
+            out.put('}');
+        }
+        void visitAssignVarOpVar(const FlatAst &ast, int node) override {
+            begin(ast, node);
+            op(ast, node);
+            child(ast, "target", ast.a[node]);
+            child(ast, "left", ast.b[node]);
+            child(ast, "right", ast.c[node]);
+            out.put('}');
+        }
+        void visitIncrementVar(const FlatAst &ast, int node) override {
+            begin(ast, node);
+            child(ast, "target", ast.a[node]);
+            key("delta");
+            value(ast.types[ast.a[node]], ast.payloads[node]);
+            out.put('}');
+        }
+        void visitCallWithConstArgs(const FlatAst &ast, int node) override {
+            begin(ast, node);
+            name(ast, node);
+            key("args");
+            out.put('[');
+            // the argument types come from the callee's formal parameters
+            auto callee = ast.c[node] == -1 ? nullptr
+                : std::static_pointer_cast<ProcedureSymbol>(ast.frames[ast.c[node]]);
+            for (int i = 0; i < ast.b[node]; ++i) {
+                if (i > 0)
+                    out.put(',');
+                Symbol::Type type = callee ? callee->formalParams[i]->valueType : Symbol::Type::INTEGER;
+                value(type, ast.values[ast.a[node] + i]);
+            }
+            out.put(']');
+            out.put('}');
+        }
+        void visitVarDeclaration(const FlatAst &ast, int node) override {
+            begin(ast, node);
+            child(ast, "variable", ast.a[node]);
+            key("declaredType");
+            out.put('"');
+            out.write(tokenType_tostring((TokenType)ast.payloads[node].i));
+            out.put('"');
+            out.put('}');
+        }
+        void visitDeclarationRoot(const FlatAst &ast, int node) override {
+            begin(ast, node);
+            list(ast, "declarations", ast.a[node], ast.b[node]);
+            out.put('}');
+        }
+        void visitParamDeclaration(const FlatAst &ast, int node) override {
+            visitVarDeclaration(ast, node);
+        }
+        void visitBlock(const FlatAst &ast, int node) override {
+            int members = ast.a[node];
+            begin(ast, node);
+            list(ast, "procedures", members, ast.b[node]);
+            list(ast, "declarations", members + ast.b[node], ast.c[node]);
+            child(ast, "body", ast.lists[members + ast.b[node] + ast.c[node]]);
+            out.put('}');
+        }
+        void visitProcedure(const FlatAst &ast, int node) override {
+            begin(ast, node);
+            name(ast, node);
+            list(ast, "params", ast.b[node], ast.c[node]);
+            child(ast, "block", ast.a[node]);
+            out.put('}');
+        }
+        void visitProgramNode(const FlatAst &ast, int node) override {
+            begin(ast, node);
+            name(ast, node);
+            child(ast, "block", ast.a[node]);
+            out.put('}');
+        }
+};
+
+// The binary dump is the FlatAst's columns, little-endian:
+//   "PASAST" u8 0, u8 version, u32 root
+//   u32 n, then the n kinds, types and ops as u8, and the n tokens, a, b,
+//   c, payloads (u64 bits) and ends
+//   u32 count + i32 lists, u32 count + u64 values
+//   u32 count + tokens, each u8 type, i32 line, i32 column, u32 length
+//   and the bytes of its value
+// Frames are runtime symbols and are not written; references to them
+// read back as -1.
+static const char AST_MAGIC[6] = {'P', 'A', 'S', 'A', 'S', 'T'};
+static const uint8_t AST_VERSION = 1;
+
+static uint64_t valueBits(Value value) {
+    uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(value));
+    return bits;
+}
+
+void writeBinaryAst(const FlatAst &ast, int root, BufferedWriter &out) {
+    out.write(AST_MAGIC, sizeof(AST_MAGIC));
+    out.writeU8(0);
+    out.writeU8(AST_VERSION);
+    out.writeU32(root);
+    int n = ast.size();
+    out.writeU32(n);
+    for (int i = 0; i < n; ++i)
+        out.writeU8((uint8_t)ast.kinds[i]);
+    for (int i = 0; i < n; ++i)
+        out.writeU8((uint8_t)ast.types[i]);
+    for (int i = 0; i < n; ++i)
+        out.writeU8((uint8_t)ast.ops[i]);
+    for (const auto *column : {&ast.tokens, &ast.a, &ast.b, &ast.c}) {
+        for (int32_t field : *column)
+            out.writeI32(field);
+    }
+    for (Value payload : ast.payloads)
+        out.writeU64(valueBits(payload));
+    for (int32_t end : ast.ends)
+        out.writeI32(end);
+    out.writeU32(ast.lists.size());
+    for (int32_t member : ast.lists)
+        out.writeI32(member);
+    out.writeU32(ast.values.size());
+    for (Value value : ast.values)
+        out.writeU64(valueBits(value));
+    out.writeU32(ast.tokenTable.size());
+    for (const std::shared_ptr<Token> &token : ast.tokenTable) {
+        out.writeU8((uint8_t)token->tokenType);
+        out.writeI32(token->lineno);
+        out.writeI32(token->column);
+        out.writeU32(token->value.size());
+        out.write(token->value);
+    }
+}
+
+// The little-endian fields that BufferedWriter writes, read back from a
+// stream. A short or malformed input throws a runtime_error naming what
+// was being read.
+class BinaryReader {
+    private:
+        std::istream &in;
+        const char *what;
+    public:
+        BinaryReader(std::istream &in, const char *what) : in(in), what(what) {}
+
+        [[noreturn]] void fail(const std::string &message) {
+            throw std::runtime_error(std::string("Bad ") + what + ": " + message);
+        }
+        void read(char *data, size_t size) {
+            if (!in.read(data, size))
+                fail("unexpected end of file");
+        }
+        uint8_t readU8() {
+            char byte;
+            read(&byte, 1);
+            return (uint8_t)byte;
+        }
+        uint32_t readU32() {
+            unsigned char bytes[4];
+            read((char*)bytes, 4);
+            return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+        }
+        int32_t readI32() {
+            return (int32_t)readU32();
+        }
+        uint64_t readU64() {
+            unsigned char bytes[8];
+            read((char*)bytes, 8);
+            uint64_t bits = 0;
+            for (int i = 7; i >= 0; --i)
+                bits = bits << 8 | bytes[i];
+            return bits;
+        }
+        Value readValue() {
+            uint64_t bits = readU64();
+            Value value;
+            std::memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+        // reads a count, refusing one larger than the bytes left could hold
+        uint32_t readCount(size_t bytesPerItem) {
+            uint32_t count = readU32();
+            std::streampos here = in.tellg();
+            in.seekg(0, std::ios::end);
+            std::streamoff left = in.tellg() - here;
+            in.seekg(here);
+            if ((std::streamoff)(count * (uint64_t)bytesPerItem) > left)
+                fail("count larger than the file");
+            return count;
+        }
+};
+
+// Reads a binary dump back into a FlatAst for offline tools. The dump is
+// checked to be a tree whose references stay inside their node's
+// subtree, so any walk over the result terminates; a malformed dump
+// throws a runtime_error.
+class BinaryAstReader: public BinaryReader {
+    private:
+        using BinaryReader::read;
+        // A parsed tree is at most about two levels deep per level of
+        // parser nesting; the printer recurses once per level.
+        static const int MAX_DEPTH = 2 * Parser::MAX_NESTING + 16;
+        std::vector<int> depths;
+
+        // Nodes are checked in index order and a child always comes after
+        // its parent, so a node's depth is known before its children's.
+        // Like the passes, depth leaves out the left links of BinaryOps.
+        void checkChild(const FlatAst &ast, int node, int child) {
+            if (child <= node || child >= ast.ends[node])
+                fail("node " + std::to_string(node) + " refers outside its subtree");
+            bool link = ast.kinds[node] == NodeKind::BINARY_OP && child == ast.a[node];
+            depths[child] = std::max(depths[child], depths[node] + (link ? 0 : 1));
+            if (depths[child] > MAX_DEPTH)
+                fail("node " + std::to_string(child) + " is nested too deep");
+        }
+        void checkList(const FlatAst &ast, int node, int offset, int count) {
+            if (offset < 0 || count < 0 || offset + (long long)count > (long long)ast.lists.size())
+                fail("node " + std::to_string(node) + " has a bad child list");
+            for (int i = 0; i < count; ++i)
+                checkChild(ast, node, ast.lists[offset + i]);
+        }
+        void check(FlatAst &ast, int root) {
+            int n = ast.size();
+            if (root < 0 || root >= n)
+                fail("bad root");
+            depths.assign(n, 0);
+            for (int node = 0; node < n; ++node) {
+                if (ast.ends[node] <= node || ast.ends[node] > n)
+                    fail("bad subtree end at node " + std::to_string(node));
+                if (ast.tokens[node] < -1 || ast.tokens[node] >= (int)ast.tokenTable.size())
+                    fail("bad token at node " + std::to_string(node));
+                int a = ast.a[node], b = ast.b[node], c = ast.c[node];
+                switch (ast.kinds[node]) {
+                    case NodeKind::NUMBER:
+                    case NodeKind::EMPTY:
+                    case NodeKind::VARIABLE:
+                        break;
+                    case NodeKind::BINARY_OP:
+                    case NodeKind::ASSIGN:
+                    case NodeKind::WHILE:
+                    case NodeKind::ASSIGN_VAR_OP_CONST:
+                        checkChild(ast, node, a);
+                        checkChild(ast, node, b);
+                        break;
+                    case NodeKind::UNARY_OP:
+                    case NodeKind::INT_TO_REAL:
+                    case NodeKind::INCREMENT_VAR:
+                    case NodeKind::VAR_DECLARATION:
+                    case NodeKind::PARAM_DECLARATION:
+                    case NodeKind::PROGRAM:
+                        checkChild(ast, node, a);
+                        break;
+                    case NodeKind::IF:
+                        checkChild(ast, node, a);
+                        checkChild(ast, node, b);
+                        if (c != -1)
+                            checkChild(ast, node, c);
+                        break;
+                    case NodeKind::ASSIGN_VAR_OP_VAR:
+                        checkChild(ast, node, a);
+                        checkChild(ast, node, b);
+                        checkChild(ast, node, c);
+                        break;
+                    case NodeKind::COMPOUND:
+                    case NodeKind::PROCEDURE_CALL:
+                    case NodeKind::DECLARATION_ROOT:
+                        checkList(ast, node, a, b);
+                        break;
+                    case NodeKind::FOR:
+                        checkList(ast, node, a, 4);
+                        break;
+                    case NodeKind::BLOCK:
+                        if (b < 0 || c < 0)
+                            fail("bad block at node " + std::to_string(node));
+                        checkList(ast, node, a, b + c + 1);
+                        break;
+                    case NodeKind::PROCEDURE:
+                        checkChild(ast, node, a);
+                        checkList(ast, node, b, c);
+                        break;
+                    case NodeKind::CALL_WITH_CONST_ARGS:
+                        if (a < 0 || b < 0 || a + (long long)b > (long long)ast.values.size())
+                            fail("bad argument list at node " + std::to_string(node));
+                        break;
+                    default:
+                        fail("bad node kind at node " + std::to_string(node));
+                }
+                // the nodes named by their token need one
+                switch (ast.kinds[node]) {
+                    case NodeKind::BINARY_OP:
+                    case NodeKind::UNARY_OP:
+                    case NodeKind::VARIABLE:
+                    case NodeKind::PROCEDURE_CALL:
+                    case NodeKind::CALL_WITH_CONST_ARGS:
+                    case NodeKind::ASSIGN_VAR_OP_CONST:
+                    case NodeKind::ASSIGN_VAR_OP_VAR:
+                    case NodeKind::INCREMENT_VAR:
+                    case NodeKind::PROCEDURE:
+                    case NodeKind::PROGRAM:
+                        if (ast.tokens[node] == -1)
+                            fail("missing token at node " + std::to_string(node));
+                        break;
+                    default:
+                        break;
+                }
+            }
+            // the printer names assignments, loops and declarations by
+            // their variable
+            for (int node = 0; node < n; ++node) {
+                int variable = -1;
+                switch (ast.kinds[node]) {
+                    case NodeKind::ASSIGN:
+                    case NodeKind::VAR_DECLARATION:
+                    case NodeKind::PARAM_DECLARATION:
+                    case NodeKind::ASSIGN_VAR_OP_CONST:
+                    case NodeKind::ASSIGN_VAR_OP_VAR:
+                    case NodeKind::INCREMENT_VAR:
+                        variable = ast.a[node];
+                        break;
+                    case NodeKind::FOR:
+                        variable = ast.lists[ast.a[node]];
+                        break;
+                    default:
+                        continue;
+                }
+                if (ast.kinds[variable] != NodeKind::VARIABLE)
+                    fail("node " + std::to_string(node) + " does not name a variable");
+            }
+        }
+    public:
+        BinaryAstReader(std::istream &in) : BinaryReader(in, "AST dump") {}
+
+        // fills ast and returns the root's index
+        int read(FlatAst &ast) {
+            char magic[sizeof(AST_MAGIC)];
+            read(magic, sizeof(magic));
+            if (std::memcmp(magic, AST_MAGIC, sizeof(magic)) != 0 || readU8() != 0)
+                fail("not an AST dump");
+            if (readU8() != AST_VERSION)
+                fail("unsupported version");
+            int root = readU32();
+            uint32_t n = readCount(3 + 4 * 5 + 8);
+            ast.kinds.resize(n);
+            ast.types.resize(n);
+            ast.ops.resize(n);
+            for (uint32_t i = 0; i < n; ++i) {
+                uint8_t kind = readU8();
+                if (kind > (uint8_t)NodeKind::TYPE)
+                    fail("bad node kind");
+                ast.kinds[i] = (NodeKind)kind;
+            }
+            for (uint32_t i = 0; i < n; ++i) {
+                uint8_t type = readU8();
+                if (type > (uint8_t)Symbol::Type::NO_TYPE)
+                    fail("bad value type");
+                ast.types[i] = (Symbol::Type)type;
+            }
+            for (uint32_t i = 0; i < n; ++i) {
+                uint8_t op = readU8();
+                if (op > (uint8_t)OpKind::BOOL_NOT)
+                    fail("bad operator");
+                ast.ops[i] = (OpKind)op;
+            }
+            for (auto *column : {&ast.tokens, &ast.a, &ast.b, &ast.c}) {
+                column->resize(n);
+                for (uint32_t i = 0; i < n; ++i)
+                    (*column)[i] = readI32();
+            }
+            ast.payloads.resize(n);
+            for (uint32_t i = 0; i < n; ++i)
+                ast.payloads[i] = readValue();
+            ast.ends.resize(n);
+            for (uint32_t i = 0; i < n; ++i)
+                ast.ends[i] = readI32();
+            ast.lists.resize(readCount(4));
+            for (int32_t &member : ast.lists)
+                member = readI32();
+            ast.values.resize(readCount(8));
+            for (Value &value : ast.values)
+                value = readValue();
+            uint32_t numTokens = readCount(13);
+            for (uint32_t i = 0; i < numTokens; ++i) {
+                uint8_t type = readU8();
+                if (type > (uint8_t)TokenType::NOT)
+                    fail("bad token type");
+                int line = readI32();
+                int column = readI32();
+                std::string value(readCount(1), '\0');
+                read(&value[0], value.size());
+                ast.addToken(std::make_shared<Token>((TokenType)type, value, line, column));
+            }
+            // frames are not part of the dump
+            for (uint32_t i = 0; i < n; ++i) {
+                switch (ast.kinds[i]) {
+                    case NodeKind::PROCEDURE_CALL:
+                    case NodeKind::CALL_WITH_CONST_ARGS:
+                        ast.c[i] = -1;
+                        break;
+                    case NodeKind::PROCEDURE:
+                    case NodeKind::PROGRAM:
+                        ast.payloads[i].i = -1;
+                        break;
+                    default:
+                        break;
+                }
+            }
+            check(ast, root);
+            return root;
+        }
+};
+
+// Writes the tree under node to path, as JSON or as a binary dump.
+void dumpTree(Node *node, std::shared_ptr<MemoryBudget> budget, const std::string &path, bool binary) {
+    FlatAst ast(budget);
+    FlatAstBuilder builder(ast);
+    int flatRoot = builder.build(node);
+    std::ofstream file(path, binary ? std::ios::out | std::ios::binary : std::ios::out);
+    if (!file.is_open())
+        throw std::runtime_error("Could not open " + path);
+    {
+        BufferedWriter out(file);
+        if (binary) {
+            writeBinaryAst(ast, flatRoot, out);
+        }
+        else {
+            JsonAstWriter writer(out);
+            ast.accept(flatRoot, &writer);
+            out.put('\n');
+        }
+    }
+    if (!file)
+        throw std::runtime_error("Could not write " + path);
+}
+
+// Prints the tree in a binary dump the same way printTree prints it.
+void printDump(const std::string &path, std::shared_ptr<MemoryBudget> budget) {
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+        throw std::runtime_error("Could not open " + path);
+    FlatAst ast(budget);
+    BinaryAstReader reader(file);
+    int flatRoot = reader.read(ast);
+    BufferedWriter out(std::cout);
+    FlatPrintVisitor printVisitor(out);
+    ast.accept(flatRoot, &printVisitor);
+}
+
+// Prints a dump of the TraceRings one event per line, each with its
+// position and the text of the token there in the program's source.
+void printTrace(const std::string &path, const std::string &source,
+    std::shared_ptr<MemoryBudget> budget) {
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+        throw std::runtime_error("Could not open " + path);
+    BinaryReader reader(file, "trace");
+    char magic[sizeof(TraceRing::MAGIC)];
+    reader.read(magic, sizeof(magic));
+    if (std::memcmp(magic, TraceRing::MAGIC, sizeof(magic)) != 0)
+        reader.fail("not a trace");
+    if (reader.readU8() != TraceRing::VERSION)
+        reader.fail("unsupported version");
+    TokenBuffer tokens(source, budget);
+    tokens.lex();
+    // tokens are in source order, so a position is found by bisection
+    auto tokenAt = [&](uint32_t line, uint32_t column) -> std::string {
+        int low = 0, high = tokens.size();
+        while (low < high) {
+            int mid = (low + high) / 2;
+            if (std::make_pair((uint32_t)tokens.lines[mid], (uint32_t)tokens.columns[mid])
+                < std::make_pair(line, column))
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        if (low == tokens.size() || (uint32_t)tokens.lines[low] != line
+            || (uint32_t)tokens.columns[low] != column)
+            return "?";
+        return tokens.token(low)->value;
+    };
+
+    BufferedWriter out(std::cout);
+    uint32_t numRings = reader.readCount(12);
+    for (uint32_t ring = 0; ring < numRings; ++ring) {
+        uint64_t recorded = reader.readU64();
+        uint32_t kept = reader.readCount(TraceRing::EVENT_SIZE);
+        out.write("Thread ");
+        out.writeInt(ring);
+        out.write(": ");
+        out.writeInt(recorded);
+        out.write(" event(s), the last ");
+        out.writeInt(kept);
+        out.write(":\n");
+        for (uint32_t i = 0; i < kept; ++i) {
+            uint8_t kind = reader.readU8();
+            uint8_t type = reader.readU8();
+            uint16_t level = reader.readU8();
+            level |= reader.readU8() << 8;
+            uint32_t slot = reader.readU32();
+            uint32_t line = reader.readU32();
+            uint32_t column = reader.readU32();
+            Value value = reader.readValue();
+            if (kind > TraceEvent::ASSIGN)
+                reader.fail("bad event kind");
+            out.write("  ");
+            if (line == 0) {
+                out.put('-');
+            }
+            else {
+                out.writeInt(line);
+                out.put(':');
+                out.writeInt(column);
+            }
+            out.put(' ');
+            std::string text = line == 0 ? "<program>" : tokenAt(line, column);
+            switch (kind) {
+                case TraceEvent::STATEMENT:
+                    out.write("statement ");
+                    out.write(text);
+                    break;
+                case TraceEvent::CALL:
+                case TraceEvent::RETURN:
+                    out.write(kind == TraceEvent::CALL ? "call " : "return ");
+                    out.write(text);
+                    out.write(", depth ");
+                    out.writeInt(slot);
+                    break;
+                case TraceEvent::ASSIGN:
+                    out.write("assign ");
+                    out.write(text);
+                    out.write(" := ");
+                    if (type == (uint8_t)Symbol::Type::REAL)
+                        out.writeReal(value.r, 17);
+                    else
+                        out.writeInt(value.i);
+                    out.write(" (level ");
+                    out.writeInt(level);
+                    out.write(", slot ");
+                    out.writeInt(slot);
+                    out.put(')');
+                    break;
+            }
+            out.put('\n');
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+// Writes an ExecutionState for other programs to read, in one pass through
+// a BufferedWriter. The program's record comes first, then the procedure
+// records in the order the procedures returned. Variables are listed in
+// declaration order, parameters first.
+//
+//   JSON    {"records":[{"name":"Main","depth":0,"variables":
+//           [{"name":"x","type":"INTEGER","value":3}, ...]}, ...]}
+//           Reals that are not finite are written as null.
+//   CSV     record,name,depth,variable,type,value with one row per
+//           variable, where record numbers the records from 0
+//   binary  "PASSTATE", u8 version, u32 record count, and per record
+//           u32 depth, the name, u32 variable count and per variable
+//           u8 type, the name and its u64 bits, little-endian; every
+//           name is a u32 length and its bytes
+enum class StateFormat { JSON, CSV, BINARY };
+
+static const char STATE_MAGIC[8] = {'P', 'A', 'S', 'S', 'T', 'A', 'T', 'E'};
+static const uint8_t STATE_VERSION = 1;
+
+class StateWriter {
+    private:
+        const ExecutionState &state;
+        BufferedWriter &out;
+
+        // the records in output order
+        template <typename F>
+        void forEachRecord(F f) {
+            const ExecutionState::Record *global = state.global();
+            if (global != nullptr)
+                f(*global);
+            for (const ExecutionState::Record &record : state.records) {
+                if (&record != global)
+                    f(record);
+            }
+        }
+        static int numVisible(const FrameSymbol *frame) {
+            int count = 0;
+            for (const auto &var : frame->frameVars)
+                count += !var->hidden;
+            return count;
+        }
+        void value(const VarSymbol *var, Value value, bool json) {
+            if (var->valueType != Symbol::Type::REAL)
+                out.writeInt(value.i);
+            else if (json && !std::isfinite(value.r))
+                out.write("null");
+            else
+                out.writeReal(value.r, 17);
+        }
+    public:
+        StateWriter(const ExecutionState &state, BufferedWriter &out) : state(state), out(out) {}
+
+        void writeJson() {
+            bool first = true;
+            out.write("{\"records\":[");
+            forEachRecord([&](const ExecutionState::Record &record) {
+                if (!first)
+                    out.put(',');
+                first = false;
+                out.write("{\"name\":");
+                writeJsonString(out, record.frame->name);
+                out.write(",\"depth\":");
+                out.writeInt(record.depth);
+                out.write(",\"variables\":[");
+                bool firstVar = true;
+                for (int i = 0; i < record.frame->frameSize(); ++i) {
+                    const VarSymbol *var = record.frame->frameVars[i].get();
+                    if (var->hidden)
+                        continue;
+                    if (!firstVar)
+                        out.put(',');
+                    firstVar = false;
+                    out.write("{\"name\":");
+                    writeJsonString(out, var->name);
+                    out.write(",\"type\":\"");
+                    out.write(valueType_tostring(var->valueType));
+                    out.write("\",\"value\":");
+                    value(var, state.values[record.offset + i], true);
+                    out.put('}');
+                }
+                out.write("]}");
+            });
+            out.write("]}\n");
+        }
+        void writeCsv() {
+            int index = 0;
+            out.write("record,name,depth,variable,type,value\n");
+            forEachRecord([&](const ExecutionState::Record &record) {
+                for (int i = 0; i < record.frame->frameSize(); ++i) {
+                    const VarSymbol *var = record.frame->frameVars[i].get();
+                    if (var->hidden)
+                        continue;
+                    out.writeInt(index);
+                    out.put(',');
+                    out.write(record.frame->name);
+                    out.put(',');
+                    out.writeInt(record.depth);
+                    out.put(',');
+                    out.write(var->name);
+                    out.put(',');
+                    out.write(valueType_tostring(var->valueType));
+                    out.put(',');
+                    value(var, state.values[record.offset + i], false);
+                    out.put('\n');
+                }
+                ++index;
+            });
+        }
+        void writeBinary() {
+            out.write(STATE_MAGIC, sizeof(STATE_MAGIC));
+            out.writeU8(STATE_VERSION);
+            out.writeU32(state.records.size());
+            forEachRecord([&](const ExecutionState::Record &record) {
+                out.writeU32(record.depth);
+                out.writeU32(record.frame->name.size());
+                out.write(record.frame->name);
+                out.writeU32(numVisible(record.frame));
+                for (int i = 0; i < record.frame->frameSize(); ++i) {
+                    const VarSymbol *var = record.frame->frameVars[i].get();
+                    if (var->hidden)
+                        continue;
+                    out.writeU8((uint8_t)var->valueType);
+                    out.writeU32(var->name.size());
+                    out.write(var->name);
+                    out.writeU64(valueBits(state.values[record.offset + i]));
+                }
+            });
+        }
+};
+
+void writeState(const ExecutionState &state, StateFormat format, BufferedWriter &out) {
+    StateWriter writer(state, out);
+    switch (format) {
+        case StateFormat::JSON: writer.writeJson(); break;
+        case StateFormat::CSV: writer.writeCsv(); break;
+        case StateFormat::BINARY: writer.writeBinary(); break;
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+
+// The values an INTEGER may take, as a closed interval. lo > hi is the
+// empty range, e.g. of a parameter of a procedure nothing calls.
+struct IntRange {
+    long long lo = 1;
+    long long hi = 0;
+
+    static IntRange all() { return {INT_MIN, INT_MAX}; }
+    static IntRange of(long long value) { return {value, value}; }
+
+    bool empty() const { return lo > hi; }
+    bool contains(long long value) const { return lo <= value && value <= hi; }
+    bool fits() const { return INT_MIN <= lo && hi <= INT_MAX; }
+    bool operator==(const IntRange &other) const {
+        return (empty() && other.empty()) || (lo == other.lo && hi == other.hi);
+    }
+    IntRange join(IntRange other) const {
+        if (empty()) return other;
+        if (other.empty()) return *this;
+        return {std::min(lo, other.lo), std::max(hi, other.hi)};
+    }
+    // the part an INTEGER can hold
+    IntRange clamp() const {
+        return {std::max(lo, (long long)INT_MIN), std::min(hi, (long long)INT_MAX)};
+    }
+};
+
+// Interval analysis for --checked, run after semantic analysis and before
+// the other optimizations. Every INTEGER variable gets one range holding
+// all the values it may have anywhere in the program: its initial 0, what
+// is assigned to it, the span of a FOR loop over it, and for a parameter
+// the arguments of every call. The program is walked until no range grows;
+// after a few walks a range that still grows jumps to the INTEGER bound on
+// that side, so the loop ends. An integer operation is then checked at run
+// time unless its exact result on any operands in their ranges fits in an
+// INTEGER and, for 'div', the divisor can't be 0. A checked operation that
+// goes wrong stops the run, so the values after it stay in range too.
+class RangeAnalyzer: public Visitor {
+    private:
+        static const int EXACT_WALKS = 3;
+        std::unordered_map<VarSymbol*, IntRange> ranges;
+        // the frames of the code being walked, by scope level
+        std::vector<FrameSymbol*> frames;
+        bool globalsPreset;
+        bool widen = false;
+        bool changed = false;
+        IntRange last; // range of the last visited expression
+        std::vector<BinaryOp*> spine;
+
+        IntRange rangeOf(VarSymbol *var) {
+            if (var->valueType != Symbol::Type::INTEGER)
+                return IntRange::all();
+            auto it = ranges.find(var);
+            return it == ranges.end() ? IntRange() : it->second;
+        }
+
+        void assign(VarSymbol *var, IntRange value) {
+            if (var->valueType != Symbol::Type::INTEGER || value.empty())
+                return;
+            IntRange &range = ranges[var];
+            IntRange grown = range.join(value);
+            if (grown == range)
+                return;
+            if (widen && !range.empty()) {
+                if (grown.lo < range.lo) grown.lo = INT_MIN;
+                if (grown.hi > range.hi) grown.hi = INT_MAX;
+            }
+            range = grown;
+            changed = true;
+        }
+
+        VarSymbol *symbolOf(Node *node) {
+            VariableNode *var = node_cast<VariableNode>(node);
+            return frames[var->level]->frameVars[var->slot].get();
+        }
+
+        void enterFrame(FrameSymbol *frame, int numParams, IntRange initial) {
+            if (frames.size() <= (size_t)frame->level)
+                frames.resize(frame->level + 1, nullptr);
+            frames[frame->level] = frame;
+            for (int i = numParams; i < frame->frameSize(); ++i)
+                assign(frame->frameVars[i].get(), initial);
+        }
+
+        // the exact result of an integer operation on any values in left
+        // and right (only left for a negation), before it could overflow
+        static IntRange exact(OpKind kind, IntRange left, IntRange right) {
+            if (left.empty() || (kind != OpKind::INT_NEG && right.empty()))
+                return IntRange();
+            switch (kind) {
+                case OpKind::INT_ADD: return {left.lo + right.lo, left.hi + right.hi};
+                case OpKind::INT_SUB: return {left.lo - right.hi, left.hi - right.lo};
+                case OpKind::INT_NEG: return {-left.hi, -left.lo};
+                case OpKind::INT_MUL: {
+                    IntRange result;
+                    for (long long a : {left.lo, left.hi})
+                        for (long long b : {right.lo, right.hi})
+                            result = result.join(IntRange::of(a * b));
+                    return result;
+                }
+                case OpKind::INT_DIV: {
+                    // the quotient is monotonic on each side of 0, so the
+                    // ends of the divisor's negative and positive parts
+                    // give its extremes
+                    std::vector<long long> divisors;
+                    if (right.lo <= -1)
+                        divisors.insert(divisors.end(), {right.lo, std::min(right.hi, -1LL)});
+                    if (right.hi >= 1)
+                        divisors.insert(divisors.end(), {std::max(right.lo, 1LL), right.hi});
+                    IntRange result;
+                    for (long long divisor : divisors)
+                        result = result.join(IntRange::of(left.lo / divisor)).join(IntRange::of(left.hi / divisor));
+                    return result;
+                }
+                default:
+                    return IntRange::all();
+            }
+        }
+
+        static bool isChecked(OpKind kind) {
+            switch (kind) {
+                case OpKind::INT_ADD: case OpKind::INT_SUB: case OpKind::INT_MUL:
+                case OpKind::INT_DIV: case OpKind::INT_NEG:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        // sets check on an operation and last to what it may leave
+        template <typename Op>
+        void operation(Op *node, IntRange left, IntRange right) {
+            if (!isChecked(node->kind)) {
+                last = IntRange::all();
+                return;
+            }
+            IntRange result = exact(node->kind, left, right);
+            node->check = result.empty() || !result.fits()
+                || (node->kind == OpKind::INT_DIV && right.contains(0));
+            ++numOperations;
+            numChecked += node->check;
+            last = result.clamp();
+        }
+    public:
+        // operations seen and left checked by the last walk
+        int numOperations = 0;
+        int numChecked = 0;
+
+        // globalsPreset: the program's variables may start at any value
+        // rather than 0, as through Execution::setInteger
+        RangeAnalyzer(bool globalsPreset) : globalsPreset(globalsPreset) {}
+
+        void analyze(ProgramNode *program) {
+            for (int walk = 0; ; ++walk) {
+                widen = walk >= EXACT_WALKS;
+                changed = false;
+                numOperations = numChecked = 0;
+                program->accept(this);
+                if (!changed)
+                    break;
+            }
+        }
+
+        void visitProgramNode(ProgramNode *node) override {
+            enterFrame(node->programSymbol.get(), 0, globalsPreset ? IntRange::all() : IntRange::of(0));
+            node->block->accept(this);
+        }
+        void visitProcedure(Procedure *node) override {
+            ProcedureSymbol *symbol = node->procSymbol.get();
+            enterFrame(symbol, symbol->formalParams.size(), IntRange::of(0));
+            node->block->accept(this);
+        }
+        void visitBlock(Block *node) override {
+            size_t depth = frames.size();
+            for (auto &procedure : node->procedures) {
+                procedure->accept(this);
+                frames.resize(depth);
+            }
+            node->compoundStatement->accept(this);
+        }
+        void visitCompoundStatement(CompoundStatement *node) override {
+            for (auto &child : node->statementList) {
+                child->accept(this);
+            }
+        }
+        void visitAssignStatement(AssignStatement *node) override {
+            node->right->accept(this);
+            assign(symbolOf(node->left.get()), last);
+        }
+        void visitProcedureCall(ProcedureCall *node) override {
+            for (int i = 0; i < node->args.size(); i++) {
+                node->args[i]->accept(this);
+                assign(node->procSymbol->frameVars[i].get(), last);
+            }
+        }
+        void visitIfStatement(IfStatement *node) override {
+            node->condition->accept(this);
+            node->thenBranch->accept(this);
+            if (node->elseBranch != nullptr)
+                node->elseBranch->accept(this);
+        }
+        void visitWhileStatement(WhileStatement *node) override {
+            node->condition->accept(this);
+            node->body->accept(this);
+        }
+        // the counter runs from the start to the end, if it runs at all
+        void visitForStatement(ForStatement *node) override {
+            node->start->accept(this);
+            IntRange start = last;
+            node->end->accept(this);
+            IntRange end = last;
+            if (!start.empty() && !end.empty())
+                assign(symbolOf(node->variable.get()),
+                    node->downto ? IntRange{end.lo, start.hi} : IntRange{start.lo, end.hi});
+            node->body->accept(this);
+        }
+
+        void visitNumberNode(NumberNode *node) override {
+            last = node->type == Symbol::Type::INTEGER ? IntRange::of(node->value.i) : IntRange::all();
+        }
+        void visitVariableNode(VariableNode *node) override {
+            last = rangeOf(symbolOf(node));
+        }
+        void visitIntToReal(IntToReal *node) override {
+            node->expr->accept(this);
+            last = IntRange::all();
+        }
+        void visitUnaryOp(UnaryOp *node) override {
+            node->factor->accept(this);
+            if (node->kind != OpKind::IDENTITY)
+                operation(node, last, last);
+        }
+        void visitBinaryOp(BinaryOp *node) override {
+            size_t mark = spine.size();
+            pushLeftSpine(node, spine)->accept(this);
+            while (spine.size() > mark) {
+                BinaryOp *link = spine.back();
+                spine.pop_back();
+                IntRange left = last;
+                link->right->accept(this);
+                operation(link, left, last);
+            }
+        }
+};
+
+// Collects the variables a loop body may write, as (level, slot) pairs.
+// A procedure call may write any variable of an enclosing scope of the
+// callee, so calls are summarized by the highest callee frame level.
+class LoopWriteCollector: public Visitor {
+    private:
+        std::set<std::pair<int, int>> written;
+        int callLevel = 0;
+    public:
+        void addVariable(Node *node) {
+            VariableNode *var = static_cast<VariableNode*>(node);
+            written.insert({var->level, var->slot});
+        }
+        bool isWritten(int level, int slot) {
+            return level < callLevel || written.count({level, slot}) > 0;
+        }
+        void visitCompoundStatement(CompoundStatement *node) override {
+            for (auto &child : node->statementList) {
+                child->accept(this);
+            }
+        }
+        void visitAssignStatement(AssignStatement *node) override {
+            addVariable(node->left.get());
+        }
+        void visitProcedureCall(ProcedureCall *node) override {
+            callLevel = std::max(callLevel, node->procSymbol->level);
+        }
+        void visitIfStatement(IfStatement *node) override {
+            node->thenBranch->accept(this);
+            if (node->elseBranch != nullptr)
+                node->elseBranch->accept(this);
+        }
+        void visitWhileStatement(WhileStatement *node) override {
+            node->body->accept(this);
+        }
+        void visitForStatement(ForStatement *node) override {
+            addVariable(node->variable.get());
+            node->body->accept(this);
+        }
+};
+
+// Moves the largest loop-invariant subexpressions of one loop into hidden
+// temporaries of the frame. The assignments to the temporaries are
+// collected in `hoisted` for the caller to place in front of the loop.
+class InvariantExprMover: public Visitor {
+    private:
+        LoopWriteCollector &writes;
+        FrameSymbol *frame;
+        std::shared_ptr<Token> loopToken;
+        // state of the last visited expression
+        bool lastInvariant = false;
+        bool lastHasOp = false;
+        std::vector<BinaryOp*> spine;
+
+        // integer division may trap, so it only moves with a nonzero
+        // constant divisor; a checked operation may trap whatever it is
+        bool mayTrap(BinaryOp *node) {
+            if (node->check)
+                return true;
+            if (node->kind != OpKind::INT_DIV)
+                return false;
+            NumberNode *divisor = node_as<NumberNode>(node->right.get());
+            return divisor == nullptr || divisor->value.i == 0;
+        }
+
+        void hoist(std::unique_ptr<Node> &expr) {
+            std::string name = "$licm" + std::to_string(frame->frameSize());
+            std::shared_ptr<VarSymbol> temp = std::make_shared<VarSymbol>(name, expr->type);
+            temp->slot = frame->frameSize();
+            temp->level = frame->level;
+            frame->frameVars.push_back(temp);
+
+            std::shared_ptr<Token> tempToken = std::make_shared<Token>(
+                TokenType::VARIABLE, name, loopToken->lineno, loopToken->column);
+            std::shared_ptr<Token> assignToken = std::make_shared<Token>(
+                TokenType::ASSIGN, ":=", loopToken->lineno, loopToken->column);
+            Symbol::Type type = expr->type;
+
+            std::unique_ptr<VariableNode> target = std::make_unique<VariableNode>(tempToken);
+            target->slot = temp->slot;
+            target->level = temp->level;
+            target->type = type;
+            hoisted.push_back(std::make_unique<AssignStatement>(
+                std::move(target), assignToken, std::move(expr)));
+
+            std::unique_ptr<VariableNode> use = std::make_unique<VariableNode>(tempToken);
+            use->slot = temp->slot;
+            use->level = temp->level;
+            use->type = type;
+            expr = std::move(use);
+        }
+
+    public:
+        std::vector<std::unique_ptr<Node>> hoisted;
+
+        void expression(std::unique_ptr<Node> &expr) {
+            expr->accept(this);
+            if (lastInvariant && lastHasOp)
+                hoist(expr);
+        }
+
+        InvariantExprMover(LoopWriteCollector &writes, FrameSymbol *frame,
+            std::shared_ptr<Token> loopToken) : writes(writes), frame(frame), loopToken(loopToken) {}
+
+        void visitNumberNode(NumberNode *node) override {
+            lastInvariant = true;
+            lastHasOp = false;
+        }
+        void visitVariableNode(VariableNode *node) override {
+            lastInvariant = !writes.isWritten(node->level, node->slot);
+            lastHasOp = false;
+        }
+        void visitIntToReal(IntToReal *node) override {
+            node->expr->accept(this);
+        }
+        void visitUnaryOp(UnaryOp *node) override {
+            node->factor->accept(this);
+            if (node->check && lastInvariant) {
+                if (lastHasOp)
+                    hoist(node->factor);
+                lastInvariant = false;
+            }
+            lastHasOp = lastHasOp || node->kind != OpKind::IDENTITY;
+        }
+        void visitBinaryOp(BinaryOp *node) override {
+            size_t mark = spine.size();
+            pushLeftSpine(node, spine)->accept(this);
+            while (spine.size() > mark) {
+                BinaryOp *link = spine.back();
+                spine.pop_back();
+                bool leftInvariant = lastInvariant, leftHasOp = lastHasOp;
+                link->right->accept(this);
+                bool rightInvariant = lastInvariant, rightHasOp = lastHasOp;
+
+                bool invariant = leftInvariant && rightInvariant && !mayTrap(link);
+                if (!invariant) {
+                    if (leftInvariant && leftHasOp)
+                        hoist(link->left);
+                    if (rightInvariant && rightHasOp)
+                        hoist(link->right);
+                }
+                lastInvariant = invariant;
+                lastHasOp = true;
+            }
+        }
+        void visitAssignStatement(AssignStatement *node) override {
+            expression(node->right);
+        }
+        void visitProcedureCall(ProcedureCall *node) override {
+            for (auto &arg : node->args) {
+                expression(arg);
+            }
+        }
+        void visitCompoundStatement(CompoundStatement *node) override {
+            for (auto &child : node->statementList) {
+                child->accept(this);
+            }
+        }
+        void visitIfStatement(IfStatement *node) override {
+            expression(node->condition);
+            node->thenBranch->accept(this);
+            if (node->elseBranch != nullptr)
+                node->elseBranch->accept(this);
+        }
+        void visitWhileStatement(WhileStatement *node) override {
+            expression(node->condition);
+            node->body->accept(this);
+        }
+        void visitForStatement(ForStatement *node) override {
+            expression(node->start);
+            expression(node->end);
+            node->body->accept(this);
+        }
+};
+
+// Loop-invariant code motion, run after semantic analysis. Loops are
+// handled innermost first, and a loop with hoisted expressions is replaced
+// by a compound statement that computes them and then runs the loop, so an
+// enclosing loop can hoist them further. FOR bounds are only evaluated once
+// already, but the bounds of an inner FOR are hoisted out of outer loops.
+class LoopInvariantHoister: public Visitor {
+    private:
+        FrameSymbol *currentFrame = nullptr;
+        // statements to run in front of the loop that was just visited
+        std::vector<std::unique_ptr<Node>> prologue;
+
+        void rewrite(std::unique_ptr<Node> &statement) {
+            statement->accept(this);
+            if (!prologue.empty()) {
+                std::vector<std::unique_ptr<Node>> list = std::move(prologue);
+                prologue.clear();
+                list.push_back(std::move(statement));
+                statement = std::make_unique<CompoundStatement>(std::move(list));
+            }
+        }
+
+        void finish(InvariantExprMover &mover) {
+            numHoisted += mover.hoisted.size();
+            prologue = std::move(mover.hoisted);
+        }
+    public:
+        int numHoisted = 0;
+
+        void visitProgramNode(ProgramNode *node) override {
+            currentFrame = node->programSymbol.get();
+            node->block->accept(this);
+        }
+        void visitProcedure(Procedure *node) override {
+            FrameSymbol *enclosingFrame = currentFrame;
+            currentFrame = node->procSymbol.get();
+            node->block->accept(this);
+            currentFrame = enclosingFrame;
+        }
+        void visitBlock(Block *node) override {
+            for (auto &procedure : node->procedures) {
+                procedure->accept(this);
+            }
+            node->compoundStatement->accept(this);
+        }
+        void visitCompoundStatement(CompoundStatement *node) override {
+            for (auto &child : node->statementList) {
+                rewrite(child);
+            }
+        }
+        void visitIfStatement(IfStatement *node) override {
+            rewrite(node->thenBranch);
+            if (node->elseBranch != nullptr)
+                rewrite(node->elseBranch);
+        }
+        void visitWhileStatement(WhileStatement *node) override {
+            rewrite(node->body);
+            LoopWriteCollector writes;
+            node->body->accept(&writes);
+
+            InvariantExprMover mover(writes, currentFrame, node->token);
+            mover.expression(node->condition);
+            node->body->accept(&mover);
+            finish(mover);
+        }
+        void visitForStatement(ForStatement *node) override {
+            rewrite(node->body);
+            LoopWriteCollector writes;
+            writes.addVariable(node->variable.get());
+            node->body->accept(&writes);
+
+            InvariantExprMover mover(writes, currentFrame, node->token);
+            node->body->accept(&mover);
+            finish(mover);
+        }
+};
+
+// Rewrites common statement shapes into the fused nodes above, so that
+// `x := y + 1`, `x := a * b`, `x := x - c` and calls with constant
+// arguments each run in one visit. Runs after the LoopInvariantHoister.
+class SuperinstructionFuser: public Visitor {
+    private:
+        std::unique_ptr<Node> replacement;
+
+        void rewrite(std::unique_ptr<Node> &statement) {
+            statement->accept(this);
+            if (replacement != nullptr)
+                statement = std::move(replacement);
+        }
+
+        static bool isArithmetic(OpKind kind) {
+            switch (kind) {
+                case OpKind::INT_ADD: case OpKind::INT_SUB:
+                case OpKind::INT_MUL: case OpKind::INT_DIV:
+                case OpKind::REAL_ADD: case OpKind::REAL_SUB:
+                case OpKind::REAL_MUL: case OpKind::REAL_DIV:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        // a literal of the given type, looking through an implicit
+        // conversion of an integer literal to REAL
+        static bool constantOf(Node *node, Symbol::Type type, Value &out) {
+            if (IntToReal *conversion = node_as<IntToReal>(node)) {
+                NumberNode *number = node_as<NumberNode>(conversion->expr.get());
+                if (number == nullptr || type != Symbol::Type::REAL)
+                    return false;
+                out.r = number->value.i;
+                return true;
+            }
+            NumberNode *number = node_as<NumberNode>(node);
+            if (number == nullptr || number->type != type)
+                return false;
+            out = number->value;
+            return true;
+        }
+
+        static std::unique_ptr<VariableNode> takeVariable(std::unique_ptr<Node> &node) {
+            return std::unique_ptr<VariableNode>(static_cast<VariableNode*>(node.release()));
+        }
+
+        static bool sameVariable(VariableNode *a, VariableNode *b) {
+            return a->level == b->level && a->slot == b->slot;
+        }
+
+        static Value negate(OpKind kind, Value value) {
+            if (kind == OpKind::INT_ADD)
+                value.i = -value.i;
+            else
+                value.r = -value.r;
+            return value;
+        }
+    public:
+        int numAssignVarOpConst = 0;
+        int numAssignVarOpVar = 0;
+        int numIncrementVar = 0;
+        int numCallWithConstArgs = 0;
+
+        void visitProgramNode(ProgramNode *node) override {
+            node->block->accept(this);
+        }
+        void visitProcedure(Procedure *node) override {
+            node->block->accept(this);
+        }
+        void visitBlock(Block *node) override {
+            for (auto &procedure : node->procedures) {
+                procedure->accept(this);
+            }
+            node->compoundStatement->accept(this);
+        }
+        void visitCompoundStatement(CompoundStatement *node) override {
+            for (auto &child : node->statementList) {
+                rewrite(child);
+            }
+        }
+        void visitIfStatement(IfStatement *node) override {
+            rewrite(node->thenBranch);
+            if (node->elseBranch != nullptr)
+                rewrite(node->elseBranch);
+        }
+        void visitWhileStatement(WhileStatement *node) override {
+            rewrite(node->body);
+        }
+        void visitForStatement(ForStatement *node) override {
+            rewrite(node->body);
+        }
+
+        void visitAssignStatement(AssignStatement *node) override {
+            BinaryOp *bin = node_as<BinaryOp>(node->right.get());
+            if (bin == nullptr || !isArithmetic(bin->kind))
+                return;
+            VariableNode *target = static_cast<VariableNode*>(node->left.get());
+            VariableNode *leftVar = node_as<VariableNode>(bin->left.get());
+            VariableNode *rightVar = node_as<VariableNode>(bin->right.get());
+            bool additive = bin->kind == OpKind::INT_ADD || bin->kind == OpKind::REAL_ADD
+                || bin->kind == OpKind::INT_SUB || bin->kind == OpKind::REAL_SUB;
+            bool commutative = bin->kind == OpKind::INT_ADD || bin->kind == OpKind::REAL_ADD
+                || bin->kind == OpKind::INT_MUL || bin->kind == OpKind::REAL_MUL;
+            OpKind addKind = bin->type == Symbol::Type::REAL ? OpKind::REAL_ADD : OpKind::INT_ADD;
+            Value constant;
+
+            // operands must already have the operation's type
+            if (leftVar != nullptr && leftVar->type != bin->type)
+                leftVar = nullptr;
+            if (rightVar != nullptr && rightVar->type != bin->type)
+                rightVar = nullptr;
+
+            if (leftVar != nullptr && rightVar != nullptr) {
+                replacement = std::make_unique<AssignVarOpVar>(takeVariable(node->left),
+                    takeVariable(bin->left), takeVariable(bin->right), bin->op, bin->kind, bin->check);
+                ++numAssignVarOpVar;
+            }
+            else if (leftVar != nullptr && constantOf(bin->right.get(), bin->type, constant)) {
+                if (additive && sameVariable(target, leftVar)) {
+                    Value delta = bin->kind == addKind ? constant : negate(addKind, constant);
+                    replacement = std::make_unique<IncrementVar>(takeVariable(node->left),
+                        bin->op, addKind, bin->check, delta);
+                    ++numIncrementVar;
+                }
+                else {
+                    replacement = std::make_unique<AssignVarOpConst>(takeVariable(node->left),
+                        takeVariable(bin->left), bin->op, bin->kind, bin->check, constant);
+                    ++numAssignVarOpConst;
+                }
+            }
+            else if (rightVar != nullptr && commutative
+                && constantOf(bin->left.get(), bin->type, constant)) {
+                if (bin->kind == addKind && sameVariable(target, rightVar)) {
+                    replacement = std::make_unique<IncrementVar>(takeVariable(node->left),
+                        bin->op, addKind, bin->check, constant);
+                    ++numIncrementVar;
+                }
+                else {
+                    replacement = std::make_unique<AssignVarOpConst>(takeVariable(node->left),
+                        takeVariable(bin->right), bin->op, bin->kind, bin->check, constant);
+                    ++numAssignVarOpConst;
+                }
+            }
+        }
+
+        void visitProcedureCall(ProcedureCall *node) override {
+            std::vector<Value> args;
+            for (int i = 0; i < node->args.size(); i++) {
+                Value value;
+                if (!constantOf(node->args[i].get(), node->procSymbol->formalParams[i]->valueType, value))
+                    return;
+                args.push_back(value);
+            }
+            replacement = std::make_unique<CallWithConstArgs>(node->procedure,
+                node->procSymbol, std::move(args));
+            ++numCallWithConstArgs;
+        }
+};
+
+// -----------------------------------------------------------------------------
+
+// The variables a piece of code may read and write, as (level, slot)
+// pairs, and the procedures it calls. Within one frame a pair always
+// names the same variable.
+struct Effects {
+    std::set<std::pair<int, int>> reads;
+    std::set<std::pair<int, int>> writes;
+    std::set<ProcedureSymbol*> callees;
+
+    void add(const Effects &other) {
+        reads.insert(other.reads.begin(), other.reads.end());
+        writes.insert(other.writes.begin(), other.writes.end());
+    }
+    // true if running this and other in either order can differ
+    bool conflicts(const Effects &other) const {
+        for (auto &cell : writes) {
+            if (other.reads.count(cell) || other.writes.count(cell))
+                return true;
+        }
+        for (auto &cell : reads) {
+            if (other.writes.count(cell))
+                return true;
+        }
+        return false;
+    }
+};
+
+// Collects the Effects of a statement or expression, not counting what
+// the procedures it calls do.
+class EffectCollector: public Visitor {
+    private:
+        void read(VariableNode *node) {
+            effects.reads.insert({node->level, node->slot});
+        }
+        void write(VariableNode *node) {
+            effects.writes.insert({node->level, node->slot});
+        }
+        std::vector<BinaryOp*> spine;
+    public:
+        Effects effects;
+
+        void visitBinaryOp(BinaryOp *node) override {
+            size_t mark = spine.size();
+            pushLeftSpine(node, spine)->accept(this);
+            while (spine.size() > mark) {
+                BinaryOp *link = spine.back();
+                spine.pop_back();
+                link->right->accept(this);
+            }
+        }
+        void visitUnaryOp(UnaryOp *node) override {
+            node->factor->accept(this);
+        }
+        void visitIntToReal(IntToReal *node) override {
+            node->expr->accept(this);
+        }
+        void visitVariableNode(VariableNode *node) override {
+            read(node);
+        }
+        void visitCompoundStatement(CompoundStatement *node) override {
+            for (auto &child : node->statementList) {
+                child->accept(this);
+            }
+        }
+        void visitAssignStatement(AssignStatement *node) override {
+            write(node_cast<VariableNode>(node->left.get()));
+            node->right->accept(this);
+        }
+        void visitProcedureCall(ProcedureCall *node) override {
+            for (auto &arg : node->args) {
+                arg->accept(this);
+            }
+            effects.callees.insert(node->procSymbol.get());
+        }
+        void visitIfStatement(IfStatement *node) override {
+            node->condition->accept(this);
+            node->thenBranch->accept(this);
+            if (node->elseBranch != nullptr)
+                node->elseBranch->accept(this);
+        }
+        void visitWhileStatement(WhileStatement *node) override {
+            node->condition->accept(this);
+            node->body->accept(this);
+        }
+        void visitForStatement(ForStatement *node) override {
+            write(node_cast<VariableNode>(node->variable.get()));
+            node->start->accept(this);
+            node->end->accept(this);
+            node->body->accept(this);
+        }
+        void visitAssignVarOpConst(AssignVarOpConst *node) override {
+            write(node->target.get());
+            read(node->source.get());
+        }
+        void visitAssignVarOpVar(AssignVarOpVar *node) override {
+            write(node->target.get());
+            read(node->left.get());
+            read(node->right.get());
+        }
+        void visitIncrementVar(IncrementVar *node) override {
+            write(node->target.get());
+            read(node->target.get());
+        }
+        void visitCallWithConstArgs(CallWithConstArgs *node) override {
+            effects.callees.insert(node->procSymbol.get());
+        }
+};
+
+static Effects collectEffects(Node *node) {
+    EffectCollector collector;
+    node->accept(&collector);
+    return collector.effects;
+}
+
+// The non-local variables a call to each procedure of a program may
+// touch, itself or through anything it calls. A procedure's own frame and
+// the frames it pushes are private to the call. The summaries are
+// iterated until they stop growing, which handles recursion. Built from
+// the final tree, after the optimization passes.
+class ProcedureEffects {
+    private:
+        std::unordered_map<ProcedureSymbol*, Effects> direct;
+
+        void summarize() {
+            for (auto &entry : direct)
+                summaries[entry.first] = Effects();
+            bool changed = true;
+            while (changed) {
+                changed = false;
+                for (auto &entry : direct) {
+                    ProcedureSymbol *procedure = entry.first;
+                    Effects all = entry.second;
+                    for (ProcedureSymbol *callee : entry.second.callees)
+                        all.add(summaries[callee]);
+                    Effects &summary = summaries[procedure];
+                    size_t before = summary.reads.size() + summary.writes.size();
+                    for (auto &cell : all.reads) {
+                        if (cell.first < procedure->level)
+                            summary.reads.insert(cell);
+                    }
+                    for (auto &cell : all.writes) {
+                        if (cell.first < procedure->level)
+                            summary.writes.insert(cell);
+                    }
+                    changed |= summary.reads.size() + summary.writes.size() != before;
+                }
+            }
+        }
+        void findProcedures(Block *block) {
+            for (auto &child : block->procedures) {
+                Procedure *procedure = node_cast<Procedure>(child.get());
+                Block *body = node_cast<Block>(procedure->block.get());
+                direct[procedure->procSymbol.get()] = collectEffects(body->compoundStatement.get());
+                findProcedures(body);
+            }
+        }
+    public:
+        std::unordered_map<ProcedureSymbol*, Effects> summaries;
+
+        ProcedureEffects(ProgramNode *program) {
+            findProcedures(node_cast<Block>(program->block.get()));
+            summarize();
+        }
+};
+
+// Builds the ParallelPlan of every compound statement with at least two
+// call statements. A call's effects are those of its arguments plus its
+// procedure's summary from ProcedureEffects.
+class DependencyAnalyzer: public Visitor {
+    private:
+        std::unique_ptr<ProcedureEffects> procedures;
+    public:
+        int numPlans = 0;
+        int numCalls = 0;
+
+        void visitProgramNode(ProgramNode *node) override {
+            procedures = std::make_unique<ProcedureEffects>(node);
+            node->block->accept(this);
+        }
+        void visitProcedure(Procedure *node) override {
+            node->block->accept(this);
+        }
+        void visitBlock(Block *node) override {
+            for (auto &procedure : node->procedures) {
+                procedure->accept(this);
+            }
+            node->compoundStatement->accept(this);
+        }
+        void visitCompoundStatement(CompoundStatement *node) override {
+            auto plan = std::make_unique<ParallelPlan>();
+            std::vector<Effects> effects;
+            for (auto &child : node->statementList) {
+                Effects statement = collectEffects(child.get());
+                for (ProcedureSymbol *callee : statement.callees)
+                    statement.add(procedures->summaries[callee]);
+                NodeKind kind = child->nodeKind;
+                if (kind == NodeKind::PROCEDURE_CALL || kind == NodeKind::CALL_WITH_CONST_ARGS) {
+                    plan->kinds.push_back(ParallelPlan::Kind::CALL);
+                    ++plan->numCalls;
+                }
+                else if (!statement.callees.empty())
+                    plan->kinds.push_back(ParallelPlan::Kind::BARRIER);
+                else
+                    plan->kinds.push_back(ParallelPlan::Kind::INLINE);
+                // only calls can still be running when a statement starts
+                std::vector<int> waitsFor;
+                for (int j = 0; j < (int)effects.size(); ++j) {
+                    if (plan->kinds[j] == ParallelPlan::Kind::CALL && effects[j].conflicts(statement))
+                        waitsFor.push_back(j);
+                }
+                plan->waitsFor.push_back(std::move(waitsFor));
+                effects.push_back(std::move(statement));
+                child->accept(this);
+            }
+            if (plan->numCalls >= 2) {
+                ++numPlans;
+                numCalls += plan->numCalls;
+                node->plan = std::move(plan);
+            }
+        }
+        void visitIfStatement(IfStatement *node) override {
+            node->thenBranch->accept(this);
+            if (node->elseBranch != nullptr)
+                node->elseBranch->accept(this);
+        }
+        void visitWhileStatement(WhileStatement *node) override {
+            node->body->accept(this);
+        }
+        void visitForStatement(ForStatement *node) override {
+            node->body->accept(this);
+        }
+};
+
+// Marks the procedures whose calls touch no variable outside their own
+// frames. Such a call's effect is fixed by its arguments: it prints the
+// same records each time. Returns how many were marked.
+int markPureProcedures(ProgramNode *program) {
+    ProcedureEffects procedures(program);
+    int numPure = 0;
+    for (auto &entry : procedures.summaries) {
+        entry.first->pure = entry.second.reads.empty() && entry.second.writes.empty();
+        numPure += entry.first->pure;
+    }
+    return numPure;
+}
+
+// -----------------------------------------------------------------------------
+
+// Register machine engine. Every frame slot is a register, so a statement
+// such as 'a := b + c' compiles to one three-address instruction that reads
+// and writes the frame directly. Expression temporaries and constants get
+// registers of their own past the frame's variables; the constants are
+// copied in when the frame is pushed.
+
+#define VM_OPCODES(X) \
+    X(MOVE) X(GETNL) X(SETNL) \
+    X(ADD_I) X(SUB_I) X(MUL_I) X(DIV_I) X(NEG_I) \
+    X(ADD_IC) X(SUB_IC) X(MUL_IC) X(DIV_IC) X(NEG_IC) \
+    X(ADD_R) X(SUB_R) X(MUL_R) X(DIV_R) X(NEG_R) X(I2R) \
+    X(EQ_I) X(NE_I) X(LT_I) X(LE_I) X(GT_I) X(GE_I) \
+    X(EQ_R) X(NE_R) X(LT_R) X(LE_R) X(GT_R) X(GE_R) X(NOT) \
+    X(JMP) X(LOOP) X(JMPF) X(JMPT) \
+    X(JNEQ_I) X(JNNE_I) X(JNLT_I) X(JNLE_I) X(JNGT_I) X(JNGE_I) \
+    X(JNEQ_R) X(JNNE_R) X(JNLT_R) X(JNLE_R) X(JNGT_R) X(JNGE_R) \
+    X(FORLOOP_UP) X(FORLOOP_DOWN) X(CALL) X(RET) X(HALT)
+
+// Operands are register numbers in the current frame unless noted:
+//   MOVE a b         R[a] = R[b]
+//   GETNL a lvl s    R[a] = slot s of the nearest frame at scope level lvl
+//   SETNL lvl s c    slot s of that frame = R[c]
+//   <op> a b c       R[a] = R[b] op R[c]; NEG, NOT and I2R only read R[b]
+//   <op>_IC a b c    <op>_I, throwing an ArithmeticError on overflow or
+//                    division by zero (--checked)
+//   JMP / LOOP c     jump to instruction c; LOOP is a back-edge and counts
+//                    a step against the execution limits
+//   JMPF / JMPT a c  jump to c if R[a] is false / true
+//   JN<cmp> a b c    jump to c unless R[a] cmp R[b]
+//   FORLOOP a b c    while R[a] has not reached R[b], step it towards R[b]
+//                    and jump back to c
+//   CALL f b c       call function f with the c arguments in R[b]...
+//   RET / HALT       pop the frame and return to the caller / stop
+#define VM_ENUM(name) name,
+enum class VMOp {
+    VM_OPCODES(VM_ENUM)
+};
+#undef VM_ENUM
+
+struct VMInstr {
+    VMOp op;
+    int a, b, c;
+};
+
+// The compiled code of the program or of one procedure.
+struct VMFunction {
+    FrameSymbol *symbol = nullptr;
+    std::vector<VMInstr> code = {};
+    std::vector<Value> constants = {}; // copied to the registers at firstConstant
+    int firstConstant = 0;
+    int numRegisters = 0;              // variables, temporaries and constants
+    // offset and operator of each checked instruction, in code order
+    std::vector<std::pair<int, std::shared_ptr<Token>>> operators = {};
+
+    const std::shared_ptr<Token> &operatorAt(const VMInstr *pc) const {
+        int offset = pc - code.data();
+        return std::lower_bound(operators.begin(), operators.end(), offset,
+            [](const std::pair<int, std::shared_ptr<Token>> &entry, int offset) {
+                return entry.first < offset;
+            })->second;
+    }
+};
+
+// functions[0] is the program's main block
+struct VMProgram {
+    std::vector<VMFunction> functions;
+};
+
+// Translates the analysed and optimized AST into a VMProgram. Procedures are
+// compiled when the first call to them is found, so ones that are never
+// called produce no code.
+class VMCompiler: public Visitor {
+    private:
+        VMProgram program;
+        std::unordered_map<ProcedureSymbol*, int> functionIndex;
+        std::vector<int> pending;
+
+        // state of the function being compiled
+        std::vector<VMInstr> code;
+        std::vector<Value> constants;
+        std::vector<Symbol::Type> constantTypes;
+        std::vector<std::pair<int, std::shared_ptr<Token>>> operators;
+        int level = 0;
+        int tempTop = 0;  // next free temporary register
+        int maxTemp = 0;
+        int dest = -1;    // register an expression should be computed into
+        int result = -1;  // register an expression was computed into
+
+        int emit(VMOp op, int a = 0, int b = 0, int c = 0) {
+            code.push_back({op, a, b, c});
+            return code.size() - 1;
+        }
+
+        // an operator's instruction, the checked form if the RangeAnalyzer
+        // left check set on it
+        void emitOperator(OpKind kind, bool check, const std::shared_ptr<Token> &op, int a, int b, int c = 0) {
+            if (!check) {
+                emit(opFor(kind), a, b, c);
+                return;
+            }
+            operators.push_back({(int)code.size(), op});
+            emit(checkedOpFor(kind), a, b, c);
+        }
+
+        // points the jump at index to the next instruction
+        void patch(int index) {
+            code[index].c = code.size();
+        }
+
+        int newTemp() {
+            maxTemp = std::max(maxTemp, tempTop + 1);
+            return tempTop++;
+        }
+
+        // Constants are numbered -1, -2, ... until the function is finished
+        // and the number of temporaries is known.
+        int constant(Value value, Symbol::Type type) {
+            for (size_t i = 0; i < constants.size(); ++i) {
+                if (constantTypes[i] == type && (type == Symbol::Type::REAL
+                    ? std::memcmp(&constants[i].r, &value.r, sizeof(double)) == 0
+                    : constants[i].i == value.i))
+                    return -(int)(i + 1);
+            }
+            constants.push_back(value);
+            constantTypes.push_back(type);
+            return -(int)constants.size();
+        }
+
+        int functionFor(ProcedureSymbol *symbol) {
+            auto it = functionIndex.find(symbol);
+            if (it != functionIndex.end())
+                return it->second;
+            int index = program.functions.size();
+            program.functions.push_back({symbol});
+            functionIndex[symbol] = index;
+            pending.push_back(index);
+            return index;
+        }
+
+        void compileFunction(int index, Block *block, VMOp exitOp) {
+            FrameSymbol *symbol = program.functions[index].symbol;
+            code.clear();
+            constants.clear();
+            constantTypes.clear();
+            operators.clear();
+            level = symbol->level;
+            tempTop = maxTemp = symbol->frameSize();
+
+            block->accept(this);
+            emit(exitOp);
+
+            for (VMInstr &instr : code) {
+                if (instr.a < 0) instr.a = maxTemp - instr.a - 1;
+                if (instr.b < 0) instr.b = maxTemp - instr.b - 1;
+                if (instr.c < 0) instr.c = maxTemp - instr.c - 1;
+            }
+            VMFunction &function = program.functions[index];
+            function.code = std::move(code);
+            function.constants = constants;
+            function.firstConstant = maxTemp;
+            function.numRegisters = maxTemp + constants.size();
+            function.operators = std::move(operators);
+            code = std::vector<VMInstr>();
+            operators = std::vector<std::pair<int, std::shared_ptr<Token>>>();
+        }
+
+        // temporaries of a statement are free again once it is compiled
+        void compileStatement(Node *node) {
+            int mark = tempTop;
+            node->accept(this);
+            tempTop = mark;
+        }
+
+        int compileExpr(Node *node, int into = -1) {
+            dest = into;
+            node->accept(this);
+            return result;
+        }
+
+        void compileInto(Node *node, int into) {
+            int reg = compileExpr(node, into);
+            if (reg != into)
+                emit(VMOp::MOVE, into, reg);
+        }
+
+        // register of a variable, loading it first if it is not local
+        int readVariable(int varLevel, int slot) {
+            if (varLevel == level)
+                return slot;
+            int reg = newTemp();
+            emit(VMOp::GETNL, reg, varLevel, slot);
+            return reg;
+        }
+
+        // register to compute a variable's new value into; storeVariable
+        // then writes it back if the variable is not local
+        int destinationFor(int varLevel, int slot) {
+            return varLevel == level ? slot : newTemp();
+        }
+
+        void storeVariable(int varLevel, int slot, int reg) {
+            if (varLevel != level)
+                emit(VMOp::SETNL, varLevel, slot, reg);
+        }
+
+        // Emits a jump taken when the condition is false and returns its
+        // index for patching. Comparisons fuse with the jump.
+        int jumpUnless(Node *condition) {
+            BinaryOp *bin = node_as<BinaryOp>(condition);
+            VMOp op = bin != nullptr ? branchFor(bin->kind) : VMOp::JMPF;
+            if (op != VMOp::JMPF) {
+                int left = compileExpr(bin->left.get());
+                int right = compileExpr(bin->right.get());
+                return emit(op, left, right);
+            }
+            int reg = compileExpr(condition);
+            return emit(VMOp::JMPF, reg);
+        }
+
+        static VMOp opFor(OpKind kind) {
+            switch (kind) {
+                case OpKind::INT_ADD: return VMOp::ADD_I;
+                case OpKind::INT_SUB: return VMOp::SUB_I;
+                case OpKind::INT_MUL: return VMOp::MUL_I;
+                case OpKind::INT_DIV: return VMOp::DIV_I;
+                case OpKind::INT_NEG: return VMOp::NEG_I;
+                case OpKind::REAL_ADD: return VMOp::ADD_R;
+                case OpKind::REAL_SUB: return VMOp::SUB_R;
+                case OpKind::REAL_MUL: return VMOp::MUL_R;
+                case OpKind::REAL_DIV: return VMOp::DIV_R;
+                case OpKind::REAL_NEG: return VMOp::NEG_R;
+                case OpKind::INT_EQ: return VMOp::EQ_I;
+                case OpKind::INT_NEQ: return VMOp::NE_I;
+                case OpKind::INT_LT: return VMOp::LT_I;
+                case OpKind::INT_LE: return VMOp::LE_I;
+                case OpKind::INT_GT: return VMOp::GT_I;
+                case OpKind::INT_GE: return VMOp::GE_I;
+                case OpKind::REAL_EQ: return VMOp::EQ_R;
+                case OpKind::REAL_NEQ: return VMOp::NE_R;
+                case OpKind::REAL_LT: return VMOp::LT_R;
+                case OpKind::REAL_LE: return VMOp::LE_R;
+                case OpKind::REAL_GT: return VMOp::GT_R;
+                case OpKind::REAL_GE: return VMOp::GE_R;
+                case OpKind::BOOL_NOT: return VMOp::NOT;
+                default: throw std::runtime_error("VMCompiler: no instruction for operator");
+            }
+        }
+
+        static VMOp checkedOpFor(OpKind kind) {
+            switch (kind) {
+                case OpKind::INT_ADD: return VMOp::ADD_IC;
+                case OpKind::INT_SUB: return VMOp::SUB_IC;
+                case OpKind::INT_MUL: return VMOp::MUL_IC;
+                case OpKind::INT_DIV: return VMOp::DIV_IC;
+                case OpKind::INT_NEG: return VMOp::NEG_IC;
+                default: throw std::runtime_error("VMCompiler: no checked instruction for operator");
+            }
+        }
+
+        // the fused compare-and-jump for a comparison, JMPF for anything else
+        static VMOp branchFor(OpKind kind) {
+            switch (kind) {
+                case OpKind::INT_EQ: return VMOp::JNEQ_I;
+                case OpKind::INT_NEQ: return VMOp::JNNE_I;
+                case OpKind::INT_LT: return VMOp::JNLT_I;
+                case OpKind::INT_LE: return VMOp::JNLE_I;
+                case OpKind::INT_GT: return VMOp::JNGT_I;
+                case OpKind::INT_GE: return VMOp::JNGE_I;
+                case OpKind::REAL_EQ: return VMOp::JNEQ_R;
+                case OpKind::REAL_NEQ: return VMOp::JNNE_R;
+                case OpKind::REAL_LT: return VMOp::JNLT_R;
+                case OpKind::REAL_LE: return VMOp::JNLE_R;
+                case OpKind::REAL_GT: return VMOp::JNGT_R;
+                case OpKind::REAL_GE: return VMOp::JNGE_R;
+                default: return VMOp::JMPF;
+            }
+        }
+
+        static Symbol::Type operandType(OpKind kind) {
+            switch (kind) {
+                case OpKind::REAL_ADD: case OpKind::REAL_SUB:
+                case OpKind::REAL_MUL: case OpKind::REAL_DIV:
+                    return Symbol::Type::REAL;
+                default:
+                    return Symbol::Type::INTEGER;
+            }
+        }
+    public:
+        VMProgram compile(ProgramNode *node) {
+            program.functions.push_back({node->programSymbol.get()});
+            compileFunction(0, static_cast<Block*>(node->block.get()), VMOp::HALT);
+            while (!pending.empty()) {
+                int index = pending.back();
+                pending.pop_back();
+                ProcedureSymbol *symbol = static_cast<ProcedureSymbol*>(program.functions[index].symbol);
+                compileFunction(index, symbol->block, VMOp::RET);
+            }
+            return std::move(program);
+        }
+
+        // expressions: each one sets result to the register holding its value
+
+        void visitNumberNode(NumberNode *node) override {
+            result = constant(node->value, node->type);
+        }
+        void visitVariableNode(VariableNode *node) override {
+            if (node->level == level) {
+                result = node->slot;
+                return;
+            }
+            result = dest >= 0 ? dest : newTemp();
+            emit(VMOp::GETNL, result, node->level, node->slot);
+        }
+        // A left chain is compiled bottom up in a loop. dests[k] is the
+        // register spine[k] is asked to leave its value in, or -1 for any;
+        // under an 'and' / 'or' it must end up in the parent's register.
+        void visitBinaryOp(BinaryOp *node) override {
+            std::vector<BinaryOp*> spine;
+            Node *operand = pushLeftSpine(node, spine);
+            std::vector<int> dests(spine.size() + 1);
+            dests[0] = dest;
+            for (size_t k = 0; k < spine.size(); ++k)
+                dests[k + 1] = isLogical(spine[k]) ? newTemp() : -1;
+            int value = compileExpr(operand, dests.back());
+            for (size_t k = spine.size(); k-- > 0;) {
+                if (isLogical(spine[k]) && value != dests[k + 1])
+                    emit(VMOp::MOVE, dests[k + 1], value);
+                BinaryOp *link = spine[k];
+                if (isLogical(link)) {
+                    // the right side only runs when the left does not decide
+                    value = dests[k + 1];
+                    int skip = emit(link->kind == OpKind::BOOL_AND ? VMOp::JMPF : VMOp::JMPT, value);
+                    compileInto(link->right.get(), value);
+                    patch(skip);
+                    continue;
+                }
+                int left = value;
+                int right = compileExpr(link->right.get());
+                value = dests[k] >= 0 ? dests[k] : newTemp();
+                emitOperator(link->kind, link->check, link->op, value, left, right);
+            }
+            result = value;
+        }
+        static bool isLogical(BinaryOp *node) {
+            return node->kind == OpKind::BOOL_AND || node->kind == OpKind::BOOL_OR;
+        }
+        void visitUnaryOp(UnaryOp *node) override {
+            if (node->kind == OpKind::IDENTITY) {
+                compileExpr(node->factor.get(), dest);
+                return;
+            }
+            int into = dest;
+            int factor = compileExpr(node->factor.get());
+            result = into >= 0 ? into : newTemp();
+            emitOperator(node->kind, node->check, node->op, result, factor);
+        }
+        void visitIntToReal(IntToReal *node) override {
+            int into = dest;
+            int expr = compileExpr(node->expr.get());
+            result = into >= 0 ? into : newTemp();
+            emit(VMOp::I2R, result, expr);
+        }
+
+        // statements
+
+        void visitAssignStatement(AssignStatement *node) override {
+            VariableNode *var = static_cast<VariableNode*>(node->left.get());
+            int reg = destinationFor(var->level, var->slot);
+            compileInto(node->right.get(), reg);
+            storeVariable(var->level, var->slot, reg);
+        }
+        void visitCompoundStatement(CompoundStatement *node) override {
+            for (auto &child : node->statementList)
+                compileStatement(child.get());
+        }
+        void visitIfStatement(IfStatement *node) override {
+            int skipThen = jumpUnless(node->condition.get());
+            compileStatement(node->thenBranch.get());
+            if (node->elseBranch == nullptr) {
+                patch(skipThen);
+                return;
+            }
+            int skipElse = emit(VMOp::JMP);
+            patch(skipThen);
+            compileStatement(node->elseBranch.get());
+            patch(skipElse);
+        }
+        void visitWhileStatement(WhileStatement *node) override {
+            int top = code.size();
+            int exit = jumpUnless(node->condition.get());
+            compileStatement(node->body.get());
+            emit(VMOp::LOOP, 0, 0, top);
+            patch(exit);
+        }
+        // the counter and the bound live in temporaries, so the body can
+        // write the loop variable without changing the iteration count
+        void visitForStatement(ForStatement *node) override {
+            VariableNode *var = static_cast<VariableNode*>(node->variable.get());
+            int counter = newTemp();
+            int last = newTemp();
+            compileInto(node->start.get(), counter);
+            compileInto(node->end.get(), last);
+            int exit = emit(node->downto ? VMOp::JNGE_I : VMOp::JNLE_I, counter, last);
+            int top = code.size();
+            if (var->level == level)
+                emit(VMOp::MOVE, var->slot, counter);
+            else
+                emit(VMOp::SETNL, var->level, var->slot, counter);
+            compileStatement(node->body.get());
+            emit(node->downto ? VMOp::FORLOOP_DOWN : VMOp::FORLOOP_UP, counter, last, top);
+            patch(exit);
+        }
+        void visitProcedureCall(ProcedureCall *node) override {
+            int first = tempTop;
+            for (size_t i = 0; i < node->args.size(); i++)
+                newTemp();
+            for (size_t i = 0; i < node->args.size(); i++)
+                compileInto(node->args[i].get(), first + (int)i);
+            emit(VMOp::CALL, functionFor(node->procSymbol.get()), first, node->args.size());
+        }
+        void visitCallWithConstArgs(CallWithConstArgs *node) override {
+            int first = tempTop;
+            for (size_t i = 0; i < node->args.size(); i++) {
+                int reg = newTemp();
+                emit(VMOp::MOVE, reg, constant(node->args[i], node->procSymbol->formalParams[i]->valueType));
+            }
+            emit(VMOp::CALL, functionFor(node->procSymbol.get()), first, node->args.size());
+        }
+        void visitAssignVarOpConst(AssignVarOpConst *node) override {
+            int source = readVariable(node->sourceLevel, node->sourceSlot);
+            int reg = destinationFor(node->targetLevel, node->targetSlot);
+            emitOperator(node->kind, node->check, node->op, reg, source,
+                constant(node->constant, operandType(node->kind)));
+            storeVariable(node->targetLevel, node->targetSlot, reg);
+        }
+        void visitAssignVarOpVar(AssignVarOpVar *node) override {
+            int left = readVariable(node->leftLevel, node->leftSlot);
+            int right = readVariable(node->rightLevel, node->rightSlot);
+            int reg = destinationFor(node->targetLevel, node->targetSlot);
+            emitOperator(node->kind, node->check, node->op, reg, left, right);
+            storeVariable(node->targetLevel, node->targetSlot, reg);
+        }
+        void visitIncrementVar(IncrementVar *node) override {
+            int target = readVariable(node->targetLevel, node->targetSlot);
+            int reg = destinationFor(node->targetLevel, node->targetSlot);
+            emitOperator(node->kind, node->check, node->op, reg, target,
+                constant(node->delta, operandType(node->kind)));
+            storeVariable(node->targetLevel, node->targetSlot, reg);
+        }
+        // procedures are compiled from their symbol when first called
+        void visitBlock(Block *node) override {
+            node->compoundStatement->accept(this);
+        }
+};
+
+// A 64-bit FNV-1a hash of what a snapshot of a run depends on: each
+// function's code, constants and registers and the types of its frame's
+// variables. The same source gives the same value in any process.
+uint64_t programFingerprint(const VMProgram &program) {
+    uint64_t hash = 14695981039346656037ULL;
+    auto mix = [&](uint64_t value) {
+        for (int i = 0; i < 8; ++i) {
+            hash ^= (value >> (8 * i)) & 0xff;
+            hash *= 1099511628211ULL;
+        }
+    };
+    mix(program.functions.size());
+    for (const VMFunction &function : program.functions) {
+        mix(function.numRegisters);
+        mix(function.firstConstant);
+        mix(function.symbol->level);
+        mix(function.symbol->frameSize());
+        for (const auto &var : function.symbol->frameVars)
+            mix((uint64_t)var->valueType);
+        mix(function.constants.size());
+        for (Value constant : function.constants)
+            mix(valueBits(constant));
+        mix(function.code.size());
+        for (const VMInstr &instr : function.code) {
+            mix((uint64_t)instr.op);
+            mix((uint32_t)instr.a);
+            mix((uint32_t)instr.b);
+            mix((uint32_t)instr.c);
+        }
+    }
+    return hash;
+}
+
+// Snapshot of a paused VM run, little-endian:
+//   "PASSNAP" u8 0, u8 version, u64 program fingerprint, u64 steps done
+//   u32 frame count, then per frame from the program's up, u32 function
+//   and u32 offset of the instruction it goes on from; below the top
+//   that is the one after its call
+//   u32 count + u64 bits of the frames' slots, registers included
+// Only the live frames are written. Their bases, the display and the call
+// depth follow from the functions, so they are rebuilt on restore.
+static const char SNAPSHOT_MAGIC[7] = {'P', 'A', 'S', 'S', 'N', 'A', 'P'};
+static const uint8_t SNAPSHOT_VERSION = 1;
+
+// Runs a VMProgram on the shared CallStack. Calls do not recurse on the
+// native stack: the return addresses are kept in a vector of their own.
+// The execution limits are checked at calls and loop back-edges, so a step
+// here is a call or a loop iteration rather than a statement.
+class RegisterVM {
+    private:
+        struct Return {
+            const VMFunction *function;
+            const VMInstr *pc;
+        };
+        std::unique_ptr<CallStack> callStack;
+        std::vector<Return, BudgetAllocator<Return>> returns;
+        ExecutionBudget limits;
+        const Value *initialGlobals = nullptr;
+        // where a paused run goes on from
+        const VMProgram *program = nullptr;
+        const VMFunction *function = nullptr;
+        const VMInstr *pc = nullptr;
+
+        // pushes the function's frame; its arguments are already in place
+        void activate(const VMFunction *function, int numArgs) {
+            FrameSymbol *symbol = function->symbol;
+            callStack->push(symbol, numArgs, function->numRegisters - symbol->frameSize());
+            std::copy(function->constants.begin(), function->constants.end(),
+                callStack->frameSlots() + function->firstConstant);
+        }
+    public:
+        RegisterVM(std::shared_ptr<MemoryBudget> budget,
+            const ExecutionLimits& executionLimits = ExecutionLimits(), ExecutionState *state = nullptr)
+        : callStack(std::make_unique<CallStack>(budget)),
+            returns(BudgetAllocator<Return>(budget, MemoryBudget::Category::CALL_STACK)),
+            limits(executionLimits, callStack.get()) {
+            callStack->recordInto(state);
+        };
+
+        // as in EvalVisitor
+        void presetGlobals(const Value *values) {
+            initialGlobals = values;
+        }
+        void printTo(std::ostream *out) {
+            callStack->printTo(out);
+        }
+
+        void run(const VMProgram &program) {
+            start(program);
+            resume();
+        }
+
+        // Pushes the program's frame; resume() runs it.
+        void start(const VMProgram &program) {
+            this->program = &program;
+            function = &program.functions[0];
+            int base = callStack->reserve(function->numRegisters);
+            int numInitialized = 0;
+            if (initialGlobals != nullptr) {
+                numInitialized = function->symbol->frameSize();
+                std::copy(initialGlobals, initialGlobals + numInitialized, &callStack->slotAt(base));
+            }
+            activate(function, numInitialized);
+            pc = function->code.data();
+        }
+
+        // Runs until the program halts and returns true, or, with a quota,
+        // pauses about that many steps later and returns false. It pauses
+        // where it counts a step (a loop's back edge or a call), with all
+        // of its state in the call stack and the members above, so the
+        // next resume() goes on from there.
+        bool resume(long long quota = 0) {
+            limits.startSlice(quota);
+            const VMProgram &program = *this->program;
+            const VMFunction *function = this->function;
+            const VMInstr *code = function->code.data();
+            const VMInstr *pc = this->pc;
+            Value *R = callStack->frameSlots();
+#define VM_PAUSE() { this->function = function; this->pc = pc; return false; }
+
+#if defined(__GNUC__)
+            // computed goto: one indirect jump per handler instead of a
+            // shared switch
+#define VM_LABEL(name) &&VM_##name,
+            static void *dispatch[] = { VM_OPCODES(VM_LABEL) };
+#undef VM_LABEL
+#define VM_CASE(name) VM_##name:
+#define VM_NEXT() goto *dispatch[(int)pc->op]
+            VM_NEXT();
+#else
+#define VM_CASE(name) case VMOp::name:
+#define VM_NEXT() continue
+            for (;;) switch (pc->op) {
+#endif
+            VM_CASE(MOVE) R[pc->a] = R[pc->b]; ++pc; VM_NEXT();
+            VM_CASE(GETNL) R[pc->a] = callStack->nonLocal(pc->b, pc->c); ++pc; VM_NEXT();
+            VM_CASE(SETNL) callStack->nonLocal(pc->a, pc->b) = R[pc->c]; ++pc; VM_NEXT();
+
+            VM_CASE(ADD_I) R[pc->a].i = R[pc->b].i + R[pc->c].i; ++pc; VM_NEXT();
+            VM_CASE(SUB_I) R[pc->a].i = R[pc->b].i - R[pc->c].i; ++pc; VM_NEXT();
+            VM_CASE(MUL_I) R[pc->a].i = R[pc->b].i * R[pc->c].i; ++pc; VM_NEXT();
+            VM_CASE(DIV_I) R[pc->a].i = R[pc->b].i / R[pc->c].i; ++pc; VM_NEXT();
+            VM_CASE(NEG_I) R[pc->a].i = -R[pc->b].i; ++pc; VM_NEXT();
+#define VM_CHECKED(kind, right) { \
+                ErrorCode error = checkedIntOp(kind, R[pc->b].i, right, R[pc->a].i); \
+                if (error != ErrorCode::NONE) \
+                    throw ArithmeticError(error, function->operatorAt(pc)); \
+                ++pc; }
+            VM_CASE(ADD_IC) VM_CHECKED(OpKind::INT_ADD, R[pc->c].i); VM_NEXT();
+            VM_CASE(SUB_IC) VM_CHECKED(OpKind::INT_SUB, R[pc->c].i); VM_NEXT();
+            VM_CASE(MUL_IC) VM_CHECKED(OpKind::INT_MUL, R[pc->c].i); VM_NEXT();
+            VM_CASE(DIV_IC) VM_CHECKED(OpKind::INT_DIV, R[pc->c].i); VM_NEXT();
+            VM_CASE(NEG_IC) VM_CHECKED(OpKind::INT_NEG, 0); VM_NEXT();
+#undef VM_CHECKED
+            VM_CASE(ADD_R) R[pc->a].r = R[pc->b].r + R[pc->c].r; ++pc; VM_NEXT();
+            VM_CASE(SUB_R) R[pc->a].r = R[pc->b].r - R[pc->c].r; ++pc; VM_NEXT();
+            VM_CASE(MUL_R) R[pc->a].r = R[pc->b].r * R[pc->c].r; ++pc; VM_NEXT();
+            VM_CASE(DIV_R) R[pc->a].r = R[pc->b].r / R[pc->c].r; ++pc; VM_NEXT();
+            VM_CASE(NEG_R) R[pc->a].r = -R[pc->b].r; ++pc; VM_NEXT();
+            VM_CASE(I2R) R[pc->a].r = R[pc->b].i; ++pc; VM_NEXT();
+
+            VM_CASE(EQ_I) R[pc->a].i = R[pc->b].i == R[pc->c].i; ++pc; VM_NEXT();
+            VM_CASE(NE_I) R[pc->a].i = R[pc->b].i != R[pc->c].i; ++pc; VM_NEXT();
+            VM_CASE(LT_I) R[pc->a].i = R[pc->b].i < R[pc->c].i; ++pc; VM_NEXT();
+            VM_CASE(LE_I) R[pc->a].i = R[pc->b].i <= R[pc->c].i; ++pc; VM_NEXT();
+            VM_CASE(GT_I) R[pc->a].i = R[pc->b].i > R[pc->c].i; ++pc; VM_NEXT();
+            VM_CASE(GE_I) R[pc->a].i = R[pc->b].i >= R[pc->c].i; ++pc; VM_NEXT();
+            VM_CASE(EQ_R) R[pc->a].i = R[pc->b].r == R[pc->c].r; ++pc; VM_NEXT();
+            VM_CASE(NE_R) R[pc->a].i = R[pc->b].r != R[pc->c].r; ++pc; VM_NEXT();
+            VM_CASE(LT_R) R[pc->a].i = R[pc->b].r < R[pc->c].r; ++pc; VM_NEXT();
+            VM_CASE(LE_R) R[pc->a].i = R[pc->b].r <= R[pc->c].r; ++pc; VM_NEXT();
+            VM_CASE(GT_R) R[pc->a].i = R[pc->b].r > R[pc->c].r; ++pc; VM_NEXT();
+            VM_CASE(GE_R) R[pc->a].i = R[pc->b].r >= R[pc->c].r; ++pc; VM_NEXT();
+            VM_CASE(NOT) R[pc->a].i = !R[pc->b].i; ++pc; VM_NEXT();
+
+            VM_CASE(JMP) pc = code + pc->c; VM_NEXT();
+            VM_CASE(LOOP) pc = code + pc->c; if (limits.step()) VM_PAUSE(); VM_NEXT();
+            VM_CASE(JMPF) pc = !R[pc->a].i ? code + pc->c : pc + 1; VM_NEXT();
+            VM_CASE(JMPT) pc = R[pc->a].i ? code + pc->c : pc + 1; VM_NEXT();
+
+            VM_CASE(JNEQ_I) pc = !(R[pc->a].i == R[pc->b].i) ? code + pc->c : pc + 1; VM_NEXT();
+            VM_CASE(JNNE_I) pc = !(R[pc->a].i != R[pc->b].i) ? code + pc->c : pc + 1; VM_NEXT();
+            VM_CASE(JNLT_I) pc = !(R[pc->a].i < R[pc->b].i) ? code + pc->c : pc + 1; VM_NEXT();
+            VM_CASE(JNLE_I) pc = !(R[pc->a].i <= R[pc->b].i) ? code + pc->c : pc + 1; VM_NEXT();
+            VM_CASE(JNGT_I) pc = !(R[pc->a].i > R[pc->b].i) ? code + pc->c : pc + 1; VM_NEXT();
+            VM_CASE(JNGE_I) pc = !(R[pc->a].i >= R[pc->b].i) ? code + pc->c : pc + 1; VM_NEXT();
+            VM_CASE(JNEQ_R) pc = !(R[pc->a].r == R[pc->b].r) ? code + pc->c : pc + 1; VM_NEXT();
+            VM_CASE(JNNE_R) pc = !(R[pc->a].r != R[pc->b].r) ? code + pc->c : pc + 1; VM_NEXT();
+            VM_CASE(JNLT_R) pc = !(R[pc->a].r < R[pc->b].r) ? code + pc->c : pc + 1; VM_NEXT();
+            VM_CASE(JNLE_R) pc = !(R[pc->a].r <= R[pc->b].r) ? code + pc->c : pc + 1; VM_NEXT();
+            VM_CASE(JNGT_R) pc = !(R[pc->a].r > R[pc->b].r) ? code + pc->c : pc + 1; VM_NEXT();
+            VM_CASE(JNGE_R) pc = !(R[pc->a].r >= R[pc->b].r) ? code + pc->c : pc + 1; VM_NEXT();
+
+            // the counter is compared before it moves, so a bound at the
+            // edge of the integer range cannot overflow it
+            VM_CASE(FORLOOP_UP)
+                if (R[pc->a].i != R[pc->b].i) {
+                    ++R[pc->a].i;
+                    pc = code + pc->c;
+                    if (limits.step())
+                        VM_PAUSE();
+                }
+                else
+                    ++pc;
+                VM_NEXT();
+            VM_CASE(FORLOOP_DOWN)
+                if (R[pc->a].i != R[pc->b].i) {
+                    --R[pc->a].i;
+                    pc = code + pc->c;
+                    if (limits.step())
+                        VM_PAUSE();
+                }
+                else
+                    ++pc;
+                VM_NEXT();
+
+            VM_CASE(CALL) {
+                const VMFunction *callee = &program.functions[pc->a];
+                int base = callStack->reserve(callee->numRegisters);
+                R = callStack->frameSlots(); // the reserve may have moved the slots
+                for (int i = 0; i < pc->c; ++i)
+                    callStack->slotAt(base + i) = R[pc->b + i];
+                bool pause = limits.step();
+                limits.enter();
+                returns.push_back({function, pc + 1});
+                activate(callee, pc->c);
+                function = callee;
+                code = pc = function->code.data();
+                R = callStack->frameSlots();
+                if (pause)
+                    VM_PAUSE();
+                VM_NEXT();
+            }
+            VM_CASE(RET) {
+                callStack->popRecord();
+                limits.leave();
+                function = returns.back().function;
+                pc = returns.back().pc;
+                returns.pop_back();
+                code = function->code.data();
+                R = callStack->frameSlots();
+                VM_NEXT();
+            }
+            VM_CASE(HALT)
+                callStack->popRecord();
+                return true;
+#if !defined(__GNUC__)
+            }
+#endif
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_PAUSE
+        }
+
+        // Writes the state of a run that start() began and resume() paused.
+        void writeSnapshot(BufferedWriter &out, uint64_t fingerprint) {
+            out.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+            out.writeU8(0);
+            out.writeU8(SNAPSHOT_VERSION);
+            out.writeU64(fingerprint);
+            out.writeU64(limits.steps());
+            auto position = [&](const VMFunction *function, const VMInstr *pc) {
+                out.writeU32(function - program->functions.data());
+                out.writeU32(pc - function->code.data());
+            };
+            out.writeU32(returns.size() + 1);
+            for (const Return &frame : returns)
+                position(frame.function, frame.pc);
+            position(function, pc);
+            int numSlots = callStack->slotsInUse();
+            out.writeU32(numSlots);
+            for (int i = 0; i < numSlots; ++i)
+                out.writeU64(valueBits(callStack->slotAt(i)));
+        }
+
+        // Instead of start(), rebuilds a paused run of program from a
+        // snapshot, so the next resume() goes on from where it was taken.
+        // The frames must form a chain of calls the program can make; a
+        // snapshot of another program or a malformed one throws a
+        // runtime_error.
+        void readSnapshot(std::istream &in, const VMProgram &program, uint64_t fingerprint) {
+            BinaryReader reader(in, "snapshot");
+            char magic[sizeof(SNAPSHOT_MAGIC)];
+            reader.read(magic, sizeof(magic));
+            if (std::memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0 || reader.readU8() != 0)
+                reader.fail("not a snapshot");
+            if (reader.readU8() != SNAPSHOT_VERSION)
+                reader.fail("unsupported version");
+            if (reader.readU64() != fingerprint)
+                reader.fail("taken of a different program");
+            uint64_t steps = reader.readU64();
+            if (steps > (uint64_t)LLONG_MAX / 2)
+                reader.fail("bad step count");
+
+            std::vector<Return> frames(reader.readCount(8));
+            if (frames.empty())
+                reader.fail("no frames");
+            int numSlots = 0;
+            for (size_t i = 0; i < frames.size(); ++i) {
+                uint32_t index = reader.readU32();
+                uint32_t offset = reader.readU32();
+                if (index >= program.functions.size() || (i == 0) != (index == 0))
+                    reader.fail("bad function in frame " + std::to_string(i));
+                const VMFunction *function = &program.functions[index];
+                if (offset >= function->code.size())
+                    reader.fail("bad position in frame " + std::to_string(i));
+                if (i > 0) {
+                    const Return &caller = frames[i - 1];
+                    if (caller.pc == caller.function->code.data() || caller.pc[-1].op != VMOp::CALL
+                        || caller.pc[-1].a != (int)index)
+                        reader.fail("frame " + std::to_string(i) + " was not called from below");
+                }
+                frames[i] = {function, function->code.data() + offset};
+                numSlots += function->numRegisters;
+            }
+            if (reader.readCount(8) != (uint32_t)numSlots)
+                reader.fail("slots do not match the frames");
+
+            this->program = &program;
+            for (size_t i = 0; i < frames.size(); ++i) {
+                const VMFunction *function = frames[i].function;
+                int base = callStack->reserve(function->numRegisters);
+                for (int slot = 0; slot < function->numRegisters; ++slot)
+                    callStack->slotAt(base + slot) = reader.readValue();
+                callStack->push(function->symbol, function->numRegisters,
+                    function->numRegisters - function->symbol->frameSize());
+                if (i > 0)
+                    limits.enter();
+                if (i + 1 < frames.size())
+                    returns.push_back(frames[i]);
+            }
+            function = frames.back().function;
+            pc = frames.back().pc;
+            limits.restoreSteps(steps);
+        }
+};
+
+// -----------------------------------------------------------------------------
+
+// the hook policy the tree engine is instantiated with
+enum class EvalHooks { NONE, TRACE, PROFILE, COVERAGE, RING };
+
+// Runs the program on an EvalVisitor with the given hooks. The hooks
+// report to stderr, also when the run stops with an error. With a pool,
+// compound statements that have a ParallelPlan run their calls on it.
+// With a memo cache, calls to pure procedures go through it.
+template <typename Hooks>
+void evaluate(Node *root, std::shared_ptr<MemoryBudget> budget, const ExecutionLimits& limits,
+    ExecutionState &state, WorkStealingPool *pool = nullptr, MemoCache *memo = nullptr) {
+    std::unique_ptr<EvalVisitor<Hooks>> evalVisitor = std::make_unique<EvalVisitor<Hooks>>(budget, limits, &state);
+    if (pool != nullptr)
+        evalVisitor->useThreads(pool, limits);
+    if (memo != nullptr)
+        evalVisitor->useMemo(memo);
+    try {
+        root->accept(evalVisitor.get());
+    } catch (...) {
+        evalVisitor->hooks.onError();
+        evalVisitor->hooks.report(std::cerr);
+        throw;
+    }
+    evalVisitor->hooks.report(std::cerr);
+}
+
+// Runs an analysed and optimized program on the chosen engine. The records
+// of the frames it pops are kept in state. With more than one thread the
+// tree engine runs independent calls on a WorkStealingPool of that many
+// workers; this is only done without hooks and without a step limit.
+// With memoEntries > 0 the tree engine caches up to that many results of
+// pure procedures, under the same conditions and on one thread.
+void execute(Node *root, std::shared_ptr<MemoryBudget> budget, const ExecutionLimits& limits,
+    Engine engine, ExecutionState &state, EvalHooks hooks = EvalHooks::NONE, int threads = 1,
+    size_t memoEntries = 0) {
+    budget->setPhase(MemoryBudget::Phase::EXECUTION);
+    if (memoEntries > 0 && threads <= 1 && engine == Engine::TREE && hooks == EvalHooks::NONE
+        && limits.maxSteps == 0) {
+        MemoCache memo(budget, memoEntries);
+        memo.numPure = markPureProcedures(static_cast<ProgramNode*>(root));
+        try {
+            evaluate<NoHooks>(root, budget, limits, state, nullptr, &memo);
+        } catch (...) {
+            memo.report(std::cerr);
+            throw;
+        }
+        memo.report(std::cerr);
+        return;
+    }
+    if (threads > 1 && engine == Engine::TREE && hooks == EvalHooks::NONE && limits.maxSteps == 0) {
+        DependencyAnalyzer analyzer;
+        root->accept(&analyzer);
+        std::cerr << "Parallel calls: " << analyzer.numCalls << " call(s) in "
+            << analyzer.numPlans << " compound statement(s) on " << threads << " threads\n";
+        WorkStealingPool pool(threads);
+        budget->setShared(true);
+        try {
+            evaluate<NoHooks>(root, budget, limits, state, &pool);
+        } catch (...) {
+            budget->setShared(false);
+            throw;
+        }
+        budget->setShared(false);
+        return;
+    }
+    if (engine == Engine::VM) {
+        std::unique_ptr<VMCompiler> compiler = std::make_unique<VMCompiler>();
+        VMProgram program = compiler->compile(static_cast<ProgramNode*>(root));
+        std::unique_ptr<RegisterVM> vm = std::make_unique<RegisterVM>(budget, limits, &state);
+        vm->run(program);
+        return;
+    }
+    switch (hooks) {
+        case EvalHooks::TRACE: return evaluate<TraceHooks>(root, budget, limits, state);
+        case EvalHooks::PROFILE: return evaluate<ProfileHooks>(root, budget, limits, state);
+        case EvalHooks::COVERAGE: return evaluate<CoverageHooks>(root, budget, limits, state);
+        case EvalHooks::RING: return evaluate<RingTraceHooks>(root, budget, limits, state);
+        default: return evaluate<NoHooks>(root, budget, limits, state);
+    }
+}
+
+// The program's variables in declaration order, each with its value as
+// printGlobalScope prints it. They outlive the tree the state refers to.
+using GlobalValues = std::vector<std::pair<std::string, std::string>>;
+GlobalValues globalValues(const ExecutionState &state) {
+    GlobalValues values;
+    const ExecutionState::Record *global = state.global();
+    if (global == nullptr)
+        return values;
+    for (int i = 0; i < global->frame->frameSize(); ++i) {
+        VarSymbol *var = global->frame->frameVars[i].get();
+        if (var->hidden)
+            continue;
+        std::stringstream ss;
+        if (var->valueType == Symbol::Type::REAL)
+            ss << state.values[global->offset + i].r;
+        else
+            ss << state.values[global->offset + i].i;
+        values.push_back({var->name, ss.str()});
+    }
+    return values;
+}
+
+// Prints how the variables changed from one run to the next.
+void printGlobalChanges(const GlobalValues &before, const GlobalValues &after) {
+    std::unordered_map<std::string, const std::string*> old;
+    for (auto &var : before)
+        old[var.first] = &var.second;
+    int changes = 0;
+    std::cout << "Changes to the global scope:\n";
+    for (auto &var : after) {
+        auto it = old.find(var.first);
+        if (it == old.end()) {
+            std::cout << "  + " << var.first << " = " << var.second << "\n";
+            ++changes;
+            continue;
         }
-        void visitProcedure(Procedure *node) {
-            ++level;
-            node->block->accept(this);
-            for (auto &dec : node->paramDeclarations) {
-                if (dec != nullptr)
-                    dec->accept(this);
-            }
-            --level;
-            print_with_tabs(level,"");
-            node->print();
+        if (*it->second != var.second) {
+            std::cout << "  " << var.first << ": " << *it->second << " -> " << var.second << "\n";
+            ++changes;
         }
-        void visitProgramNode(ProgramNode *node) {
-            ++level;
-            node->block->accept(this);
-            --level;
-            print_with_tabs(level, "");
-            node->print();
-            std::cout << "\n";
+        old.erase(it);
+    }
+    for (auto &var : before) {
+        if (old.count(var.first) > 0) {
+            std::cout << "  - " << var.first << "\n";
+            ++changes;
         }
-};
-
+    }
+    if (changes == 0)
+        std::cout << "  none\n";
+}
 
-// -----------------------------------------------------------------------------
+// Prints the program's variables in declaration order.
+void printGlobalScope(const ExecutionState &state) {
+    std::cout << "\nGLOBAL SCOPE: \n";
+    const ExecutionState::Record *global = state.global();
+    if (global == nullptr)
+        return;
+    for (int i = 0; i < global->frame->frameSize(); ++i) {
+        VarSymbol *var = global->frame->frameVars[i].get();
+        if (var->hidden)
+            continue;
+        std::cout << "{ [\"" << var->name << "\"] = ";
+        if (var->valueType == Symbol::Type::REAL)
+            std::cout << state.values[global->offset + i].r;
+        else
+            std::cout << state.values[global->offset + i].i;
+        std::cout << " }\n";
+    }
+}
 
 class Interpreter {
     private:
+        std::shared_ptr<MemoryBudget> budget;
         std::unique_ptr<Parser> parser;
-        std::unordered_map<std::string, int> GLOBAL_SCOPE;
         std::unique_ptr<Node> root;
+        ExecutionState state;
         void error(const std::string& message);
     public:
-        Interpreter(const std::string& aText);
-        void interpret();
+        Interpreter(const std::string& aText, size_t memoryLimit = 0);
+        void interpret(const ExecutionLimits& limits = ExecutionLimits(), Engine engine = Engine::TREE,
+            EvalHooks hooks = EvalHooks::NONE, int threads = 1, size_t memoEntries = 0);
         void print_postorder();
+        void dump_ast(const std::string& path, bool binary);
         void build_symbol_table();
+        void optimize(bool checked = false);
         void print_global_scope();
+        ExecutionState& execution_state();
+        void export_state(const std::string& path, StateFormat format);
+        void print_memory_usage();
 };
-Interpreter::Interpreter(const std::string& aText) {
-    parser = std::make_unique<Parser>(aText);
+Interpreter::Interpreter(const std::string& aText, size_t memoryLimit)
+: budget(std::make_shared<MemoryBudget>(memoryLimit)), state(budget) {
+    parser = std::make_unique<Parser>(aText, budget);
     root = parser->parse();
 }
 void Interpreter::error(const std::string& message) {
     throw std::runtime_error(message);
 }
-void Interpreter::interpret() {
-    std::unique_ptr<EvalVisitor> evalVisitor = std::make_unique<EvalVisitor>();
+void Interpreter::interpret(const ExecutionLimits& limits, Engine engine, EvalHooks hooks, int threads,
+    size_t memoEntries) {
     try {
-        root->accept(evalVisitor.get());
-        GLOBAL_SCOPE = evalVisitor->getVarValues();
+        execute(root.get(), budget, limits, engine, state, hooks, threads, memoEntries);
+    } catch(const Error& e) {
+        throw;
     } catch(const std::exception& e) {
         error(e.what());
     }
 }
 void Interpreter::print_postorder() {
-    std::unique_ptr<Visitor> printVisitor = std::make_unique<PrintVisitor>();
-    root->accept(printVisitor.get());
+    printTree(root.get());
+}
+void Interpreter::dump_ast(const std::string& path, bool binary) {
+    dumpTree(root.get(), budget, path, binary);
 }
 // semantic analysis, throws a Semantic Error
 void Interpreter::build_symbol_table() {
-    std::unique_ptr<SemanticAnalyzer> builder = std::make_unique<SemanticAnalyzer>();
+    budget->setPhase(MemoryBudget::Phase::ANALYSIS);
+    std::unique_ptr<SemanticAnalyzer> builder = std::make_unique<SemanticAnalyzer>(budget);
     root->accept(builder.get());
     builder->print_table();
 }
+// optimization passes, run after semantic analysis; checked keeps run-time
+// checks on the integer operations the range analysis can't prove safe
+void Interpreter::optimize(bool checked) {
+    budget->setPhase(MemoryBudget::Phase::OPTIMIZATION);
+    if (checked) {
+        std::unique_ptr<RangeAnalyzer> ranges = std::make_unique<RangeAnalyzer>(false);
+        ranges->analyze(static_cast<ProgramNode*>(root.get()));
+        std::printf("Range analysis: %d of %d integer operation(s) checked\n",
+            ranges->numChecked, ranges->numOperations);
+    }
+    std::unique_ptr<LoopInvariantHoister> hoister = std::make_unique<LoopInvariantHoister>();
+    root->accept(hoister.get());
+    std::printf("Loop-invariant code motion: hoisted %d expression(s)\n", hoister->numHoisted);
+
+    std::unique_ptr<SuperinstructionFuser> fuser = std::make_unique<SuperinstructionFuser>();
+    root->accept(fuser.get());
+    std::printf("Superinstructions: AssignVarOpConst %d, AssignVarOpVar %d, IncrementVar %d, CallWithConstArgs %d\n\n",
+        fuser->numAssignVarOpConst, fuser->numAssignVarOpVar,
+        fuser->numIncrementVar, fuser->numCallWithConstArgs);
+}
+void Interpreter::print_memory_usage() {
+    std::printf("\n");
+    budget->print();
+}
 void Interpreter::print_global_scope() {
-    std::printf("\nGLOBAL SCOPE: \n");
-    for (const auto &pair : GLOBAL_SCOPE) {
-        std::cout << "{ [\"" << pair.first <<  "\"] = " << pair.second << " }\n";
+    printGlobalScope(state);
+}
+// the records of the last run; set keepProcedures before interpret() to
+// keep every procedure's record as well
+ExecutionState& Interpreter::execution_state() {
+    return state;
+}
+void Interpreter::export_state(const std::string& path, StateFormat format) {
+    std::ofstream file(path, std::ios::out | std::ios::binary);
+    if (!file.is_open())
+        error("Could not open " + path);
+    {
+        BufferedWriter out(file);
+        writeState(state, format, out);
+    }
+    if (!file)
+        error("Could not write " + path);
+}
+
+// -----------------------------------------------------------------------------
+
+// The embedding API declared in pascal.h. Compiling runs the same passes as
+// the Interpreter, without printing; the analysed tree and its VM code are
+// only read afterwards. A run gets its own memory budget, evaluator and
+// call stack, with records kept but not printed.
+
+struct CompiledProgram::Impl {
+    size_t memoryLimit;
+    std::shared_ptr<MemoryBudget> budget;
+    std::unique_ptr<Node> root;
+    ProgramSymbol *frame = nullptr;
+    VMProgram vmProgram;
+    uint64_t fingerprint = 0; // checked when a snapshot is restored
+    std::vector<std::string> names;
+    std::unordered_map<std::string, VarSymbol*> variables;
+
+    VarSymbol *variable(const std::string& name) const {
+        auto it = variables.find(name);
+        if (it == variables.end())
+            throw std::invalid_argument("No variable named \'" + name + "\'");
+        return it->second;
+    }
+};
+
+CompiledProgram::CompiledProgram() : impl(std::make_unique<Impl>()) {}
+CompiledProgram::~CompiledProgram() {}
+
+std::shared_ptr<const CompiledProgram> CompiledProgram::compile(const std::string& source,
+    size_t memoryLimit, Arithmetic arithmetic) {
+    std::shared_ptr<CompiledProgram> compiled(new CompiledProgram());
+    Impl &impl = *compiled->impl;
+    impl.memoryLimit = memoryLimit;
+    impl.budget = std::make_shared<MemoryBudget>(memoryLimit);
+    {
+        Parser parser(source, impl.budget);
+        impl.root = parser.parse();
+    }
+    impl.budget->setPhase(MemoryBudget::Phase::ANALYSIS);
+    SemanticAnalyzer analyzer(impl.budget);
+    analyzer.quiet();
+    impl.root->accept(&analyzer);
+
+    impl.budget->setPhase(MemoryBudget::Phase::OPTIMIZATION);
+    ProgramNode *programNode = static_cast<ProgramNode*>(impl.root.get());
+    if (arithmetic == Arithmetic::CHECKED) {
+        // an Execution may preset any of the program's variables
+        RangeAnalyzer ranges(true);
+        ranges.analyze(programNode);
+    }
+    LoopInvariantHoister hoister;
+    impl.root->accept(&hoister);
+    SuperinstructionFuser fuser;
+    impl.root->accept(&fuser);
+    VMCompiler compiler;
+    impl.vmProgram = compiler.compile(programNode);
+    impl.fingerprint = programFingerprint(impl.vmProgram);
+
+    impl.frame = programNode->programSymbol.get();
+    for (auto &var : impl.frame->frameVars) {
+        if (var->hidden)
+            continue;
+        impl.names.push_back(var->name);
+        impl.variables[var->name] = var.get();
+    }
+    return compiled;
+}
+
+const std::vector<std::string>& CompiledProgram::globals() const {
+    return impl->names;
+}
+
+struct Execution::State {
+    std::vector<Value> presets;
+    // the program's frame at the end of the last run
+    std::vector<Value> results;
+    bool ran = false;
+    // a run that start() began and resume() has not finished
+    std::shared_ptr<MemoryBudget> budget;
+    std::unique_ptr<ExecutionState> records;
+    std::unique_ptr<RegisterVM> vm;
+
+    // a VM with nothing on its stack yet, for start() and restore()
+    void begin(const CompiledProgram::Impl &impl, const ExecutionLimits& limits) {
+        stop();
+        ran = false;
+        budget = std::make_shared<MemoryBudget>(impl.memoryLimit);
+        budget->setPhase(MemoryBudget::Phase::EXECUTION);
+        records = std::make_unique<ExecutionState>(budget);
+        vm = std::make_unique<RegisterVM>(budget, limits, records.get());
+        vm->printTo(nullptr);
+    }
+    void finish() {
+        const ExecutionState::Record *global = records->global();
+        results.assign(records->values.begin() + global->offset,
+            records->values.begin() + global->offset + global->frame->frameSize());
+        ran = true;
+    }
+    void stop() {
+        vm.reset();
+        records.reset();
+        budget.reset();
+    }
+};
+
+Execution::Execution(std::shared_ptr<const CompiledProgram> program)
+: program(program), state(std::make_unique<State>()) {
+    Value zero;
+    zero.r = 0.0;
+    state->presets.assign(program->impl->frame->frameSize(), zero);
+}
+Execution::~Execution() {}
+
+void Execution::setInteger(const std::string& name, int value) {
+    VarSymbol *var = program->impl->variable(name);
+    if (var->valueType == Symbol::Type::REAL)
+        state->presets[var->slot].r = value;
+    else
+        state->presets[var->slot].i = value;
+}
+void Execution::setReal(const std::string& name, double value) {
+    VarSymbol *var = program->impl->variable(name);
+    if (var->valueType != Symbol::Type::REAL)
+        throw std::invalid_argument("\'" + name + "\' is not a REAL");
+    state->presets[var->slot].r = value;
+}
+
+void Execution::run(const ExecutionLimits& limits, Engine engine) {
+    if (engine == Engine::VM) {
+        start(limits);
+        resume(0);
+        return;
+    }
+    const CompiledProgram::Impl &impl = *program->impl;
+    state->stop();
+    state->ran = false;
+    state->budget = std::make_shared<MemoryBudget>(impl.memoryLimit);
+    state->budget->setPhase(MemoryBudget::Phase::EXECUTION);
+    state->records = std::make_unique<ExecutionState>(state->budget);
+    {
+        EvalVisitor<NoHooks> evaluator(state->budget, limits, state->records.get());
+        evaluator.presetGlobals(state->presets.data());
+        evaluator.printTo(nullptr);
+        impl.root->accept(&evaluator);
+    }
+    state->finish();
+    state->stop();
+}
+
+void Execution::start(const ExecutionLimits& limits) {
+    const CompiledProgram::Impl &impl = *program->impl;
+    state->begin(impl, limits);
+    state->vm->presetGlobals(state->presets.data());
+    try {
+        state->vm->start(impl.vmProgram);
+    }
+    catch (...) {
+        state->stop();
+        throw;
+    }
+}
+
+void Execution::snapshot(std::ostream& out) const {
+    if (!state->vm)
+        throw std::logic_error("The program is not running");
+    BufferedWriter writer(out);
+    state->vm->writeSnapshot(writer, program->impl->fingerprint);
+}
+
+void Execution::restore(std::istream& in, const ExecutionLimits& limits) {
+    const CompiledProgram::Impl &impl = *program->impl;
+    state->begin(impl, limits);
+    try {
+        state->vm->readSnapshot(in, impl.vmProgram, impl.fingerprint);
+    }
+    catch (...) {
+        state->stop();
+        throw;
+    }
+}
+
+bool Execution::resume(long long steps) {
+    if (!state->vm)
+        throw std::logic_error("The program is not running");
+    try {
+        if (!state->vm->resume(steps))
+            return false;
+    }
+    catch (...) {
+        state->stop();
+        throw;
+    }
+    state->finish();
+    state->stop();
+    return true;
+}
+
+void Execution::cancel() {
+    state->stop();
+}
+
+bool Execution::running() const {
+    return state->vm != nullptr;
+}
+
+void Scheduler::add(Execution& execution, long long quota) {
+    if (!execution.running())
+        throw std::logic_error("The program is not running");
+    entries.push_back({&execution, quota > 0 ? quota : this->quota});
+}
+
+void Scheduler::cancel(Execution& execution) {
+    execution.cancel();
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+        [&](const Entry& entry) { return entry.execution == &execution; }), entries.end());
+}
+
+size_t Scheduler::runRound() {
+    size_t kept = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        Entry entry = entries[i];
+        bool finished;
+        try {
+            finished = !entry.execution->running() || entry.execution->resume(entry.quota);
+        }
+        catch (...) {
+            failed.push_back({entry.execution, std::current_exception()});
+            finished = true;
+        }
+        if (!finished)
+            entries[kept++] = entry;
+    }
+    entries.resize(kept);
+    return kept;
+}
+
+void Scheduler::runAll() {
+    while (runRound() > 0) {}
+}
+
+int Execution::integer(const std::string& name) const {
+    VarSymbol *var = program->impl->variable(name);
+    if (var->valueType != Symbol::Type::INTEGER)
+        throw std::invalid_argument("\'" + name + "\' is not an INTEGER");
+    if (!state->ran)
+        throw std::logic_error("The program has not run");
+    return state->results[var->slot].i;
+}
+double Execution::real(const std::string& name) const {
+    VarSymbol *var = program->impl->variable(name);
+    if (!state->ran)
+        throw std::logic_error("The program has not run");
+    if (var->valueType == Symbol::Type::INTEGER)
+        return state->results[var->slot].i;
+    return state->results[var->slot].r;
+}
+
+// -----------------------------------------------------------------------------
+
+// Keeps a program's tokens, tree and per-procedure results between edits of
+// its source. An edit re-lexes only the damaged stretch of text, and a
+// top-level procedure whose tokens were not touched keeps its analysed and
+// optimized subtree; its printed output and analysis are replayed from its
+// record. Changing a global declaration or any procedure header changes
+// what the other procedures were analysed against, so the whole program is
+// parsed again. The output of run() is that of a full run, except that
+// memory usage is not reported.
+class IncrementalSession: public ReusableProcedures {
+    private:
+        struct CachedProcedure {
+            Procedure *procedure;
+            int first;            // index of its PROCEDURE token
+            int numTokens;
+            size_t hash;          // types and values of its tokens
+            size_t interfaceHash; // its header and those of its nested procedures
+            std::shared_ptr<ProcedureRecord> record;
+            bool taken = false;   // by the parse that follows an edit
+        };
+        std::shared_ptr<MemoryBudget> budget;
+        std::string text;
+        std::unique_ptr<TokenBuffer> tokens;
+        // tokens lexed by the last edit, and how far it moved those after
+        int damageBegin = 0, damageEnd = 0, damageShift = 0;
+        std::unique_ptr<Node> root;
+        std::vector<CachedProcedure> procedures; // top-level, in order
+        // the tree before the current parse; its procedures are taken over
+        // in order, so the next one to look at is previous[cursor]
+        std::unique_ptr<Node> previousRoot;
+        std::vector<CachedProcedure> previous;
+        int cursor = 0;
+        std::unordered_map<std::string, std::shared_ptr<ProcedureSymbol>> previousSymbols;
+        size_t interfaceHash = 0;
+        bool allowReuse = false;
+        int numReused = 0;
+        bool prepared = false;
+        std::string preparedOutput;
+        GlobalValues finalGlobals;
+
+        static void hashCombine(size_t &seed, size_t value) {
+            seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+        }
+        size_t tokenHash(int first, int count);
+        void headerHash(Procedure *node, int depth, size_t &seed);
+        size_t programInterfaceHash();
+        void lexAll();
+        int movedIndex(int index);
+        void relex(int offset, int removed, int inserted, int lineDelta);
+        void parse(bool reuse);
+        void release(int first, int last);
+        void prepare();
+    public:
+        IncrementalSession(const std::string& aText);
+        void edit(int offset, int length, const std::string& replacement);
+        void run(const ExecutionLimits& limits = ExecutionLimits(), Engine engine = Engine::TREE);
+        const std::string& source() {
+            return text;
+        }
+        // the final variables of the last run
+        const GlobalValues& globals() {
+            return finalGlobals;
+        }
+        // the types and text of all the tokens; an edit that keeps it, such
+        // as one to whitespace or a comment, does not change the program
+        size_t contentHash() {
+            return tokens != nullptr ? tokenHash(0, tokens->size()) : 0;
+        }
+        // top-level procedures the last parse took over from the one before
+        int reusedProcedures() {
+            return numReused;
+        }
+        int totalProcedures() {
+            return procedures.size();
+        }
+
+        std::unique_ptr<Node> reuse(int first, int &count) override;
+        std::unique_ptr<Node> parsed(std::unique_ptr<Node> procedure, int first, int count) override;
+};
+IncrementalSession::IncrementalSession(const std::string& aText) {
+    budget = std::make_shared<MemoryBudget>(0);
+    text = aText;
+    lexAll();
+    parse(false);
+}
+size_t IncrementalSession::tokenHash(int first, int count) {
+    size_t seed = 0;
+    for (int i = first; i < first + count; ++i) {
+        hashCombine(seed, (size_t)tokens->types[i]);
+        hashCombine(seed, std::hash<std::string_view>()(
+            std::string_view(text).substr(tokens->starts[i], tokens->lengths[i])));
+    }
+    return seed;
+}
+void IncrementalSession::headerHash(Procedure *node, int depth, size_t &seed) {
+    hashCombine(seed, std::hash<std::string>()(node->id->value));
+    hashCombine(seed, depth);
+    for (auto &param : node->paramDeclarations) {
+        ParamDeclaration *paramDec = static_cast<ParamDeclaration*>(param.get());
+        hashCombine(seed, std::hash<std::string>()(static_cast<VariableNode*>(paramDec->varNode.get())->name));
+        hashCombine(seed, (size_t)static_cast<TypeNode*>(paramDec->typeNode.get())->type->tokenType);
+    }
+    for (auto &nested : static_cast<Block*>(node->block.get())->procedures)
+        headerHash(static_cast<Procedure*>(nested.get()), depth + 1, seed);
+}
+// the program name, its global variables and every procedure header
+size_t IncrementalSession::programInterfaceHash() {
+    ProgramNode *program = static_cast<ProgramNode*>(root.get());
+    size_t seed = std::hash<std::string>()(program->programName->value);
+    for (auto &declaration : static_cast<Block*>(program->block.get())->varDeclarations) {
+        VarDeclaration *varDec = static_cast<VarDeclaration*>(declaration.get());
+        hashCombine(seed, std::hash<std::string>()(static_cast<VariableNode*>(varDec->varNode.get())->name));
+        hashCombine(seed, (size_t)static_cast<TypeNode*>(varDec->typeNode.get())->type->tokenType);
+    }
+    for (CachedProcedure &cached : procedures)
+        hashCombine(seed, cached.interfaceHash);
+    return seed;
+}
+void IncrementalSession::lexAll() {
+    tokens = std::make_unique<TokenBuffer>(text, budget);
+    tokens->lex();
+    if (!tokens->lexerError.empty())
+        throw LexerError(tokens->lexerError);
+    damageBegin = 0;
+    damageEnd = tokens->size();
+    damageShift = 0;
+}
+// where a token from before the last edit is now, or -1 if it was lexed again
+int IncrementalSession::movedIndex(int index) {
+    if (index < damageBegin)
+        return index;
+    if (index >= damageEnd - damageShift)
+        return index + damageShift;
+    return -1;
+}
+// Lexes from the end of the last token before the edit until a token lines
+// up with an old one past the edit, in windows of the text that double
+// until they reach that point. From there on the old tokens are kept and
+// only their offsets and lines are moved.
+void IncrementalSession::relex(int offset, int removed, int inserted, int lineDelta) {
+    int delta = inserted - removed;
+    int editEnd = offset + inserted; // in the new text
+    int size = tokens->size();
+    const int *starts = tokens->starts.data();
+    int firstDamaged = 0; // the first token that ends at or after the edit
+    for (int count = size; count > 0; ) {
+        int half = count / 2;
+        if (tokens->end(firstDamaged + half) < offset) {
+            firstDamaged += half + 1;
+            count -= half + 1;
+        }
+        else
+            count = half;
+    }
+    int firstAfter = std::lower_bound(starts, starts + size, offset + removed) - starts;
+
+    int start = 0, line = 0, column = 0;
+    if (firstDamaged > 0) {
+        int previous = firstDamaged - 1;
+        start = tokens->end(previous);
+        line = tokens->lines[previous];
+        column = tokens->columns[previous] + tokens->lengths[previous] - 1;
+    }
+
+    TokenBuffer fresh(text, budget);
+    int resync = -1;
+    for (size_t window = std::max(1024, 2 * (editEnd - start)); resync < 0; window *= 2) {
+        bool atEnd = start + window >= text.size();
+        std::string piece = text.substr(start, window);
+        std::unique_ptr<Lexer> lexer = start == 0 ? std::make_unique<Lexer>(piece, budget)
+            : std::make_unique<Lexer>(piece, budget, line, column);
+        fresh = TokenBuffer(text, budget);
+        while (true) {
+            TokenType type = lexer->scan();
+            int tokenStart = start + lexer->tokenStart;
+            int tokenEnd = start + lexer->position();
+            // a token at the end of a window may go on past it
+            if (!atEnd && (type == TokenType::END_OF_FILE || lexer->position() >= (int)piece.size()))
+                break;
+            // past the edit an old token reads the same text if it lines up
+            if (tokenStart >= editEnd) {
+                int match = std::lower_bound(starts + firstAfter, starts + size, tokenStart - delta) - starts;
+                if (match < size && starts[match] == tokenStart - delta
+                    && tokens->types[match] == type && tokens->lengths[match] == tokenEnd - tokenStart
+                    && tokens->lines[match] + lineDelta == lexer->tokenLine
+                    && tokens->columns[match] == lexer->tokenColumn) {
+                    resync = match;
+                    break;
+                }
+            }
+            fresh.push(type, tokenStart, tokenEnd, lexer->tokenLine, lexer->tokenColumn);
+            if (type == TokenType::END_OF_FILE) {
+                resync = size;
+                break;
+            }
+        }
+    }
+
+    if (delta != 0) {
+        for (int i = resync; i < size; ++i)
+            tokens->starts[i] += delta;
+    }
+    if (lineDelta != 0) {
+        for (int i = resync; i < size; ++i) {
+            tokens->lines[i] += lineDelta;
+            // tokens the tree refers to carry their line as well
+            if (Token *token = tokens->madeToken(i))
+                token->lineno += lineDelta;
+        }
+    }
+    tokens->replace(firstDamaged, resync, fresh);
+    damageBegin = firstDamaged;
+    damageEnd = firstDamaged + fresh.size();
+    damageShift = fresh.size() - (resync - firstDamaged);
+}
+void IncrementalSession::parse(bool reuse) {
+    previousSymbols.clear();
+    previousRoot = reuse ? std::move(root) : nullptr;
+    previous = reuse && previousRoot != nullptr ? std::move(procedures) : std::vector<CachedProcedure>();
+    cursor = 0;
+    root.reset();
+    procedures.clear();
+    procedures.reserve(previous.size());
+    prepared = false;
+    allowReuse = reuse;
+    numReused = 0;
+
+    std::unique_ptr<Parser> parser = std::make_unique<Parser>(*tokens, budget, this);
+    try {
+        budget->setPhase(MemoryBudget::Phase::PARSE);
+        root = parser->parse();
+    } catch (...) {
+        previousRoot.reset();
+        previous.clear();
+        procedures.clear();
+        throw;
+    }
+    release(cursor, previous.size());
+    previousRoot.reset();
+    previous.clear();
+
+    size_t newInterface = programInterfaceHash();
+    if (numReused > 0 && newInterface != interfaceHash) {
+        // the reused procedures were analysed against other declarations
+        parse(false);
+        return;
+    }
+    interfaceHash = newInterface;
+}
+// previous procedures that were not taken over; a procedure parsed again
+// under the same name keeps its symbol
+void IncrementalSession::release(int first, int last) {
+    for (int i = first; i < last; ++i) {
+        if (previous[i].taken)
+            continue;
+        for (auto &procSym : previous[i].record->symbols)
+            previousSymbols[procSym->name] = procSym;
+    }
+}
+std::unique_ptr<Node> IncrementalSession::reuse(int first, int &count) {
+    if (!allowReuse || (first >= damageBegin && first < damageEnd))
+        return nullptr;
+    int i = cursor;
+    while (i < (int)previous.size() && (previous[i].taken || movedIndex(previous[i].first) < first))
+        ++i;
+    if (i == (int)previous.size() || movedIndex(previous[i].first) != first)
+        return nullptr;
+    // the procedures in between were edited away or are parsed again
+    release(cursor, i);
+    cursor = i;
+    CachedProcedure &cached = previous[i];
+    // all of its tokens have to be on one side of the edit
+    int oldLast = cached.first + cached.numTokens - 1;
+    if (oldLast >= damageBegin && cached.first < damageEnd - damageShift)
+        return nullptr;
+    count = cached.numTokens;
+    Block *block = static_cast<Block*>(static_cast<ProgramNode*>(previousRoot.get())->block.get());
+    std::unique_ptr<Node> node = std::move(block->procedures[i]);
+    procedures.push_back(std::move(cached));
+    procedures.back().first = first;
+    previous[i].taken = true;
+    ++cursor;
+    ++numReused;
+    return node;
+}
+// a procedure that was lexed again but reads the same as the old one in its
+// place, e.g. after an edit inside a comment, still takes over its subtree.
+// One that was edited replaces the old procedure of its name there, so the
+// procedures after it are compared with theirs.
+std::unique_ptr<Node> IncrementalSession::parsed(std::unique_ptr<Node> procedure, int first, int count) {
+    CachedProcedure cached;
+    cached.first = first;
+    cached.numTokens = count;
+    cached.hash = tokenHash(first, count);
+    if (allowReuse && cursor < (int)previous.size() && previous[cursor].hash != cached.hash
+        && previous[cursor].procedure->id->value == static_cast<Procedure*>(procedure.get())->id->value) {
+        release(cursor, cursor + 1);
+        ++cursor;
+    }
+    else if (allowReuse && cursor < (int)previous.size() && previous[cursor].hash == cached.hash) {
+        CachedProcedure &old = previous[cursor];
+        Block *block = static_cast<Block*>(static_cast<ProgramNode*>(previousRoot.get())->block.get());
+        procedure = std::move(block->procedures[cursor]);
+        cached.interfaceHash = old.interfaceHash;
+        cached.record = std::move(old.record);
+        cached.procedure = old.procedure;
+        old.taken = true;
+        ++cursor;
+        ++numReused;
+        procedures.push_back(std::move(cached));
+        return procedure;
+    }
+    cached.procedure = static_cast<Procedure*>(procedure.get());
+    cached.interfaceHash = 0;
+    headerHash(cached.procedure, 0, cached.interfaceHash);
+    cached.record = std::make_shared<ProcedureRecord>();
+    procedures.push_back(std::move(cached));
+    return procedure;
+}
+void IncrementalSession::edit(int offset, int length, const std::string& replacement) {
+    if (offset < 0 || length < 0 || offset + length > (int)text.size())
+        throw std::runtime_error("Edit is outside of the source");
+    std::string removed = text.substr(offset, length);
+    int lineDelta = std::count(replacement.begin(), replacement.end(), '\n')
+        - std::count(removed.begin(), removed.end(), '\n');
+    text.replace(offset, length, replacement);
+    try {
+        if (tokens == nullptr)
+            lexAll();
+        else
+            relex(offset, length, replacement.size(), lineDelta);
+    } catch (...) {
+        // start over from the text on the next edit
+        tokens.reset();
+        root.reset();
+        procedures.clear();
+        throw;
+    }
+    parse(true);
+}
+// Prints the tree, analyses and optimizes it. Procedures with an analysed
+// record are only replayed; the others fill in their record.
+void IncrementalSession::prepare() {
+    OutputCapture capture;
+    ProgramNode *program = static_cast<ProgramNode*>(root.get());
+    Block *block = static_cast<Block*>(program->block.get());
+
+    for (CachedProcedure &cached : procedures) {
+        if (!cached.record->printed.empty()) {
+            std::cout << cached.record->printed;
+            continue;
+        }
+        OutputCapture procedureOutput;
+        printTree(cached.procedure, 2);
+        cached.record->printed = procedureOutput.text();
+    }
+    // the rest of the program, with the procedures set aside
+    std::vector<std::unique_ptr<Node>> topLevel = std::move(block->procedures);
+    printTree(root.get());
+    block->procedures = std::move(topLevel);
+
+    budget->setPhase(MemoryBudget::Phase::ANALYSIS);
+    std::vector<CachedProcedure*> fresh;
+    AnalysisCache cache;
+    for (CachedProcedure &cached : procedures) {
+        cache.records[cached.procedure] = cached.record.get();
+        if (!cached.record->analysed)
+            fresh.push_back(&cached);
+    }
+    cache.symbols = previousSymbols;
+    std::unique_ptr<SemanticAnalyzer> analyzer = std::make_unique<SemanticAnalyzer>(budget);
+    analyzer->useCache(&cache);
+    try {
+        root->accept(analyzer.get());
+    } catch (...) {
+        // the tree is half analysed; parse it again before the next run
+        root.reset();
+        procedures.clear();
+        throw;
+    }
+    analyzer->print_table();
+
+    budget->setPhase(MemoryBudget::Phase::OPTIMIZATION);
+    for (CachedProcedure *cached : fresh) {
+        LoopInvariantHoister hoister;
+        cached->procedure->accept(&hoister);
+        SuperinstructionFuser fuser;
+        cached->procedure->accept(&fuser);
+        ProcedureRecord *record = cached->record.get();
+        record->numHoisted = hoister.numHoisted;
+        record->numAssignVarOpConst = fuser.numAssignVarOpConst;
+        record->numAssignVarOpVar = fuser.numAssignVarOpVar;
+        record->numIncrementVar = fuser.numIncrementVar;
+        record->numCallWithConstArgs = fuser.numCallWithConstArgs;
+    }
+    topLevel = std::move(block->procedures);
+    LoopInvariantHoister hoister;
+    root->accept(&hoister);
+    SuperinstructionFuser fuser;
+    root->accept(&fuser);
+    block->procedures = std::move(topLevel);
+    for (CachedProcedure &cached : procedures) {
+        hoister.numHoisted += cached.record->numHoisted;
+        fuser.numAssignVarOpConst += cached.record->numAssignVarOpConst;
+        fuser.numAssignVarOpVar += cached.record->numAssignVarOpVar;
+        fuser.numIncrementVar += cached.record->numIncrementVar;
+        fuser.numCallWithConstArgs += cached.record->numCallWithConstArgs;
     }
+    std::cout << "Loop-invariant code motion: hoisted " << hoister.numHoisted << " expression(s)\n";
+    std::cout << "Superinstructions: AssignVarOpConst " << fuser.numAssignVarOpConst
+        << ", AssignVarOpVar " << fuser.numAssignVarOpVar
+        << ", IncrementVar " << fuser.numIncrementVar
+        << ", CallWithConstArgs " << fuser.numCallWithConstArgs << "\n\n";
+
+    prepared = true;
+    preparedOutput = capture.text();
+}
+void IncrementalSession::run(const ExecutionLimits& limits, Engine engine) {
+    if (root == nullptr)
+        parse(false);
+    if (prepared)
+        std::cout << preparedOutput;
+    else
+        prepare();
+    ExecutionState state(budget);
+    execute(root.get(), budget, limits, engine, state);
+    printGlobalScope(state);
+    finalGlobals = globalValues(state);
 }
 
 void print_help() {
@@ -1739,20 +8212,28 @@ void print_help() {
     std::printf("\n");
 }
 
-const std::string read_file(const std::string& path) {
+// the file's lines, each after a newline; false if it can't be opened
+bool read_file(const std::string& path, std::string& result) {
     std::ifstream file;
     file.open(path);
 
-    if (!file.is_open()) {
-        std::cout << "Could not open file\n";
-        std::exit(EXIT_FAILURE);
-    }
-    std::string result;
+    if (!file.is_open())
+        return false;
+    result.clear();
     std::string lineBuffer;
     while(std::getline(file, lineBuffer)) {
         result += "\n" + lineBuffer;
     }
     file.close();
+    return true;
+}
+
+const std::string read_file(const std::string& path) {
+    std::string result;
+    if (!read_file(path, result)) {
+        std::cout << "Could not open file\n";
+        std::exit(EXIT_FAILURE);
+    }
     return result;
 }
 
@@ -1774,13 +8255,337 @@ void input_loop() {
     }
 }
 
+// The command-line tool, left out when main.cpp is built as a library
+// (see pascal.h).
+#ifndef PASCAL_NO_MAIN
+
+// run [options] <program file>
+struct Options {
+    std::string programPath;
+    size_t memoryLimit = 0;
+    ExecutionLimits limits;
+    Engine engine = Engine::TREE;
+    EvalHooks hooks = EvalHooks::NONE;
+    std::string jsonDumpPath;
+    std::string binaryDumpPath;
+    std::string readAstPath;
+    std::string readTracePath;
+    std::string traceFile;
+    size_t traceEvents = 0;
+    std::string statePath;
+    StateFormat stateFormat = StateFormat::JSON;
+    bool allRecords = false;
+    int threads = 1;
+    size_t memoEntries = 0;
+    bool watch = false;
+    bool checked = false;
+};
+
+void usage_error(const std::string& message) {
+    std::cout << message << "\n";
+    std::cout << "Usage: run [--memory-limit=BYTES[K|M|G]] [--max-steps=N] [--timeout-ms=N]\n"
+        << "           [--max-depth=N] [--engine=tree|vm] [--hooks=trace|profile|coverage|ring]\n"
+        << "           [--trace-file=PATH] [--trace-events=N]\n"
+        << "           [--dump-json=PATH] [--dump-binary=PATH]\n"
+        << "           [--export-state=PATH] [--export-format=json|csv|binary]\n"
+        << "           [--export-records=global|all] [--threads=N] [--memo=N] [--checked]\n"
+        << "           [--watch] <program file>\n"
+        << "       run --read-ast=PATH\n"
+        << "       run --read-trace=PATH <program file>\n";
+    std::exit(EXIT_FAILURE);
+}
+
+// a byte count with an optional K, M or G suffix
+size_t parse_size(const std::string& text) {
+    size_t pos = 0;
+    unsigned long long value = 0;
+    try {
+        value = std::stoull(text, &pos);
+    } catch (const std::exception& e) {
+        usage_error("Invalid size \'" + text + "\'");
+    }
+    std::string suffix = text.substr(pos);
+    if (suffix == "K" || suffix == "k") value <<= 10;
+    else if (suffix == "M" || suffix == "m") value <<= 20;
+    else if (suffix == "G" || suffix == "g") value <<= 30;
+    else if (!suffix.empty()) usage_error("Invalid size \'" + text + "\'");
+    return value;
+}
+
+// a non-negative count
+long long parse_count(const std::string& text) {
+    size_t pos = 0;
+    long long value = -1;
+    try {
+        value = std::stoll(text, &pos);
+    } catch (const std::exception& e) {}
+    if (value < 0 || pos != text.size())
+        usage_error("Invalid number \'" + text + "\'");
+    return value;
+}
+
+Options parse_options(int argc, char **argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--memory-limit=", 0) == 0) {
+            options.memoryLimit = parse_size(arg.substr(arg.find('=') + 1));
+        }
+        else if (arg.rfind("--max-steps=", 0) == 0) {
+            options.limits.maxSteps = parse_count(arg.substr(arg.find('=') + 1));
+        }
+        else if (arg.rfind("--timeout-ms=", 0) == 0) {
+            options.limits.timeoutMs = parse_count(arg.substr(arg.find('=') + 1));
+        }
+        else if (arg.rfind("--max-depth=", 0) == 0) {
+            options.limits.maxCallDepth = parse_count(arg.substr(arg.find('=') + 1));
+        }
+        else if (arg == "--engine=tree") {
+            options.engine = Engine::TREE;
+        }
+        else if (arg == "--engine=vm") {
+            options.engine = Engine::VM;
+        }
+        else if (arg == "--hooks=trace") {
+            options.hooks = EvalHooks::TRACE;
+        }
+        else if (arg == "--hooks=profile") {
+            options.hooks = EvalHooks::PROFILE;
+        }
+        else if (arg == "--hooks=coverage") {
+            options.hooks = EvalHooks::COVERAGE;
+        }
+        else if (arg == "--hooks=ring") {
+            options.hooks = EvalHooks::RING;
+        }
+        else if (arg.rfind("--trace-file=", 0) == 0) {
+            options.traceFile = arg.substr(arg.find('=') + 1);
+        }
+        else if (arg.rfind("--trace-events=", 0) == 0) {
+            options.traceEvents = parse_count(arg.substr(arg.find('=') + 1));
+        }
+        else if (arg.rfind("--read-trace=", 0) == 0) {
+            options.readTracePath = arg.substr(arg.find('=') + 1);
+        }
+        else if (arg.rfind("--dump-json=", 0) == 0) {
+            options.jsonDumpPath = arg.substr(arg.find('=') + 1);
+        }
+        else if (arg.rfind("--dump-binary=", 0) == 0) {
+            options.binaryDumpPath = arg.substr(arg.find('=') + 1);
+        }
+        else if (arg.rfind("--read-ast=", 0) == 0) {
+            options.readAstPath = arg.substr(arg.find('=') + 1);
+        }
+        else if (arg.rfind("--export-state=", 0) == 0) {
+            options.statePath = arg.substr(arg.find('=') + 1);
+        }
+        else if (arg == "--export-format=json") {
+            options.stateFormat = StateFormat::JSON;
+        }
+        else if (arg == "--export-format=csv") {
+            options.stateFormat = StateFormat::CSV;
+        }
+        else if (arg == "--export-format=binary") {
+            options.stateFormat = StateFormat::BINARY;
+        }
+        else if (arg == "--export-records=global") {
+            options.allRecords = false;
+        }
+        else if (arg == "--export-records=all") {
+            options.allRecords = true;
+        }
+        else if (arg.rfind("--threads=", 0) == 0) {
+            options.threads = parse_count(arg.substr(arg.find('=') + 1));
+        }
+        else if (arg.rfind("--memo=", 0) == 0) {
+            options.memoEntries = parse_count(arg.substr(arg.find('=') + 1));
+        }
+        else if (arg == "--watch") {
+            options.watch = true;
+        }
+        else if (arg == "--checked") {
+            options.checked = true;
+        }
+        else if (arg.rfind("--", 0) == 0) {
+            usage_error("Unknown option " + arg);
+        }
+        else if (options.programPath.empty()) {
+            options.programPath = arg;
+        }
+        else {
+            usage_error("Only one program file can be given.");
+        }
+    }
+    if (!options.readAstPath.empty()) {
+        if (!options.programPath.empty())
+            usage_error("--read-ast does not take a program file.");
+        return options;
+    }
+    if (options.programPath.empty()) {
+        usage_error("Must have a program file path.");
+    }
+    if (!options.readTracePath.empty())
+        return options;
+    if (options.hooks != EvalHooks::NONE && options.engine != Engine::TREE) {
+        usage_error("--hooks needs the tree engine.");
+    }
+    if ((!options.traceFile.empty() || options.traceEvents > 0) && options.hooks != EvalHooks::RING) {
+        usage_error("--trace-file and --trace-events need --hooks=ring.");
+    }
+    if (options.threads > 1 && (options.engine != Engine::TREE || options.hooks != EvalHooks::NONE
+        || options.limits.maxSteps > 0)) {
+        usage_error("--threads needs the tree engine and cannot be used with --hooks or --max-steps.");
+    }
+    if (options.memoEntries > 0 && (options.engine != Engine::TREE || options.hooks != EvalHooks::NONE
+        || options.limits.maxSteps > 0 || options.threads > 1)) {
+        usage_error("--memo needs the tree engine and cannot be used with --hooks, --max-steps or --threads.");
+    }
+    if (options.watch && (options.hooks != EvalHooks::NONE || options.threads > 1 || options.memoEntries > 0
+        || options.memoryLimit > 0 || !options.jsonDumpPath.empty() || !options.binaryDumpPath.empty()
+        || !options.statePath.empty() || options.allRecords || options.checked)) {
+        usage_error("--watch can only be combined with --engine, --max-steps, --timeout-ms and --max-depth.");
+    }
+    return options;
+}
+
+// Runs the program, then again each time its file is saved, until the
+// process is stopped. The file's directory is watched with inotify, since
+// many editors save by renaming a new file over the old one. An
+// IncrementalSession turns each save into a single edit of the text it
+// had, so only the procedures whose tokens changed are parsed, analysed
+// and optimized again. A save that leaves the tokens as they were, e.g.
+// one to whitespace or a comment, keeps the last result without running.
+// After the first run only the changes to the global scope are printed.
+int watch_program(const Options& options) {
+#if defined(__linux__)
+    const std::string &path = options.programPath;
+    size_t slash = path.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "." : path.substr(0, std::max(slash, (size_t)1));
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        std::cerr << "Could not watch " << directory << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::unique_ptr<IncrementalSession> session;
+    // the result of the last run that finished, and the tokens it ran
+    bool finished = false;
+    GlobalValues globals;
+    size_t hash = 0;
+    try {
+        session = std::make_unique<IncrementalSession>(read_file(path));
+        session->run(options.limits, options.engine);
+        globals = session->globals();
+        hash = session->contentHash();
+        finished = true;
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+    std::cout << "Watching " << path << " for changes" << std::endl;
+
+    alignas(inotify_event) char events[4096];
+    std::string text;
+    while (true) {
+        ssize_t length = read(fd, events, sizeof(events));
+        if (length < 0 && errno == EINTR)
+            continue;
+        if (length <= 0)
+            break;
+        bool saved = false;
+        for (char *p = events; p < events + length; ) {
+            const inotify_event *event = reinterpret_cast<const inotify_event*>(p);
+            if (event->len > 0 && name == event->name)
+                saved = true;
+            p += sizeof(inotify_event) + event->len;
+        }
+        if (!saved || !read_file(path, text))
+            continue;
+        if (session != nullptr && text == session->source())
+            continue;
+
+        auto start = std::chrono::steady_clock::now();
+        try {
+            if (session == nullptr) {
+                session = std::make_unique<IncrementalSession>(text);
+            }
+            else {
+                // the edit is what lies between the common prefix and suffix
+                const std::string &old = session->source();
+                size_t prefix = 0;
+                size_t limit = std::min(old.size(), text.size());
+                while (prefix < limit && old[prefix] == text[prefix])
+                    ++prefix;
+                size_t suffix = 0;
+                while (suffix < limit - prefix && old[old.size() - 1 - suffix] == text[text.size() - 1 - suffix])
+                    ++suffix;
+                session->edit(prefix, old.size() - prefix - suffix,
+                    text.substr(prefix, text.size() - prefix - suffix));
+            }
+            size_t newHash = session->contentHash();
+            if (finished && newHash == hash) {
+                std::cout << "\n" << path << " saved; the tokens did not change" << std::endl;
+                continue;
+            }
+            {
+                OutputSilencer silencer;
+                session->run(options.limits, options.engine);
+            }
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "\n" << path << " saved; reused " << session->reusedProcedures() << " of "
+                << session->totalProcedures() << " procedure(s), ran in " << ms << " ms\n";
+            printGlobalChanges(globals, session->globals());
+            std::cout << std::flush;
+            globals = session->globals();
+            hash = newHash;
+            finished = true;
+        }
+        catch (const std::exception& e) {
+            std::cout << std::flush;
+            std::cerr << "\n" << e.what() << std::endl;
+        }
+    }
+    std::cerr << "Stopped watching " << path << std::endl;
+    close(fd);
+    return EXIT_FAILURE;
+#else
+    std::cerr << "--watch needs inotify, which is only available on Linux" << std::endl;
+    return EXIT_FAILURE;
+#endif
+}
+
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        std::cout << "Must have a program file path.\n";
-        std::exit(EXIT_FAILURE);
+    Options options = parse_options(argc, argv);
+    if (!options.readAstPath.empty()) {
+        try {
+            printDump(options.readAstPath, std::make_shared<MemoryBudget>(options.memoryLimit));
+        }
+        catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        return 0;
     }
-    std::string programPath = std::string(argv[1]);
+    if (options.watch)
+        return watch_program(options);
+    std::string programPath = options.programPath;
     const std::string input = read_file(programPath);
+    if (!options.readTracePath.empty()) {
+        try {
+            printTrace(options.readTracePath, input, std::make_shared<MemoryBudget>(options.memoryLimit));
+        }
+        catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        return 0;
+    }
+    if (options.hooks == EvalHooks::RING) {
+        TraceRing::configure(options.traceFile.empty() ? "pascal.trace" : options.traceFile,
+            options.traceEvents > 0 ? options.traceEvents : 1 << 16);
+        TraceRing::dumpOnSignals();
+    }
     
     // std::cout << "Program path is " << programPath << "\n";
     // std::cout << "Input string is " << input << "\n";
@@ -1788,11 +8593,21 @@ int main(int argc, char **argv) {
     try {
         // std::unique_ptr<SymbolTable> tab = std::make_unique<SymbolTable>();
         // tab->print();
-        std::unique_ptr<Interpreter> interpreter = std::make_unique<Interpreter>(input);
+        std::unique_ptr<Interpreter> interpreter = std::make_unique<Interpreter>(input, options.memoryLimit);
         interpreter->print_postorder();
+        if (!options.jsonDumpPath.empty())
+            interpreter->dump_ast(options.jsonDumpPath, false);
+        if (!options.binaryDumpPath.empty())
+            interpreter->dump_ast(options.binaryDumpPath, true);
         interpreter->build_symbol_table();
-        interpreter->interpret();
+        interpreter->optimize(options.checked);
+        interpreter->execution_state().keepProcedures = options.allRecords;
+        interpreter->interpret(options.limits, options.engine, options.hooks, options.threads,
+            options.memoEntries);
         interpreter->print_global_scope();
+        if (!options.statePath.empty())
+            interpreter->export_state(options.statePath, options.stateFormat);
+        interpreter->print_memory_usage();
         std::cout << "Done\n";
     }
     catch (const std::exception& e) {
@@ -1800,4 +8615,6 @@ int main(int argc, char **argv) {
         std::cerr << errormessage << std::endl;
     }
     return 0;
-}
\ No newline at end of file
+}
+
+#endif
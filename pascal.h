@@ -0,0 +1,151 @@
+// Embedding API of the interpreter.
+//
+// A program is compiled once into a CompiledProgram: lexed, parsed,
+// analysed and optimized, with nothing printed. It never changes after
+// that, so any number of threads may run it at once. Each run is an
+// Execution, which can preset the program's variables before it runs and
+// read them back afterwards. Runs print nothing either.
+//
+//     std::shared_ptr<const CompiledProgram> program = CompiledProgram::compile(source);
+//     Execution run(program);
+//     run.setInteger("limit", 10);
+//     run.run();
+//     int total = run.integer("total");
+//
+// With the VM engine a run can also be taken in slices: start() it, then
+// resume() it a number of steps at a time until it returns true. A
+// Scheduler does that in turn for many Executions on one thread. A paused
+// run can be saved with snapshot() and carried on with restore() by an
+// Execution of the same program, in this process or another.
+//
+// main.cpp is the implementation. Compile it with PASCAL_NO_MAIN defined to
+// leave out the command-line tool:
+//
+//     g++ -std=c++17 -O2 -DPASCAL_NO_MAIN -c main.cpp -o pascal.o
+
+#ifndef PASCAL_H
+#define PASCAL_H
+
+#include <cstddef>
+#include <exception>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Limits on one execution; 0 means unlimited. The default call depth keeps
+// deep recursion well inside the native stack of the tree-walking evaluator.
+struct ExecutionLimits {
+    long long maxSteps = 0;     // statements and calls executed
+    long long timeoutMs = 0;    // wall clock
+    int maxCallDepth = 10000;
+};
+
+// how the program is executed after it has been analysed and optimized
+enum class Engine { TREE, VM };
+
+// CHECKED makes an INTEGER operation that overflows or divides by zero
+// throw an error naming its operator instead of wrapping or crashing.
+// Compiling works out the range of each variable and leaves out the checks
+// of the operations that can't go wrong. A preset variable may hold any
+// value, and the values of a restored snapshot are trusted.
+enum class Arithmetic { UNCHECKED, CHECKED };
+
+class CompiledProgram {
+    public:
+        // Throws a std::exception if the source does not lex, parse or pass
+        // semantic analysis. memoryLimit caps the memory of compiling and of
+        // each run (0 for no cap).
+        static std::shared_ptr<const CompiledProgram> compile(const std::string& source,
+            size_t memoryLimit = 0, Arithmetic arithmetic = Arithmetic::UNCHECKED);
+        ~CompiledProgram();
+        // the program's variables in declaration order
+        const std::vector<std::string>& globals() const;
+    private:
+        friend class Execution;
+        struct Impl;
+        std::unique_ptr<Impl> impl;
+        CompiledProgram();
+};
+
+// One run of a CompiledProgram. An Execution is not shared between threads;
+// each thread makes its own. Variables that are not set start at 0, and
+// run() may be called again, starting from the same presets.
+class Execution {
+    public:
+        explicit Execution(std::shared_ptr<const CompiledProgram> program);
+        ~Execution();
+        // An INTEGER value can be given to a REAL variable but not the
+        // reverse. An unknown name or a wrong type throws
+        // std::invalid_argument.
+        void setInteger(const std::string& name, int value);
+        void setReal(const std::string& name, double value);
+        // Throws a std::exception when the run hits one of the limits or
+        // the memory limit, or, CHECKED, on an arithmetic error. The
+        // interpreter's error classes are not part of this header; what()
+        // starts with the kind, e.g. "ExecutionLimitError: ..." or
+        // "ArithmeticError: ...".
+        void run(const ExecutionLimits& limits = ExecutionLimits(), Engine engine = Engine::TREE);
+        // A run on the VM that goes on with resume(). Each resume() runs
+        // about steps more steps, counted like ExecutionLimits::maxSteps on
+        // the VM (calls and loop iterations), or to the end for 0. It
+        // returns true once the program has finished. The timeout counts
+        // wall-clock time from start(), paused or not.
+        void start(const ExecutionLimits& limits = ExecutionLimits());
+        bool resume(long long steps);
+        // drops a started run; the results of the last finished run stay
+        void cancel();
+        bool running() const;
+        // Writes a started run's frames, variables and position in the
+        // program as a compact binary snapshot; throws std::logic_error if
+        // there is none. restore() replaces any started run with the one
+        // in the snapshot, to be carried on with resume(); the steps it
+        // had taken count towards the new limits. A snapshot of another
+        // program or a malformed one throws std::runtime_error.
+        void snapshot(std::ostream& out) const;
+        void restore(std::istream& in, const ExecutionLimits& limits = ExecutionLimits());
+        // the values at the end of the last run; real() also reads an
+        // INTEGER variable. Reading before a run throws std::logic_error.
+        int integer(const std::string& name) const;
+        double real(const std::string& name) const;
+    private:
+        struct State;
+        std::shared_ptr<const CompiledProgram> program;
+        std::unique_ptr<State> state;
+};
+
+// Runs started Executions in turn on the calling thread. Each gets its
+// quota of steps per round, so a long program can't hold up the others.
+// The Executions are not owned and must outlive the Scheduler, or be
+// cancelled first.
+class Scheduler {
+    public:
+        struct Failure {
+            Execution *execution;
+            std::exception_ptr error;
+        };
+
+        explicit Scheduler(long long quota = 10000) : quota(quota) {}
+        // quota 0 takes the Scheduler's; throws std::logic_error if the
+        // Execution has not been started
+        void add(Execution& execution, long long quota = 0);
+        // stops the Execution and takes it off the Scheduler
+        void cancel(Execution& execution);
+        // Resumes every Execution once, in the order they were added, and
+        // drops the ones that finished or threw. Returns how many are left.
+        size_t runRound();
+        void runAll();
+        size_t size() const { return entries.size(); }
+        // the Executions that threw, with their errors, in the order it happened
+        const std::vector<Failure>& failures() const { return failed; }
+    private:
+        struct Entry {
+            Execution *execution;
+            long long quota;
+        };
+        long long quota;
+        std::vector<Entry> entries;
+        std::vector<Failure> failed;
+};
+
+#endif
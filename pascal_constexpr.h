@@ -0,0 +1,1002 @@
+// A compile-time front end for the interpreter. A program given as a
+// string literal is lexed, parsed, checked and run while the C++ code that
+// includes this header compiles:
+//
+//     #include "pascal_constexpr.h"
+//     constexpr ConstResult config = runConstProgram(R"(
+//         program Config; var limit : integer;
+//         begin limit := 6 * 7 end.)");
+//     static_assert(config.integer("limit") == 42, "");
+//
+// The interpreter's classes in main.cpp allocate, use std::string and call
+// virtuals, none of which a C++17 constant expression may do, so these are
+// separate passes over fixed-size arrays. They follow the same grammar,
+// scope and type rules, and share the token and keyword tables and the node
+// and operator kinds of pascal_syntax.h. This header needs nothing else, so
+// any translation unit can include it.
+//
+// A program the passes reject reaches constProgramError, which is not
+// constexpr: in a constant expression that call is the compile error, and
+// the "in 'constexpr' expansion of" notes above it lead to the check that
+// failed. Called at run time, it throws a ConstProgramError.
+//
+// INTEGER overflow and division by zero are errors of the program too. A
+// long loop can run into the compiler's own limits (-fconstexpr-loop-limit
+// and -fconstexpr-ops-limit with GCC), and deep recursion into
+// -fconstexpr-depth.
+
+#ifndef PASCAL_CONSTEXPR_H
+#define PASCAL_CONSTEXPR_H
+
+#include <climits>
+#include <stdexcept>
+#include <string>
+
+#include "pascal_syntax.h"
+
+// a program runConstProgram rejected, when it is called at run time
+class ConstProgramError: public std::runtime_error {
+    private:
+        ErrorCode errorCode;
+    public:
+        ConstProgramError(ErrorCode code, int line, int column)
+        : std::runtime_error("ConstProgramError: " + error_tostring(code) + " at line "
+            + std::to_string(line) + " column " + std::to_string(column)), errorCode(code) {}
+        ErrorCode code() const {
+            return errorCode;
+        }
+};
+
+[[noreturn]] inline void constProgramError(ErrorCode code, int line, int column) {
+    throw ConstProgramError(code, line, column);
+}
+
+// Value without the union: a constant expression may not change the active
+// member of one in C++17
+struct ConstValue {
+    int i = 0;
+    double r = 0;
+};
+
+struct ConstToken {
+    TokenType type = TokenType::END_OF_FILE;
+    int start = 0;
+    int length = 0;
+    int line = 1;
+    int column = 0;
+};
+
+// Like the interpreter's FlatAst, the fields a node uses depend on its kind. Lists (statements,
+// arguments, declarations) start at a and go on through next. A FOR keeps
+// its body in d and value.i is 1 for downto; a call keeps the index of the
+// procedure it calls in slot.
+struct ConstNode {
+    NodeKind kind = NodeKind::EMPTY;
+    ValueType type = ValueType::NO_TYPE;
+    OpKind op = OpKind::NONE;
+    int token = 0;
+    int a = -1;
+    int b = -1;
+    int c = -1;
+    int d = -1;
+    int next = -1;
+    int level = 0;
+    int slot = 0;
+    ConstValue value;
+};
+
+// A variable, a procedure, or the program name when scope is 0. Procedures
+// are defined in the global scope, as the SemanticAnalyzer does.
+struct ConstSymbol {
+    bool procedure = false;
+    int token = 0;
+    int scope = 0;
+    ValueType type = ValueType::NO_TYPE;
+    int level = 0;
+    int slot = 0;
+    int index = 0;
+};
+
+// procedures[0] is the program itself
+struct ConstProcedure {
+    int node = -1;
+    int level = 1;
+    int frameSize = 0;
+    int params = 0;
+    int firstParam = 0;
+};
+
+class ConstAst {
+    public:
+        static const int MAX_TOKENS = 2048;
+        static const int MAX_NODES = 2048;
+        static const int MAX_SYMBOLS = 256;
+        static const int MAX_PROCEDURES = 64;
+        static const int MAX_LEVELS = 16;
+        const char *text = nullptr;
+        int length = 0;
+        ConstToken tokens[MAX_TOKENS] {};
+        int tokenCount = 0;
+        ConstNode nodes[MAX_NODES] {};
+        int nodeCount = 0;
+        int root = -1;
+        ConstSymbol symbols[MAX_SYMBOLS] {};
+        int symbolCount = 0;
+        ConstProcedure procedures[MAX_PROCEDURES] {};
+        int procedureCount = 0;
+
+        // not constexpr: reaching it stops a constant evaluation
+        void error(ErrorCode code, int token) const {
+            constProgramError(code, tokens[token].line, tokens[token].column);
+        }
+        constexpr int add(NodeKind kind, int token) {
+            if (nodeCount == MAX_NODES)
+                error(ErrorCode::MEMORY_LIMIT_EXCEEDED, token);
+            nodes[nodeCount].kind = kind;
+            nodes[nodeCount].token = token;
+            return nodeCount++;
+        }
+        // names keep their case, as in the SymbolTable
+        constexpr bool sameName(int left, int right) const {
+            const ConstToken &l = tokens[left];
+            const ConstToken &r = tokens[right];
+            if (l.length != r.length)
+                return false;
+            for (int i = 0; i < l.length; ++i) {
+                if (text[l.start + i] != text[r.start + i])
+                    return false;
+            }
+            return true;
+        }
+        // pushLeftSpine over node indices; spine has room for every node
+        constexpr int pushLeftSpine(int node, int *spine, int &size) const {
+            while (nodes[node].kind == NodeKind::BINARY_OP) {
+                spine[size++] = node;
+                node = nodes[node].a;
+            }
+            return node;
+        }
+};
+
+// Lexer::scan over a char array, with the same positions
+class ConstLexer {
+    private:
+        ConstAst &ast;
+        int pos = 0;
+        int lineno = 1;
+        int column = 0;
+
+        static constexpr bool isDigit(char ch) {
+            return ch >= '0' && ch <= '9';
+        }
+        static constexpr bool isAlnum(char ch) {
+            return isDigit(ch) || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+        }
+        constexpr char current() const {
+            return pos < ast.length ? ast.text[pos] : '\0';
+        }
+        constexpr char peek() const {
+            return pos + 1 < ast.length ? ast.text[pos + 1] : '\0';
+        }
+        constexpr void advance() {
+            ++pos;
+            ++column;
+            if (current() == '\n') {
+                ++lineno;
+                column = 0;
+            }
+        }
+        constexpr void skipIgnored() {
+            while (current() == ' ' || current() == '\n' || current() == '{') {
+                if (current() == '{') {
+                    while (current() != '}' && current() != '\0')
+                        advance();
+                }
+                if (current() != '\0')
+                    advance();
+            }
+        }
+        constexpr TokenType scan() {
+            if (current() == '\0')
+                return TokenType::END_OF_FILE;
+            if (isDigit(current())) {
+                while (isDigit(current()))
+                    advance();
+                if (current() == '.' && isDigit(peek())) {
+                    advance();
+                    while (isDigit(current()))
+                        advance();
+                    return TokenType::REAL_CONST;
+                }
+                return TokenType::INT;
+            }
+            if (isAlnum(current())) {
+                int start = pos;
+                while (isAlnum(current()))
+                    advance();
+                return keywordType(ast.text + start, pos - start);
+            }
+            int line = lineno;
+            int col = column;
+            int length = 0;
+            TokenType type = symbolToken(current(), peek(), length);
+            if (length == 0)
+                constProgramError(ErrorCode::UNEXPECTED_TOKEN, line, col);
+            for (int i = 0; i < length; ++i)
+                advance();
+            return type;
+        }
+    public:
+        constexpr ConstLexer(ConstAst &ast) : ast(ast) {}
+        // fills ast.tokens, ending with END_OF_FILE
+        constexpr void lex() {
+            while (ast.text[ast.length] != '\0')
+                ++ast.length;
+            while (true) {
+                skipIgnored();
+                if (ast.tokenCount == ConstAst::MAX_TOKENS)
+                    constProgramError(ErrorCode::MEMORY_LIMIT_EXCEEDED, lineno, column);
+                ConstToken &token = ast.tokens[ast.tokenCount++];
+                token.start = pos;
+                token.line = lineno;
+                token.column = column;
+                token.type = scan();
+                token.length = pos - token.start;
+                if (token.type == TokenType::END_OF_FILE)
+                    return;
+            }
+        }
+};
+
+// Parser, building a ConstAst
+class ConstParser {
+    private:
+        ConstAst &ast;
+        int tokenIndex = 0;
+
+        constexpr TokenType lookahead(int k = 0) const {
+            int index = tokenIndex + k;
+            if (index >= ast.tokenCount)
+                return TokenType::END_OF_FILE;
+            return ast.tokens[index].type;
+        }
+        // returns the token eaten
+        constexpr int eat(TokenType type) {
+            if (lookahead() != type)
+                ast.error(ErrorCode::UNEXPECTED_TOKEN, tokenIndex);
+            int token = tokenIndex;
+            if (tokenIndex + 1 < ast.tokenCount)
+                ++tokenIndex;
+            return token;
+        }
+        // adds node to the list that starts at first and ends at last
+        constexpr void append(int &first, int &last, int node) {
+            if (last == -1)
+                first = node;
+            else
+                ast.nodes[last].next = node;
+            last = node;
+        }
+        constexpr ValueType typeSpec() {
+            if (lookahead() == TokenType::REAL) {
+                eat(TokenType::REAL);
+                return ValueType::REAL;
+            }
+            eat(TokenType::INTEGER);
+            return ValueType::INTEGER;
+        }
+        // variable (COMMA variable)* COLON type, one node of the given kind
+        // per variable
+        constexpr void declarationLine(NodeKind kind, int &first, int &last) {
+            int firstNew = ast.nodeCount;
+            append(first, last, ast.add(kind, eat(TokenType::VARIABLE)));
+            while (lookahead() == TokenType::COMMA) {
+                eat(TokenType::COMMA);
+                append(first, last, ast.add(kind, eat(TokenType::VARIABLE)));
+            }
+            eat(TokenType::COLON);
+            ValueType type = typeSpec();
+            for (int i = firstNew; i < ast.nodeCount; ++i)
+                ast.nodes[i].type = type;
+        }
+        // PROCEDURE VARIABLE (LPAREN PARAM_LIST RPAREN)? SEMI BLOCK SEMI
+        constexpr int procedure() {
+            eat(TokenType::PROCEDURE);
+            int node = ast.add(NodeKind::PROCEDURE, eat(TokenType::VARIABLE));
+            int params = ast.add(NodeKind::DECLARATION_ROOT, ast.nodes[node].token);
+            if (lookahead() == TokenType::LPAREN) {
+                eat(TokenType::LPAREN);
+                int last = -1;
+                while (true) {
+                    declarationLine(NodeKind::PARAM_DECLARATION, ast.nodes[params].a, last);
+                    if (lookahead() != TokenType::SEMI)
+                        break;
+                    eat(TokenType::SEMI);
+                }
+                eat(TokenType::RPAREN);
+            }
+            eat(TokenType::SEMI);
+            ast.nodes[node].a = params;
+            ast.nodes[node].b = block();
+            eat(TokenType::SEMI);
+            return node;
+        }
+        constexpr int block() {
+            int node = ast.add(NodeKind::BLOCK, tokenIndex);
+            int declarations = ast.add(NodeKind::DECLARATION_ROOT, tokenIndex);
+            if (lookahead() == TokenType::VAR) {
+                eat(TokenType::VAR);
+                int last = -1;
+                while (lookahead() == TokenType::VARIABLE) {
+                    declarationLine(NodeKind::VAR_DECLARATION, ast.nodes[declarations].a, last);
+                    eat(TokenType::SEMI);
+                }
+            }
+            int procedures = ast.add(NodeKind::DECLARATION_ROOT, tokenIndex);
+            int last = -1;
+            while (lookahead() == TokenType::PROCEDURE)
+                append(ast.nodes[procedures].a, last, procedure());
+            ast.nodes[node].a = declarations;
+            ast.nodes[node].b = procedures;
+            ast.nodes[node].c = compoundStatement();
+            return node;
+        }
+        constexpr int compoundStatement() {
+            int node = ast.add(NodeKind::COMPOUND, eat(TokenType::BEGIN));
+            int last = -1;
+            while (true) {
+                if (lookahead() == TokenType::END_OF_FILE)
+                    break;
+                if (lookahead() == TokenType::END) {
+                    append(ast.nodes[node].a, last, ast.add(NodeKind::EMPTY, tokenIndex));
+                    break;
+                }
+                if (lookahead() == TokenType::BEGIN) {
+                    append(ast.nodes[node].a, last, compoundStatement());
+                    eat(TokenType::SEMI);
+                    continue;
+                }
+                append(ast.nodes[node].a, last, statement());
+                if (lookahead() == TokenType::SEMI)
+                    eat(TokenType::SEMI);
+            }
+            eat(TokenType::END);
+            return node;
+        }
+        constexpr int statement() {
+            switch (lookahead()) {
+                case TokenType::BEGIN:
+                    return compoundStatement();
+                case TokenType::IF: {
+                    int node = ast.add(NodeKind::IF, eat(TokenType::IF));
+                    ast.nodes[node].a = expr();
+                    eat(TokenType::THEN);
+                    // IF c THEN ELSE s leaves the THEN branch empty
+                    ast.nodes[node].b = lookahead() == TokenType::ELSE
+                        ? ast.add(NodeKind::EMPTY, tokenIndex) : statement();
+                    if (lookahead() == TokenType::ELSE) {
+                        eat(TokenType::ELSE);
+                        ast.nodes[node].c = statement();
+                    }
+                    return node;
+                }
+                case TokenType::WHILE: {
+                    int node = ast.add(NodeKind::WHILE, eat(TokenType::WHILE));
+                    ast.nodes[node].a = expr();
+                    eat(TokenType::DO);
+                    ast.nodes[node].b = statement();
+                    return node;
+                }
+                case TokenType::FOR: {
+                    int node = ast.add(NodeKind::FOR, eat(TokenType::FOR));
+                    ast.nodes[node].a = ast.add(NodeKind::VARIABLE, eat(TokenType::VARIABLE));
+                    eat(TokenType::ASSIGN);
+                    ast.nodes[node].b = expr();
+                    ast.nodes[node].value.i = lookahead() == TokenType::DOWNTO;
+                    eat(ast.nodes[node].value.i ? TokenType::DOWNTO : TokenType::TO);
+                    ast.nodes[node].c = expr();
+                    eat(TokenType::DO);
+                    ast.nodes[node].d = statement();
+                    return node;
+                }
+                case TokenType::SEMI:
+                case TokenType::END:
+                    return ast.add(NodeKind::EMPTY, tokenIndex);
+                // only an IF can be followed by ELSE, and it checks for one itself
+                case TokenType::ELSE:
+                    ast.error(ErrorCode::UNEXPECTED_TOKEN, tokenIndex);
+                    return -1;
+                default:
+                    break;
+            }
+            if (lookahead(1) == TokenType::LPAREN) {
+                int node = ast.add(NodeKind::PROCEDURE_CALL, eat(TokenType::VARIABLE));
+                eat(TokenType::LPAREN);
+                if (lookahead() != TokenType::RPAREN) {
+                    int last = -1;
+                    append(ast.nodes[node].a, last, expr());
+                    while (lookahead() == TokenType::COMMA) {
+                        eat(TokenType::COMMA);
+                        append(ast.nodes[node].a, last, expr());
+                    }
+                }
+                eat(TokenType::RPAREN);
+                return node;
+            }
+            int variable = ast.add(NodeKind::VARIABLE, eat(TokenType::VARIABLE));
+            int node = ast.add(NodeKind::ASSIGN, eat(TokenType::ASSIGN));
+            ast.nodes[node].a = variable;
+            ast.nodes[node].b = expr();
+            return node;
+        }
+        // the value of an INT or REAL_CONST token, as NumberNode reads it
+        constexpr int number(TokenType type) {
+            int token = eat(type);
+            int node = ast.add(NodeKind::NUMBER, token);
+            const ConstToken &t = ast.tokens[token];
+            long long integer = 0;
+            double mantissa = 0;
+            double scale = 1;
+            bool fraction = false;
+            for (int i = t.start; i < t.start + t.length; ++i) {
+                char ch = ast.text[i];
+                if (ch == '.') {
+                    fraction = true;
+                    continue;
+                }
+                mantissa = mantissa * 10 + (ch - '0');
+                if (fraction)
+                    scale *= 10;
+                if (type == TokenType::INT) {
+                    integer = integer * 10 + (ch - '0');
+                    if (integer > INT_MAX)
+                        ast.error(ErrorCode::UNEXPECTED_TOKEN, token);
+                }
+            }
+            if (type == TokenType::INT) {
+                ast.nodes[node].value.i = integer;
+                ast.nodes[node].type = ValueType::INTEGER;
+            }
+            else {
+                ast.nodes[node].value.r = mantissa / scale;
+                ast.nodes[node].type = ValueType::REAL;
+            }
+            return node;
+        }
+        constexpr int factor() {
+            switch (lookahead()) {
+                case TokenType::INT:
+                case TokenType::REAL_CONST:
+                    return number(lookahead());
+                case TokenType::VARIABLE:
+                    return ast.add(NodeKind::VARIABLE, eat(TokenType::VARIABLE));
+                case TokenType::ADD:
+                case TokenType::SUB:
+                case TokenType::NOT: {
+                    int node = ast.add(NodeKind::UNARY_OP, eat(lookahead()));
+                    ast.nodes[node].a = factor();
+                    return node;
+                }
+                case TokenType::LPAREN: {
+                    eat(TokenType::LPAREN);
+                    int node = expr();
+                    eat(TokenType::RPAREN);
+                    return node;
+                }
+                default:
+                    break;
+            }
+            ast.error(ErrorCode::UNEXPECTED_TOKEN, tokenIndex);
+            return -1;
+        }
+        constexpr int binaryOp(int left, int right, int token) {
+            int node = ast.add(NodeKind::BINARY_OP, token);
+            ast.nodes[node].a = left;
+            ast.nodes[node].b = right;
+            return node;
+        }
+        constexpr int term() {
+            int root = factor();
+            while (lookahead() == TokenType::MUL || lookahead() == TokenType::DIV
+                || lookahead() == TokenType::INT_DIV || lookahead() == TokenType::AND) {
+                int op = eat(lookahead());
+                root = binaryOp(root, factor(), op);
+            }
+            return root;
+        }
+        constexpr int simpleExpr() {
+            int root = term();
+            while (lookahead() == TokenType::ADD || lookahead() == TokenType::SUB
+                || lookahead() == TokenType::OR) {
+                int op = eat(lookahead());
+                root = binaryOp(root, term(), op);
+            }
+            return root;
+        }
+        // simpleExpr (relational operator simpleExpr)?
+        constexpr int expr() {
+            int root = simpleExpr();
+            switch (lookahead()) {
+                case TokenType::EQ:
+                case TokenType::NEQ:
+                case TokenType::LT:
+                case TokenType::LE:
+                case TokenType::GT:
+                case TokenType::GE: {
+                    int op = eat(lookahead());
+                    return binaryOp(root, simpleExpr(), op);
+                }
+                default:
+                    return root;
+            }
+        }
+    public:
+        constexpr ConstParser(ConstAst &ast) : ast(ast) {}
+        // PROGRAM VARIABLE SEMI BLOCK DOT
+        constexpr void parse() {
+            eat(TokenType::PROGRAM);
+            ast.root = ast.add(NodeKind::PROGRAM, eat(TokenType::VARIABLE));
+            eat(TokenType::SEMI);
+            ast.nodes[ast.root].a = block();
+            eat(TokenType::DOT);
+        }
+};
+
+// SemanticAnalyzer over a ConstAst: resolves every variable to a level and
+// slot, gives each node its type and OpKind and inserts the INT_TO_REAL
+// conversions
+class ConstAnalyzer {
+    private:
+        ConstAst &ast;
+        // scope 0 holds the program name and scope 1 the globals
+        int parents[ConstAst::MAX_PROCEDURES + 1] {};
+        int levels[ConstAst::MAX_PROCEDURES + 1] {};
+        int scopeCount = 2;
+        int scope = 1;
+        int frame = 0;
+        int spine[ConstAst::MAX_NODES] {};
+        int spineSize = 0;
+
+        // the newest symbol named by token in scope or, unless local, the
+        // scopes around it; -1 if there is none
+        constexpr int lookup(int token, int scope, bool local = false) const {
+            for (int s = scope; s != -1; s = parents[s]) {
+                for (int i = ast.symbolCount - 1; i >= 0; --i) {
+                    if (ast.symbols[i].scope == s && ast.sameName(ast.symbols[i].token, token))
+                        return i;
+                }
+                if (local)
+                    break;
+            }
+            return -1;
+        }
+        constexpr ConstSymbol &define(int token, int scope) {
+            if (ast.symbolCount == ConstAst::MAX_SYMBOLS)
+                ast.error(ErrorCode::MEMORY_LIMIT_EXCEEDED, token);
+            ConstSymbol &symbol = ast.symbols[ast.symbolCount++];
+            symbol.token = token;
+            symbol.scope = scope;
+            return symbol;
+        }
+        // a variable or parameter of the current frame
+        constexpr void declare(int node) {
+            int token = ast.nodes[node].token;
+            if (lookup(token, scope, true) != -1)
+                ast.error(ErrorCode::DUPLICATE_ID, token);
+            ConstSymbol &symbol = define(token, scope);
+            symbol.type = ast.nodes[node].type;
+            symbol.level = levels[scope];
+            symbol.slot = ast.procedures[frame].frameSize++;
+        }
+        constexpr void coerceToReal(int &expr) {
+            if (ast.nodes[expr].type != ValueType::INTEGER)
+                return;
+            int node = ast.add(NodeKind::INT_TO_REAL, ast.nodes[expr].token);
+            ast.nodes[node].type = ValueType::REAL;
+            ast.nodes[node].a = expr;
+            ast.nodes[node].next = ast.nodes[expr].next;
+            ast.nodes[expr].next = -1;
+            expr = node;
+        }
+        constexpr void checkAssignable(ValueType target, int &expr, int token) {
+            if (target == ValueType::REAL && ast.nodes[expr].type == ValueType::INTEGER)
+                coerceToReal(expr);
+            else if (ast.nodes[expr].type != target)
+                ast.error(ErrorCode::TYPE_MISMATCH, token);
+        }
+        constexpr void variable(int node) {
+            ConstNode &var = ast.nodes[node];
+            int symbol = lookup(var.token, scope);
+            if (symbol == -1 || ast.symbols[symbol].procedure || ast.symbols[symbol].scope == 0)
+                ast.error(ErrorCode::UNDECLARED_ID, var.token);
+            var.type = ast.symbols[symbol].type;
+            var.level = ast.symbols[symbol].level;
+            var.slot = ast.symbols[symbol].slot;
+        }
+        constexpr void expression(int node) {
+            ConstNode &n = ast.nodes[node];
+            switch (n.kind) {
+                case NodeKind::VARIABLE:
+                    variable(node);
+                    return;
+                case NodeKind::UNARY_OP: {
+                    expression(n.a);
+                    n.type = ast.nodes[n.a].type;
+                    TokenType op = ast.tokens[n.token].type;
+                    bool boolean = n.type == ValueType::BOOLEAN;
+                    if (boolean != (op == TokenType::NOT))
+                        ast.error(ErrorCode::TYPE_MISMATCH, n.token);
+                    if (boolean)
+                        n.op = OpKind::BOOL_NOT;
+                    else if (op == TokenType::ADD)
+                        n.op = OpKind::IDENTITY;
+                    else
+                        n.op = n.type == ValueType::REAL ? OpKind::REAL_NEG : OpKind::INT_NEG;
+                    return;
+                }
+                case NodeKind::BINARY_OP: {
+                    int mark = spineSize;
+                    expression(ast.pushLeftSpine(node, spine, spineSize));
+                    while (spineSize > mark) {
+                        int link = spine[--spineSize];
+                        expression(ast.nodes[link].b);
+                        checkBinaryOp(ast.nodes[link]);
+                    }
+                    return;
+                }
+                default:
+                    return;
+            }
+        }
+        // SemanticAnalyzer::checkBinaryOp
+        constexpr void checkBinaryOp(ConstNode &node) {
+            TokenType op = ast.tokens[node.token].type;
+            bool leftBool = ast.nodes[node.a].type == ValueType::BOOLEAN;
+            bool rightBool = ast.nodes[node.b].type == ValueType::BOOLEAN;
+            if (op == TokenType::AND || op == TokenType::OR) {
+                if (!leftBool || !rightBool)
+                    ast.error(ErrorCode::TYPE_MISMATCH, node.token);
+                node.type = ValueType::BOOLEAN;
+                node.op = op == TokenType::AND ? OpKind::BOOL_AND : OpKind::BOOL_OR;
+                return;
+            }
+            if (leftBool || rightBool)
+                ast.error(ErrorCode::TYPE_MISMATCH, node.token);
+            bool real = ast.nodes[node.a].type == ValueType::REAL
+                || ast.nodes[node.b].type == ValueType::REAL
+                || op == TokenType::DIV;
+            if (real && op == TokenType::INT_DIV)
+                ast.error(ErrorCode::TYPE_MISMATCH, node.token);
+            if (real) {
+                coerceToReal(node.a);
+                coerceToReal(node.b);
+            }
+            node.type = real ? ValueType::REAL : ValueType::INTEGER;
+            switch (op) {
+                case TokenType::ADD: node.op = real ? OpKind::REAL_ADD : OpKind::INT_ADD; break;
+                case TokenType::SUB: node.op = real ? OpKind::REAL_SUB : OpKind::INT_SUB; break;
+                case TokenType::MUL: node.op = real ? OpKind::REAL_MUL : OpKind::INT_MUL; break;
+                case TokenType::DIV: node.op = OpKind::REAL_DIV; break;
+                case TokenType::INT_DIV: node.op = OpKind::INT_DIV; break;
+                case TokenType::EQ: node.op = real ? OpKind::REAL_EQ : OpKind::INT_EQ; break;
+                case TokenType::NEQ: node.op = real ? OpKind::REAL_NEQ : OpKind::INT_NEQ; break;
+                case TokenType::LT: node.op = real ? OpKind::REAL_LT : OpKind::INT_LT; break;
+                case TokenType::LE: node.op = real ? OpKind::REAL_LE : OpKind::INT_LE; break;
+                case TokenType::GT: node.op = real ? OpKind::REAL_GT : OpKind::INT_GT; break;
+                default: node.op = real ? OpKind::REAL_GE : OpKind::INT_GE; break;
+            }
+            if (op != TokenType::ADD && op != TokenType::SUB && op != TokenType::MUL
+                && op != TokenType::DIV && op != TokenType::INT_DIV)
+                node.type = ValueType::BOOLEAN;
+        }
+        constexpr void checkCondition(int condition, int token) {
+            expression(condition);
+            if (ast.nodes[condition].type != ValueType::BOOLEAN)
+                ast.error(ErrorCode::TYPE_MISMATCH, token);
+        }
+        constexpr void statement(int node) {
+            ConstNode &n = ast.nodes[node];
+            switch (n.kind) {
+                case NodeKind::COMPOUND:
+                    for (int child = n.a; child != -1; child = ast.nodes[child].next)
+                        statement(child);
+                    return;
+                case NodeKind::ASSIGN:
+                    expression(n.b);
+                    variable(n.a);
+                    checkAssignable(ast.nodes[n.a].type, n.b, n.token);
+                    return;
+                case NodeKind::IF:
+                    checkCondition(n.a, n.token);
+                    statement(n.b);
+                    if (n.c != -1)
+                        statement(n.c);
+                    return;
+                case NodeKind::WHILE:
+                    checkCondition(n.a, n.token);
+                    statement(n.b);
+                    return;
+                case NodeKind::FOR:
+                    variable(n.a);
+                    if (ast.nodes[n.a].type != ValueType::INTEGER)
+                        ast.error(ErrorCode::TYPE_MISMATCH, n.token);
+                    expression(n.b);
+                    checkAssignable(ValueType::INTEGER, n.b, n.token);
+                    expression(n.c);
+                    checkAssignable(ValueType::INTEGER, n.c, n.token);
+                    statement(n.d);
+                    return;
+                case NodeKind::PROCEDURE_CALL: {
+                    int symbol = lookup(n.token, scope);
+                    if (symbol == -1 || !ast.symbols[symbol].procedure)
+                        ast.error(ErrorCode::UNDECLARED_PROCEDURE, n.token);
+                    n.slot = ast.symbols[symbol].index;
+                    const ConstProcedure &callee = ast.procedures[n.slot];
+                    int args = 0;
+                    for (int arg = n.a; arg != -1; arg = ast.nodes[arg].next)
+                        ++args;
+                    if (args != callee.params)
+                        ast.error(ErrorCode::PROCEDURE_ARGUMENT_MISMATCH, n.token);
+                    int param = callee.firstParam;
+                    for (int *arg = &n.a; *arg != -1; arg = &ast.nodes[*arg].next) {
+                        expression(*arg);
+                        checkAssignable(ast.symbols[param++].type, *arg, n.token);
+                    }
+                    return;
+                }
+                default:
+                    return;
+            }
+        }
+        constexpr void procedure(int node) {
+            int token = ast.nodes[node].token;
+            if (lookup(token, 1) != -1)
+                ast.error(ErrorCode::DUPLICATE_PROCEDURE, token);
+            if (ast.procedureCount == ConstAst::MAX_PROCEDURES)
+                ast.error(ErrorCode::MEMORY_LIMIT_EXCEEDED, token);
+            if (levels[scope] + 1 == ConstAst::MAX_LEVELS)
+                ast.error(ErrorCode::NESTING_TOO_DEEP, token);
+            int index = ast.procedureCount++;
+            ConstSymbol &symbol = define(token, 1);
+            symbol.procedure = true;
+            symbol.index = index;
+
+            int enclosingScope = scope;
+            int enclosingFrame = frame;
+            parents[scopeCount] = scope;
+            levels[scopeCount] = levels[scope] + 1;
+            scope = scopeCount++;
+            frame = index;
+            ConstProcedure &proc = ast.procedures[index];
+            proc.node = node;
+            proc.level = levels[scope];
+            proc.firstParam = ast.symbolCount;
+            for (int param = ast.nodes[ast.nodes[node].a].a; param != -1; param = ast.nodes[param].next) {
+                declare(param);
+                ++proc.params;
+            }
+            block(ast.nodes[node].b);
+            scope = enclosingScope;
+            frame = enclosingFrame;
+        }
+        constexpr void block(int node) {
+            const ConstNode &n = ast.nodes[node];
+            for (int var = ast.nodes[n.a].a; var != -1; var = ast.nodes[var].next)
+                declare(var);
+            for (int proc = ast.nodes[n.b].a; proc != -1; proc = ast.nodes[proc].next)
+                procedure(proc);
+            statement(n.c);
+        }
+    public:
+        constexpr ConstAnalyzer(ConstAst &ast) : ast(ast) {
+            parents[0] = -1;
+            parents[1] = 0;
+            levels[1] = 1;
+        }
+        constexpr void analyse() {
+            define(ast.nodes[ast.root].token, 0);
+            ast.procedures[0].node = ast.root;
+            ast.procedureCount = 1;
+            block(ast.nodes[ast.root].a);
+        }
+};
+
+// The program's global variables after a run. Names point into the source,
+// which has to outlive the result; a string literal does.
+class ConstResult {
+    public:
+        struct Global {
+            int start = 0;
+            int length = 0;
+            ValueType type = ValueType::NO_TYPE;
+            ConstValue value;
+        };
+        static const int MAX_GLOBALS = 64;
+        const char *text = nullptr;
+        Global globals[MAX_GLOBALS] {};
+        int count = 0;
+
+        constexpr const Global &global(const char *name) const {
+            for (int g = 0; g < count; ++g) {
+                int i = 0;
+                while (i < globals[g].length && name[i] == text[globals[g].start + i])
+                    ++i;
+                if (i == globals[g].length && name[i] == '\0')
+                    return globals[g];
+            }
+            constProgramError(ErrorCode::UNDECLARED_ID, 0, 0);
+        }
+        constexpr int integer(const char *name) const {
+            const Global &g = global(name);
+            if (g.type != ValueType::INTEGER)
+                constProgramError(ErrorCode::TYPE_MISMATCH, 0, 0);
+            return g.value.i;
+        }
+        constexpr double real(const char *name) const {
+            const Global &g = global(name);
+            if (g.type != ValueType::REAL)
+                constProgramError(ErrorCode::TYPE_MISMATCH, 0, 0);
+            return g.value.r;
+        }
+};
+
+// EvalVisitor over a checked ConstAst. Frames sit in one array with a
+// display of the newest frame of each level, as in the CallStack.
+class ConstEvaluator {
+    private:
+        static const int MAX_SLOTS = 1024;
+        const ConstAst &ast;
+        ConstValue slots[MAX_SLOTS] {};
+        int top = 0;
+        int display[ConstAst::MAX_LEVELS] {};
+        int spine[ConstAst::MAX_NODES] {};
+        int spineSize = 0;
+
+        constexpr ConstValue &variable(const ConstNode &node) {
+            return slots[display[node.level] + node.slot];
+        }
+        // INTEGER arithmetic fails the same way at compile time and at run
+        // time, instead of being undefined behaviour at run time
+        constexpr int checked(OpKind op, int left, int right, int token) {
+            int out = 0;
+            ErrorCode code = checkedIntOp(op, left, right, out);
+            if (code != ErrorCode::NONE)
+                ast.error(code, token);
+            return out;
+        }
+        constexpr ConstValue evaluate(int node) {
+            const ConstNode &n = ast.nodes[node];
+            ConstValue result;
+            switch (n.kind) {
+                case NodeKind::NUMBER:
+                    return n.value;
+                case NodeKind::VARIABLE:
+                    return variable(n);
+                case NodeKind::INT_TO_REAL:
+                    result.r = evaluate(n.a).i;
+                    return result;
+                case NodeKind::UNARY_OP:
+                    result = evaluate(n.a);
+                    switch (n.op) {
+                        case OpKind::INT_NEG: result.i = checked(n.op, result.i, 0, n.token); break;
+                        case OpKind::REAL_NEG: result.r = -result.r; break;
+                        case OpKind::BOOL_NOT: result.i = !result.i; break;
+                        default: break;
+                    }
+                    return result;
+                default:
+                    break;
+            }
+            // a left chain is folded bottom up into one running value
+            int mark = spineSize;
+            result = evaluate(ast.pushLeftSpine(node, spine, spineSize));
+            while (spineSize > mark) {
+                const ConstNode &link = ast.nodes[spine[--spineSize]];
+                // 'and' / 'or' only evaluate the right side when they need to
+                if (link.op == OpKind::BOOL_AND || link.op == OpKind::BOOL_OR) {
+                    if (result.i == (link.op == OpKind::BOOL_AND))
+                        result = evaluate(link.b);
+                    continue;
+                }
+                ConstValue right = evaluate(link.b);
+                if (link.op >= OpKind::INT_ADD && link.op <= OpKind::INT_DIV)
+                    result.i = checked(link.op, result.i, right.i, link.token);
+                else
+                    result = applyBinaryOp(link.op, result, right);
+            }
+            return result;
+        }
+        constexpr void call(const ConstNode &node) {
+            const ConstProcedure &callee = ast.procedures[node.slot];
+            int base = top;
+            if (base + callee.frameSize > MAX_SLOTS)
+                ast.error(ErrorCode::CALL_DEPTH_EXCEEDED, node.token);
+            // the arguments go straight into the callee's parameter slots
+            int i = base;
+            for (int arg = node.a; arg != -1; arg = ast.nodes[arg].next)
+                slots[i++] = evaluate(arg);
+            for (; i < base + callee.frameSize; ++i)
+                slots[i] = ConstValue();
+            top = base + callee.frameSize;
+            int saved = display[callee.level];
+            display[callee.level] = base;
+            statement(ast.nodes[ast.nodes[callee.node].b].c);
+            display[callee.level] = saved;
+            top = base;
+        }
+        constexpr void statement(int node) {
+            const ConstNode &n = ast.nodes[node];
+            switch (n.kind) {
+                case NodeKind::COMPOUND:
+                    for (int child = n.a; child != -1; child = ast.nodes[child].next)
+                        statement(child);
+                    return;
+                case NodeKind::ASSIGN:
+                    variable(ast.nodes[n.a]) = evaluate(n.b);
+                    return;
+                case NodeKind::IF:
+                    if (evaluate(n.a).i)
+                        statement(n.b);
+                    else if (n.c != -1)
+                        statement(n.c);
+                    return;
+                case NodeKind::WHILE:
+                    while (evaluate(n.a).i)
+                        statement(n.b);
+                    return;
+                case NodeKind::FOR: {
+                    // the bounds are evaluated once
+                    long long first = evaluate(n.b).i;
+                    long long last = evaluate(n.c).i;
+                    long long step = n.value.i ? -1 : 1;
+                    for (long long i = first; n.value.i ? i >= last : i <= last; i += step) {
+                        variable(ast.nodes[n.a]).i = i;
+                        statement(n.d);
+                    }
+                    return;
+                }
+                case NodeKind::PROCEDURE_CALL:
+                    call(n);
+                    return;
+                default:
+                    return;
+            }
+        }
+    public:
+        constexpr ConstEvaluator(const ConstAst &ast) : ast(ast) {}
+        constexpr void run(ConstResult &result) {
+            const ConstProcedure &program = ast.procedures[0];
+            if (program.frameSize > ConstResult::MAX_GLOBALS)
+                ast.error(ErrorCode::MEMORY_LIMIT_EXCEEDED, ast.nodes[program.node].token);
+            display[program.level] = 0;
+            top = program.frameSize;
+            statement(ast.nodes[ast.nodes[program.node].a].c);
+
+            result.text = ast.text;
+            result.count = program.frameSize;
+            for (int s = 0; s < ast.symbolCount; ++s) {
+                const ConstSymbol &symbol = ast.symbols[s];
+                if (symbol.scope != 1 || symbol.procedure)
+                    continue;
+                ConstResult::Global &global = result.globals[symbol.slot];
+                global.start = ast.tokens[symbol.token].start;
+                global.length = ast.tokens[symbol.token].length;
+                global.type = symbol.type;
+                global.value = slots[symbol.slot];
+            }
+        }
+};
+
+// lexes, parses, checks and runs a program; see the top of this section
+constexpr ConstResult runConstProgram(const char *text) {
+    ConstAst ast {};
+    ast.text = text;
+    ConstLexer(ast).lex();
+    ConstParser(ast).parse();
+    ConstAnalyzer(ast).analyse();
+    ConstResult result {};
+    ConstEvaluator(ast).run(result);
+    return result;
+}
+
+#endif
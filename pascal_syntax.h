@@ -0,0 +1,373 @@
+// Tokens, keywords, node and operator kinds, value types and error codes.
+// They are shared by the interpreter in main.cpp and the compile-time front
+// end in pascal_constexpr.h, so both read a program the same way. Nothing
+// here allocates, and the tables can be used in constant expressions.
+
+#ifndef PASCAL_SYNTAX_H
+#define PASCAL_SYNTAX_H
+
+#include <climits>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+enum class TokenType {
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    INT_DIV,
+    LPAREN,
+    RPAREN,
+    INT,
+    REAL_CONST,
+    END_OF_FILE,
+
+    BEGIN,
+    END,
+    COMMA,
+    DOT,
+    SEMI,
+    COLON,
+    ASSIGN,
+    VARIABLE,
+    PROCEDURE,
+    PROGRAM,
+    PROGRAM_NAME,
+    VAR,
+
+    INTEGER,
+    REAL,
+
+    IF,
+    THEN,
+    ELSE,
+    WHILE,
+    DO,
+    FOR,
+    TO,
+    DOWNTO,
+
+    EQ,
+    NEQ,
+    LT,
+    LE,
+    GT,
+    GE,
+    AND,
+    OR,
+    NOT,
+};
+
+// The reserved words. Identifiers match them in any case.
+struct Keyword {
+    const char *word;
+    TokenType type;
+};
+constexpr Keyword KEYWORDS[] = {
+    {"begin", TokenType::BEGIN}, {"end", TokenType::END},
+    {"program", TokenType::PROGRAM}, {"var", TokenType::VAR},
+    {"procedure", TokenType::PROCEDURE}, {"integer", TokenType::INTEGER},
+    {"real", TokenType::REAL}, {"div", TokenType::INT_DIV},
+    {"if", TokenType::IF}, {"then", TokenType::THEN},
+    {"else", TokenType::ELSE}, {"while", TokenType::WHILE},
+    {"do", TokenType::DO}, {"for", TokenType::FOR},
+    {"to", TokenType::TO}, {"downto", TokenType::DOWNTO},
+    {"and", TokenType::AND}, {"or", TokenType::OR},
+    {"not", TokenType::NOT},
+};
+
+constexpr char toLowerAscii(char ch) {
+    return ch >= 'A' && ch <= 'Z' ? ch - 'A' + 'a' : ch;
+}
+// the keyword the length characters at word spell, or VARIABLE
+constexpr TokenType keywordType(const char *word, int length) {
+    for (const Keyword &keyword : KEYWORDS) {
+        int i = 0;
+        while (i < length && keyword.word[i] == toLowerAscii(word[i]))
+            ++i;
+        if (i == length && keyword.word[i] == '\0')
+            return keyword.type;
+    }
+    return TokenType::VARIABLE;
+}
+// The operator or punctuation token that starts with ch, given the
+// character after it. length is set to the number of characters it takes,
+// or 0 if no token starts with ch.
+constexpr TokenType symbolToken(char ch, char next, int &length) {
+    length = 1;
+    switch (ch) {
+        case '+': return TokenType::ADD;
+        case '-': return TokenType::SUB;
+        case '*': return TokenType::MUL;
+        case '/': return TokenType::DIV;
+        case '(': return TokenType::LPAREN;
+        case ')': return TokenType::RPAREN;
+        case ',': return TokenType::COMMA;
+        case '.': return TokenType::DOT;
+        case ';': return TokenType::SEMI;
+        case '=': return TokenType::EQ;
+        case ':':
+            if (next != '=')
+                return TokenType::COLON;
+            length = 2;
+            return TokenType::ASSIGN;
+        case '<':
+            if (next == '>') {
+                length = 2;
+                return TokenType::NEQ;
+            }
+            if (next != '=')
+                return TokenType::LT;
+            length = 2;
+            return TokenType::LE;
+        case '>':
+            if (next != '=')
+                return TokenType::GT;
+            length = 2;
+            return TokenType::GE;
+    }
+    length = 0;
+    return TokenType::END_OF_FILE;
+}
+
+inline const std::string tokenType_tostring(TokenType aTokenType) {
+    switch (aTokenType) {
+        case TokenType::ADD: return "ADD";
+        case TokenType::SUB: return "SUB";
+        case TokenType::MUL: return "MUL";
+        case TokenType::DIV: return "DIV";
+        case TokenType::INT_DIV: return "INT_DIV";
+        case TokenType::INT: return "INT";
+        case TokenType::REAL_CONST: return "REAL_CONST";
+        case TokenType::LPAREN: return "LPAREN";
+        case TokenType::RPAREN: return "RPAREN";
+        case TokenType::END_OF_FILE: return "EOF";
+
+        case TokenType::BEGIN: return "BEGIN";
+        case TokenType::END: return "END";
+        case TokenType::COMMA: return "COMMA";
+        case TokenType::DOT: return "DOT";
+        case TokenType::SEMI: return "SEMI";
+        case TokenType::COLON: return "COLON";
+        case TokenType::ASSIGN: return "ASSIGN";
+        case TokenType::VARIABLE: return "VARIABLE";
+        case TokenType::PROCEDURE: return "PROCEDURE";
+        case TokenType::PROGRAM: return "PROGRAM";
+        case TokenType::PROGRAM_NAME: return "PROGRAM_NAME";
+        case TokenType::VAR: return "VAR";
+        case TokenType::INTEGER: return "INTEGER";
+        case TokenType::REAL: return "REAL";
+
+        case TokenType::IF: return "IF";
+        case TokenType::THEN: return "THEN";
+        case TokenType::ELSE: return "ELSE";
+        case TokenType::WHILE: return "WHILE";
+        case TokenType::DO: return "DO";
+        case TokenType::FOR: return "FOR";
+        case TokenType::TO: return "TO";
+        case TokenType::DOWNTO: return "DOWNTO";
+
+        case TokenType::EQ: return "EQ";
+        case TokenType::NEQ: return "NEQ";
+        case TokenType::LT: return "LT";
+        case TokenType::LE: return "LE";
+        case TokenType::GT: return "GT";
+        case TokenType::GE: return "GE";
+        case TokenType::AND: return "AND";
+        case TokenType::OR: return "OR";
+        case TokenType::NOT: return "NOT";
+    }
+    return "Unknown";
+}
+
+enum class ErrorCode {
+    UNEXPECTED_TOKEN,
+    UNDECLARED_ID,
+    DUPLICATE_ID,
+    DUPLICATE_PROCEDURE,
+    UNDECLARED_PROCEDURE,
+    PROCEDURE_ARGUMENT_MISMATCH,
+    TYPE_MISMATCH,
+    MEMORY_LIMIT_EXCEEDED,
+    STEP_LIMIT_EXCEEDED,
+    TIME_LIMIT_EXCEEDED,
+    CALL_DEPTH_EXCEEDED,
+    NESTING_TOO_DEEP,
+    INTEGER_OVERFLOW,
+    DIVISION_BY_ZERO,
+    NONE,
+};
+inline const std::string error_tostring(ErrorCode errorType) {
+    switch (errorType) {
+        case ErrorCode::UNEXPECTED_TOKEN:
+            return "Unexpected token";
+        case ErrorCode::UNDECLARED_ID:
+            return "undeclared identifier";
+        case ErrorCode::DUPLICATE_ID:
+            return "duplicate identifier";
+        case ErrorCode::DUPLICATE_PROCEDURE:
+            return "duplicate procedure";
+        case ErrorCode::UNDECLARED_PROCEDURE:
+            return "undeclared procedure";
+        case ErrorCode::PROCEDURE_ARGUMENT_MISMATCH:
+            return "procedure call has mismatched arguments";
+        case ErrorCode::TYPE_MISMATCH:
+            return "incompatible types";
+        case ErrorCode::MEMORY_LIMIT_EXCEEDED:
+            return "memory limit exceeded";
+        case ErrorCode::STEP_LIMIT_EXCEEDED:
+            return "statement limit exceeded";
+        case ErrorCode::TIME_LIMIT_EXCEEDED:
+            return "time limit exceeded";
+        case ErrorCode::CALL_DEPTH_EXCEEDED:
+            return "call depth limit exceeded";
+        case ErrorCode::NESTING_TOO_DEEP:
+            return "nesting too deep";
+        case ErrorCode::INTEGER_OVERFLOW:
+            return "integer overflow";
+        case ErrorCode::DIVISION_BY_ZERO:
+            return "division by zero";
+        case ErrorCode::NONE:
+            break;
+    }
+    return "Unknown ErrorCode";
+}
+
+// the static type of a value; Symbol::Type in the interpreter
+enum class ValueType { INTEGER, REAL, BOOLEAN, NO_TYPE };
+
+// Arithmetic operation with its operand types already resolved by the
+// SemanticAnalyzer, so the evaluator can run an integer-only or a
+// double-only path without looking at the values.
+enum class OpKind {
+    NONE,
+    INT_ADD,
+    INT_SUB,
+    INT_MUL,
+    INT_DIV,
+    INT_NEG,
+    REAL_ADD,
+    REAL_SUB,
+    REAL_MUL,
+    REAL_DIV,
+    REAL_NEG,
+    IDENTITY,
+    INT_EQ,
+    INT_NEQ,
+    INT_LT,
+    INT_LE,
+    INT_GT,
+    INT_GE,
+    REAL_EQ,
+    REAL_NEQ,
+    REAL_LT,
+    REAL_LE,
+    REAL_GT,
+    REAL_GE,
+    BOOL_AND,
+    BOOL_OR,
+    BOOL_NOT,
+};
+
+// Applies an arithmetic or relational OpKind. 'and' / 'or' short-circuit
+// and are handled by the evaluator itself. V is Value, or ConstValue for
+// the compile-time front end.
+template <typename V>
+constexpr V applyBinaryOp(OpKind kind, V leftVal, V rightVal) {
+    V result {};
+    switch (kind) {
+        case OpKind::INT_ADD: result.i = leftVal.i + rightVal.i; break;
+        case OpKind::INT_SUB: result.i = leftVal.i - rightVal.i; break;
+        case OpKind::INT_MUL: result.i = leftVal.i * rightVal.i; break;
+        case OpKind::INT_DIV: result.i = leftVal.i / rightVal.i; break;
+        case OpKind::REAL_ADD: result.r = leftVal.r + rightVal.r; break;
+        case OpKind::REAL_SUB: result.r = leftVal.r - rightVal.r; break;
+        case OpKind::REAL_MUL: result.r = leftVal.r * rightVal.r; break;
+        case OpKind::REAL_DIV: result.r = leftVal.r / rightVal.r; break;
+        case OpKind::INT_EQ: result.i = leftVal.i == rightVal.i; break;
+        case OpKind::INT_NEQ: result.i = leftVal.i != rightVal.i; break;
+        case OpKind::INT_LT: result.i = leftVal.i < rightVal.i; break;
+        case OpKind::INT_LE: result.i = leftVal.i <= rightVal.i; break;
+        case OpKind::INT_GT: result.i = leftVal.i > rightVal.i; break;
+        case OpKind::INT_GE: result.i = leftVal.i >= rightVal.i; break;
+        case OpKind::REAL_EQ: result.i = leftVal.r == rightVal.r; break;
+        case OpKind::REAL_NEQ: result.i = leftVal.r != rightVal.r; break;
+        case OpKind::REAL_LT: result.i = leftVal.r < rightVal.r; break;
+        case OpKind::REAL_LE: result.i = leftVal.r <= rightVal.r; break;
+        case OpKind::REAL_GT: result.i = leftVal.r > rightVal.r; break;
+        case OpKind::REAL_GE: result.i = leftVal.r >= rightVal.r; break;
+        default: throw std::runtime_error("Unknown binary op value");
+    }
+    return result;
+}
+
+// Integer arithmetic for --checked and the constexpr front end. Each returns the ErrorCode of the
+// operation, NONE if it succeeded and its result is in out. GCC and Clang
+// have overflow intrinsics; elsewhere the sum and product are exact in 64
+// bits.
+constexpr ErrorCode checkedIntOp(OpKind kind, int left, int right, int &out) {
+    switch (kind) {
+#if defined(__GNUC__)
+        case OpKind::INT_ADD:
+            return __builtin_add_overflow(left, right, &out) ? ErrorCode::INTEGER_OVERFLOW : ErrorCode::NONE;
+        case OpKind::INT_SUB:
+            return __builtin_sub_overflow(left, right, &out) ? ErrorCode::INTEGER_OVERFLOW : ErrorCode::NONE;
+        case OpKind::INT_MUL:
+            return __builtin_mul_overflow(left, right, &out) ? ErrorCode::INTEGER_OVERFLOW : ErrorCode::NONE;
+#else
+        case OpKind::INT_ADD:
+        case OpKind::INT_SUB:
+        case OpKind::INT_MUL: {
+            long long exact = kind == OpKind::INT_ADD ? (long long)left + right
+                : kind == OpKind::INT_SUB ? (long long)left - right : (long long)left * right;
+            if (exact < INT_MIN || exact > INT_MAX)
+                return ErrorCode::INTEGER_OVERFLOW;
+            out = exact;
+            return ErrorCode::NONE;
+        }
+#endif
+        case OpKind::INT_DIV:
+            if (right == 0)
+                return ErrorCode::DIVISION_BY_ZERO;
+            if (left == INT_MIN && right == -1)
+                return ErrorCode::INTEGER_OVERFLOW;
+            out = left / right;
+            return ErrorCode::NONE;
+        case OpKind::INT_NEG:
+            if (left == INT_MIN)
+                return ErrorCode::INTEGER_OVERFLOW;
+            out = -left;
+            return ErrorCode::NONE;
+        default:
+            throw std::runtime_error("Unknown checked op value");
+    }
+}
+
+enum class NodeKind : uint8_t {
+    NUMBER,
+    BINARY_OP,
+    UNARY_OP,
+    INT_TO_REAL,
+    VARIABLE,
+    COMPOUND,
+    PROCEDURE_CALL,
+    ASSIGN,
+    EMPTY,
+    IF,
+    WHILE,
+    FOR,
+    ASSIGN_VAR_OP_CONST,
+    ASSIGN_VAR_OP_VAR,
+    INCREMENT_VAR,
+    CALL_WITH_CONST_ARGS,
+    VAR_DECLARATION,
+    DECLARATION_ROOT,
+    PARAM_DECLARATION,
+    BLOCK,
+    PROCEDURE,
+    PROGRAM,
+    TYPE,
+};
+
+#endif
@@ -0,0 +1,80 @@
+// Feeds malformed programs to the embedding API. It sees only pascal.h and
+// is linked with main.cpp built with PASCAL_NO_MAIN. Each bad program must
+// throw a std::exception from compile() or run(), not crash or hang, and a
+// good program must still compile and run afterwards.
+#include "../pascal.h"
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << "FAIL: " << what << "\n";
+        ++failures;
+    }
+}
+
+// compile() of source must throw, with what() starting with kind
+static void expectCompileError(const std::string& name, const std::string& source, const char *kind) {
+    try {
+        CompiledProgram::compile(source);
+        check(false, name + " compiled");
+    } catch (const std::exception& e) {
+        check(std::strncmp(e.what(), kind, std::strlen(kind)) == 0,
+            name + " threw '" + e.what() + "'");
+    }
+}
+
+// source compiles, but run() must throw, with what() starting with kind
+static void expectRunError(const std::string& name, const std::string& source, const char *kind,
+    const ExecutionLimits& limits, Engine engine, Arithmetic arithmetic = Arithmetic::UNCHECKED) {
+    try {
+        Execution run(CompiledProgram::compile(source, 0, arithmetic));
+        run.run(limits, engine);
+        check(false, name + " ran");
+    } catch (const std::exception& e) {
+        check(std::strncmp(e.what(), kind, std::strlen(kind)) == 0,
+            name + " threw '" + e.what() + "'");
+    }
+}
+
+static std::string program(const std::string& body) {
+    return "program A; var a, s : INTEGER; begin " + body + " end.";
+}
+
+int main() {
+    expectCompileError("missing operand", program("s := s - ;"), "ParserError");
+    expectCompileError("missing operand at the end", program("a := 1 -"), "ParserError");
+    expectCompileError("stray else", program("else a := 1"), "ParserError");
+    expectCompileError("double else", program("if a < 1 then a := 1 else a := 2 else a := 3"), "ParserError");
+    expectCompileError("else after a statement", program("a := 1; else a := 2"), "ParserError");
+    expectCompileError("unclosed parenthesis", program("a := (1 + 2"), "ParserError");
+    expectCompileError("missing end", "program A; var a : INTEGER; begin a := 1", "ParserError");
+    expectCompileError("empty source", "", "ParserError");
+    expectCompileError("unknown character", program("a := 1 @ 2"), "Lexer error");
+    expectCompileError("undeclared variable", program("b := 1"), "SemanticError");
+    expectCompileError("nesting too deep", program("a := " + std::string(2000, '(') + "1"
+        + std::string(2000, ')')), "ParserError");
+
+    ExecutionLimits limits;
+    expectRunError("division by zero", program("a := 0; s := 1 div a"), "ArithmeticError",
+        limits, Engine::TREE, Arithmetic::CHECKED);
+    expectRunError("division by zero on the VM", program("a := 0; s := 1 div a"), "ArithmeticError",
+        limits, Engine::VM, Arithmetic::CHECKED);
+    limits.maxSteps = 1000;
+    std::string endless = "program A; var a : INTEGER; procedure p(n : INTEGER); begin a := a + 1; p(n) end; begin p(0) end.";
+    expectRunError("step limit", endless, "ExecutionLimitError", limits, Engine::TREE);
+    expectRunError("step limit on the VM", endless, "ExecutionLimitError", limits, Engine::VM);
+
+    // the failures above leave nothing behind
+    Execution run(CompiledProgram::compile(program("a := 6; s := a * 7")));
+    run.run();
+    check(run.integer("s") == 42, "a good program runs after the bad ones");
+
+    if (failures == 0)
+        std::cerr << "api: all checks passed\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,6 @@
+#!/bin/sh
+# Builds the malformed-source checks against pascal.h alone and links them
+# with the interpreter built as a library.
+"$CXX" -std=c++17 -O1 -DPASCAL_NO_MAIN -c "$ROOT/main.cpp" -o "$SCRATCH/api_pascal.o" || exit 1
+"$CXX" -std=c++17 -O1 -Wall "$ROOT/tests/api_test.cpp" "$SCRATCH/api_pascal.o" -o "$SCRATCH/api_test" -lpthread || exit 1
+timeout 60 "$SCRATCH/api_test"
@@ -0,0 +1,64 @@
+#!/bin/sh
+# Compares a run with --hooks=ring against the same run with no hooks
+# (NoHooks) on the tree engine. Not a test, so run.sh leaves it out:
+#
+#     sh tests/bench_ring.sh [outer loop count] [runs]
+#
+# Both get the same number of runs, alternately, and the best CPU time of
+# each is reported.
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+SCRATCH=$(mktemp -d)
+trap 'rm -rf "$SCRATCH"' EXIT
+CXX=${CXX:-g++}
+OUTER=${1:-2000}
+RUNS=${2:-7}
+RUN="$SCRATCH/run"
+$CXX -std=c++17 -O2 "$ROOT/main.cpp" -o "$RUN" || exit 1
+
+# every inner iteration records 9 ring events: statements, a call, a
+# return and assignments, the loop counter's among them
+cat > "$SCRATCH/bench.txt" <<PROGRAM
+program Bench;
+var i, j, s : INTEGER;
+procedure add(a : INTEGER);
+begin
+    s := s + a
+end;
+begin
+    for i := 1 to $OUTER do
+        for j := 1 to 1000 do
+        begin
+            s := s - j;
+            add(j)
+        end
+end.
+PROGRAM
+
+# Sets cpu to the CPU time in ms of the children that have finished so
+# far; wall time is too noisy on a shared machine. The times builtin must
+# run in this shell, not in a pipe or $(...), which are subshells.
+children_ms() {
+    times > "$SCRATCH/times"
+    cpu=$(awk 'NR == 2 { split($1, u, /[ms]/); split($2, s, /[ms]/);
+        printf "%d\n", (u[1] * 60 + u[2] + s[1] * 60 + s[2]) * 1000 }' "$SCRATCH/times")
+}
+best_none=0
+best_ring=0
+i=0
+while [ $i -lt "$RUNS" ]; do
+    children_ms; start=$cpu
+    "$RUN" "$SCRATCH/bench.txt" > /dev/null 2>&1 || exit 1
+    children_ms; t=$((cpu - start))
+    if [ $best_none -eq 0 ] || [ $t -lt $best_none ]; then best_none=$t; fi
+    children_ms; start=$cpu
+    "$RUN" --hooks=ring --trace-file="$SCRATCH/bench.trace" "$SCRATCH/bench.txt" > /dev/null 2>&1 || exit 1
+    children_ms; t=$((cpu - start))
+    if [ $best_ring -eq 0 ] || [ $t -lt $best_ring ]; then best_ring=$t; fi
+    i=$((i + 1))
+done
+events=$("$RUN" --hooks=ring --trace-file="$SCRATCH/bench.trace" "$SCRATCH/bench.txt" 2>&1 > /dev/null \
+    | sed -n 's/^Trace: \([0-9]*\) event.*/\1/p')
+echo "$OUTER x 1000 iterations, $events events, best CPU time of $RUNS runs"
+echo "no hooks:     $best_none ms"
+echo "--hooks=ring: $best_ring ms ($(( (best_ring - best_none) * 100 / best_none ))% slower," \
+    "$(( (best_ring - best_none) * 1000000 / events )) ns per event)"
@@ -0,0 +1,6 @@
+#!/bin/sh
+# An unoptimized build must link too: static members used by reference,
+# such as ExecutionBudget::DEADLINE_INTERVAL, only inline away at -O1 and up.
+"$CXX" -std=c++17 -O0 "$ROOT/main.cpp" -o "$SCRATCH/run_O0" || exit 1
+output=$(timeout 60 "$SCRATCH/run_O0" --timeout-ms=10000 "$ROOT/test.txt" 2>&1)
+echo "$output" | grep -q '"interesting"\] = 231' || { echo "$output" | tail -5; exit 1; }
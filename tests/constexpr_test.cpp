@@ -0,0 +1,78 @@
+// Compile-time checks of runConstProgram, in a translation unit of its own
+// that sees only pascal_constexpr.h and pascal.h. The static_asserts fail
+// the build; at run time the same programs go through CompiledProgram
+// (linked in from main.cpp) and must give the same values.
+#include "../pascal_constexpr.h"
+#include "../pascal.h"
+
+#include <iostream>
+
+constexpr const char *CONFIG = R"(
+program Config;
+var limit, i : integer; x : real;
+procedure add(a : integer);
+begin
+    limit := limit + a
+end;
+begin
+    limit := 6 * 7;
+    x := limit / 4;
+    if limit > 3 then else limit := 0;
+    for i := 1 to 3 do add(i);
+    add(-6)
+end.
+)";
+
+constexpr ConstResult config = runConstProgram(CONFIG);
+static_assert(config.integer("limit") == 42, "procedure calls and loop");
+static_assert(config.integer("i") == 3, "FOR leaves its variable at the end value");
+static_assert(config.real("x") == 10.5, "/ is real division");
+
+// keywords are case-insensitive, shared with the runtime lexer
+static_assert(keywordType("BeGiN", 5) == TokenType::BEGIN, "");
+static_assert(keywordType("beginx", 6) == TokenType::VARIABLE, "");
+
+// constexpr_test.sh builds this once more with BAD_PROGRAM defined and
+// expects the build to fail
+#ifdef BAD_PROGRAM
+constexpr ConstResult bad = runConstProgram(BAD_PROGRAM);
+#endif
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        std::cerr << "FAIL: " << what << std::endl;
+        failures++;
+    }
+}
+
+static void expectError(const char *text, ErrorCode code, const char *what) {
+    try {
+        runConstProgram(text);
+        check(false, what);
+    } catch (const ConstProgramError &e) {
+        check(e.code() == code, what);
+    }
+}
+
+int main() {
+    Execution run(CompiledProgram::compile(CONFIG));
+    run.run();
+    check(run.integer("limit") == config.integer("limit"), "limit matches the interpreter");
+    check(run.integer("i") == config.integer("i"), "i matches the interpreter");
+    check(run.real("x") == config.real("x"), "x matches the interpreter");
+
+    expectError("program A; var a : integer; begin else a := 1 end.",
+        ErrorCode::UNEXPECTED_TOKEN, "a stray ELSE is rejected");
+    expectError("program A; var a : integer; begin if 1 < 2 then a := 1 else else a := 2 end.",
+        ErrorCode::UNEXPECTED_TOKEN, "a double ELSE is rejected");
+    expectError("program A; var a : integer; begin a := 1 - ; end.",
+        ErrorCode::UNEXPECTED_TOKEN, "a missing operand is rejected");
+    expectError("program A; var a : integer; begin a := 1 div 0 end.",
+        ErrorCode::DIVISION_BY_ZERO, "division by zero is an error");
+
+    if (failures == 0)
+        std::cerr << "constexpr: all checks passed" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
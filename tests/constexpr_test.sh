@@ -0,0 +1,17 @@
+#!/bin/sh
+# Builds the runConstProgram checks as their own translation unit and links
+# them with the interpreter, so the shared syntax tables must not clash.
+"$CXX" -std=c++17 -O1 -DPASCAL_NO_MAIN -c "$ROOT/main.cpp" -o "$SCRATCH/pascal.o" || exit 1
+"$CXX" -std=c++17 -O1 -Wall -c "$ROOT/tests/constexpr_test.cpp" -o "$SCRATCH/constexpr_test.o" || exit 1
+"$CXX" "$SCRATCH/constexpr_test.o" "$SCRATCH/pascal.o" -o "$SCRATCH/constexpr_test" -lpthread || exit 1
+
+# a rejected program is a compile error
+for bad in "begin else a := 1 end." "begin a := 1 - ; end." "begin a := 1 div 0 end."; do
+    if "$CXX" -std=c++17 -fsyntax-only \
+            -DBAD_PROGRAM="\"program A; var a : integer; $bad\"" \
+            "$ROOT/tests/constexpr_test.cpp" 2> /dev/null; then
+        echo "FAIL: '$bad' compiled" >&2
+        exit 1
+    fi
+done
+timeout 60 "$SCRATCH/constexpr_test"
@@ -0,0 +1,47 @@
+#!/bin/sh
+# Long expression chains and the deepest nesting the parser allows must run
+# in a 1MB native stack. STRESS_TERMS sets the length of the longest chain;
+# the default of 5M terms is a tree of 10^7 nodes.
+TERMS=${STRESS_TERMS:-5000000}
+GEN="python3 $ROOT/tests/gen_chain.py"
+ulimit -s 1024
+status=0
+
+# expect <program> <text the output must contain> [options...]
+expect() {
+    program=$1
+    text=$2
+    shift 2
+    if ! timeout 300 "$RUN" "$@" "$program" 2>&1 | grep -a -q -F "$text"; then
+        echo "$(basename "$program") $*: expected '$text'"
+        status=1
+    fi
+}
+
+$GEN sum "$TERMS" > "$SCRATCH/sum.txt"
+expect "$SCRATCH/sum.txt" "{ [\"a\"] = $TERMS }"
+expect "$SCRATCH/sum.txt" "{ [\"a\"] = $TERMS }" --engine=vm
+
+units=$((TERMS / 4))
+$GEN mixed "$units" > "$SCRATCH/mixed.txt"
+expect "$SCRATCH/mixed.txt" "{ [\"a\"] = $((units + 1)) }" --checked
+expect "$SCRATCH/mixed.txt" "{ [\"a\"] = $((units + 1)) }" --engine=vm --checked
+
+# the dumps and reading one back walk the chain too
+$GEN sum 1000000 > "$SCRATCH/dump.txt"
+expect "$SCRATCH/dump.txt" "{ [\"a\"] = 1000000 }" \
+    --dump-json="$SCRATCH/chain.json" --dump-binary="$SCRATCH/chain.ast"
+if ! timeout 300 "$RUN" --read-ast="$SCRATCH/chain.ast" | tail -2 | grep -q 'Program "Chain.pas"'; then
+    echo "--read-ast of the dumped chain did not print the program"
+    status=1
+fi
+
+# the program's own BEGIN is the first of Parser::MAX_NESTING levels
+for kind in parens unary blocks; do
+    $GEN $kind 999 > "$SCRATCH/$kind.txt"
+    expect "$SCRATCH/$kind.txt" '{ ["a"] = '
+    expect "$SCRATCH/$kind.txt" '{ ["a"] = ' --engine=vm
+    $GEN $kind 1000 > "$SCRATCH/$kind.txt"
+    expect "$SCRATCH/$kind.txt" 'ParserError: nesting too deep'
+done
+exit $status
@@ -0,0 +1,37 @@
+#!/usr/bin/env python3
+"""Writes a program with one very long or very deeply nested expression.
+
+    gen_chain.py sum N       a := 1 + 1 + ... + 1 with N terms
+    gen_chain.py mixed N     a := b + b * 2 - b ... with N units of 3 operators
+    gen_chain.py parens D    a := ((...(1)...)) nested D deep
+    gen_chain.py unary D     a := - - ... - 1 with D signs
+    gen_chain.py blocks D    begin ... end nested D deep around a := 1
+"""
+import sys
+
+
+def main():
+    kind, n = sys.argv[1], int(sys.argv[2])
+    out = sys.stdout
+    out.write("program Chain;\nvar\n    a, b : INTEGER;\nbegin\n    b := 1;\n")
+    if kind == "sum":
+        out.write("    a := 1")
+        out.write(" + 1" * (n - 1))
+    elif kind == "mixed":
+        out.write("    a := b")
+        out.write(" + b * 2 - b" * n)
+    elif kind == "parens":
+        out.write("    a := " + "(" * n + "1" + ")" * n)
+    elif kind == "unary":
+        out.write("    a := " + "- " * n + "1")
+    elif kind == "blocks":
+        # a compound statement inside a statement list ends with a SEMI
+        out.write("    " + "begin " * n + "a := 1" + " end;" * n + "\nend.\n")
+        return
+    else:
+        sys.exit("unknown kind " + kind)
+    out.write(";\nend.\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,93 @@
+// Edits a program through an IncrementalSession and checks which top-level
+// procedures are parsed and analysed again, and that every run gives the
+// same variables as a fresh session on the edited text.
+#define PASCAL_NO_MAIN
+#include "../main.cpp"
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << "FAIL: " << what << "\n";
+        ++failures;
+    }
+}
+
+static std::string procedureText(int k, const std::string& body) {
+    return "    procedure p" + std::to_string(k) + "(a : INTEGER);\n"
+        "    var t : INTEGER;\n"
+        "    begin\n"
+        "        " + body + "\n"
+        "    end;\n";
+}
+
+static std::string programText(int numProcedures) {
+    std::string text = "program Incremental;\nvar\n    g : INTEGER;\n";
+    for (int k = 0; k < numProcedures; ++k)
+        text += procedureText(k, "t := a + " + std::to_string(k) + "; g := g + t;");
+    text += "begin\n";
+    for (int k = 0; k < numProcedures; ++k)
+        text += "    p" + std::to_string(k) + "(" + std::to_string(k * 10) + ");\n";
+    return text + "end.\n";
+}
+
+// replaces the first occurrence of what in the session's source
+static void replace(IncrementalSession& session, const std::string& what, const std::string& with) {
+    size_t offset = session.source().find(what);
+    if (offset == std::string::npos)
+        throw std::runtime_error("'" + what + "' is not in the source");
+    session.edit(offset, what.size(), with);
+}
+
+static void expectRun(IncrementalSession& session, const std::string& what) {
+    session.run();
+    IncrementalSession fresh(session.source());
+    fresh.run();
+    check(session.globals() == fresh.globals(), what + ": globals differ from a full run");
+}
+
+int main() {
+    const int N = 6;
+    IncrementalSession session(programText(N));
+    check(session.totalProcedures() == N, "all procedures are parsed");
+    check(session.reusedProcedures() == 0, "the first parse reuses nothing");
+    expectRun(session, "first run");
+
+    // an edit inside one body re-analyses only that procedure
+    replace(session, "t := a + 3;", "t := a * 3;");
+    check(session.reusedProcedures() == N - 1, "a body edit reuses the other procedures");
+    expectRun(session, "body edit");
+
+    // an edit that spans several procedures re-analyses only the ones that
+    // changed; p2 is lexed again but reads the same and is taken over
+    size_t from = session.source().find("t := a + 1;");
+    size_t to = session.source().find("t := a * 3;") + std::string("t := a * 3;").size();
+    std::string span = session.source().substr(from, to - from);
+    span.replace(0, std::string("t := a + 1;").size(), "t := a - 1;");
+    span.replace(span.size() - std::string("t := a * 3;").size(), std::string::npos, "t := a * 4;");
+    session.edit(from, to - from, span);
+    check(session.reusedProcedures() == N - 2, "an edit spanning p1..p3 reuses p2 and the rest");
+    expectRun(session, "spanning edit");
+
+    // whitespace and comments change no tokens
+    replace(session, "begin\n    p0", "begin { run them all }\n\n    p0");
+    check(session.reusedProcedures() == N, "a comment edit reuses every procedure");
+    expectRun(session, "comment edit");
+
+    // a header change can change how the others are analysed
+    replace(session, procedureText(4, "t := a + 4; g := g + t;"),
+        "    procedure p4(b : INTEGER);\n    var t : INTEGER;\n    begin\n        t := b + 4; g := g + t;\n    end;\n");
+    check(session.reusedProcedures() == 0, "a header edit parses everything again");
+    expectRun(session, "header edit");
+
+    // a procedure can be added and removed
+    replace(session, "    procedure p5", procedureText(9, "g := g - a;") + "    procedure p5");
+    check(session.totalProcedures() == N + 1, "an added procedure is parsed");
+    replace(session, procedureText(9, "g := g - a;"), "");
+    check(session.totalProcedures() == N, "a removed procedure is dropped");
+    expectRun(session, "add and remove");
+
+    if (failures == 0)
+        std::cerr << "incremental: all checks passed\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,5 @@
+#!/bin/sh
+# Builds and runs the IncrementalSession driver; run() prints the program's
+# records, so only the driver's report on stderr is kept.
+"$CXX" -std=c++17 -O1 "$ROOT/tests/incremental.cpp" -o "$SCRATCH/incremental" || exit 1
+timeout 60 "$SCRATCH/incremental" > /dev/null
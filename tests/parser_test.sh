@@ -0,0 +1,19 @@
+#!/bin/sh
+# Malformed programs must stop with a ParserError, not crash or hang.
+status=0
+
+# expect_error <program> <text the error must contain>
+expect_error() {
+    output=$(timeout 10 "$RUN" "$ROOT/tests/programs/$1" 2>&1)
+    code=$?
+    if [ $code -ge 124 ] || ! echo "$output" | grep -q "$2"; then
+        echo "$1: expected '$2', got (exit $code):"
+        echo "$output" | tail -5
+        status=1
+    fi
+}
+
+expect_error stray_else.txt "ParserError: Unexpected token at '{ TokenType::ELSE"
+expect_error double_else.txt "ParserError: Unexpected token at '{ TokenType::ELSE"
+expect_error missing_operand.txt "ParserError: Unexpected token at '{ TokenType::SEMI"
+exit $status
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Builds the interpreter and runs every *_test.sh next to this script.
+# Each test gets the binary in $RUN, the source tree in $ROOT and a scratch
+# directory in $SCRATCH, and fails by exiting non-zero.
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+SCRATCH=$(mktemp -d)
+trap 'rm -rf "$SCRATCH"' EXIT
+CXX=${CXX:-g++}
+RUN="$SCRATCH/run"
+$CXX -std=c++17 -O2 "$ROOT/main.cpp" -o "$RUN" || exit 1
+export ROOT SCRATCH RUN CXX
+
+failed=0
+for test in "$ROOT"/tests/*_test.sh; do
+    if sh "$test"; then
+        echo "PASS $(basename "$test")"
+    else
+        echo "FAIL $(basename "$test")"
+        failed=1
+    fi
+done
+exit $failed
@@ -0,0 +1,63 @@
+#!/bin/sh
+# A --watch session must report a save that does not parse and go on
+# watching: a missing operand and a stray ELSE used to crash or hang it.
+# Skipped where there is no inotify.
+[ "$(uname)" = Linux ] || exit 0
+FILE="$SCRATCH/watched.txt"
+OUT="$SCRATCH/watch.out"
+ERR="$SCRATCH/watch.err"
+
+# save <statement>: writes the program with that statement in its body
+save() {
+    cat > "$FILE" <<PROGRAM
+program Watched;
+var
+    s : INTEGER;
+    procedure add(a : INTEGER);
+    begin
+        s := s + a
+    end;
+begin
+    add(5);
+    $1
+end.
+PROGRAM
+}
+
+# wait_for <file> <count> <text>: waits until text is in the file count times
+wait_for() {
+    i=0
+    while [ "$(grep -c "$3" "$2")" -lt "$1" ]; do
+        i=$((i + 1))
+        if [ $i -gt 100 ] || ! kill -0 $pid 2> /dev/null; then
+            echo "watch: no '$3' (x$1) in $2"
+            kill $pid 2> /dev/null
+            wait $pid
+            echo "exit $?; stdout:"; tail -5 "$OUT"; echo "stderr:"; tail -5 "$ERR"
+            exit 1
+        fi
+        sleep 0.1
+    done
+}
+
+save "s := s - 1"
+"$RUN" --watch "$FILE" > "$OUT" 2> "$ERR" &
+pid=$!
+wait_for 1 "$OUT" "Watching"
+
+save "s := s - ;"
+wait_for 1 "$ERR" "ParserError: Unexpected token at '{ TokenType::SEMI"
+save "else s := 1"
+wait_for 1 "$ERR" "ParserError: Unexpected token at '{ TokenType::ELSE"
+save "if s > 0 then s := 1 else else s := 2"
+wait_for 2 "$ERR" "ParserError: Unexpected token at '{ TokenType::ELSE"
+
+# a good save after the bad ones runs again
+save "s := s * 2"
+wait_for 1 "$OUT" "saved; reused"
+wait_for 1 "$OUT" "s.*10"
+
+kill $pid
+wait $pid
+# killed by our SIGTERM, not by a crash
+[ $? -eq 143 ] || { echo "watch: exit $?"; exit 1; }